@@ -0,0 +1,145 @@
+#include "generate.h"
+
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+// Functions go to out, statements for main() to main
+struct programText {
+    std::string out;
+    std::string main;
+    std::mt19937 rng;
+
+    explicit programText(uint32_t seed) : rng(seed) {}
+
+    // Raw engine output so the text does not depend on the library's distributions
+    uint32_t below(uint32_t n) { return rng() % n; }
+};
+
+// One expression depth levels deep. Each level wraps the last one in a prefix and a
+// suffix, which are joined once at the end so deep nesting stays linear.
+std::string nestedExpression(programText& p, size_t depth) {
+    std::vector<std::string> prefixes, suffixes;
+    prefixes.reserve(depth);
+    suffixes.reserve(depth);
+    for ( size_t d = 0; d < depth; d++ ) {
+        std::string k = std::to_string(p.below(9) + 1);
+        switch ( p.below(5) ) {
+            case 0: prefixes.push_back("("); suffixes.push_back(" + " + k + ")"); break;
+            case 1: prefixes.push_back("(b - "); suffixes.push_back(")"); break;
+            case 2: prefixes.push_back("-("); suffixes.push_back(")"); break;
+            case 3: prefixes.push_back("("); suffixes.push_back(" % 97 * " + k + ")"); break;
+            default: prefixes.push_back("(" + k + " * "); suffixes.push_back(" % 89)"); break;
+        }
+    }
+    std::string text;
+    for ( auto it = prefixes.rbegin(); it != prefixes.rend(); ++it ) text += *it;
+    text += "a";
+    for ( const std::string& s : suffixes ) text += s;
+    return text;
+}
+
+void addNesting(programText& p, size_t depth) {
+    for ( int f = 0; f < 16; f++ ) {
+        std::string name = "nest" + std::to_string(f);
+        p.out += "fn int " + name + "(int a, int b) {\n    return " + nestedExpression(p, depth) + ";\n};\n\n";
+        p.main += "    total += " + name + "(" + std::to_string(f + 2) + ", 3) % 1000;\n";
+    }
+}
+
+void addFunctions(programText& p, size_t count) {
+    for ( size_t i = 0; i < count; i++ ) {
+        std::string name = "work" + std::to_string(i);
+        std::string k = std::to_string(p.below(50) + 2), m = std::to_string(p.below(90) + 7);
+        p.out += "fn int " + name + "(int a, int b) {\n";
+        p.out += "    int x = a * " + k + " + b;\n";
+        p.out += "    int y = x % " + m + " + " + std::to_string(i % 10) + ";\n";
+        p.out += "    if (x > y) {\n        x -= y;\n    } else {\n        y += x;\n    };\n";
+        p.out += "    while (x > 1000) {\n        x = x / 2;\n    };\n";
+        if ( i > 0 ) {
+            // Never taken, main only passes non-negative arguments
+            p.out += "    if (a < 0) {\n        x += work" + std::to_string(i - 1) + "(b, a);\n    };\n";
+        }
+        p.out += "    return x + y;\n};\n\n";
+        if ( i % 64 == 0 || i + 1 == count ) {
+            p.main += "    total += " + name + "(" + std::to_string(i % 17) + ", 5) % 1000;\n";
+        }
+    }
+}
+
+void addStrings(programText& p, size_t count) {
+    static const char* words[] = { "lorem", "ipsum", "dolor", "sit", "amet", "token", "buffer",
+                                   "parser", "lexeme", "arena", "vector", "quote", "branch", "scope" };
+    constexpr size_t PER_FUNCTION = 8;
+    for ( size_t f = 0; f * PER_FUNCTION < count; f++ ) {
+        std::string name = "text" + std::to_string(f);
+        p.out += "fn void " + name + "(int n) {\n";
+        for ( size_t j = 0; j < PER_FUNCTION && f * PER_FUNCTION + j < count; j++ ) {
+            std::string literal;
+            size_t length = 200 + p.below(400);
+            while ( literal.size() < length ) {
+                switch ( p.below(12) ) {
+                    case 0: literal += "\\n"; break;
+                    case 1: literal += "\\t"; break;
+                    case 2: literal += "\\\"quoted\\\" "; break;
+                    case 3: literal += "${n + " + std::to_string(j) + "} "; break;
+                    default: literal += std::string(words[p.below(sizeof(words) / sizeof(words[0]))]) + " "; break;
+                }
+            }
+            p.out += "    string s" + std::to_string(j) + " = \"" + literal + "\";\n";
+            if ( j == 0 ) p.out += "    print(s0);\n";
+        }
+        p.out += "    return;\n};\n\n";
+        if ( f % 64 == 0 ) p.main += "    " + name + "(" + std::to_string(f) + ");\n";
+    }
+}
+
+void addLoops(programText& p, size_t count) {
+    for ( size_t i = 0; i < count; i++ ) {
+        std::string name = "loop" + std::to_string(i);
+        std::string inner = std::to_string(p.below(24) + 8), k = std::to_string(p.below(100));
+        std::string m = std::to_string(p.below(500) + 11);
+        p.out += "fn int " + name + "(int n) {\n";
+        p.out += "    int acc = 0;\n";
+        p.out += "    for (int a = 0; a < n; a++) {\n";
+        p.out += "        for (int b = 0; b < " + inner + "; b++) {\n";
+        p.out += "            acc += (a * b + " + k + ") % " + m + ";\n";
+        p.out += "            if (acc > 100000) {\n                acc -= 100000;\n            };\n";
+        p.out += "        };\n    };\n";
+        p.out += "    int w = 0;\n";
+        p.out += "    while (w < n) {\n        acc = acc * 3 % 1009;\n        w++;\n    };\n";
+        p.out += "    return acc;\n};\n\n";
+        p.main += "    total += " + name + "(32);\n";
+    }
+}
+
+} // namespace
+
+const std::vector<std::string>& programShapes() {
+    static const std::vector<std::string> shapes{ "nesting", "functions", "strings", "loops", "mixed" };
+    return shapes;
+}
+
+std::string generateProgram(const std::string& shape, size_t size, uint32_t seed) {
+    programText p(seed);
+    p.out += "// Generated by qurgen: " + shape + " " + std::to_string(size) + " " + std::to_string(seed) + "\n\n";
+    if ( shape == "nesting" ) {
+        addNesting(p, size);
+    } else if ( shape == "functions" ) {
+        addFunctions(p, size);
+    } else if ( shape == "strings" ) {
+        addStrings(p, size);
+    } else if ( shape == "loops" ) {
+        addLoops(p, size);
+    } else if ( shape == "mixed" ) {
+        addFunctions(p, size / 2);
+        addLoops(p, size / 4);
+        addStrings(p, size);
+        addNesting(p, 64);
+    } else {
+        throw std::invalid_argument("unknown shape " + shape);
+    }
+    p.out += "fn int main() {\n    int total = 0;\n" + p.main + "    print(total);\n    return 0;\n};\n";
+    return p.out;
+}
@@ -0,0 +1,20 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Synthetic Qur programs for benchmarking, each a valid program with a main() that
+// the compiler accepts. size scales the output roughly linearly:
+//   nesting    16 functions, each returning one expression nested size levels deep
+//   functions  size functions with locals, branches, a loop and a call to the previous one
+//   strings    size string literals of a few hundred bytes, with escapes and interpolations
+//   loops      size functions of nested for loops with arithmetic, run from main
+//   mixed      all of the above in equal parts, about size functions in total
+// The same shape, size and seed always give the same text.
+std::string generateProgram(const std::string& shape, size_t size, uint32_t seed = 1);
+const std::vector<std::string>& programShapes();
+
+#endif // GENERATE_H
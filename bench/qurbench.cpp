@@ -0,0 +1,180 @@
+#include "generate.h"
+#include "../utils/lexer.h"
+#include "../utils/ast.h"
+#include "../utils/document.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the front end: lexer, StringToToken, AST::build(),
+// AST::print() and a keystroke in a sourceDocument, each timed as the best of
+// several runs over the same input.
+// qurbench [-r runs] [-j parse workers] [file.qur ...], with no files it runs the
+// generated programs of every shape, see generate.h.
+
+namespace {
+
+struct benchInput {
+    std::string name;
+    std::string text;
+};
+
+struct benchOptions {
+    int runs = 5;
+    size_t parseWorkers = 0;
+};
+
+// Discards everything written to it, counting the bytes
+class countingBuf : public std::streambuf {
+public:
+    size_t bytes = 0;
+
+protected:
+    int overflow(int c) override {
+        if ( c != traits_type::eof() ) bytes++;
+        return traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        bytes += (size_t)n;
+        return n;
+    }
+};
+
+using benchClock = std::chrono::steady_clock;
+
+// Best wall time in seconds of runs calls to body
+template <class F>
+double bestOf(int runs, F&& body) {
+    double best = 1e30;
+    for ( int r = 0; r < runs; r++ ) {
+        auto start = benchClock::now();
+        body();
+        best = std::min(best, std::chrono::duration<double>(benchClock::now() - start).count());
+    }
+    return best;
+}
+
+void report(const char* what, double seconds, size_t bytes, size_t tokens) {
+    std::printf("  %-15s %10.3f ms %10.1f MB/s %10.2f M tokens/s\n", what, seconds * 1e3,
+                bytes / seconds / 1e6, tokens / seconds / 1e6);
+}
+
+std::unique_ptr<lexer> lexText(const benchInput& input) {
+    sourceBuffer buffer;
+    buffer.assign(input.text);
+    return std::make_unique<lexer>(std::move(buffer), input.name);
+}
+
+void runBenchmarks(const benchInput& input, const benchOptions& opts) {
+    std::unique_ptr<lexer> lex = lexText(input);
+    size_t tokens = lex->getCompactTokens().size();
+    std::printf("%s: %.2f MB, %zu tokens\n", input.name.c_str(), input.text.size() / 1e6, tokens);
+
+    // Buffers are filled outside the timed region so only scanning is measured
+    double best = 1e30;
+    for ( int r = 0; r < opts.runs; r++ ) {
+        sourceBuffer buffer;
+        buffer.assign(input.text);
+        auto start = benchClock::now();
+        lexer timed(std::move(buffer), input.name);
+        best = std::min(best, std::chrono::duration<double>(benchClock::now() - start).count());
+    }
+    report("lexer", best, input.text.size(), tokens);
+
+    std::vector<std::string_view> lexemes;
+    size_t lexemeBytes = 0;
+    lexemes.reserve(tokens);
+    for ( const compactToken& tok : lex->getCompactTokens() ) {
+        lexemes.push_back(lex->text(tok));
+        lexemeBytes += tok.length;
+    }
+    unsigned sink = 0;
+    best = bestOf(opts.runs, [&] {
+        for ( std::string_view word : lexemes ) sink += (unsigned)StringToToken(word);
+    });
+    report("StringToToken", best, lexemeBytes, lexemes.size());
+
+    std::ostringstream errors;
+    std::unique_ptr<AST> ast;
+    best = 1e30;
+    for ( int r = 0; r < opts.runs; r++ ) {
+        ast.reset(); // tearing down the previous tree is not part of the measurement
+        ast = std::make_unique<AST>(*lex);
+        ast->setErrorStream(errors);
+        ast->setParseWorkers(opts.parseWorkers);
+        auto start = benchClock::now();
+        try {
+            ast->build();
+        } catch ( const std::exception& e ) {
+            std::printf("  AST::build failed: %s\n%s", e.what(), errors.str().c_str());
+            return;
+        }
+        best = std::min(best, std::chrono::duration<double>(benchClock::now() - start).count());
+    }
+    report("AST::build", best, input.text.size(), tokens);
+
+    countingBuf counter;
+    std::ostream out(&counter);
+    best = bestOf(opts.runs, [&] { ast->print(out); });
+    report("AST::print", best, input.text.size(), tokens);
+    std::printf("  %-15s %10.2f MB printed per run\n", "", counter.bytes / (double)opts.runs / 1e6);
+
+    // A space typed before a ';' halfway through the file and taken out again, as an
+    // editor would send them
+    sourceDocument doc(input.name, input.text);
+    size_t at = input.text.find(';', input.text.size() / 2);
+    if ( at != std::string::npos ) {
+        const sourceEdit type{ at, 0, " " }, undo{ at, 1, "" };
+        best = bestOf(opts.runs, [&] {
+            doc.apply(type);
+            doc.apply(undo);
+        }) / 2;
+        std::printf("  %-15s %10.3f ms %10zu tokens lexed %5zu declarations parsed\n", "edit", best * 1e3,
+                    doc.relexedTokens(), doc.reparsedDeclarations());
+    }
+    if ( sink == 1 ) std::printf("\n"); // keeps the StringToToken loop from being dropped
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchOptions opts;
+    std::vector<benchInput> inputs;
+    for ( int i = 1; i < argc; i++ ) {
+        std::string param = argv[i];
+        if ( (param == "-r" || param == "--runs") && i + 1 < argc ) {
+            opts.runs = std::max(1, std::stoi(argv[++i]));
+        } else if ( (param == "-j" || param == "--jobs") && i + 1 < argc ) {
+            opts.parseWorkers = std::stoul(argv[++i]);
+        } else {
+            std::ifstream in(param, std::ios::binary);
+            if ( !in.good() ) {
+                std::cerr << "Error: cannot read " << param << std::endl;
+                return 1;
+            }
+            inputs.push_back({ param, std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()) });
+        }
+    }
+    if ( inputs.empty() ) {
+        // About 1-4 MB each, enough for the timings to settle
+        const std::pair<const char*, size_t> defaults[] = {
+            { "nesting", 4000 }, { "functions", 8000 }, { "strings", 6000 }, { "loops", 6000 }, { "mixed", 8000 },
+        };
+        for ( const auto& [shape, size] : defaults ) {
+            inputs.push_back({ std::string(shape) + " " + std::to_string(size), generateProgram(shape, size) });
+        }
+    }
+
+    for ( const benchInput& input : inputs ) {
+        runBenchmarks(input, opts);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#include "generate.h"
+
+#include <iostream>
+#include <string>
+
+// qurgen <shape> <size> [seed], writes a synthetic program to stdout, see generate.h
+int main(int argc, char** argv) {
+    if ( argc < 3 ) {
+        std::cerr << "Usage: qurgen <shape> <size> [seed]\nShapes:";
+        for ( const std::string& shape : programShapes() ) std::cerr << " " << shape;
+        std::cerr << std::endl;
+        return 1;
+    }
+    try {
+        uint32_t seed = argc > 3 ? (uint32_t)std::stoul(argv[3]) : 1;
+        std::cout << generateProgram(argv[1], std::stoul(argv[2]), seed);
+    } catch ( const std::exception& e ) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,61 +1,539 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <vector>
 
 #include "utils/lexer.h"
 #include "utils/ast.h"
+#include "utils/interp.h"
+#include "utils/module.h"
+#include "utils/printer.h"
+#include "utils/profile.h"
+#include "utils/serialize.h"
+#include "utils/server.h"
+#include "utils/threadpool.h"
+#include "utils/vm.h"
 
 void debug() {
     std::cout << "Debug Called." << std::endl;
 }
 
-int main(int argc, char** argv) {
-    std::string inFile = "";
-    std::string outFile = "out";
-    for ( int i = 1; i < argc; i++ ) { // Parse through arguments
-        std::string param = std::string(argv[i]);
-        if ( param == "-h" || param == "-?" || param == "--help" ) {
-            std::cout << "See https://github.com/Parker-Isaacson/qur for help." << std::endl;
-            return 0;
-        } else if ( param == "-c" || param == "--compile" ) {
-            inFile = argv[++i];
-        } else if ( param == "-d" || param == "--download" ) {
-            inFile = argv[++i];
-        } else if ( param == "-o" || param == "--out" ) {
-            outFile = argv[++i];
-        } else {
-            std::cout << "Bad argument: " << param << ". Skipping.\n";
+// What compileFile() prints besides program output and errors
+enum class dumpMode {
+    ALL, // every stage with its banner, tokens and the tree included
+    TOKENS, // only the token list
+    AST, // only the tree
+    JSON, // one JSON object per file with the tokens and the tree
+    NONE, // nothing, for production runs
+};
+
+struct compileOptions {
+    dumpMode dump = dumpMode::ALL;
+    std::string outFile; // assembly output, empty skips code generation
+    bool streaming = false;
+    std::string cacheDir; // empty disables the build cache
+    bool emitAST = false; // write <input>.qast next to each input
+    bool run = false; // execute main() after a successful compile
+    bool useVM = false; // run on the bytecode VM instead of the tree walker
+    std::vector<std::string> includeDirs;
+};
+
+std::string failureMessage(const std::exception_ptr& failure) {
+    try {
+        std::rethrow_exception(failure);
+    } catch (const std::exception& e) {
+        return e.what();
+    } catch (...) {
+        return "unknown error";
+    }
+}
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// A pre-parsed module written by --emit-ast, printed straight from the mapped file.
+// It has no tokens, so only the tree modes print anything. Running or generating
+// code from one goes through the loader like a source file instead.
+int dumpImage(const std::string& inFile, dumpMode dump, std::ostream& out, std::ostream& err) {
+    try {
+        astImage image(inFile);
+        if ( dump == dumpMode::ALL || dump == dumpMode::AST ) {
+            out << "=== Abstract Syntax Tree ===\n";
+            image.print(out);
+            out << "============================\n";
+        } else if ( dump == dumpMode::JSON ) {
+            astArena arena;
+            nodePtr<programNode> root = image.toFlat().toProgram(arena);
+            out << "{\"file\": ";
+            bufferedWriter(out).quoted(inFile);
+            out << ", \"tokens\": null, \"ast\": ";
+            astJsonPrinter(out).visit(root.get());
+            out << "}\n";
         }
+        return 0;
+    } catch (const std::exception& e) {
+        err << "Error: " << inFile << ": " << e.what() << std::endl;
+        return 1;
     }
+}
+
+// The process status for a program whose main returned code. Only the low 8 bits
+// reach the parent, so other values are reported rather than wrapped silently.
+int exitStatusOf(int64_t code, std::ostream& err) {
+    int status = static_cast<int>(code & 0xFF);
+    if ( code < 0 || code > 0xFF ) {
+        err << "Warning: main returned " << code << ", exit status is " << status << std::endl;
+    }
+    return status;
+}
+
+// Runs one file through the pipeline, all output goes to the given streams.
+// Parsed modules, including this one, are shared through loader. Returns 0 once
+// every requested step succeeded; with --run the status of the program itself
+// goes to exitStatus when given.
+int compileFile(const std::string& inFile, const compileOptions& opts, moduleLoader& loader,
+                std::ostream& out, std::ostream& err, int* exitStatus = nullptr) {
+    if ( endsWith(inFile, ".qast") && !opts.run && opts.outFile.empty() ) {
+        return dumpImage(inFile, opts.dump, out, err);
+    }
+    // Banners and progress lines only come with the full dump
+    bool trace = opts.dump == dumpMode::ALL;
     try {
         // Step 1: Lexical Analysis
-        std::cout << "=== Lexical Analysis ===\n";
-        lexer lex(inFile);
-        std::vector<Token> tokens = lex.getTokens();
-        
-        std::cout << "Tokens: ";
-        lex.printTokens();
-        std::cout << "\n\n";
+        if ( trace ) out << "=== Lexical Analysis ===\n";
+        std::shared_ptr<const module> mod = loader.load(inFile);
+        if ( !mod->ast ) {
+            std::rethrow_exception(mod->failure);
+        }
+
+        // Unchanged modules were neither lexed nor parsed, streamed tokens were pulled
+        // by the parser, either way there is no full list to print
+        bool haveTokens = !mod->cached && !mod->lex->isStreaming();
+        if ( trace || opts.dump == dumpMode::TOKENS ) {
+            phaseTimer timer("print");
+            out << "Tokens: ";
+            if ( haveTokens ) {
+                mod->lex->printTokens(out);
+            } else {
+                out << (endsWith(inFile, ".qast") ? "(image)" : mod->cached ? "(cached)" : "(streamed)");
+            }
+            out << "\n\n";
+        }
 
         // Step 2: Build AST
-        std::cout << "=== Building AST ===\n";
-        AST ast(tokens);
-        ast.build();
-        std::cout << "AST built successfully!\n\n";
+        if ( trace ) out << "=== Building AST ===\n";
+        err << mod->diagnostics;
+        if ( !mod->ast || !mod->ast->getRoot() ) {
+            std::rethrow_exception(mod->failure);
+        }
+        if ( trace ) out << "AST built successfully!\n\n";
 
         // Step 3: Print AST
-        ast.print();
-        std::cout << "\n";
+        if ( trace || opts.dump == dumpMode::AST ) {
+            phaseTimer timer("print");
+            mod->ast->print(out);
+            out << "\n";
+        } else if ( opts.dump == dumpMode::JSON ) {
+            phaseTimer timer("print");
+            out << "{\"file\": ";
+            bufferedWriter(out).quoted(inFile);
+            out << ", \"tokens\": ";
+            if ( haveTokens ) {
+                mod->lex->printTokensJSON(out);
+            } else {
+                out << "null";
+            }
+            out << ", \"ast\": ";
+            mod->ast->printJSON(out);
+            out << "}\n";
+        }
+        if ( opts.emitAST && !endsWith(inFile, ".qast") ) {
+            phaseTimer timer("emit_ast");
+            std::string imagePath = (endsWith(inFile, ".qur") ? inFile.substr(0, inFile.size() - 4) : inFile) + ".qast";
+            if ( !writeAST(imagePath, flatAST::fromProgram(*mod->ast->getRoot()), mod->hash) ) {
+                err << "Error: cannot write " << imagePath << std::endl;
+                return 1;
+            }
+        }
 
-        // Step 4: Code Generation (placeholder)
-        // ast.generateCode();
+        // Step 4: Imports, each parsed once per loader
+        int status = 0;
+        std::vector<std::shared_ptr<const module>> deps = loader.dependencies(*mod);
+        if ( !deps.empty() ) {
+            if ( trace ) out << "=== Imports ===\n";
+            for ( const auto& dep : deps ) {
+                if ( trace ) out << dep->path << "\n";
+                if ( !dep->ok() ) {
+                    err << dep->diagnostics;
+                    err << "Import Error: " << dep->path << ": " << failureMessage(dep->failure) << std::endl;
+                    status = 1;
+                }
+            }
+            if ( trace ) out << "\n";
+        }
+        if ( mod->failure ) {
+            std::rethrow_exception(mod->failure);
+        }
+
+        // Execution and code generation both work on resolved trees, so names and
+        // types are checked here before anything runs
+        std::vector<const programNode*> imports;
+        bool generate = !opts.outFile.empty();
+        if ( (opts.run || generate) && status == 0 ) {
+            // Each module sees the functions and globals of its own imports, deepest first
+            phaseTimer timer("sema");
+            std::vector<std::shared_ptr<const module>> modules(deps.rbegin(), deps.rend());
+            modules.push_back(mod);
+            for ( const auto& m : modules ) {
+                std::vector<const programNode*> visible;
+                for ( const auto& dep : loader.dependencies(*m) ) {
+                    visible.push_back(dep->ast->getRoot());
+                }
+                resolveProgram(*m->ast->getRoot(), visible);
+            }
+            for ( const auto& dep : deps ) {
+                imports.push_back(dep->ast->getRoot());
+            }
+        }
+
+        // Step 5: Execution
+        if ( opts.run && status == 0 ) {
+            int64_t code;
+            if ( opts.useVM ) {
+                bcProgram program;
+                {
+                    phaseTimer timer("bytecode");
+                    program = compileBytecode(*mod->ast->getRoot(), imports);
+                }
+                if ( trace ) out << "=== Execution ===\n";
+                phaseTimer timer("run");
+                code = vm(out).run(program);
+            } else {
+                if ( trace ) out << "=== Execution ===\n";
+                phaseTimer timer("run");
+                code = interpreter(out).run(*mod->ast->getRoot(), imports);
+            }
+            if ( trace ) out << "\nProgram exited with code " << code << "\n";
+            if ( exitStatus ) *exitStatus = exitStatusOf(code, err);
+        }
+
+        // Step 6: Code Generation
+        if ( generate && status == 0 ) {
+            std::ostringstream assembly;
+            mod->ast->generateCode(assembly, imports);
+            std::ofstream file(opts.outFile, std::ios::binary);
+            file << assembly.str();
+            if ( !file.good() ) {
+                err << "Error: cannot write " << opts.outFile << std::endl;
+                return 1;
+            }
+            if ( trace ) out << "=== Code Generation ===\n" << "Assembly written to " << opts.outFile << "\n";
+        }
+        return status;
     } catch (const lexerError& e) {
-        std::cerr << "Lexer Error: " << e.what() << std::endl;
+        err << "Lexer Error: " << e.what() << std::endl;
         return 1;
     } catch (const astError& e) {
-        std::cerr << "AST Error: " << e.what() << std::endl;
+        err << "AST Error: " << e.what() << std::endl;
+        return 1;
+    } catch (const moduleError& e) {
+        err << "Import Error: " << e.what() << std::endl;
+        return 1;
+    } catch (const semanticError& e) {
+        err << "Semantic Error: " << e.what() << std::endl;
+        return 1;
+    } catch (const runtimeError& e) {
+        out << std::flush;
+        err << "Runtime Error: " << e.what() << std::endl;
         return 1;
     } catch (const std::exception& e) {
+        err << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+// One input path per line, blank lines and lines starting with # are ignored
+bool readManifest(const std::string& path, std::vector<std::string>& inputs) {
+    std::ifstream in(path);
+    if ( !in.good() ) return false;
+    std::string line;
+    while ( std::getline(in, line) ) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        if ( begin == std::string::npos || line[begin] == '#' ) continue;
+        size_t end = line.find_last_not_of(" \t\r");
+        inputs.push_back(line.substr(begin, end - begin + 1));
+    }
+    return true;
+}
+
+// Compiles every input on a pool, each file's output is buffered and flushed in input order.
+// Returns 1 if any failed, else the first nonzero status of the programs run.
+int compileAll(const std::vector<std::string>& inputs, const compileOptions& opts, moduleLoader& loader, size_t jobs,
+               std::ostream& out, std::ostream& err) {
+    struct result {
+        std::ostringstream out;
+        std::ostringstream err;
+        int status = 0;
+        int exitStatus = 0;
+        bool done = false;
+    };
+    std::vector<result> results(inputs.size());
+    std::mutex lock;
+    std::condition_variable finished;
+
+    threadPool pool(jobs < inputs.size() ? jobs : inputs.size());
+    for ( size_t i = 0; i < inputs.size(); i++ ) {
+        pool.submit([&, i] {
+            result& r = results[i];
+            r.status = compileFile(inputs[i], opts, loader, r.out, r.err, &r.exitStatus);
+            std::lock_guard<std::mutex> guard(lock);
+            r.done = true;
+            finished.notify_all();
+        });
+    }
+
+    int failures = 0;
+    int exitStatus = 0;
+    for ( size_t i = 0; i < inputs.size(); i++ ) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&] { return results[i].done; });
+        }
+        // JSON names the file in each object, and quiet runs print no headers
+        if ( opts.dump != dumpMode::JSON && opts.dump != dumpMode::NONE ) {
+            out << "=== " << inputs[i] << " ===\n";
+        }
+        out << results[i].out.str() << std::flush;
+        err << results[i].err.str() << std::flush;
+        if ( results[i].status != 0 ) failures++;
+        if ( exitStatus == 0 ) exitStatus = results[i].exitStatus;
+    }
+    pool.wait();
+
+    if ( failures ) {
+        err << failures << " of " << inputs.size() << " file(s) failed to compile" << std::endl;
+    }
+    return failures ? 1 : exitStatus;
+}
+
+// Everything one command line asks for
+struct invocation {
+    std::vector<std::string> inputs;
+    compileOptions opts;
+    size_t jobs = 0;
+    size_t maxErrors = diagnosticEngine::DEFAULT_LIMIT;
+    bool timeReport = false;
+    std::string timeReportJSON; // file for the JSON report, - for stdout
+    std::string serveSocket; // run as a compile server listening here
+    std::string connectSocket; // hand the command line to the server listening here
+    bool shutdown = false; // with connectSocket, stop the server
+};
+
+// Relative paths are taken from cwd, empty for the process's own directory
+std::string inDirectory(const std::string& cwd, const std::string& path) {
+    if ( cwd.empty() || path.empty() || path[0] == '/' ) return path;
+    return cwd + "/" + path;
+}
+
+// Fills inv from the arguments, returns the exit status if there is nothing left to do, else -1
+int parseArguments(const std::vector<std::string>& args, const std::string& cwd, invocation& inv,
+                   std::ostream& out, std::ostream& err) {
+    compileOptions& opts = inv.opts;
+    for ( size_t i = 0; i < args.size(); i++ ) { // Parse through arguments
+        const std::string& param = args[i];
+        // The value after param, empty when it is missing
+        auto value = [&]() { return i + 1 < args.size() ? args[++i] : std::string(); };
+        if ( param == "-h" || param == "-?" || param == "--help" ) {
+            out << "See https://github.com/Parker-Isaacson/qur for help." << std::endl;
+            return 0;
+        } else if ( param == "-c" || param == "--compile" ) {
+            inv.inputs.push_back(inDirectory(cwd, value()));
+        } else if ( param == "-d" || param == "--download" ) {
+            inv.inputs.push_back(inDirectory(cwd, value()));
+        } else if ( param == "-o" || param == "--out" ) {
+            opts.outFile = inDirectory(cwd, value());
+        } else if ( param == "--cache-dir" ) {
+            opts.cacheDir = inDirectory(cwd, value());
+        } else if ( param == "--emit-ast" ) {
+            opts.emitAST = true;
+        } else if ( param == "-r" || param == "--run" ) {
+            opts.run = true;
+        } else if ( param == "--engine" ) {
+            std::string engine = value();
+            if ( engine != "tree" && engine != "vm" ) {
+                err << "Error: unknown engine " << engine << ", expected tree or vm" << std::endl;
+                return 1;
+            }
+            opts.useVM = engine == "vm";
+            opts.run = true;
+        } else if ( param == "--dump" ) {
+            static const std::pair<const char*, dumpMode> modes[] = {
+                { "all", dumpMode::ALL }, { "tokens", dumpMode::TOKENS }, { "ast", dumpMode::AST },
+                { "json", dumpMode::JSON }, { "none", dumpMode::NONE },
+            };
+            std::string mode = value();
+            auto found = std::find_if(std::begin(modes), std::end(modes), [&](const auto& m) { return mode == m.first; });
+            if ( found == std::end(modes) ) {
+                err << "Error: unknown dump mode " << mode << ", expected all, tokens, ast, json or none" << std::endl;
+                return 1;
+            }
+            opts.dump = found->second;
+        } else if ( param == "-s" || param == "--stream" ) {
+            opts.streaming = true;
+        } else if ( param == "-m" || param == "--manifest" ) {
+            std::string manifest = inDirectory(cwd, value());
+            size_t first = inv.inputs.size();
+            if ( !readManifest(manifest, inv.inputs) ) {
+                err << "Error: cannot read manifest " << manifest << std::endl;
+                return 1;
+            }
+            for ( size_t k = first; k < inv.inputs.size(); k++ ) {
+                inv.inputs[k] = inDirectory(cwd, inv.inputs[k]);
+            }
+        } else if ( param == "-I" || param == "--include" ) {
+            opts.includeDirs.push_back(inDirectory(cwd, value()));
+        } else if ( param == "--max-errors" ) {
+            inv.maxErrors = std::stoul(value());
+        } else if ( param == "-j" || param == "--jobs" ) {
+            inv.jobs = std::stoul(value());
+        } else if ( param == "--time-report" ) {
+            inv.timeReport = true;
+        } else if ( param == "--time-report-json" ) {
+            inv.timeReportJSON = value();
+            if ( inv.timeReportJSON != "-" ) inv.timeReportJSON = inDirectory(cwd, inv.timeReportJSON);
+        } else if ( param == "--serve" ) {
+            inv.serveSocket = value();
+        } else if ( param == "--connect" ) {
+            inv.connectSocket = value();
+        } else if ( param == "--shutdown" ) {
+            inv.shutdown = true;
+        } else if ( !param.empty() && param[0] != '-' ) {
+            inv.inputs.push_back(inDirectory(cwd, param));
+        } else {
+            out << "Bad argument: " << param << ". Skipping.\n";
+        }
+    }
+    return -1;
+}
+
+// Compiles the inputs of inv with loader, which may already hold some of their modules
+int compileInputs(invocation& inv, moduleLoader& loader, std::ostream& out, std::ostream& err) {
+    if ( inv.inputs.empty() ) {
+        inv.inputs.push_back("");
+    }
+    if ( inv.inputs.size() > 1 && !inv.opts.outFile.empty() ) {
+        err << "Error: -o takes a single input" << std::endl;
+        return 1;
+    }
+    int exitStatus = 0;
+    int status = inv.inputs.size() == 1
+        ? compileFile(inv.inputs[0], inv.opts, loader, out, err, &exitStatus)
+        : compileAll(inv.inputs, inv.opts, loader, inv.jobs ? inv.jobs : threadPool::defaultWorkers(), out, err);
+    out << std::flush;
+    return status ? status : exitStatus;
+}
+
+// Runs as a compile server, see server.h. Modules stay loaded between requests, and
+// each request first drops those whose files changed. The loader (search paths,
+// build cache, streaming, error limit, parse workers) is configured once from the
+// server's own command line; those options are ignored in requests, and so are
+// the time reports, which would mix concurrent requests.
+int runServer(invocation& server, moduleLoader& loader) {
+    // Inputs given to the server are loaded up front so the first request finds them warm
+    for ( const std::string& input : server.inputs ) {
+        loader.load(input);
+    }
+    requestHandler handler = [&loader](const serverRequest& request, std::ostream& out, std::ostream& err) {
+        invocation inv;
+        int status = parseArguments(request.args, request.cwd, inv, out, err);
+        if ( status >= 0 ) return status;
+        loader.revalidate();
+        return compileInputs(inv, loader, out, err);
+    };
+    try {
+        serve(server.serveSocket, handler, std::cerr);
+    } catch ( const serverError& e ) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
     return 0;
 }
+
+// Hands the command line to a running server and prints what it sends back
+int runClient(const std::vector<std::string>& args, const invocation& inv) {
+    serverRequest request;
+    request.shutdown = inv.shutdown;
+    std::error_code ec;
+    request.cwd = std::filesystem::current_path(ec).string();
+    for ( size_t i = 0; i < args.size(); i++ ) {
+        if ( args[i] == "--connect" ) {
+            i++;
+        } else if ( args[i] != "--shutdown" ) {
+            request.args.push_back(args[i]);
+        }
+    }
+    try {
+        return sendRequest(inv.connectSocket, request, std::cout, std::cerr);
+    } catch ( const serverError& e ) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    invocation inv;
+    try {
+        int status = parseArguments(args, "", inv, std::cout, std::cerr);
+        if ( status >= 0 ) return status;
+    } catch ( const std::exception& e ) {
+        std::cerr << "Error: bad argument: " << e.what() << std::endl;
+        return 1;
+    }
+    if ( !inv.connectSocket.empty() ) {
+        return runClient(args, inv);
+    }
+    if ( inv.timeReport || !inv.timeReportJSON.empty() ) {
+        enableProfiling();
+    }
+
+    std::unique_ptr<buildCache> cache;
+    if ( !inv.opts.cacheDir.empty() ) {
+        cache = std::make_unique<buildCache>(inv.opts.cacheDir);
+    }
+    moduleLoader loader(inv.opts.streaming ? tokenFlow::STREAMING : tokenFlow::EAGER);
+    for ( const std::string& dir : inv.opts.includeDirs ) {
+        loader.addSearchPath(dir);
+    }
+    if ( cache ) {
+        loader.setBuildCache(cache.get());
+    }
+    // Several inputs already keep the threads busy, a single one spreads its functions over them
+    loader.setParseWorkers(inv.inputs.size() > 1 ? 1 : inv.jobs);
+    loader.setErrorLimit(inv.maxErrors);
+    if ( !inv.serveSocket.empty() ) {
+        return runServer(inv, loader);
+    }
+
+    int status = compileInputs(inv, loader, std::cout, std::cerr);
+    if ( inv.timeReport ) {
+        writeTimeReport(std::cerr);
+    }
+    if ( inv.timeReportJSON == "-" ) {
+        writeTimeReportJSON(std::cout);
+    } else if ( !inv.timeReportJSON.empty() ) {
+        std::ofstream file(inv.timeReportJSON);
+        writeTimeReportJSON(file);
+        if ( !file.good() ) {
+            std::cerr << "Error: cannot write " << inv.timeReportJSON << std::endl;
+            return 1;
+        }
+    }
+    return status;
+}
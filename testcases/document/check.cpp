@@ -0,0 +1,191 @@
+#include "../../utils/lexer.h"
+#include "../../utils/ast.h"
+#include "../../utils/document.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Applies random edits to a sourceDocument holding each file given, and after every
+// one compares its tokens, tree and errors with lexing and parsing the edited text
+// from scratch with no error limit.
+// check [-n edits] file.qur ..., exits 1 at the first difference, printing the edits
+// that led to it.
+
+namespace {
+
+// Pieces of the language, so the edits make and break every kind of token and
+// declaration rather than only identifiers
+const char* const FRAGMENTS[] = {
+    " ", "\n", ";", "{", "}", "(", ")", "[", "]", ",", "=", "+", "-", "*", "/", "<", "&", "|", "!",
+    "\"", "'", "${", "//", "/*", "*/", "\\", "x", "n2", "42", "1.5", "'c'", "\"s ${x}\"", "fn", "int",
+    "double", "string", "list<int>", "return", "if", "else", "for", "while", "import", "true", "#",
+    "fn int f(int a) { return a; };", "int g = 1;",
+};
+
+struct reference {
+    std::vector<compactToken> tokens;
+    std::string tree; // empty when the text did not build
+    std::string errors;
+    bool built = false;
+};
+
+reference parseFresh(const std::string& name, std::string_view text) {
+    sourceBuffer buffer;
+    buffer.assign(std::string(text));
+    lexer lex(std::move(buffer), name, tokenFlow::EAGER, 0);
+    reference ref;
+    ref.tokens = lex.getCompactTokens();
+    std::ostringstream printed;
+    AST ast(lex);
+    ast.setErrorStream(printed);
+    try {
+        ast.build();
+        ast.getRoot()->print(printed, 0);
+        ref.tree = printed.str();
+        ref.built = true;
+    } catch ( const astError& ) {
+        // A text without tokens fails to build with no errors, as an empty program
+        if ( lex.diagnostics().empty() ) {
+            programNode().print(printed, 0);
+            ref.tree = printed.str();
+            ref.built = true;
+        }
+    }
+    std::ostringstream errors;
+    lex.diagnostics().print(errors);
+    ref.errors = errors.str();
+    return ref;
+}
+
+bool sameTokens(const std::vector<compactToken>& a, const std::vector<compactToken>& b) {
+    if ( a.size() != b.size() ) return false;
+    for ( size_t i = 0; i < a.size(); i++ ) {
+        if ( a[i].type != b[i].type || a[i].line != b[i].line || a[i].column != b[i].column ||
+             a[i].offset != b[i].offset || a[i].length != b[i].length || a[i].sym != b[i].sym ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// What differs between doc and parsing its text again, empty if nothing does
+std::string compare(const sourceDocument& doc, const std::string& name) {
+    reference ref = parseFresh(name, doc.text());
+    if ( !sameTokens(doc.tokens(), ref.tokens) ) return "tokens differ";
+    diagnosticEngine errors(0);
+    doc.diagnostics(errors);
+    std::ostringstream printed;
+    errors.print(printed);
+    if ( printed.str() != ref.errors ) return "errors differ:\n" + printed.str() + "expected:\n" + ref.errors;
+    if ( doc.ok() != ref.built ) return doc.ok() ? "document has no errors" : "document has errors";
+    if ( ref.built ) {
+        std::ostringstream tree;
+        doc.program()->print(tree, 0);
+        if ( tree.str() != ref.tree ) return "trees differ";
+    }
+    return "";
+}
+
+std::string describe(const sourceEdit& edit) {
+    std::ostringstream out;
+    out << "  replace " << edit.length << " bytes at " << edit.offset << " with \"";
+    for ( char c : edit.text ) {
+        if ( c == '\n' ) out << "\\n";
+        else if ( c == '"' || c == '\\' ) out << '\\' << c;
+        else out << c;
+    }
+    out << "\"\n";
+    return out.str();
+}
+
+// An edit that keeps a valid program valid: a space, line break or comment before a
+// token, another name for an identifier, or a declaration added at the top
+sourceEdit harmlessEdit(const sourceDocument& doc, std::mt19937& random) {
+    const std::vector<compactToken>& tokens = doc.tokens();
+    if ( tokens.empty() || random() % 8 == 0 ) return { 0, 0, "int added" + std::to_string(random() % 100) + " = 1;\n" };
+    const compactToken& tok = tokens[std::uniform_int_distribution<size_t>(0, tokens.size() - 1)(random)];
+    if ( tok.type == TokenType::IDENTIFIER && random() % 2 == 0 ) {
+        return { tok.offset, tok.length, "renamed" + std::to_string(random() % 100) };
+    }
+    const char* const spaces[] = { " ", "\n", "\n\n", "/* c */", "\t" };
+    // Quoted tokens start at their quote, before the offset
+    size_t at = tok.type == TokenType::STRING || tok.type == TokenType::CHAR ? tok.offset - 1 : tok.offset;
+    return { at, 0, spaces[random() % std::size(spaces)] };
+}
+
+// Anything at all, made of the pieces in FRAGMENTS
+sourceEdit randomEdit(const sourceDocument& doc, std::mt19937& random) {
+    size_t size = doc.text().size();
+    sourceEdit edit;
+    edit.offset = std::uniform_int_distribution<size_t>(0, size)(random);
+    size_t room = size - edit.offset;
+    edit.length = std::uniform_int_distribution<size_t>(0, room < 8 ? room : 8)(random);
+    int pieces = std::uniform_int_distribution<int>(0, 2)(random);
+    for ( int p = 0; p < pieces; p++ ) {
+        edit.text += FRAGMENTS[std::uniform_int_distribution<size_t>(0, std::size(FRAGMENTS) - 1)(random)];
+    }
+    return edit;
+}
+
+// Runs edits random edits over the file, from a seed of its own so failures repeat.
+// Most edits that may break the text are taken back, as an undo would, so the text
+// is valid often enough for the trees to be compared too.
+bool checkFile(const std::string& name, const std::string& text, int edits) {
+    std::mt19937 random(0x5eed);
+    sourceDocument doc(name, text);
+    std::string problem = compare(doc, name);
+    std::vector<sourceEdit> applied;
+    for ( int i = 0; problem.empty() && i < edits; i++ ) {
+        bool harmless = random() % 2 == 0;
+        sourceEdit edit = harmless ? harmlessEdit(doc, random) : randomEdit(doc, random);
+        // Broken edits that were kept are cleared out now and then by going back to
+        // the file as it was, in one edit
+        if ( i % 25 == 24 ) {
+            edit = { 0, doc.text().size(), text };
+            harmless = true;
+        }
+        sourceEdit undo{ edit.offset, edit.text.size(), std::string(doc.text().substr(edit.offset, edit.length)) };
+        doc.apply(edit);
+        applied.push_back(edit);
+        problem = compare(doc, name);
+        if ( problem.empty() && !harmless && random() % 8 != 0 ) {
+            doc.apply(undo);
+            applied.push_back(undo);
+            problem = compare(doc, name);
+        }
+    }
+    if ( problem.empty() ) return true;
+    std::cerr << name << ": " << problem << "\nafter " << applied.size() << " edit(s):\n";
+    for ( const sourceEdit& edit : applied ) std::cerr << describe(edit);
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int edits = 300;
+    bool ok = true;
+    for ( int i = 1; i < argc; i++ ) {
+        std::string param = argv[i];
+        if ( param == "-n" && i + 1 < argc ) {
+            edits = std::stoi(argv[++i]);
+            continue;
+        }
+        std::ifstream in(param, std::ios::binary);
+        if ( !in.good() ) {
+            std::cerr << "Error: cannot read " << param << std::endl;
+            return 1;
+        }
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        bool passed = checkFile(param, text, edits);
+        std::cout << param << ": " << (passed ? "ok" : "FAILED") << std::endl;
+        ok = ok && passed;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Runs every program in this directory through each back end: the tree
+# interpreter (--run), the bytecode VM (--engine vm), the assembly from -o,
+# assembled and linked with gcc, and the VM again on the program's --emit-ast
+# image. Compares what each prints, and its exit status, with <name>.out next to it.
+# usage: check.sh [compiler], from anywhere; exits 1 if any program differs.
+
+dir=$(cd "$(dirname "$0")" && pwd)
+compiler=$(realpath "${1:-$dir/../../compiler}")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+# Images are written next to their source and import from there, so into a copy
+cp -R "$dir" "$work/src"
+
+# Output of one run followed by its exit status, so both are compared
+run() {
+    "$@" 2>&1
+    echo "exit status $?"
+}
+
+failed=0
+for program in "$dir"/*.qur; do
+    name=$(basename "$program" .qur)
+    run "$compiler" --dump none --run "$program" > "$work/$name.tree"
+    run "$compiler" --dump none --engine vm "$program" > "$work/$name.vm"
+    if "$compiler" --dump none -o "$work/$name.s" "$program" > "$work/$name.native" 2>&1 &&
+       gcc "$work/$name.s" -o "$work/$name" >> "$work/$name.native" 2>&1; then
+        run "$work/$name" > "$work/$name.native"
+    else
+        echo "exit status build failed" >> "$work/$name.native"
+    fi
+    "$compiler" --dump none --emit-ast "$work/src/$name.qur" > /dev/null 2>&1
+    run "$compiler" --dump none --engine vm "$work/src/$name.qast" > "$work/$name.image"
+
+    status=ok
+    for engine in tree vm native image; do
+        if ! diff -u --label "$name.out" --label "$name ($engine)" "$dir/$name.out" "$work/$name.$engine"; then
+            status=FAILED
+        fi
+    done
+    [ "$status" = ok ] || failed=1
+    echo "$name: $status"
+done
+exit $failed
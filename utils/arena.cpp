@@ -0,0 +1,37 @@
+#include "arena.h"
+
+astArena::~astArena() {
+    // Each object only releases its own members, children are finalized by their own entry
+    for ( auto it = finalizers_.rbegin(); it != finalizers_.rend(); ++it ) {
+        it->destroy(it->object);
+    }
+}
+
+void* astArena::allocateSlow(size_t size, size_t align) {
+    // Oversized requests get a dedicated block so the current one keeps filling
+    size_t blockSize = size + align > BLOCK_SIZE ? size + align : BLOCK_SIZE;
+    block b{ std::unique_ptr<char[]>(new char[blockSize]), blockSize };
+    char* begin = b.data.get();
+    blocks_.push_back(std::move(b));
+
+    size_t pad = (align - (reinterpret_cast<uintptr_t>(begin) & (align - 1))) & (align - 1);
+    char* p = begin + pad;
+    if ( blockSize == BLOCK_SIZE ) {
+        cursor_ = p + size;
+        limit_ = begin + blockSize;
+    }
+    bytesUsed_ += size + pad;
+    return p;
+}
+
+void astArena::absorb(astArena& other) {
+    for ( auto& b : other.blocks_ ) {
+        blocks_.push_back(std::move(b));
+    }
+    finalizers_.insert(finalizers_.end(), other.finalizers_.begin(), other.finalizers_.end());
+    bytesUsed_ += other.bytesUsed_;
+    other.blocks_.clear();
+    other.finalizers_.clear();
+    other.cursor_ = other.limit_ = nullptr;
+    other.bytesUsed_ = 0;
+}
@@ -0,0 +1,81 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator. Objects live until the arena is destroyed, at which point every
+// registered destructor runs once in reverse order and the blocks are freed together.
+class astArena {
+private:
+    struct block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    struct finalizer {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<block> blocks_;
+    std::vector<finalizer> finalizers_;
+    char* cursor_ = nullptr;
+    char* limit_ = nullptr;
+    size_t bytesUsed_ = 0;
+
+    void* allocateSlow(size_t size, size_t align);
+
+public:
+    astArena() = default;
+    ~astArena();
+    astArena(const astArena&) = delete;
+    astArena& operator=(const astArena&) = delete;
+
+    void* allocate(size_t size, size_t align) {
+        size_t pad = (align - (reinterpret_cast<uintptr_t>(cursor_) & (align - 1))) & (align - 1);
+        if ( cursor_ && (size_t)(limit_ - cursor_) >= size + pad ) {
+            char* p = cursor_ + pad;
+            cursor_ = p + size;
+            bytesUsed_ += size + pad;
+            return p;
+        }
+        return allocateSlow(size, align);
+    }
+
+    template <class T, class... Args>
+    T* make(Args&&... args) {
+        void* mem = allocate(sizeof(T), alignof(T));
+        T* obj = new (mem) T(std::forward<Args>(args)...);
+        if ( !std::is_trivially_destructible<T>::value ) {
+            finalizers_.push_back({ obj, [](void* p) { static_cast<T*>(p)->~T(); } });
+        }
+        return obj;
+    }
+
+    // Takes over every object and block of other, which is left empty. Lets nodes built
+    // in a separate arena (e.g. on another thread) live as long as this one.
+    void absorb(astArena& other);
+
+    size_t bytesUsed() const { return bytesUsed_; }
+    size_t objectCount() const { return finalizers_.size(); }
+};
+
+// Arena-owned objects are never deleted individually, the owning pointer only
+// expresses tree structure
+struct arenaDeleter {
+    template <class T>
+    void operator()(T*) const noexcept {}
+};
+
+template <class T>
+using nodePtr = std::unique_ptr<T, arenaDeleter>;
+
+#endif // ARENA_H
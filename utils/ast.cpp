@@ -1,24 +1,136 @@
 #include "ast.h"
 #include "lexer.h"
+#include "printer.h"
+#include "codegen.h"
+#include "fold.h"
+#include "profile.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+
+opKind tokenTypeToOp(TokenType type, bool postfix) {
+    switch (type) {
+        case TokenType::ADD: return opKind::ADD;
+        case TokenType::SUB: return opKind::SUB;
+        case TokenType::MUL: return opKind::MUL;
+        case TokenType::DIV: return opKind::DIV;
+        case TokenType::MOD: return opKind::MOD;
+        case TokenType::LESSTHAN: return opKind::LESSTHAN;
+        case TokenType::MORETHAN: return opKind::MORETHAN;
+        case TokenType::LESSTHANEQUAL: return opKind::LESSTHANEQUAL;
+        case TokenType::MORETHANEQUAL: return opKind::MORETHANEQUAL;
+        case TokenType::EQUAL: return opKind::EQUAL;
+        case TokenType::NOTEQUAL: return opKind::NOTEQUAL;
+        case TokenType::AND: return opKind::AND;
+        case TokenType::OR: return opKind::OR;
+        case TokenType::NOT: return opKind::NOT;
+        case TokenType::INVERT: return opKind::INVERT;
+        case TokenType::INCREMENT: return postfix ? opKind::POST_INCREMENT : opKind::PRE_INCREMENT;
+        case TokenType::DECREMENT: return postfix ? opKind::POST_DECREMENT : opKind::PRE_DECREMENT;
+        case TokenType::ASSIGN: return opKind::ASSIGN;
+        case TokenType::ASSIGN_ADD: return opKind::ASSIGN_ADD;
+        case TokenType::ASSIGN_SUB: return opKind::ASSIGN_SUB;
+        case TokenType::ASSIGN_MUL: return opKind::ASSIGN_MUL;
+        case TokenType::ASSIGN_DIV: return opKind::ASSIGN_DIV;
+        case TokenType::ASSIGN_MOD: return opKind::ASSIGN_MOD;
+        default: return opKind::UNKNOWN;
+    }
+}
+
+std::string_view opToString(opKind op) {
+    switch (op) {
+        case opKind::ADD: return "+";
+        case opKind::SUB: return "-";
+        case opKind::MUL: return "*";
+        case opKind::DIV: return "/";
+        case opKind::MOD: return "%";
+        case opKind::LESSTHAN: return "<";
+        case opKind::MORETHAN: return ">";
+        case opKind::LESSTHANEQUAL: return "<=";
+        case opKind::MORETHANEQUAL: return ">=";
+        case opKind::EQUAL: return "==";
+        case opKind::NOTEQUAL: return "!=";
+        case opKind::AND: return "&";
+        case opKind::OR: return "|";
+        case opKind::NOT: return "!";
+        case opKind::INVERT: return "~";
+        case opKind::PRE_INCREMENT: return "++";
+        case opKind::PRE_DECREMENT: return "--";
+        case opKind::POST_INCREMENT: return "++_postfix";
+        case opKind::POST_DECREMENT: return "--_postfix";
+        case opKind::ASSIGN: return "=";
+        case opKind::ASSIGN_ADD: return "+=";
+        case opKind::ASSIGN_SUB: return "-=";
+        case opKind::ASSIGN_MUL: return "*=";
+        case opKind::ASSIGN_DIV: return "/=";
+        case opKind::ASSIGN_MOD: return "%=";
+        default: return "?";
+    }
+}
 
 // Constructor
 AST::AST(const std::vector<Token>& tokens)
-    : tokens_(tokens), current_(0), root_(nullptr) {}
+    : source_(nullptr), tokens_(nullptr), tokenCount_(0), current_(0), stream_(nullptr),
+      prev_(compactToken::make(TokenType::UNKNOWN, 0, 0, 0, 0)), errorOut_(&std::cerr), root_(nullptr),
+      diagnostics_(&ownDiagnostics_) {
+    // Pack the owned lexemes into one buffer so parsing works on compact tokens
+    size_t total = 0;
+    for (const Token& tok : tokens) total += tok.lexme.size();
+    ownedSource_.reserve(total);
+    ownedTokens_.reserve(tokens.size());
+    for (const Token& tok : tokens) {
+        symbolId sym = tok.type == TokenType::IDENTIFIER ? intern(tok.lexme).id : 0;
+        ownedTokens_.push_back(compactToken::make(tok.type, ownedSource_.size(), tok.lexme.size(),
+                                                  tok.line, tok.column, sym));
+        ownedSource_ += tok.lexme;
+    }
+    source_ = ownedSource_.data();
+    tokens_ = ownedTokens_.data();
+    tokenCount_ = ownedTokens_.size();
+}
+
+AST::AST(lexer& lex)
+    : source_(lex.sourceData()), tokens_(lex.getCompactTokens().data()),
+      tokenCount_(lex.getCompactTokens().size()), current_(0),
+      stream_(lex.isStreaming() ? &lex : nullptr),
+      prev_(compactToken::make(TokenType::UNKNOWN, 0, 0, 0, 0)), errorOut_(&std::cerr), root_(nullptr),
+      diagnostics_(&lex.diagnostics()) {}
+
+AST::AST(const char* source, const compactToken* tokens, size_t count)
+    : source_(source), tokens_(tokens), tokenCount_(count), current_(0), stream_(nullptr),
+      prev_(compactToken::make(TokenType::UNKNOWN, 0, 0, 0, 0)), errorOut_(&std::cerr), root_(nullptr),
+      diagnostics_(&ownDiagnostics_) {}
+
+AST::AST()
+    : source_(nullptr), tokens_(nullptr), tokenCount_(0), current_(0), stream_(nullptr),
+      prev_(compactToken::make(TokenType::UNKNOWN, 0, 0, 0, 0)), errorOut_(&std::cerr), root_(nullptr),
+      diagnostics_(&ownDiagnostics_) {}
+
+void AST::setTokens(const char* source, const compactToken* tokens, size_t count) {
+    source_ = source;
+    tokens_ = tokens;
+    tokenCount_ = count;
+    current_ = 0;
+}
 
 // Helper methods
-Token AST::peek() const {
+const compactToken& AST::peek() const {
+    if (stream_) return stream_->peek();
     if (isAtEnd()) {
         // Return a dummy EOF token instead of accessing invalid memory
-        static Token eofToken = {TokenType::UNKNOWN, "", -1, -1};
+        static const compactToken eofToken = compactToken::make(TokenType::UNKNOWN, 0, 0, 0, 0);
         return eofToken;
     }
     return tokens_[current_];
 }
 
-Token AST::previous() const {
+const compactToken& AST::previous() const {
+    if (stream_) return current_ == 0 ? stream_->peek() : prev_;
     if (current_ == 0) {
-        if (tokens_.empty()) {
-            static Token dummy = {TokenType::UNKNOWN, "", -1, -1};
+        if (tokenCount_ == 0) {
+            static const compactToken dummy = compactToken::make(TokenType::UNKNOWN, 0, 0, 0, 0);
             return dummy;
         }
         return tokens_[0];
@@ -26,7 +138,14 @@ Token AST::previous() const {
     return tokens_[current_ - 1];
 }
 
-Token AST::advance() {
+const compactToken& AST::advance() {
+    if (stream_) {
+        if (!stream_->atEnd()) {
+            prev_ = stream_->next();
+            current_++;
+        }
+        return previous();
+    }
     if (!isAtEnd()) current_++;
     return previous();
 }
@@ -55,19 +174,38 @@ bool AST::match(std::initializer_list<TokenType> types) {
 }
 
 bool AST::isAtEnd() const {
-    return current_ >= tokens_.size();
+    if (stream_) return stream_->atEnd();
+    return current_ >= tokenCount_;
 }
 
-Token AST::consume(TokenType type, const std::string& errorMsg) {
+const compactToken& AST::consume(TokenType type, const char* errorMsg) {
     if (check(type)) return advance();
-    
-    Token current = peek();
-    std::string fullMsg = errorMsg;
-    if (current.line >= 0) {
-        fullMsg += " at line " + std::to_string(current.line) + ", column " + std::to_string(current.column);
+    const compactToken& current = peek();
+    error(current, errorMsg);
+    return current;
+}
+
+void AST::error(const compactToken& tok, const char* what) {
+    failed_ = true;
+    if (diagnostics_->full()) return;
+    std::string message = what;
+    if (tok.line > 0) {
+        message += " at line " + std::to_string(tok.line) + ", column " + std::to_string(tok.column);
     }
-    fullMsg += " (found '" + current.lexme + "')";
-    throw astError(fullMsg);
+    message += " (found '" + std::string(text(tok)) + "')";
+    diagnostics_->report(diagStage::PARSER, sourceSpan{ tok.line, tok.column, tok.offset, tok.length }, std::move(message));
+}
+
+void AST::fail(const compactToken& tok, std::string message) {
+    failed_ = true;
+    diagnostics_->report(diagStage::PARSER, sourceSpan{ tok.line, tok.column, tok.offset, tok.length }, std::move(message));
+}
+
+void AST::reportDiagnostics() {
+    if (diagnostics_->empty()) return;
+    diagnostics_->print(*errorOut_);
+    throw astError(diagnostics_->hasParserErrors() ? "Failed to build AST due to parse errors"
+                                                   : "Failed to build AST due to lexer errors");
 }
 
 astVarType AST::tokenTypeToVarType(TokenType type) {
@@ -82,14 +220,59 @@ astVarType AST::tokenTypeToVarType(TokenType type) {
     }
 }
 
+bool AST::matchType(astVarType& type) {
+    if (match({TokenType::INT, TokenType::DOUBLE, TokenType::CHAR,
+               TokenType::BOOLEAN, TokenType::STRING})) {
+        type = tokenTypeToVarType(previous().type);
+        return true;
+    }
+    if (match(TokenType::LIST)) {
+        type = parseListType(); // check failed_ after a true return
+        return true;
+    }
+    return false;
+}
+
+// <int> or <double> after 'list'
+astVarType AST::parseListType() {
+    consume(TokenType::LESSTHAN, "Expected '<' after 'list'");
+    if (failed_) return astVarType::INFERRED;
+    astVarType type;
+    if (match(TokenType::INT)) {
+        type = astVarType::INT_LIST;
+    } else if (match(TokenType::DOUBLE)) {
+        type = astVarType::DOUBLE_LIST;
+    } else {
+        error(peek(), "Expected list element type int or double");
+        return astVarType::INFERRED;
+    }
+    consume(TokenType::MORETHAN, "Expected '>' after list element type");
+    return type;
+}
+
 // Main build method
 void AST::build() {
-    if (tokens_.empty()) {
+    if (isAtEnd()) {
+        reportDiagnostics(); // a file of nothing but stray characters
         throw astError("No tokens to parse - input file may be empty");
     }
 
-    std::vector<std::unique_ptr<astNode>> declarations;
-    bool hadError = false;
+    std::vector<nodePtr<astNode>> declarations;
+
+    // Functions parsed ahead are taken when parsing reaches their first token, anything
+    // else is parsed here, including functions that failed ahead so errors come out in order
+    std::vector<functionSpan> spans;
+    std::vector<nodePtr<astNode>> ahead;
+    size_t workers = parseWorkers_ ? parseWorkers_ : threadPool::defaultWorkers();
+    if (!stream_ && workers > 1 && tokenCount_ >= PARALLEL_MIN_TOKENS) {
+        spans = scanFunctions();
+        if (spans.size() >= PARALLEL_MIN_FUNCTIONS) {
+            ahead = parseAhead(spans, workers);
+        } else {
+            spans.clear();
+        }
+    }
+    size_t nextSpan = 0;
     
     while (!isAtEnd()) {
         if (check(TokenType::SEMICOLON) || check(TokenType::RBRACE)) {
@@ -97,45 +280,134 @@ void AST::build() {
             continue;
         }
 
-        try {
-            auto decl = parseDeclaration();
-            if (decl) {
-                declarations.push_back(std::move(decl));
-            }
-        } catch (const astError& e) {
-            std::cerr << "Parse error: " << e.what() << std::endl;
-            hadError = true;
-            
-            // Synchronize: skip to next safe point
-            while (!isAtEnd()) {
-                Token t = peek();
-                // Stop at statement/declaration boundaries
-                if (t.type == TokenType::SEMICOLON) {
-                    advance();
-                    break;
-                }
-                if (t.type == TokenType::RBRACE || 
-                    t.type == TokenType::FUNCTION ||
-                    t.type == TokenType::IF ||
-                    t.type == TokenType::WHILE ||
-                    t.type == TokenType::FOR ||
-                    t.type == TokenType::RETURN) {
-                    break;
-                }
-                advance();
-            }
+        while (nextSpan < spans.size() && spans[nextSpan].begin < current_) nextSpan++;
+        if (nextSpan < spans.size() && spans[nextSpan].begin == current_ && ahead[nextSpan]) {
+            declarations.push_back(std::move(ahead[nextSpan]));
+            current_ = spans[nextSpan++].end;
+            continue;
         }
+
+        auto decl = parseTopLevel();
+        if (decl) {
+            declarations.push_back(std::move(decl));
+        }
+        if (diagnostics_->full()) break; // too broken to be worth going on
     }
     
-    if (hadError) {
-        throw astError("Failed to build AST due to parse errors");
+    reportDiagnostics();
+    root_ = makeNode<programNode>(std::move(declarations));
+}
+
+nodePtr<astNode> AST::parseTopLevel() {
+    auto decl = parseDeclaration();
+    if (!failed_) return decl;
+    failed_ = false;
+    if (diagnostics_->full()) return nullptr; // build stops here
+
+    // Synchronize: skip to next safe point
+    while (!isAtEnd()) {
+        const compactToken& t = peek();
+        // Stop at statement/declaration boundaries
+        if (t.type == TokenType::SEMICOLON) {
+            advance();
+            break;
+        }
+        if (t.type == TokenType::RBRACE || 
+            t.type == TokenType::FUNCTION ||
+            t.type == TokenType::IF ||
+            t.type == TokenType::WHILE ||
+            t.type == TokenType::FOR ||
+            t.type == TokenType::RETURN) {
+            break;
+        }
+        advance();
     }
-    
-    root_ = std::make_unique<programNode>(std::move(declarations));
+    return nullptr;
+}
+
+nodePtr<astNode> AST::parseDeclarationAt(size_t start, size_t& end) {
+    current_ = start;
+    auto decl = parseTopLevel();
+    end = current_;
+    return decl;
 }
 
 // Parse declaration (function or variable)
-std::unique_ptr<astNode> AST::parseDeclaration() {
+std::vector<AST::functionSpan> AST::scanFunctions() const {
+    std::vector<functionSpan> spans;
+    size_t depth = 0;
+    size_t begin = 0;
+    bool inFunction = false;
+    for (size_t i = 0; i < tokenCount_; i++) {
+        switch (tokens_[i].type) {
+            case TokenType::LBRACE:
+                depth++;
+                break;
+            case TokenType::RBRACE:
+                // A stray '}' at the top level is skipped by build
+                if (depth > 0 && --depth == 0 && inFunction) {
+                    spans.push_back({ begin, i + 1 });
+                    inFunction = false;
+                }
+                break;
+            case TokenType::FUNCTION:
+                // Another fn before any '{' means the previous header is broken, build reports it
+                if (depth == 0) {
+                    begin = i;
+                    inFunction = true;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return spans;
+}
+
+std::vector<nodePtr<astNode>> AST::parseAhead(const std::vector<functionSpan>& spans, size_t workers) {
+    // A few chunks of about the same token count per thread, so one long function
+    // does not hold the rest up
+    size_t chunks = std::min(spans.size(), workers * 4);
+    size_t total = 0;
+    for (const functionSpan& span : spans) total += span.end - span.begin;
+    std::vector<size_t> cuts{ 0 };
+    size_t filled = 0;
+    for (size_t i = 0; i < spans.size(); i++) {
+        filled += spans[i].end - spans[i].begin;
+        if (filled * chunks >= total * cuts.size() || i + 1 == spans.size()) cuts.push_back(i + 1);
+    }
+
+    // Each chunk gets a parser of its own over the same tokens, the parser only
+    // depends on where it starts so a clean parse matches what build would produce
+    std::vector<nodePtr<astNode>> parsed(spans.size());
+    std::vector<std::unique_ptr<AST>> parsers;
+    {
+        threadPool pool(std::min(workers, cuts.size() - 1));
+        for (size_t c = 0; c + 1 < cuts.size(); c++) {
+            parsers.push_back(std::make_unique<AST>());
+            AST& parser = *parsers.back();
+            parser.source_ = source_;
+            parser.tokens_ = tokens_;
+            parser.tokenCount_ = tokenCount_;
+            size_t first = cuts[c], last = cuts[c + 1];
+            pool.submit([&parser, &spans, &parsed, first, last] {
+                for (size_t i = first; i < last; i++) {
+                    parser.current_ = spans[i].begin;
+                    auto decl = parser.parseDeclaration();
+                    if (!parser.failed_ && decl && parser.current_ == spans[i].end) parsed[i] = std::move(decl);
+                    // Errors are left to build, which parses the span again to report them
+                    parser.failed_ = false;
+                    parser.diagnostics_->clear();
+                }
+            });
+        }
+        pool.wait();
+    }
+    for (auto& parser : parsers) arena_.absorb(parser->arena_);
+    return parsed;
+}
+
+nodePtr<astNode> AST::parseDeclaration() {
     if (check(TokenType::RBRACE) || check(TokenType::SEMICOLON)) {
         advance();
         return nullptr;
@@ -150,19 +422,18 @@ std::unique_ptr<astNode> AST::parseDeclaration() {
         // Accumulate tokens until semicolon as path
         std::string path;
         while (!check(TokenType::SEMICOLON) && !isAtEnd()) {
-            Token t = advance();
-            path += t.lexme;
+            path += text(advance());
         }
         consume(TokenType::SEMICOLON, "Expected ';' after import");
-        return std::make_unique<importNode>(path);
+        if (failed_) return nullptr;
+        return makeNode<importNode>(path);
     }
 
     // Variable declaration: type name = expr;
-    if (check(TokenType::INT) || check(TokenType::DOUBLE) || 
-        check(TokenType::CHAR) || check(TokenType::BOOLEAN) || 
-        check(TokenType::STRING)) {
-        advance();
-        return parseVarDeclaration();
+    astVarType varType;
+    if (matchType(varType)) {
+        if (failed_) return nullptr;
+        return parseVarDeclaration(varType);
     }
     
     // Otherwise it's a statement
@@ -170,66 +441,69 @@ std::unique_ptr<astNode> AST::parseDeclaration() {
 }
 
 // Parse function declaration
-std::unique_ptr<functionNode> AST::parseFunction() {
+nodePtr<functionNode> AST::parseFunction() {
     // Return type (optional, defaults to void)
     astVarType returnType = astVarType::VOID;
-    if (match({TokenType::INT, TokenType::DOUBLE, TokenType::CHAR, 
-               TokenType::BOOLEAN, TokenType::STRING, TokenType::VOID})) {
-        returnType = tokenTypeToVarType(previous().type);
-    }
+    if (!matchType(returnType)) match(TokenType::VOID);
+    if (failed_) return nullptr;
     
     // Function name
-    Token nameToken = consume(TokenType::IDENTIFIER, "Expected function name");
-    std::string name = nameToken.lexme;
+    const compactToken& nameTok = consume(TokenType::IDENTIFIER, "Expected function name");
+    if (failed_) return nullptr;
+    symbol name = symbolOf(nameTok);
     
     // Parameters
     consume(TokenType::LPAREN, "Expected '(' after function name");
+    if (failed_) return nullptr;
     std::vector<paramNode> params;
     
     if (!check(TokenType::RPAREN)) {
         do {
             // Parameter type
-            if (!match({TokenType::INT, TokenType::DOUBLE, TokenType::CHAR, 
-                       TokenType::BOOLEAN, TokenType::STRING})) {
-                throw astError("Expected parameter type");
+            astVarType paramType;
+            if (!matchType(paramType)) {
+                fail(peek(), "Expected parameter type");
             }
-            astVarType paramType = tokenTypeToVarType(previous().type);
+            if (failed_) return nullptr;
             
             // Parameter name
-            Token paramName = consume(TokenType::IDENTIFIER, "Expected parameter name");
-            params.emplace_back(paramType, paramName.lexme);
+            const compactToken& paramTok = consume(TokenType::IDENTIFIER, "Expected parameter name");
+            if (failed_) return nullptr;
+            params.emplace_back(paramType, symbolOf(paramTok));
             
         } while (match(TokenType::COMMA));
     }
     
     consume(TokenType::RPAREN, "Expected ')' after parameters");
+    if (failed_) return nullptr;
     
     // Function body
     auto body = parseBody();
+    if (failed_) return nullptr;
     
-    return std::make_unique<functionNode>(returnType, name, std::move(params), std::move(body));
+    return makeNode<functionNode>(returnType, name, std::move(params), std::move(body));
 }
 
 // Parse variable declaration
-std::unique_ptr<varDeclNode> AST::parseVarDeclaration() {
-    Token typeToken = previous();
-    astVarType varType = tokenTypeToVarType(typeToken.type);
-    
-    Token nameToken = consume(TokenType::IDENTIFIER, "Expected variable name");
-    std::string name = nameToken.lexme;
+nodePtr<varDeclNode> AST::parseVarDeclaration(astVarType varType) {
+    const compactToken& nameTok = consume(TokenType::IDENTIFIER, "Expected variable name");
+    if (failed_) return nullptr;
+    symbol name = symbolOf(nameTok);
     
-    std::unique_ptr<expressionNode> initializer = nullptr;
+    nodePtr<expressionNode> initializer = nullptr;
     if (match(TokenType::ASSIGN)) {
         initializer = parseExpression();
+        if (failed_) return nullptr;
     }
     
     consume(TokenType::SEMICOLON, "Expected ';' after variable declaration");
+    if (failed_) return nullptr;
     
-    return std::make_unique<varDeclNode>(varType, name, std::move(initializer));
+    return makeNode<varDeclNode>(varType, name, std::move(initializer));
 }
 
 // Parse statement
-std::unique_ptr<astNode> AST::parseStatement() {
+nodePtr<astNode> AST::parseStatement() {
     if (match(TokenType::IF)) {
         return parseIfStatement();
     }
@@ -248,300 +522,465 @@ std::unique_ptr<astNode> AST::parseStatement() {
     
     if (match(TokenType::BREAK)) {
         consume(TokenType::SEMICOLON, "Expected ';' after break");
-        return std::make_unique<breakNode>();
+        if (failed_) return nullptr;
+        return makeNode<breakNode>();
     }
     
     if (match(TokenType::CONTINUE)) {
         consume(TokenType::SEMICOLON, "Expected ';' after continue");
-        return std::make_unique<continueNode>();
+        if (failed_) return nullptr;
+        return makeNode<continueNode>();
     }
     
     if (check(TokenType::LBRACE)) {
-        auto body = parseBody();
-        return body;
+        return parseBody();
     }
     
     // Expression statement
     auto expr = parseExpression();
+    if (failed_) return nullptr;
     consume(TokenType::SEMICOLON, "Expected ';' after expression");
+    if (failed_) return nullptr;
     return expr;
 }
 
 // Parse if statement
-std::unique_ptr<ifNode> AST::parseIfStatement() {
+nodePtr<ifNode> AST::parseIfStatement() {
     consume(TokenType::LPAREN, "Expected '(' after 'if'");
+    if (failed_) return nullptr;
     auto condition = parseExpression();
+    if (failed_) return nullptr;
     consume(TokenType::RPAREN, "Expected ')' after condition");
+    if (failed_) return nullptr;
     
     auto thenBranch = parseStatement();
-    std::unique_ptr<astNode> elseBranch = nullptr;
+    if (failed_) return nullptr;
+    nodePtr<astNode> elseBranch = nullptr;
     
     if (match(TokenType::ELSE)) {
         elseBranch = parseStatement();
+        if (failed_) return nullptr;
     }
     
-    return std::make_unique<ifNode>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
+    return makeNode<ifNode>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
 }
 
 // Parse while statement
-std::unique_ptr<whileNode> AST::parseWhileStatement() {
+nodePtr<whileNode> AST::parseWhileStatement() {
     consume(TokenType::LPAREN, "Expected '(' after 'while'");
+    if (failed_) return nullptr;
     auto condition = parseExpression();
+    if (failed_) return nullptr;
     consume(TokenType::RPAREN, "Expected ')' after condition");
+    if (failed_) return nullptr;
     auto body = parseBody();
+    if (failed_) return nullptr;
     consume(TokenType::SEMICOLON, "Expected ';' after while body");
-    return std::make_unique<whileNode>(std::move(condition), std::move(body));
+    if (failed_) return nullptr;
+    return makeNode<whileNode>(std::move(condition), std::move(body));
 }
 
 // Parse for statement
-std::unique_ptr<forNode> AST::parseForStatement() {
+nodePtr<forNode> AST::parseForStatement() {
     consume(TokenType::LPAREN, "Expected '(' after 'for'");
+    if (failed_) return nullptr;
 
     // Initializer
-    std::unique_ptr<astNode> initializer;
+    nodePtr<astNode> initializer;
+    astVarType varType;
     if (match(TokenType::SEMICOLON)) {
         initializer = nullptr;
-    } else if (match({TokenType::INT, TokenType::DOUBLE, TokenType::CHAR, 
-                      TokenType::BOOLEAN, TokenType::STRING})) {
-        initializer = parseVarDeclaration();
+    } else if (matchType(varType)) {
+        if (failed_) return nullptr;
+        initializer = parseVarDeclaration(varType);
         // parseVarDeclaration already consumed the semicolon
     } else {
         auto expr = parseExpression();
+        if (failed_) return nullptr;
         consume(TokenType::SEMICOLON, "Expected ';' after for initializer");
         initializer = std::move(expr);
     }
+    if (failed_) return nullptr;
 
     // Condition
-    std::unique_ptr<expressionNode> condition = nullptr;
+    nodePtr<expressionNode> condition = nullptr;
     if (!check(TokenType::SEMICOLON)) {
         condition = parseExpression();
+        if (failed_) return nullptr;
     }
     consume(TokenType::SEMICOLON, "Expected ';' after for condition");
+    if (failed_) return nullptr;
 
     // Increment
-    std::unique_ptr<expressionNode> increment = nullptr;
+    nodePtr<expressionNode> increment = nullptr;
     if (!check(TokenType::RPAREN)) {
         increment = parseExpression();
+        if (failed_) return nullptr;
     }
     consume(TokenType::RPAREN, "Expected ')' after for clauses");
+    if (failed_) return nullptr;
 
     auto body = parseBody();
+    if (failed_) return nullptr;
     consume(TokenType::SEMICOLON, "Expected ';' after for body");
+    if (failed_) return nullptr;
 
-    return std::make_unique<forNode>(std::move(initializer), std::move(condition), std::move(increment), std::move(body));
+    return makeNode<forNode>(std::move(initializer), std::move(condition), std::move(increment), std::move(body));
 }
 
 // Parse return statement
-std::unique_ptr<returnNode> AST::parseReturnStatement() {
-    std::unique_ptr<expressionNode> value = nullptr;
+nodePtr<returnNode> AST::parseReturnStatement() {
+    nodePtr<expressionNode> value = nullptr;
     
     if (!check(TokenType::SEMICOLON)) {
         value = parseExpression();
+        if (failed_) return nullptr;
     }
     
     consume(TokenType::SEMICOLON, "Expected ';' after return statement");
-    return std::make_unique<returnNode>(std::move(value));
+    if (failed_) return nullptr;
+    return makeNode<returnNode>(std::move(value));
 }
 
 // Parse body (block of statements)
-std::unique_ptr<bodyNode> AST::parseBody() {
+nodePtr<bodyNode> AST::parseBody() {
     consume(TokenType::LBRACE, "Expected '{'");
+    if (failed_) return nullptr;
     
-    std::vector<std::unique_ptr<astNode>> statements;
+    std::vector<nodePtr<astNode>> statements;
     
     while (!check(TokenType::RBRACE) && !isAtEnd()) {
         if (match(TokenType::SEMICOLON)) continue;
         auto stmt = parseDeclaration();
+        if (failed_) return nullptr;
         if (stmt) {
             statements.push_back(std::move(stmt));
         }
     }
     
     consume(TokenType::RBRACE, "Expected '}'");
+    if (failed_) return nullptr;
     
-    return std::make_unique<bodyNode>(std::move(statements));
+    return makeNode<bodyNode>(std::move(statements));
 }
 
 // Parse expression (entry point for expression parsing)
-std::unique_ptr<expressionNode> AST::parseExpression() {
-    return parseAssignment();
-}
-
-// Parse assignment
-std::unique_ptr<expressionNode> AST::parseAssignment() {
-    auto expr = parseLogicalOr();
-    
-    if (match({TokenType::ASSIGN, TokenType::ASSIGN_ADD, TokenType::ASSIGN_SUB,
-                TokenType::ASSIGN_MUL, TokenType::ASSIGN_DIV, TokenType::ASSIGN_MOD})) {
-        std::string op = previous().lexme;
-        auto value = parseAssignment();
-        if (expr->type == astNodeType::VARIABLE) {
-            variableNode* varNode = dynamic_cast<variableNode*>(expr.get());
-            std::string name = varNode->name;
-            return std::make_unique<assignOpNode>(name, std::move(value), op);
-        }
-        throw astError("Invalid assignment target");
-    }
+// Binding powers of the infix operators, higher binds tighter. Every level is
+// left associative except assignment, which groups to the right.
+enum bindingPower : uint8_t {
+    BP_NONE, // not an infix operator, the expression ends before it
+    BP_ASSIGN, // = += -= *= /= %=
+    BP_OR, // |
+    BP_AND, // &
+    BP_EQUALITY, // == !=
+    BP_COMPARISON, // < > <= >=
+    BP_ADDITION, // + -
+    BP_MULTIPLICATION, // * / %
+    BP_PREFIX, // ! - ~ ++ -- in front of an operand
+};
 
-    return expr;
-}
-
-// Parse logical OR
-std::unique_ptr<expressionNode> AST::parseLogicalOr() {
-    auto expr = parseLogicalAnd();
-    
-    while (match(TokenType::OR)) {
-        std::string op = previous().lexme;
-        auto right = parseLogicalAnd();
-        expr = std::make_unique<binaryOpNode>(op, std::move(expr), std::move(right));
+static constexpr std::array<uint8_t, (size_t)TokenType::TOKEN_TYPE_COUNT> infixPower = [] {
+    std::array<uint8_t, (size_t)TokenType::TOKEN_TYPE_COUNT> power{};
+    for (TokenType type : { TokenType::ASSIGN, TokenType::ASSIGN_ADD, TokenType::ASSIGN_SUB,
+                            TokenType::ASSIGN_MUL, TokenType::ASSIGN_DIV, TokenType::ASSIGN_MOD }) {
+        power[(size_t)type] = BP_ASSIGN;
     }
-    
-    return expr;
-}
-
-// Parse logical AND
-std::unique_ptr<expressionNode> AST::parseLogicalAnd() {
-    auto expr = parseEquality();
-    
-    while (match(TokenType::AND)) {
-        std::string op = previous().lexme;
-        auto right = parseEquality();
-        expr = std::make_unique<binaryOpNode>(op, std::move(expr), std::move(right));
+    power[(size_t)TokenType::OR] = BP_OR;
+    power[(size_t)TokenType::AND] = BP_AND;
+    power[(size_t)TokenType::EQUAL] = BP_EQUALITY;
+    power[(size_t)TokenType::NOTEQUAL] = BP_EQUALITY;
+    for (TokenType type : { TokenType::LESSTHAN, TokenType::MORETHAN, TokenType::LESSTHANEQUAL, TokenType::MORETHANEQUAL }) {
+        power[(size_t)type] = BP_COMPARISON;
     }
-    
-    return expr;
-}
+    power[(size_t)TokenType::ADD] = BP_ADDITION;
+    power[(size_t)TokenType::SUB] = BP_ADDITION;
+    power[(size_t)TokenType::MUL] = BP_MULTIPLICATION;
+    power[(size_t)TokenType::DIV] = BP_MULTIPLICATION;
+    power[(size_t)TokenType::MOD] = BP_MULTIPLICATION;
+    return power;
+}();
 
-// Parse equality (== and !=)
-std::unique_ptr<expressionNode> AST::parseEquality() {
-    auto expr = parseComparison();
-    
-    while (match({TokenType::EQUAL, TokenType::NOTEQUAL})) {
-        std::string op = previous().lexme;
-        auto right = parseComparison();
-        expr = std::make_unique<binaryOpNode>(op, std::move(expr), std::move(right));
+static bool isPrefixOp(TokenType type) {
+    switch (type) {
+        case TokenType::NOT: case TokenType::SUB: case TokenType::INVERT:
+        case TokenType::INCREMENT: case TokenType::DECREMENT:
+            return true;
+        default:
+            return false;
     }
-    
-    return expr;
 }
 
-// Parse comparison (<, >, <=, >=)
-std::unique_ptr<expressionNode> AST::parseComparison() {
-    auto expr = parseAddition();
-    
-    while (match({TokenType::LESSTHAN, TokenType::MORETHAN, 
-                  TokenType::LESSTHANEQUAL, TokenType::MORETHANEQUAL})) {
-        std::string op = previous().lexme;
-        auto right = parseAddition();
-        expr = std::make_unique<binaryOpNode>(op, std::move(expr), std::move(right));
+// Operator precedence parsing over explicit stacks. The operands and pending
+// operators of every expression being parsed share operands_ and operators_, each
+// parse working above the sizes it found on entry. Parentheses are pending entries
+// too, so deep nesting and long prefix or assignment chains take no native stack;
+// only call arguments, indices, list elements and interpolations parse recursively.
+nodePtr<expressionNode> AST::parseExpression() {
+    struct frame {
+        AST& ast;
+        size_t operandBase, operatorBase;
+        ~frame() {
+            ast.operands_.resize(operandBase); // left over when a parse error returns early
+            ast.operators_.resize(operatorBase);
+            ast.nesting_--;
+        }
+    } scope{ *this, operands_.size(), operators_.size() };
+    if (++nesting_ > MAX_NESTING) {
+        const compactToken& current = peek();
+        fail(current, "Expression nested too deeply at line " + std::to_string(current.line) +
+                      ", column " + std::to_string(current.column));
+        return nullptr;
     }
-    
-    return expr;
-}
 
-// Parse addition and subtraction
-std::unique_ptr<expressionNode> AST::parseAddition() {
-    auto expr = parseMultiplication();
-    
-    while (match({TokenType::ADD, TokenType::SUB})) {
-        std::string op = previous().lexme;
-        auto right = parseMultiplication();
-        expr = std::make_unique<binaryOpNode>(op, std::move(expr), std::move(right));
+    size_t groups = 0; // open parentheses
+    for (;;) {
+        // Operand: any prefix operators and opening parentheses come first
+        TokenType type = isAtEnd() ? TokenType::UNKNOWN : peek().type;
+        while (isPrefixOp(type) || type == TokenType::LPAREN) {
+            advance();
+            if (type == TokenType::LPAREN) {
+                operators_.push_back({ opKind::UNKNOWN, BP_NONE });
+                groups++;
+            } else {
+                operators_.push_back({ tokenTypeToOp(type), BP_PREFIX });
+            }
+            type = isAtEnd() ? TokenType::UNKNOWN : peek().type;
+        }
+        nodePtr<expressionNode> operand = parsePrimary();
+        if (failed_) return nullptr;
+        operands_.push_back(parsePostfix(std::move(operand)));
+        if (failed_) return nullptr;
+
+        // Closing parentheses, a group takes postfix operators like any operand
+        type = isAtEnd() ? TokenType::UNKNOWN : peek().type;
+        while (groups && type == TokenType::RPAREN) {
+            advance();
+            reduce(scope.operatorBase, BP_ASSIGN);
+            if (failed_) return nullptr;
+            operators_.pop_back();
+            groups--;
+            operands_.back() = parsePostfix(std::move(operands_.back()));
+            if (failed_) return nullptr;
+            type = isAtEnd() ? TokenType::UNKNOWN : peek().type;
+        }
+
+        uint8_t power = infixPower[(size_t)type];
+        if (power == BP_NONE) break;
+        // Equal powers group to the left, so they are applied first, except assignment
+        reduce(scope.operatorBase, power == BP_ASSIGN ? BP_ASSIGN + 1 : power);
+        if (failed_) return nullptr;
+        advance();
+        operators_.push_back({ tokenTypeToOp(type), power });
     }
-    
+    if (groups) consume(TokenType::RPAREN, "Expected ')' after expression");
+    if (failed_) return nullptr;
+
+    reduce(scope.operatorBase, BP_ASSIGN);
+    if (failed_) return nullptr;
+    nodePtr<expressionNode> expr = std::move(operands_.back());
+    operands_.pop_back();
     return expr;
 }
 
-// Parse multiplication, division, and modulo
-std::unique_ptr<expressionNode> AST::parseMultiplication() {
-    auto expr = parseUnary();
-    
-    while (match({TokenType::MUL, TokenType::DIV, TokenType::MOD})) {
-        std::string op = previous().lexme;
-        auto right = parseUnary();
-        expr = std::make_unique<binaryOpNode>(op, std::move(expr), std::move(right));
+void AST::reduce(size_t base, uint8_t minPower) {
+    while (operators_.size() > base) {
+        pendingOp top = operators_.back();
+        if (top.power == BP_NONE || top.power < minPower) return;
+        operators_.pop_back();
+        nodePtr<expressionNode> right = std::move(operands_.back());
+        operands_.pop_back();
+        if (top.power == BP_PREFIX) {
+            operands_.push_back(makeNode<unaryOpNode>(top.op, std::move(right)));
+            continue;
+        }
+        nodePtr<expressionNode>& left = operands_.back();
+        if (top.power == BP_ASSIGN) {
+            left = makeAssignment(std::move(left), std::move(right), top.op);
+            if (failed_) return;
+        } else {
+            left = makeNode<binaryOpNode>(top.op, std::move(left), std::move(right));
+        }
     }
-    
-    return expr;
 }
 
-// Parse unary expressions (!, -, ~)
-std::unique_ptr<expressionNode> AST::parseUnary() {
-    if (match({TokenType::NOT, TokenType::SUB, TokenType::INVERT,
-                TokenType::INCREMENT, TokenType::DECREMENT})) {
-        std::string op = previous().lexme;
-        auto right = parseUnary();
-        return std::make_unique<unaryOpNode>(op, std::move(right));
+nodePtr<expressionNode> AST::makeAssignment(nodePtr<expressionNode> target, nodePtr<expressionNode> value, opKind op) {
+    if (target->type == astNodeType::VARIABLE) {
+        variableNode* varNode = static_cast<variableNode*>(target.get());
+        return makeNode<assignOpNode>(varNode->name, std::move(value), op);
     }
-
-    return parseCall();
+    // Element assignment, only to a list held by a variable
+    if (target->type == astNodeType::INDEX) {
+        indexNode* element = static_cast<indexNode*>(target.get());
+        if (element->list->type == astNodeType::VARIABLE) {
+            symbol name = static_cast<variableNode*>(element->list.get())->name;
+            return makeNode<assignOpNode>(name, std::move(value), op, std::move(element->index));
+        }
+    }
+    fail(previous(), "Invalid assignment target");
+    return nullptr;
 }
 
-// Parse function calls and primary expressions
-std::unique_ptr<expressionNode> AST::parseCall() {
-    auto expr = parsePrimary();
-    
+nodePtr<expressionNode> AST::parsePostfix(nodePtr<expressionNode> expr) {
     // Function call
     if (check(TokenType::LPAREN) && expr->type == astNodeType::VARIABLE) {
         advance(); // consume '('
         
-        variableNode* varNode = dynamic_cast<variableNode*>(expr.get());
-        std::string funcName = varNode->name;
+        symbol funcName = static_cast<variableNode*>(expr.get())->name;
         
-        std::vector<std::unique_ptr<expressionNode>> args;
+        std::vector<nodePtr<expressionNode>> args;
         
         if (!check(TokenType::RPAREN)) {
             do {
                 args.push_back(parseExpression());
+                if (failed_) return nullptr;
             } while (match(TokenType::COMMA));
         }
         
         consume(TokenType::RPAREN, "Expected ')' after function arguments");
+        if (failed_) return nullptr;
         
-        return std::make_unique<fnCallNode>(funcName, std::move(args));
+        expr = makeNode<fnCallNode>(funcName, std::move(args));
+    }
+
+    // Indexing: a[i], f()[i]
+    while (match(TokenType::LBRACK)) {
+        auto index = parseExpression();
+        if (failed_) return nullptr;
+        consume(TokenType::RBRACK, "Expected ']' after index");
+        if (failed_) return nullptr;
+        expr = makeNode<indexNode>(std::move(expr), std::move(index));
     }
     
     while (match({TokenType::INCREMENT, TokenType::DECREMENT})) {
-        std::string op = previous().lexme;
-        expr = std::make_unique<unaryOpNode>(op + "_postfix", std::move(expr));
+        opKind op = tokenTypeToOp(previous().type, true);
+        expr = makeNode<unaryOpNode>(op, std::move(expr));
     }
     
     return expr;
 }
 
-// Parse primary expressions (literals, variables, grouped expressions)
-std::unique_ptr<expressionNode> AST::parsePrimary() {
+// Start of the next ${ in raw string text at or after from, npos if there is none.
+// Escaped characters are skipped, so \${ stays literal.
+static size_t findInterpolation(std::string_view raw, size_t from) {
+    for (size_t i = from; i + 1 < raw.size(); i++) {
+        if (raw[i] == '\\') i++;
+        else if (raw[i] == '$' && raw[i + 1] == '{') return i;
+    }
+    return std::string_view::npos;
+}
+
+nodePtr<expressionNode> AST::parseString(compactToken tok) {
+    std::string_view raw = text(tok);
+    size_t open = findInterpolation(raw, 0);
+    if (open == std::string_view::npos) return makeNode<stringLiteralNode>(std::string(raw));
+
+    std::string where = tok.line > 0
+        ? " at line " + std::to_string(tok.line) + ", column " + std::to_string(tok.column)
+        : std::string();
+    std::vector<std::string> segments;
+    std::vector<nodePtr<expressionNode>> parts;
+    size_t start = 0;
+    while (open != std::string_view::npos) {
+        segments.push_back(decodeEscapes(raw.substr(start, open - start)));
+        size_t close = raw.find('}', open + 2);
+        if (close == std::string_view::npos) {
+            fail(tok, "Unterminated '${' in string" + where);
+            return nullptr;
+        }
+        std::string_view expr = raw.substr(open + 2, close - open - 2);
+        if (expr.find_first_not_of(" \t\r\n") == std::string_view::npos) {
+            fail(tok, "Empty '${}' in string" + where);
+            return nullptr;
+        }
+
+        // Parse the expression from its own tokens into a list of its own, then pick up
+        // where we left off. The first error inside becomes one error on the string.
+        const char* source = source_;
+        const compactToken* tokens = tokens_;
+        size_t tokenCount = tokenCount_, current = current_;
+        lexer* stream = stream_;
+        compactToken prev = prev_;
+        diagnosticEngine* diagnostics = diagnostics_;
+        sourceBuffer buffer;
+        buffer.assign(std::string(expr));
+        lexer sub(std::move(buffer), "<interpolation>", tokenFlow::EAGER, 1);
+        source_ = sub.sourceData();
+        tokens_ = sub.getCompactTokens().data();
+        tokenCount_ = sub.getCompactTokens().size();
+        current_ = 0;
+        stream_ = nullptr;
+        diagnostics_ = &sub.diagnostics();
+        if (!sub.diagnostics().empty()) {
+            failed_ = true;
+        } else {
+            parts.push_back(parseExpression());
+            if (!failed_ && !isAtEnd()) fail(peek(), "Unexpected '" + std::string(text(peek())) + "'");
+        }
+        std::string inner = failed_ ? sub.diagnostics().entries().front().message : std::string();
+        source_ = source;
+        tokens_ = tokens;
+        tokenCount_ = tokenCount;
+        current_ = current;
+        stream_ = stream;
+        prev_ = prev;
+        diagnostics_ = diagnostics;
+        if (failed_) {
+            fail(tok, "In '${" + std::string(expr) + "}'" + where + ": " + inner);
+            return nullptr;
+        }
+
+        start = close + 1;
+        open = findInterpolation(raw, start);
+    }
+    segments.push_back(decodeEscapes(raw.substr(start)));
+    return makeNode<interpStringNode>(std::move(segments), std::move(parts));
+}
+
+// Parse primary expressions (literals, variables, lists), parentheses are handled by parseExpression
+nodePtr<expressionNode> AST::parsePrimary() {
     // String literal
     if (match(TokenType::STRING)) {
-        std::string value = previous().lexme;
-        return std::make_unique<stringLiteralNode>(value);
+        return parseString(previous());
     }
 
     // Boolean literals
     if (check(TokenType::IDENTIFIER)) {
-        Token t = peek();
-        if (t.lexme == "true" || t.lexme == "false") {
+        std::string_view word = text(peek());
+        if (word == "true" || word == "false") {
             advance();
-            bool value = (t.lexme == "true");
-            return std::make_unique<booleanLiteralNode>(value);
+            bool value = (word == "true");
+            return makeNode<booleanLiteralNode>(value);
         }
     }
     
     // Number literal
     if (match(TokenType::LITERAL)) {
-        std::string value = previous().lexme;
+        const compactToken& tok = previous();
+        std::string_view value = text(tok);
+        const char* end = value.data() + value.size();
         
         // Check if it's a double (contains '.')
-        if (value.find('.') != std::string::npos) {
-            return std::make_unique<doubleLiteralNode>(std::stod(value));
+        std::from_chars_result parsed;
+        nodePtr<expressionNode> literal;
+        if (value.find('.') != std::string_view::npos) {
+            double number = 0;
+            parsed = std::from_chars(value.data(), end, number);
+            literal = makeNode<doubleLiteralNode>(number);
         } else {
-            return std::make_unique<intLiteralNode>(std::stoi(value));
+            int number = 0;
+            parsed = std::from_chars(value.data(), end, number);
+            literal = makeNode<intLiteralNode>(number);
         }
+        if (parsed.ec == std::errc::result_out_of_range) {
+            error(tok, "Number out of range");
+            return nullptr;
+        }
+        return literal;
     }
     
     // Character literal
     if (match(TokenType::CHAR)) {
-        std::string charStr = previous().lexme;
+        std::string_view charStr = text(previous());
         char value = charStr.empty() ? '\0' : charStr[0];
         
         // Handle escape sequences
@@ -557,46 +996,80 @@ std::unique_ptr<expressionNode> AST::parsePrimary() {
             }
         }
         
-        return std::make_unique<charLiteralNode>(value);
+        return makeNode<charLiteralNode>(value);
     }
     
     // Variable reference
     if (match(TokenType::IDENTIFIER)) {
-        std::string name = previous().lexme;
-        return std::make_unique<variableNode>(name);
+        return makeNode<variableNode>(symbolOf(previous()));
     }
     
-    // Grouped expression
-    if (match(TokenType::LPAREN)) {
-        auto expr = parseExpression();
-        consume(TokenType::RPAREN, "Expected ')' after expression");
-        return expr;
+    // List literal: [a, b, c]
+    if (match(TokenType::LBRACK)) {
+        std::vector<nodePtr<expressionNode>> elements;
+        if (!check(TokenType::RBRACK)) {
+            do {
+                elements.push_back(parseExpression());
+                if (failed_) return nullptr;
+            } while (match(TokenType::COMMA));
+        }
+        consume(TokenType::RBRACK, "Expected ']' after list elements");
+        if (failed_) return nullptr;
+        return makeNode<listNode>(astVarType::INFERRED, std::move(elements));
     }
-    
-    Token current = peek();
-    throw astError("Expected expression at line " + std::to_string(current.line) + 
-                   ", column " + std::to_string(current.column) + 
-                   " (found '" + current.lexme + "')");
+
+    // Sized list: list<int>(n)
+    if (match(TokenType::LIST)) {
+        astVarType listType = parseListType();
+        if (failed_) return nullptr;
+        consume(TokenType::LPAREN, "Expected '(' after list type");
+        if (failed_) return nullptr;
+        auto length = parseExpression();
+        if (failed_) return nullptr;
+        consume(TokenType::RPAREN, "Expected ')' after list length");
+        if (failed_) return nullptr;
+        return makeNode<listNode>(listType, std::vector<nodePtr<expressionNode>>{}, std::move(length));
+    }
+
+    error(peek(), "Expected expression");
+    return nullptr;
+}
+
+void AST::optimize() {
+    if (root_) foldConstants(*root_, arena_);
 }
 
 // Print the AST
 void AST::print() const {
+    print(std::cout);
+}
+
+void AST::print(std::ostream& out) const {
     if (root_) {
-        std::cout << "=== Abstract Syntax Tree ===\n";
-        root_->print(0);
-        std::cout << "============================\n";
+        out << "=== Abstract Syntax Tree ===\n";
+        astPrinter(out).visit(root_.get());
+        out << "============================\n";
     } else {
-        std::cout << "AST is empty (not built yet)\n";
+        out << "AST is empty (not built yet)\n";
     }
 }
 
-// Generate code (placeholder for now)
-void AST::generateCode() const {
+void AST::printJSON(std::ostream& out) const {
     if (root_) {
-        std::cout << "=== Code Generation ===\n";
-        root_->generateASM();
-        std::cout << "=======================\n";
+        astJsonPrinter(out).visit(root_.get());
     } else {
-        std::cout << "Cannot generate code: AST is empty\n";
+        out << "null";
+    }
+}
+
+// Generate native code through the bytecode, which does the type checking
+void AST::generateCode(std::ostream& out, const std::vector<const programNode*>& imports) const {
+    if (!root_) throw astError("Cannot generate code: AST is empty");
+    bcProgram program;
+    {
+        phaseTimer timer("bytecode");
+        program = compileBytecode(*root_, imports);
     }
+    phaseTimer timer("codegen");
+    codeGenerator(out).generate(program);
 }
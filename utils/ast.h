@@ -2,6 +2,8 @@
 #define AST_H
 
 #include "lexer.h"
+#include "arena.h"
+#include "diagnostics.h"
 #include <memory>
 #include <string>
 #include <vector>
@@ -18,10 +20,11 @@ public:
     }
 };
 
-enum class astNodeType {
+enum class astNodeType : uint8_t {
     GENERIC = 0,
         EXPRESSION,
             LITERAL,
+                STRING,
                 INT,
                 DOUBLE,
                 CHAR,
@@ -31,7 +34,11 @@ enum class astNodeType {
             BINARYOP,
             ASSIGNOP,
             FNCALL,
+            INDEX,
+            LIST,
+            INTERP,
         STATEMENT,
+            IMPORT,
             IF,
                 CONDITION,
             LOOP,
@@ -47,15 +54,59 @@ enum class astNodeType {
         PROGRAM,
 };
 
+// Operators carried by unaryOpNode, binaryOpNode and assignOpNode
+enum class opKind : uint8_t {
+    ADD, // +
+    SUB, // - (binary) or negation (unary)
+    MUL, // *
+    DIV, // /
+    MOD, // %
+    LESSTHAN, // <
+    MORETHAN, // >
+    LESSTHANEQUAL, // <=
+    MORETHANEQUAL, // >=
+    EQUAL, // ==
+    NOTEQUAL, // !=
+    AND, // &
+    OR, // |
+    NOT, // !
+    INVERT, // ~
+    PRE_INCREMENT, // ++x
+    PRE_DECREMENT, // --x
+    POST_INCREMENT, // x++
+    POST_DECREMENT, // x--
+    ASSIGN, // =
+    ASSIGN_ADD, // +=
+    ASSIGN_SUB, // -=
+    ASSIGN_MUL, // *=
+    ASSIGN_DIV, // /=
+    ASSIGN_MOD, // %=
+    UNKNOWN,
+};
+
+// Maps an operator token to its opKind, postfix selects x++ / x-- over ++x / --x
+opKind tokenTypeToOp(TokenType type, bool postfix = false);
+std::string_view opToString(opKind op);
+
+inline std::ostream& operator<<(std::ostream& out, opKind op) {
+    return out << opToString(op);
+}
+
 // Forward declarations
 class AST;
+struct functionNode;
+
+// Resolved variable location, see interp.h. Unresolved until a resolver runs.
+constexpr uint32_t NO_SLOT = 0xFFFFFFFFu;
 
 struct astNode {
     virtual ~astNode() = default;
     astNodeType type = astNodeType::GENERIC;
-    virtual void print(int indent = 0) const = 0;
-    virtual void generateASM() const = 0;
     virtual std::string describe() const = 0;
+
+    // Debug dump through astPrinter, see printer.h
+    void print(int indent = 0) const;
+    void print(std::ostream& out, int indent) const;
 };
 
 struct expressionNode : astNode {
@@ -67,58 +118,39 @@ struct literalNode : expressionNode {
 };
 
 struct stringLiteralNode : literalNode {
-    std::string value;
-    explicit stringLiteralNode(std::string v) : value(std::move(v)) {
-        type = astNodeType::LITERAL;
+    std::string value; // as written, escapes included
+    std::string text; // value with its escapes decoded, what the program sees at runtime
+    explicit stringLiteralNode(std::string v) : value(std::move(v)), text(decodeEscapes(value)) {
+        type = astNodeType::STRING;
     }
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "string(\"" << value << "\")\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "STRING literal: " + value; }
 };
 
 struct intLiteralNode : literalNode {
     int value;
     explicit intLiteralNode(int v) : value(v) { type = astNodeType::INT; }
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "int(" << value << ")\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "INT literal: " + std::to_string(value); }
 };
 
 struct doubleLiteralNode : literalNode {
     double value;
     explicit doubleLiteralNode(double v) : value(v) { type = astNodeType::DOUBLE; }
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "double(" << value << ")\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "DOUBLE literal: " + std::to_string(value); }
 };
 
 struct charLiteralNode : literalNode {
     char value;
     explicit charLiteralNode(char v) : value(v) { type = astNodeType::CHAR; }
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "char('" << value << "')\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { return std::string("CHAR literal: '") + value + "'"; }
 };
 
 struct booleanLiteralNode : literalNode {
     bool value;
     explicit booleanLiteralNode(bool v) : value(v) { type = astNodeType::BOOL; }
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "bool(" << (value ? "true" : "false") << ")\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { return std::string("BOOL literal: ") + (value ? "true" : "false"); }
 };
 
-enum class astVarType {
+enum class astVarType : uint8_t {
     VOID,
     INT,
     DOUBLE,
@@ -126,99 +158,139 @@ enum class astVarType {
     CHAR,
     BOOLEAN,
     INFERRED,
+    INT_LIST, // list<int>
+    DOUBLE_LIST, // list<double>
 };
 
+inline bool isListType(astVarType t) {
+    return t == astVarType::INT_LIST || t == astVarType::DOUBLE_LIST;
+}
+
+// Element type of a list type, VOID for anything else
+inline astVarType elementType(astVarType t) {
+    switch (t) {
+        case astVarType::INT_LIST: return astVarType::INT;
+        case astVarType::DOUBLE_LIST: return astVarType::DOUBLE;
+        default: return astVarType::VOID;
+    }
+}
+
 struct variableNode : expressionNode {
-    std::string name;
+    symbol name;
     astVarType varType;
+    // Annotations, filled in after parsing
+    mutable uint32_t slot = NO_SLOT; // frame slot, or global slot (unique across modules) when global is set
+    mutable bool global = false;
+    mutable astVarType valueType = astVarType::INFERRED; // static type of the declaration
 
-    variableNode(std::string n, astVarType t = astVarType::INFERRED)
-        : name(std::move(n)), varType(t) {
+    variableNode(symbol n, astVarType t = astVarType::INFERRED)
+        : name(n), varType(t) {
         type = astNodeType::VARIABLE;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Variable(\"" << name << "\", type=" << (int)varType << ")\n";
-    }
-    void generateASM() const override {}
-    std::string describe() const override { return "Variable: " + name; }
+    std::string describe() const override { return "Variable: " + std::string(name.str()); }
 };
 
 struct unaryOpNode : expressionNode {
-    std::string op;
-    std::unique_ptr<expressionNode> operand;
+    opKind op;
+    nodePtr<expressionNode> operand;
 
-    unaryOpNode(std::string o, std::unique_ptr<expressionNode> expr)
-        : op(std::move(o)), operand(std::move(expr)) {
+    unaryOpNode(opKind o, nodePtr<expressionNode> expr)
+        : op(o), operand(std::move(expr)) {
         type = astNodeType::UNARYOP;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "UnaryOp(" << op << ")\n";
-        if (operand) operand->print(indent + 2);
-    }
-    void generateASM() const override {}
-    std::string describe() const override { return "Unary operation: " + op; }
+    std::string describe() const override { return "Unary operation: " + std::string(opToString(op)); }
 };
 
 struct binaryOpNode : expressionNode {
-    std::string op;
-    std::unique_ptr<expressionNode> left;
-    std::unique_ptr<expressionNode> right;
+    opKind op;
+    nodePtr<expressionNode> left;
+    nodePtr<expressionNode> right;
 
-    binaryOpNode(std::string o, std::unique_ptr<expressionNode> l, std::unique_ptr<expressionNode> r)
-        : op(std::move(o)), left(std::move(l)), right(std::move(r)) {
+    binaryOpNode(opKind o, nodePtr<expressionNode> l, nodePtr<expressionNode> r)
+        : op(o), left(std::move(l)), right(std::move(r)) {
         type = astNodeType::BINARYOP;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "BinaryOp(" << op << ")\n";
-        if (left) left->print(indent + 2);
-        if (right) right->print(indent + 2);
-    }
-    void generateASM() const override {}
-    std::string describe() const override { return "Binary operation: " + op; }
+    std::string describe() const override { return "Binary operation: " + std::string(opToString(op)); }
 };
 
 struct assignOpNode : expressionNode {
-    std::string targetName;
-    std::unique_ptr<expressionNode> value;
-    std::string op; // e.g. '=', '+=', '-=', etc.
-
-    assignOpNode(std::string t, std::unique_ptr<expressionNode> v, std::string o = "=")
-        : targetName(std::move(t)), value(std::move(v)), op(std::move(o)) {
+    symbol targetName;
+    nodePtr<expressionNode> value;
+    opKind op; // e.g. '=', '+=', '-=', etc.
+    nodePtr<expressionNode> index; // set for element assignment, targetName[index] = value
+    mutable uint32_t slot = NO_SLOT; // of targetName, as in variableNode
+    mutable bool global = false;
+    // Of targetName, also the result type unless index is set, then it's the element type
+    mutable astVarType valueType = astVarType::INFERRED;
+
+    assignOpNode(symbol t, nodePtr<expressionNode> v, opKind o = opKind::ASSIGN, nodePtr<expressionNode> i = nullptr)
+        : targetName(t), value(std::move(v)), op(o), index(std::move(i)) {
         type = astNodeType::ASSIGNOP;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ')
-                  << "AssignOp(target=\"" << targetName << "\", op=\"" << op << "\")\n";
-        if (value) value->print(indent + 2);
-    }
-
-    void generateASM() const override {}
     std::string describe() const override { 
-        return "Assignment (" + op + ") to: " + targetName; 
+        return "Assignment (" + std::string(opToString(op)) + ") to: " + std::string(targetName.str()); 
     }
 };
 
 struct fnCallNode : expressionNode {
-    std::string name;
-    std::vector<std::unique_ptr<expressionNode>> args;
+    symbol name;
+    std::vector<nodePtr<expressionNode>> args;
+    mutable const functionNode* callee = nullptr; // null for builtins once resolved
 
-    fnCallNode(std::string n, std::vector<std::unique_ptr<expressionNode>> a = {})
-        : name(std::move(n)), args(std::move(a)) {
+    fnCallNode(symbol n, std::vector<nodePtr<expressionNode>> a = {})
+        : name(n), args(std::move(a)) {
         type = astNodeType::FNCALL;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "FnCall(\"" << name << "\")\n";
-        for (const auto &a : args) {
-            if (a) a->print(indent + 2);
-        }
+    std::string describe() const override { return "Function call: " + std::string(name.str()); }
+};
+
+// list[index], indices are checked against the length at runtime
+struct indexNode : expressionNode {
+    nodePtr<expressionNode> list;
+    nodePtr<expressionNode> index;
+
+    indexNode(nodePtr<expressionNode> l, nodePtr<expressionNode> i)
+        : list(std::move(l)), index(std::move(i)) {
+        type = astNodeType::INDEX;
     }
-    void generateASM() const override {}
-    std::string describe() const override { return "Function call: " + name; }
+
+    std::string describe() const override { return "Index"; }
+};
+
+// A new list: [a, b, c], or list<T>(length) filled with zeros when length is set.
+// Lists have a fixed length and are shared by reference.
+struct listNode : expressionNode {
+    astVarType varType; // INFERRED for [...], whose type comes from the elements or the target
+    std::vector<nodePtr<expressionNode>> elements;
+    nodePtr<expressionNode> length;
+    mutable astVarType valueType = astVarType::INFERRED; // static type, filled in after parsing
+
+    listNode(astVarType t, std::vector<nodePtr<expressionNode>> e, nodePtr<expressionNode> len = nullptr)
+        : varType(t), elements(std::move(e)), length(std::move(len)) {
+        type = astNodeType::LIST;
+    }
+
+    std::string describe() const override { return "List with " + std::to_string(elements.size()) + " element(s)"; }
+};
+
+// "a ${x} b", split at parse time into decoded literal segments around the
+// expressions. There is always one more segment than parts, empty ones included,
+// and the value is segments[0] + parts[0] + segments[1] + ... as strings.
+struct interpStringNode : expressionNode {
+    std::vector<std::string> segments;
+    std::vector<nodePtr<expressionNode>> parts;
+
+    interpStringNode(std::vector<std::string> s, std::vector<nodePtr<expressionNode>> p)
+        : segments(std::move(s)), parts(std::move(p)) {
+        type = astNodeType::INTERP;
+    }
+
+    std::string describe() const override { return "Interpolated string with " + std::to_string(parts.size()) + " part(s)"; }
 };
 
 struct statementNode : astNode {
@@ -228,35 +300,19 @@ struct statementNode : astNode {
 
 struct importNode : statementNode {
     std::string path;
-    explicit importNode(std::string p) : path(std::move(p)) { type = astNodeType::STATEMENT; }
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Import(" << path << ")\n";
-    }
-    void generateASM() const override {}
+    explicit importNode(std::string p) : path(std::move(p)) { type = astNodeType::IMPORT; }
     std::string describe() const override { return "Import: " + path; }
 };
 struct ifNode : statementNode {
-    std::unique_ptr<expressionNode> condition;
-    std::unique_ptr<astNode> thenBody;
-    std::unique_ptr<astNode> elseBody;
+    nodePtr<expressionNode> condition;
+    nodePtr<astNode> thenBody;
+    nodePtr<astNode> elseBody;
 
-    ifNode(std::unique_ptr<expressionNode> c, std::unique_ptr<astNode> t, std::unique_ptr<astNode> e = nullptr)
+    ifNode(nodePtr<expressionNode> c, nodePtr<astNode> t, nodePtr<astNode> e = nullptr)
         : condition(std::move(c)), thenBody(std::move(t)), elseBody(std::move(e)) {
         type = astNodeType::IF;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "IfStatement\n";
-        std::cout << std::string(indent + 2, ' ') << "Condition:\n";
-        if (condition) condition->print(indent + 4);
-        std::cout << std::string(indent + 2, ' ') << "Then:\n";
-        if (thenBody) thenBody->print(indent + 4);
-        if (elseBody) {
-            std::cout << std::string(indent + 2, ' ') << "Else:\n";
-            elseBody->print(indent + 4);
-        }
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "If statement"; }
 };
 
@@ -265,85 +321,52 @@ struct loopNode : statementNode {
 };
 
 struct forNode : loopNode {
-    std::unique_ptr<astNode> init;
-    std::unique_ptr<expressionNode> condition;
-    std::unique_ptr<expressionNode> increment;
-    std::unique_ptr<astNode> body;
+    nodePtr<astNode> init;
+    nodePtr<expressionNode> condition;
+    nodePtr<expressionNode> increment;
+    nodePtr<astNode> body;
 
-    forNode(std::unique_ptr<astNode> i, std::unique_ptr<expressionNode> c,
-            std::unique_ptr<expressionNode> inc, std::unique_ptr<astNode> b)
+    forNode(nodePtr<astNode> i, nodePtr<expressionNode> c,
+            nodePtr<expressionNode> inc, nodePtr<astNode> b)
         : init(std::move(i)), condition(std::move(c)), increment(std::move(inc)), body(std::move(b)) {
         type = astNodeType::FOR;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "ForLoop\n";
-        std::cout << std::string(indent + 2, ' ') << "Init:\n";
-        if (init) init->print(indent + 4);
-        std::cout << std::string(indent + 2, ' ') << "Condition:\n";
-        if (condition) condition->print(indent + 4);
-        std::cout << std::string(indent + 2, ' ') << "Increment:\n";
-        if (increment) increment->print(indent + 4);
-        std::cout << std::string(indent + 2, ' ') << "Body:\n";
-        if (body) body->print(indent + 4);
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "For loop"; }
 };
 
 struct whileNode : loopNode {
-    std::unique_ptr<expressionNode> condition;
-    std::unique_ptr<astNode> body;
+    nodePtr<expressionNode> condition;
+    nodePtr<astNode> body;
 
-    whileNode(std::unique_ptr<expressionNode> c, std::unique_ptr<astNode> b)
+    whileNode(nodePtr<expressionNode> c, nodePtr<astNode> b)
         : condition(std::move(c)), body(std::move(b)) {
         type = astNodeType::WHILE;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "WhileLoop\n";
-        std::cout << std::string(indent + 2, ' ') << "Condition:\n";
-        if (condition) condition->print(indent + 4);
-        std::cout << std::string(indent + 2, ' ') << "Body:\n";
-        if (body) body->print(indent + 4);
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "While loop"; }
 };
 
 struct returnNode : statementNode {
-    std::unique_ptr<expressionNode> value;
+    nodePtr<expressionNode> value;
 
-    explicit returnNode(std::unique_ptr<expressionNode> v = nullptr)
+    explicit returnNode(nodePtr<expressionNode> v = nullptr)
         : value(std::move(v)) {
         type = astNodeType::RETURN;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Return\n";
-        if (value) value->print(indent + 2);
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "Return statement"; }
 };
 
 struct breakNode : statementNode {
     breakNode() { type = astNodeType::BREAK; }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Break\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "Break statement"; }
 };
 
 struct continueNode : statementNode {
     continueNode() { type = astNodeType::CONTINUE; }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Continue\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { return "Continue statement"; }
 };
 
@@ -353,94 +376,64 @@ struct declarationNode : astNode {
 
 struct varDeclNode : declarationNode {
     astVarType varType;
-    std::string name;
-    std::unique_ptr<expressionNode> initializer;
+    symbol name;
+    nodePtr<expressionNode> initializer;
+    mutable uint32_t slot = NO_SLOT;
+    mutable bool global = false;
 
-    varDeclNode(astVarType t, std::string n, std::unique_ptr<expressionNode> init = nullptr)
-        : varType(t), name(std::move(n)), initializer(std::move(init)) {
+    varDeclNode(astVarType t, symbol n, nodePtr<expressionNode> init = nullptr)
+        : varType(t), name(n), initializer(std::move(init)) {
         type = astNodeType::VARDECL;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "VarDecl(\"" << name << "\", type=" << (int)varType << ")\n";
-        if (initializer) {
-            std::cout << std::string(indent + 2, ' ') << "Initializer:\n";
-            initializer->print(indent + 4);
-        }
-    }
-    void generateASM() const override {}
-    std::string describe() const override { return "Variable declaration: " + name; }
+    std::string describe() const override { return "Variable declaration: " + std::string(name.str()); }
 };
 
 struct paramNode {
     astVarType type;
-    std::string name;
+    symbol name;
 
-    paramNode(astVarType t, std::string n) : type(t), name(std::move(n)) {}
+    paramNode(astVarType t, symbol n) : type(t), name(n) {}
 };
 
 struct functionNode : declarationNode {
     astVarType returnType;
-    std::string name;
+    symbol name;
     std::vector<paramNode> params;
-    std::unique_ptr<astNode> body;
+    nodePtr<astNode> body;
+    mutable uint32_t frameSize = 0; // slots needed by params and locals, params first
 
-    functionNode(astVarType rt, std::string n, std::vector<paramNode> p, std::unique_ptr<astNode> b)
-        : returnType(rt), name(std::move(n)), params(std::move(p)), body(std::move(b)) {
+    functionNode(astVarType rt, symbol n, std::vector<paramNode> p, nodePtr<astNode> b)
+        : returnType(rt), name(n), params(std::move(p)), body(std::move(b)) {
         type = astNodeType::FUNCTION;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Function(\"" << name << "\", returnType=" << (int)returnType << ")\n";
-        std::cout << std::string(indent + 2, ' ') << "Params:\n";
-        for (const auto &param : params) {
-            std::cout << std::string(indent + 4, ' ') << "Param(\"" << param.name << "\", type=" << (int)param.type << ")\n";
-        }
-        if (body) {
-            std::cout << std::string(indent + 2, ' ') << "Body:\n";
-            body->print(indent + 4);
-        }
-    }
-    void generateASM() const override {}
-    std::string describe() const override { return "Function: " + name; }
+    std::string describe() const override { return "Function: " + std::string(name.str()); }
 };
 
 struct bodyNode : astNode {
-    std::vector<std::unique_ptr<astNode>> statements;
+    std::vector<nodePtr<astNode>> statements;
 
-    explicit bodyNode(std::vector<std::unique_ptr<astNode>> s = {})
+    explicit bodyNode(std::vector<nodePtr<astNode>> s = {})
         : statements(std::move(s)) {
         type = astNodeType::BODY;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Body {\n";
-        for (const auto &stmt : statements) {
-            if (stmt) stmt->print(indent + 2);
-        }
-        std::cout << std::string(indent, ' ') << "}\n";
-    }
-    void generateASM() const override {}
     std::string describe() const override { 
         return "Body block with " + std::to_string(statements.size()) + " statement(s)"; 
     }
 };
 
 struct programNode : astNode {
-    std::vector<std::unique_ptr<astNode>> declarations;
+    std::vector<nodePtr<astNode>> declarations;
+    mutable uint32_t globalCount = 0;
+    mutable bool resolved = false;
 
-    explicit programNode(std::vector<std::unique_ptr<astNode>> decls = {})
+    explicit programNode(std::vector<nodePtr<astNode>> decls = {})
         : declarations(std::move(decls)) {
         type = astNodeType::PROGRAM;
     }
 
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Program\n";
-        for (const auto &decl : declarations) {
-            if (decl) decl->print(indent + 2);
-        }
-    }
-    void generateASM() const override {}
     std::string describe() const override {
         return "Program with " + std::to_string(declarations.size()) + " top-level declaration(s)";
     }
@@ -449,51 +442,140 @@ struct programNode : astNode {
 // Main AST class for building and managing the abstract syntax tree
 class AST {
 private:
-    std::vector<Token> tokens_;
+    astArena arena_; // owns every node of this compilation unit
+    const char* source_; // text the tokens point into
+    std::string ownedSource_; // backing text when built from owning Tokens
+    std::vector<compactToken> ownedTokens_;
+    const compactToken* tokens_;
+    size_t tokenCount_;
     size_t current_;
-    std::unique_ptr<programNode> root_;
+    lexer* stream_; // set when pulling tokens from a streaming lexer
+    compactToken prev_; // last consumed token while streaming
+    std::ostream* errorOut_; // where the diagnostics are printed when build() fails
+    nodePtr<programNode> root_;
+
+    // Parse errors are collected, never thrown. The first one sets failed_ and every
+    // parse method returns null as soon as it sees it, which unwinds to build().
+    diagnosticEngine ownDiagnostics_; // used unless built on a lexer
+    diagnosticEngine* diagnostics_; // the lexer's when built on one, so a file has one list
+    bool failed_ = false;
+
+    // Expression parsing state, see parseExpression. power BP_NONE marks an open '('.
+    struct pendingOp {
+        opKind op;
+        uint8_t power;
+    };
+    static constexpr unsigned MAX_NESTING = 1000; // nested parses, through call arguments and the like
+    std::vector<nodePtr<expressionNode>> operands_;
+    std::vector<pendingOp> operators_;
+    unsigned nesting_ = 0;
+
+    // Large token arrays have their top-level functions parsed ahead on worker
+    // threads, each into its own arena, see build
+    struct functionSpan {
+        size_t begin; // the FUNCTION token
+        size_t end; // one past the '}' closing its body
+    };
+    static constexpr size_t PARALLEL_MIN_TOKENS = 16384;
+    static constexpr size_t PARALLEL_MIN_FUNCTIONS = 8;
+    size_t parseWorkers_ = 0;
 
     // Helper methods
-    Token peek() const;
-    Token previous() const;
-    Token advance();
+    const compactToken& peek() const;
+    const compactToken& previous() const;
+    const compactToken& advance();
     bool check(TokenType type) const;
     bool match(TokenType type);
     bool match(std::initializer_list<TokenType> types);
     bool isAtEnd() const;
-    Token consume(TokenType type, const std::string& errorMsg);
+    // On a mismatch reports "errorMsg at line ..., column ... (found '...')" and
+    // returns the current token without consuming it
+    const compactToken& consume(TokenType type, const char* errorMsg);
+    // Reports an error at tok, message is only built when there is room for it
+    void error(const compactToken& tok, const char* what); // what, then the position and tok
+    void fail(const compactToken& tok, std::string message);
+    // Prints the diagnostics and throws astError if there are any
+    void reportDiagnostics();
+    std::string_view text(const compactToken& tok) const { return tok.text(source_); }
+    // Identifiers are interned by the lexer, anything else is interned on demand
+    symbol symbolOf(const compactToken& tok) const { return tok.sym ? symbol{ tok.sym } : intern(text(tok)); }
+
+    template <class T, class... Args>
+    nodePtr<T> makeNode(Args&&... args) {
+        return nodePtr<T>(arena_.make<T>(std::forward<Args>(args)...));
+    }
 
     // Type conversion
     astVarType tokenTypeToVarType(TokenType type);
+    // Consumes a variable type, scalar or list<int | double>, returns false if there is none
+    bool matchType(astVarType& type);
+    astVarType parseListType();
 
     // Parsing methods
-    std::unique_ptr<astNode> parseDeclaration();
-    std::unique_ptr<functionNode> parseFunction();
-    std::unique_ptr<varDeclNode> parseVarDeclaration();
-    std::unique_ptr<astNode> parseStatement();
-    std::unique_ptr<ifNode> parseIfStatement();
-    std::unique_ptr<whileNode> parseWhileStatement();
-    std::unique_ptr<forNode> parseForStatement();
-    std::unique_ptr<returnNode> parseReturnStatement();
-    std::unique_ptr<bodyNode> parseBody();
-    std::unique_ptr<expressionNode> parseExpression();
-    std::unique_ptr<expressionNode> parseAssignment();
-    std::unique_ptr<expressionNode> parseLogicalOr();
-    std::unique_ptr<expressionNode> parseLogicalAnd();
-    std::unique_ptr<expressionNode> parseEquality();
-    std::unique_ptr<expressionNode> parseComparison();
-    std::unique_ptr<expressionNode> parseAddition();
-    std::unique_ptr<expressionNode> parseMultiplication();
-    std::unique_ptr<expressionNode> parseUnary();
-    std::unique_ptr<expressionNode> parsePrimary();
-    std::unique_ptr<expressionNode> parseCall();
+    nodePtr<astNode> parseDeclaration();
+    // One step of build() at the cursor: the next declaration, or null for a stray
+    // ';' or '}' and after an error, once skipped to where parsing resumes
+    nodePtr<astNode> parseTopLevel();
+    nodePtr<functionNode> parseFunction();
+    nodePtr<varDeclNode> parseVarDeclaration(astVarType varType);
+    nodePtr<astNode> parseStatement();
+    nodePtr<ifNode> parseIfStatement();
+    nodePtr<whileNode> parseWhileStatement();
+    nodePtr<forNode> parseForStatement();
+    nodePtr<returnNode> parseReturnStatement();
+    nodePtr<bodyNode> parseBody();
+    nodePtr<expressionNode> parseExpression();
+    // Applies the pending operators above base that bind at least as tightly as minPower
+    void reduce(size_t base, uint8_t minPower);
+    nodePtr<expressionNode> makeAssignment(nodePtr<expressionNode> target, nodePtr<expressionNode> value, opKind op);
+    nodePtr<expressionNode> parsePrimary();
+    // Calls, indexing and postfix ++ / -- after an operand
+    nodePtr<expressionNode> parsePostfix(nodePtr<expressionNode> expr);
+    // Splits the raw text of a string literal at ${...}, see interpStringNode
+    nodePtr<expressionNode> parseString(compactToken tok);
+    // fn ... { ... } at brace depth 0, from matching braces alone
+    std::vector<functionSpan> scanFunctions() const;
+    // One entry per span, null where the span did not parse cleanly into exactly one function
+    std::vector<nodePtr<astNode>> parseAhead(const std::vector<functionSpan>& spans, size_t workers);
 
 public:
     explicit AST(const std::vector<Token>& tokens);
+    // Parses straight from the lexer's buffers, which must outlive the AST.
+    // A streaming lexer is pulled from incrementally as parsing proceeds.
+    explicit AST(lexer& lex);
+    // Parses tokens lexed from source, both owned by the caller and left unchanged
+    // while the AST is in use. Errors go to the AST's own diagnostics().
+    AST(const char* source, const compactToken* tokens, size_t count);
+    // No tokens, the tree is supplied through setRoot(), e.g. from the build cache
+    AST();
+    // Moves the AST on to other tokens, as the constructor above takes them, e.g. the
+    // tokens of an edited text. Nodes built so far stay in arena().
+    void setTokens(const char* source, const compactToken* tokens, size_t count);
     void build();
+    // Parses what build() would parse next if it had got to token start: one
+    // top-level declaration, or null for a stray ';' or '}' or a declaration with
+    // errors. end is set to the token build() would go on from. Only the tokens
+    // from start up to and including end are looked at, see sourceDocument.
+    nodePtr<astNode> parseDeclarationAt(size_t start, size_t& end);
+    // Folds constants and prunes dead branches in the built tree, see fold.h
+    void optimize();
+    void setErrorStream(std::ostream& err) { errorOut_ = &err; }
+    // Errors of the last build(), shared with the lexer when built on one. The
+    // limit set here caps how many are kept before parsing stops.
+    diagnosticEngine& diagnostics() { return *diagnostics_; }
+    // Threads build() may use, 0 picks one per hardware thread and 1 keeps parsing on the caller
+    void setParseWorkers(size_t workers) { parseWorkers_ = workers; }
     void print() const;
+    void print(std::ostream& out) const;
+    // The tree as one JSON object, see astJsonPrinter
+    void printJSON(std::ostream& out) const;
     const programNode* getRoot() const { return root_.get(); }
-    void generateCode() const;
+    // The tree must live in arena()
+    void setRoot(nodePtr<programNode> root) { root_ = std::move(root); }
+    astArena& arena() { return arena_; }
+    // Writes x86-64 assembly for the tree, see codegen.h. The tree and its imports
+    // must have been resolved (see resolveProgram). Throws runtimeError on type errors.
+    void generateCode(std::ostream& out, const std::vector<const programNode*>& imports = {}) const;
 };
 
 #endif // AST_H
@@ -0,0 +1,1533 @@
+#include "bytecode.h"
+#include "interp.h"
+#include "visitor.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+const std::string EMPTY_STRING;
+
+// Calls are inlined when the callee has at most INLINE_BUDGET nodes, up to
+// MAX_INLINE_DEPTH calls deep
+constexpr uint32_t INLINE_BUDGET = 40;
+constexpr size_t MAX_INLINE_DEPTH = 3;
+// for loops with a constant trip count of at most MAX_UNROLL_TRIPS are unrolled
+// while the copies stay within UNROLL_BUDGET nodes
+constexpr int64_t MAX_UNROLL_TRIPS = 8;
+constexpr uint32_t UNROLL_BUDGET = 64;
+
+const char* const opNames[] = {
+#define QUR_BC_NAME(name) #name,
+    QUR_BC_OPS(QUR_BC_NAME)
+#undef QUR_BC_NAME
+};
+
+// int, boolean and char share the integer registers
+bool isIntClass(astVarType t) {
+    return t == astVarType::INT || t == astVarType::BOOLEAN || t == astVarType::CHAR;
+}
+
+bool isNumeric(astVarType t) {
+    return isIntClass(t) || t == astVarType::DOUBLE;
+}
+
+bcOp moveOp(astVarType t) {
+    return t == astVarType::DOUBLE ? bcOp::MOV_D : bcOp::MOV;
+}
+
+std::string typeName(astVarType t) {
+    switch (t) {
+        case astVarType::INT: return "int";
+        case astVarType::DOUBLE: return "double";
+        case astVarType::BOOLEAN: return "boolean";
+        case astVarType::CHAR: return "char";
+        case astVarType::STRING: return "string";
+        case astVarType::INT_LIST: return "list<int>";
+        case astVarType::DOUBLE_LIST: return "list<double>";
+        default: return "void";
+    }
+}
+
+bool isComparison(opKind op) {
+    switch (op) {
+        case opKind::LESSTHAN:
+        case opKind::MORETHAN:
+        case opKind::LESSTHANEQUAL:
+        case opKind::MORETHANEQUAL:
+        case opKind::EQUAL:
+        case opKind::NOTEQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Ops are laid out in the order of opKind's comparisons, these pick by offset
+bcOp pick(bcOp first, opKind op) {
+    uint32_t offset = 0;
+    switch (op) {
+        case opKind::ADD: case opKind::LESSTHAN: offset = 0; break;
+        case opKind::SUB: case opKind::MORETHAN: offset = 1; break;
+        case opKind::MUL: case opKind::LESSTHANEQUAL: offset = 2; break;
+        case opKind::DIV: case opKind::MORETHANEQUAL: offset = 3; break;
+        case opKind::MOD: case opKind::EQUAL: offset = 4; break;
+        case opKind::NOTEQUAL: offset = 5; break;
+        default: break;
+    }
+    return (bcOp)((uint32_t)first + offset);
+}
+
+opKind negate(opKind op) {
+    switch (op) {
+        case opKind::LESSTHAN: return opKind::MORETHANEQUAL;
+        case opKind::MORETHAN: return opKind::LESSTHANEQUAL;
+        case opKind::LESSTHANEQUAL: return opKind::MORETHAN;
+        case opKind::MORETHANEQUAL: return opKind::LESSTHAN;
+        case opKind::EQUAL: return opKind::NOTEQUAL;
+        default: return opKind::EQUAL;
+    }
+}
+
+// JLT_I .. JNE_I follow the comparison order LT GT LE GE EQ NE
+bcOp fusedJump(opKind op) {
+    return pick(bcOp::JLT_I, op);
+}
+
+opKind compoundBase(opKind op) {
+    switch (op) {
+        case opKind::ASSIGN_ADD: return opKind::ADD;
+        case opKind::ASSIGN_SUB: return opKind::SUB;
+        case opKind::ASSIGN_MUL: return opKind::MUL;
+        case opKind::ASSIGN_DIV: return opKind::DIV;
+        case opKind::ASSIGN_MOD: return opKind::MOD;
+        default: return opKind::UNKNOWN;
+    }
+}
+
+// Size of a subtree in nodes, and whether it calls self
+class bodySize : public astVisitor<bodySize> {
+private:
+    const functionNode* fn_;
+
+public:
+    uint32_t nodes = 0;
+    bool recursive = false;
+
+    explicit bodySize(const astNode* body, const functionNode* self = nullptr) : fn_(self) { visit(body); }
+
+    void defaultVisit(const astNode* n) {
+        nodes++;
+        visitChildren(n);
+    }
+    void visitFnCall(const fnCallNode* n) {
+        if (n->callee == fn_) recursive = true;
+        defaultVisit(n);
+    }
+};
+
+bool isStep(opKind op) {
+    return op == opKind::PRE_INCREMENT || op == opKind::PRE_DECREMENT || op == opKind::POST_INCREMENT || op == opKind::POST_DECREMENT;
+}
+
+// Variables a loop may change, locals by register and globals by slot
+class loopWrites : public astVisitor<loopWrites> {
+private:
+    uint32_t base_;
+
+    void write(uint32_t slot, bool global) {
+        if (global) globals.insert(slot);
+        else locals.insert(base_ + slot);
+    }
+
+public:
+    std::unordered_set<uint32_t> locals;
+    std::unordered_set<uint32_t> globals;
+    bool calls = false; // a call may change any global
+
+    explicit loopWrites(uint32_t base) : base_(base) {}
+
+    bool writes(const variableNode* var) const {
+        return var->global ? calls || globals.count(var->slot) : locals.count(base_ + var->slot) != 0;
+    }
+
+    void visitVarDecl(const varDeclNode* n) {
+        write(n->slot, n->global);
+        visitChildren(n);
+    }
+    void visitAssignOp(const assignOpNode* n) {
+        if (!n->index) write(n->slot, n->global); // storing an element leaves the list itself
+        visitChildren(n);
+    }
+    void visitUnaryOp(const unaryOpNode* n) {
+        if (isStep(n->op) && n->operand && n->operand->type == astNodeType::VARIABLE) {
+            auto var = static_cast<const variableNode*>(n->operand.get());
+            write(var->slot, var->global);
+        }
+        visitChildren(n);
+    }
+    void visitFnCall(const fnCallNode* n) {
+        if (n->callee) calls = true;
+        visitChildren(n);
+    }
+};
+
+// Operators whose operands the loop never changes, evaluated once before it. Only
+// what has no effects and can't fail qualifies, so hoisting out of a branch or a
+// loop that never runs is safe. With an induction variable, products of it and an
+// invariant are collected for strength reduction.
+class loopInvariants : public astVisitor<loopInvariants> {
+private:
+    const loopWrites& writes_;
+    uint32_t base_;
+    uint32_t induction_; // register, or NO_REG
+    const symbol len_ = intern("len");
+
+    bool isInduction(const astNode* node) const {
+        if (induction_ == NO_REG || !node || node->type != astNodeType::VARIABLE) return false;
+        auto var = static_cast<const variableNode*>(node);
+        return !var->global && base_ + var->slot == induction_;
+    }
+
+public:
+    std::vector<const astNode*> found;
+    std::vector<std::pair<const binaryOpNode*, const astNode*>> products; // with the invariant factor
+
+    loopInvariants(const loopWrites& writes, uint32_t base, uint32_t induction)
+        : writes_(writes), base_(base), induction_(induction) {}
+
+    bool invariant(const astNode* node) const {
+        if (!node) return false;
+        switch (node->type) {
+            case astNodeType::STRING:
+            case astNodeType::INT:
+            case astNodeType::DOUBLE:
+            case astNodeType::CHAR:
+            case astNodeType::BOOL:
+                return true;
+            case astNodeType::VARIABLE:
+                return !writes_.writes(static_cast<const variableNode*>(node));
+            case astNodeType::UNARYOP: {
+                auto n = static_cast<const unaryOpNode*>(node);
+                return !isStep(n->op) && invariant(n->operand.get());
+            }
+            case astNodeType::FNCALL: {
+                // Lists never change length, so len of an unchanged variable is fixed
+                auto n = static_cast<const fnCallNode*>(node);
+                return !n->callee && n->name == len_ && n->args.size() == 1 && invariant(n->args[0].get());
+            }
+            case astNodeType::BINARYOP: {
+                auto n = static_cast<const binaryOpNode*>(node);
+                if (n->op == opKind::DIV || n->op == opKind::MOD) {
+                    // Only literal divisors, an integer zero would fail at runtime
+                    const astNode* r = n->right.get();
+                    bool safe = r && ((r->type == astNodeType::INT && static_cast<const intLiteralNode*>(r)->value != 0) ||
+                                      r->type == astNodeType::DOUBLE);
+                    if (!safe) return false;
+                }
+                return invariant(n->left.get()) && invariant(n->right.get());
+            }
+            default:
+                return false;
+        }
+    }
+
+    void visitUnaryOp(const unaryOpNode* n) {
+        if (invariant(n)) found.push_back(n);
+        else visitChildren(n);
+    }
+    void visitFnCall(const fnCallNode* n) {
+        if (invariant(n)) found.push_back(n);
+        else visitChildren(n);
+    }
+    void visitBinaryOp(const binaryOpNode* n) {
+        if (invariant(n)) {
+            found.push_back(n);
+            return;
+        }
+        if (n->op == opKind::MUL) {
+            if (isInduction(n->left.get()) && invariant(n->right.get())) {
+                products.emplace_back(n, n->right.get());
+                if (n->right->type == astNodeType::UNARYOP || n->right->type == astNodeType::BINARYOP) found.push_back(n->right.get());
+                return;
+            }
+            if (isInduction(n->right.get()) && invariant(n->left.get())) {
+                products.emplace_back(n, n->left.get());
+                if (n->left->type == astNodeType::UNARYOP || n->left->type == astNodeType::BINARYOP) found.push_back(n->left.get());
+                return;
+            }
+        }
+        visitChildren(n);
+    }
+};
+
+class bcCompiler {
+private:
+    struct loopTargets {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    // A call being compiled in place: returns write out and jump to the end,
+    // except the last statement, which falls through
+    struct inlineFrame {
+        uint32_t out;
+        const astNode* last;
+        std::vector<size_t> exits;
+    };
+
+    struct hoistedValue {
+        uint32_t reg;
+        astVarType type;
+    };
+
+    bcProgram& prog_;
+    std::unordered_map<const functionNode*, uint32_t> functions_;
+    std::vector<const functionNode*> pending_; // referenced but not compiled yet
+    std::unordered_map<const functionNode*, bool> inlinable_;
+    std::unordered_map<uint32_t, uint32_t> globals_; // resolver slot to dense index
+    std::vector<astVarType> globalTypes_;
+
+    // Current function
+    bcFunction* fn_ = nullptr;
+    const functionNode* node_ = nullptr; // innermost, inlined callees included
+    uint32_t tempTop_ = 0;
+    uint32_t slotBase_ = 0; // where the frame of node_ starts
+    std::vector<loopTargets> loops_;
+    std::vector<inlineFrame> inlines_;
+    std::vector<const functionNode*> inlined_; // node_ and its inlined callers, outermost first
+    std::unordered_map<const astNode*, hoistedValue> hoisted_; // computed before the loop around them
+    const symbol len_ = intern("len");
+
+    std::string where() const {
+        return node_ ? " in function '" + std::string(node_->name.str()) + "'" : std::string();
+    }
+    [[noreturn]] void fail(const std::string& msg) const { throw runtimeError(msg + where()); }
+
+    size_t emit(bcOp op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+        fn_->code.push_back({ op, a, b, c });
+        return fn_->code.size() - 1;
+    }
+    uint32_t here() const { return (uint32_t)fn_->code.size(); }
+
+    // Jumps keep their target in the last operand they use
+    void patch(size_t at, uint32_t target) {
+        bcInstr& in = fn_->code[at];
+        switch (in.op) {
+            case bcOp::JMP: in.a = target; break;
+            case bcOp::JZ: case bcOp::JNZ: in.b = target; break;
+            default: in.c = target; break;
+        }
+    }
+    void patchAll(const std::vector<size_t>& jumps, uint32_t target) {
+        for (size_t at : jumps) patch(at, target);
+    }
+
+    uint32_t temp() {
+        uint32_t r = tempTop_++;
+        if (tempTop_ > fn_->registerCount) fn_->registerCount = tempTop_;
+        return r;
+    }
+    uint32_t target(uint32_t dst) { return dst != NO_REG ? dst : temp(); }
+
+    uint32_t constant(bcReg value) {
+        fn_->constants.push_back(value);
+        return (uint32_t)(fn_->constants.size() - 1);
+    }
+    uint32_t loadInt(int64_t v, uint32_t dst) {
+        bcReg k;
+        k.i = v;
+        uint32_t r = target(dst);
+        emit(bcOp::LOADK, r, constant(k));
+        return r;
+    }
+    uint32_t loadDefault(astVarType type, uint32_t dst) {
+        if (isListType(type)) {
+            uint32_t r = target(dst);
+            emit(bcOp::NEWLIST, r, loadInt(0, NO_REG));
+            return r;
+        }
+        bcReg k;
+        bcOp op = bcOp::LOADK;
+        if (type == astVarType::STRING) {
+            k.s = &EMPTY_STRING;
+            op = bcOp::LOADK_S;
+        } else if (type == astVarType::DOUBLE) {
+            k.d = 0.0;
+            op = bcOp::LOADK_D;
+        } else {
+            k.i = 0;
+        }
+        uint32_t r = target(dst);
+        emit(op, r, constant(k));
+        return r;
+    }
+
+    uint32_t globalIndex(uint32_t slot) const { return globals_.at(slot); }
+
+    // Writes src converted from one static type to another into dst
+    void convertInto(uint32_t dst, uint32_t src, astVarType from, astVarType to) {
+        if (from == to) {
+            if (src != dst) emit(moveOp(to), dst, src);
+            return;
+        }
+        if (!isNumeric(from) || !isNumeric(to)) fail("Cannot convert " + typeName(from) + " to " + typeName(to));
+        bcOp op = bcOp::MOV;
+        switch (to) {
+            case astVarType::INT:
+                if (from == astVarType::DOUBLE) op = bcOp::D2I;
+                break;
+            case astVarType::DOUBLE:
+                if (from != astVarType::DOUBLE) op = bcOp::I2D;
+                break;
+            case astVarType::BOOLEAN:
+                if (from == astVarType::DOUBLE) op = bcOp::D2B;
+                else if (from != astVarType::BOOLEAN) op = bcOp::I2B;
+                break;
+            case astVarType::CHAR:
+                if (from == astVarType::DOUBLE) {
+                    emit(bcOp::D2I, dst, src);
+                    src = dst;
+                    op = bcOp::I2C;
+                } else if (from == astVarType::INT) {
+                    op = bcOp::I2C;
+                }
+                break;
+            default:
+                break;
+        }
+        if (op != bcOp::MOV || src != dst) emit(op, dst, src);
+    }
+
+    uint32_t convert(uint32_t src, astVarType from, astVarType to) {
+        if (from == to) return src;
+        uint32_t r = temp();
+        convertInto(r, src, from, to);
+        return r;
+    }
+
+    // A register that is non-zero exactly when the value is true
+    uint32_t truth(uint32_t reg, astVarType t) {
+        if (isIntClass(t)) return reg;
+        if (t == astVarType::DOUBLE) return convert(reg, t, astVarType::BOOLEAN);
+        if (t == astVarType::STRING) {
+            uint32_t r = temp();
+            emit(bcOp::S2B, r, reg);
+            return r;
+        }
+        fail("Cannot use void as a condition");
+    }
+
+    // Jumps (to be patched) taken when cond evaluates to sense
+    std::vector<size_t> jumpIf(const astNode* cond, bool sense) {
+        if (cond->type == astNodeType::UNARYOP) {
+            auto n = static_cast<const unaryOpNode*>(cond);
+            if (n->op == opKind::NOT) return jumpIf(n->operand.get(), !sense);
+        }
+        if (cond->type == astNodeType::BINARYOP) {
+            auto n = static_cast<const binaryOpNode*>(cond);
+            if (isComparison(n->op)) {
+                astVarType lt, rt;
+                uint32_t l = expr(n->left.get(), lt);
+                uint32_t r = expr(n->right.get(), rt);
+                if (isIntClass(lt) && isIntClass(rt)) {
+                    return { emit(fusedJump(sense ? n->op : negate(n->op)), l, r, 0) };
+                }
+                astVarType t;
+                uint32_t value = binary(n->op, l, lt, r, rt, NO_REG, t);
+                return { emit(sense ? bcOp::JNZ : bcOp::JZ, value, 0) };
+            }
+        }
+        astVarType t;
+        uint32_t reg = expr(cond, t);
+        uint32_t value = truth(reg, t);
+        return { emit(sense ? bcOp::JNZ : bcOp::JZ, value, 0) };
+    }
+
+    uint32_t binary(opKind op, uint32_t l, astVarType lt, uint32_t r, astVarType rt, uint32_t dst, astVarType& t) {
+        if (lt == astVarType::STRING || rt == astVarType::STRING) {
+            if (op == opKind::ADD) {
+                l = toText(l, lt);
+                r = toText(r, rt);
+                uint32_t out = target(dst);
+                emit(bcOp::CONCAT, out, l, r);
+                t = astVarType::STRING;
+                return out;
+            }
+            if (lt == rt && isComparison(op)) {
+                uint32_t out = target(dst);
+                emit(pick(bcOp::LT_S, op), out, l, r);
+                t = astVarType::BOOLEAN;
+                return out;
+            }
+            fail("Operator " + std::string(opToString(op)) + " is not defined for " + typeName(lt) + " and " + typeName(rt));
+        }
+        if (!isNumeric(lt) || !isNumeric(rt)) {
+            fail("Operator " + std::string(opToString(op)) + " needs values, got void");
+        }
+        bool isDouble = lt == astVarType::DOUBLE || rt == astVarType::DOUBLE;
+        if (isDouble) {
+            l = convert(l, lt, astVarType::DOUBLE);
+            r = convert(r, rt, astVarType::DOUBLE);
+        }
+        uint32_t out = target(dst);
+        if (isComparison(op)) {
+            emit(pick(isDouble ? bcOp::LT_D : bcOp::LT_I, op), out, l, r);
+            t = astVarType::BOOLEAN;
+        } else {
+            if (op != opKind::ADD && op != opKind::SUB && op != opKind::MUL && op != opKind::DIV && op != opKind::MOD) {
+                fail("Unsupported binary operator " + std::string(opToString(op)));
+            }
+            emit(pick(isDouble ? bcOp::ADD_D : bcOp::ADD_I, op), out, l, r);
+            t = isDouble ? astVarType::DOUBLE : astVarType::INT;
+        }
+        return out;
+    }
+
+    uint32_t toText(uint32_t reg, astVarType t, uint32_t dst = NO_REG) {
+        bcOp op;
+        switch (t) {
+            case astVarType::STRING:
+                if (dst == NO_REG || dst == reg) return reg;
+                emit(bcOp::MOV, dst, reg);
+                return dst;
+            case astVarType::INT: op = bcOp::TOSTR_I; break;
+            case astVarType::DOUBLE: op = bcOp::TOSTR_D; break;
+            case astVarType::BOOLEAN: op = bcOp::TOSTR_B; break;
+            case astVarType::CHAR: op = bcOp::TOSTR_C; break;
+            default: fail("Cannot convert void to string");
+        }
+        uint32_t r = target(dst);
+        emit(op, r, reg);
+        return r;
+    }
+
+    uint32_t loadString(const std::string* text, uint32_t dst) {
+        bcReg k;
+        k.s = text;
+        uint32_t r = target(dst);
+        emit(bcOp::LOADK_S, r, constant(k));
+        return r;
+    }
+
+    // Non-empty segments and the parts as text go in consecutive registers, one JOIN
+    // puts them together
+    uint32_t interpolate(const interpStringNode* n, uint32_t dst, astVarType& t) {
+        t = astVarType::STRING;
+        uint32_t count = (uint32_t)n->parts.size();
+        for (const std::string& segment : n->segments) count += !segment.empty();
+        if (count <= 1) {
+            if (n->parts.empty()) return loadString(n->segments.empty() ? &EMPTY_STRING : &n->segments[0], dst);
+            astVarType pt;
+            uint32_t r = expr(n->parts[0].get(), pt);
+            return toText(r, pt, dst);
+        }
+        uint32_t out = target(dst);
+        uint32_t base = tempTop_;
+        for (uint32_t i = 0; i < count; i++) temp();
+        uint32_t at = base;
+        for (size_t i = 0; i < n->segments.size(); i++) {
+            if (!n->segments[i].empty()) loadString(&n->segments[i], at++);
+            if (i < n->parts.size()) {
+                uint32_t saved = tempTop_;
+                astVarType pt;
+                uint32_t r = expr(n->parts[i].get(), pt);
+                toText(r, pt, at++);
+                tempTop_ = saved;
+            }
+        }
+        emit(bcOp::JOIN, out, base, count);
+        tempTop_ = base;
+        return out;
+    }
+
+    void print(uint32_t reg, astVarType t) {
+        switch (t) {
+            case astVarType::INT: emit(bcOp::PRINT_I, reg); break;
+            case astVarType::DOUBLE: emit(bcOp::PRINT_D, reg); break;
+            case astVarType::BOOLEAN: emit(bcOp::PRINT_B, reg); break;
+            case astVarType::CHAR: emit(bcOp::PRINT_C, reg); break;
+            case astVarType::STRING: emit(bcOp::PRINT_S, reg); break;
+            default: break;
+        }
+    }
+
+    // Where a variable lives: its own register for locals, a loaded copy for globals
+    uint32_t readVar(uint32_t slot, bool global, astVarType type) {
+        if (!global) return slotBase_ + slot;
+        uint32_t r = temp();
+        emit(type == astVarType::DOUBLE ? bcOp::GGET_D : bcOp::GGET, r, globalIndex(slot));
+        return r;
+    }
+    void writeBack(uint32_t slot, bool global, astVarType type, uint32_t reg) {
+        if (global) emit(type == astVarType::DOUBLE ? bcOp::GSET_D : bcOp::GSET, globalIndex(slot), reg);
+    }
+
+    // used is false for statements like i++; where the old value needs no copy
+    uint32_t unary(const unaryOpNode* n, astVarType& t, bool used = true) {
+        bool increment = n->op == opKind::PRE_INCREMENT || n->op == opKind::POST_INCREMENT;
+        bool postfix = n->op == opKind::POST_INCREMENT || n->op == opKind::POST_DECREMENT;
+        if (increment || n->op == opKind::PRE_DECREMENT || n->op == opKind::POST_DECREMENT) {
+            if (!n->operand || n->operand->type != astNodeType::VARIABLE) {
+                fail("Operand of " + std::string(opToString(n->op)) + " must be a variable");
+            }
+            auto var = static_cast<const variableNode*>(n->operand.get());
+            t = var->valueType;
+            uint32_t reg = readVar(var->slot, var->global, t);
+            if (!isNumeric(t)) fail("Cannot apply " + std::string(opToString(n->op)) + " to " + typeName(t));
+            uint32_t old = NO_REG;
+            postfix = postfix && used;
+            if (postfix) {
+                old = temp();
+                emit(moveOp(t), old, reg);
+            }
+            uint32_t delta = increment ? 1u : (uint32_t)-1;
+            emit(t == astVarType::DOUBLE ? bcOp::INC_D : bcOp::INC_I, reg, 0, delta);
+            if (t == astVarType::CHAR) emit(bcOp::I2C, reg, reg);
+            if (t == astVarType::BOOLEAN) emit(bcOp::I2B, reg, reg);
+            writeBack(var->slot, var->global, t, reg);
+            return postfix ? old : reg;
+        }
+
+        astVarType vt;
+        uint32_t v = expr(n->operand.get(), vt);
+        uint32_t out = temp();
+        switch (n->op) {
+            case opKind::NOT:
+                if (vt == astVarType::VOID) break;
+                emit(bcOp::NOT, out, truth(v, vt));
+                t = astVarType::BOOLEAN;
+                return out;
+            case opKind::SUB:
+                if (vt == astVarType::DOUBLE) {
+                    emit(bcOp::NEG_D, out, v);
+                    t = astVarType::DOUBLE;
+                    return out;
+                }
+                if (!isIntClass(vt)) break;
+                emit(bcOp::NEG_I, out, v);
+                t = astVarType::INT;
+                return out;
+            case opKind::INVERT:
+                if (vt == astVarType::BOOLEAN) {
+                    emit(bcOp::NOT, out, v);
+                    t = astVarType::BOOLEAN;
+                    return out;
+                }
+                if (vt != astVarType::INT && vt != astVarType::CHAR) break;
+                emit(bcOp::INV_I, out, v);
+                t = astVarType::INT;
+                return out;
+            default:
+                break;
+        }
+        fail("Cannot apply " + std::string(opToString(n->op)) + " to " + typeName(vt));
+    }
+
+    uint32_t logical(const binaryOpNode* n, astVarType& t) {
+        uint32_t out = temp();
+        astVarType lt, rt;
+        uint32_t l = expr(n->left.get(), lt);
+        convertInto(out, truth(l, lt), isIntClass(lt) ? lt : astVarType::BOOLEAN, astVarType::BOOLEAN);
+        size_t skip = emit(n->op == opKind::AND ? bcOp::JZ : bcOp::JNZ, out, 0);
+        uint32_t r = expr(n->right.get(), rt);
+        convertInto(out, truth(r, rt), isIntClass(rt) ? rt : astVarType::BOOLEAN, astVarType::BOOLEAN);
+        patch(skip, here());
+        t = astVarType::BOOLEAN;
+        return out;
+    }
+
+    // Index, value, then the store, in the tree interpreter's order
+    uint32_t assignElement(const assignOpNode* n, astVarType& t) {
+        astVarType it, vt;
+        uint32_t index = expr(n->index.get(), it);
+        uint32_t v = expr(n->value.get(), vt);
+        uint32_t list = readVar(n->slot, n->global, n->valueType);
+        t = elementType(n->valueType);
+        bool isDouble = t == astVarType::DOUBLE;
+        if (n->op != opKind::ASSIGN) {
+            uint32_t old = temp();
+            emit(isDouble ? bcOp::LGET_D : bcOp::LGET, old, list, index);
+            astVarType resultType;
+            v = binary(compoundBase(n->op), old, t, v, vt, NO_REG, resultType);
+            vt = resultType;
+        }
+        uint32_t stored = convert(v, vt, t);
+        emit(isDouble ? bcOp::LSET_D : bcOp::LSET, list, index, stored);
+        return stored;
+    }
+
+    // Sized lists start zeroed, literals are filled in element by element
+    uint32_t list(const listNode* n, uint32_t dst, astVarType& t) {
+        t = n->valueType;
+        if (n->length) {
+            astVarType lt;
+            uint32_t length = expr(n->length.get(), lt);
+            uint32_t r = target(dst);
+            emit(bcOp::NEWLIST, r, length);
+            return r;
+        }
+        // The elements may still read what dst holds
+        uint32_t r = temp();
+        emit(bcOp::NEWLIST, r, loadInt((int64_t)n->elements.size(), NO_REG));
+        astVarType et = elementType(t);
+        for (size_t i = 0; i < n->elements.size(); i++) {
+            uint32_t saved = tempTop_;
+            astVarType at;
+            uint32_t v = expr(n->elements[i].get(), at);
+            v = convert(v, at, et);
+            emit(et == astVarType::DOUBLE ? bcOp::LSET_D : bcOp::LSET, r, loadInt((int64_t)i, NO_REG), v);
+            tempTop_ = saved;
+        }
+        return r;
+    }
+
+    uint32_t assign(const assignOpNode* n, astVarType& t) {
+        if (n->index) return assignElement(n, t);
+        astVarType targetType = n->valueType;
+        uint32_t reg = readVar(n->slot, n->global, targetType);
+        astVarType vt;
+        if (n->op == opKind::ASSIGN) {
+            uint32_t v = expr(n->value.get(), vt, n->global ? NO_REG : reg);
+            convertInto(reg, v, vt, targetType);
+        } else {
+            uint32_t v = expr(n->value.get(), vt);
+            astVarType resultType;
+            uint32_t result = binary(compoundBase(n->op), reg, targetType, v, vt,
+                                     vt == targetType ? reg : NO_REG, resultType);
+            convertInto(reg, result, resultType, targetType);
+        }
+        writeBack(n->slot, n->global, targetType, reg);
+        t = targetType;
+        return reg;
+    }
+
+    uint32_t call(const fnCallNode* n, uint32_t dst, astVarType& t) {
+        if (!n->callee && n->name == len_) {
+            astVarType lt;
+            uint32_t l = expr(n->args[0].get(), lt);
+            uint32_t out = target(dst);
+            emit(bcOp::LEN, out, l);
+            t = astVarType::INT;
+            return out;
+        }
+        if (!n->callee) {
+            // Builtin print
+            for (size_t i = 0; i < n->args.size(); i++) {
+                if (i) emit(bcOp::PRINT_SP);
+                const astNode* arg = n->args[i].get();
+                astVarType at;
+                if (arg->type == astNodeType::INTERP) {
+                    // Printed piece by piece, the joined string is never built
+                    auto interp = static_cast<const interpStringNode*>(arg);
+                    for (size_t j = 0; j < interp->segments.size(); j++) {
+                        if (!interp->segments[j].empty()) print(loadString(&interp->segments[j], NO_REG), astVarType::STRING);
+                        if (j < interp->parts.size()) {
+                            uint32_t r = expr(interp->parts[j].get(), at);
+                            print(r, at);
+                        }
+                    }
+                    continue;
+                }
+                uint32_t r = expr(arg, at);
+                print(r, at);
+            }
+            emit(bcOp::PRINT_NL);
+            t = astVarType::VOID;
+            return NO_REG;
+        }
+
+        const functionNode* callee = n->callee;
+        t = callee->returnType;
+        uint32_t out = t == astVarType::VOID ? NO_REG : target(dst);
+        if (shouldInline(callee)) {
+            inlineCall(n, callee, out);
+            return out;
+        }
+        // Arguments go in consecutive registers at the top, they become the callee's parameters
+        uint32_t argBase = tempTop_;
+        for (size_t i = 0; i < n->args.size(); i++) temp();
+        for (size_t i = 0; i < n->args.size(); i++) {
+            astVarType at;
+            uint32_t r = expr(n->args[i].get(), at, argBase + (uint32_t)i);
+            convertInto(argBase + (uint32_t)i, r, at, callee->params[i].type);
+        }
+        emit(bcOp::CALL, out, functionIndex(callee), argBase);
+        tempTop_ = argBase;
+        return out;
+    }
+
+    static const astNode* lastStatement(const functionNode* fn) {
+        const astNode* body = fn->body.get();
+        if (!body || body->type != astNodeType::BODY) return body;
+        const auto& statements = static_cast<const bodyNode*>(body)->statements;
+        return statements.empty() ? nullptr : statements.back().get();
+    }
+
+    // Small, non-recursive functions whose result can't fall off the end
+    bool shouldInline(const functionNode* callee) {
+        if (inlines_.size() >= MAX_INLINE_DEPTH) return false;
+        for (const functionNode* fn : inlined_) {
+            if (fn == callee) return false;
+        }
+        auto it = inlinable_.find(callee);
+        if (it == inlinable_.end()) {
+            bodySize size(callee->body.get(), callee);
+            const astNode* last = lastStatement(callee);
+            bool returns = callee->returnType == astVarType::VOID || (last && last->type == astNodeType::RETURN);
+            it = inlinable_.emplace(callee, size.nodes <= INLINE_BUDGET && !size.recursive && returns).first;
+        }
+        return it->second;
+    }
+
+    // The callee's frame becomes a block of the caller's registers, parameters first
+    void inlineCall(const fnCallNode* n, const functionNode* callee, uint32_t out) {
+        uint32_t base = tempTop_;
+        for (uint32_t i = 0; i < callee->frameSize; i++) temp();
+        for (size_t i = 0; i < n->args.size(); i++) {
+            astVarType at;
+            uint32_t r = expr(n->args[i].get(), at, base + (uint32_t)i);
+            convertInto(base + (uint32_t)i, r, at, callee->params[i].type);
+        }
+
+        const functionNode* savedNode = node_;
+        uint32_t savedBase = slotBase_;
+        std::vector<loopTargets> savedLoops;
+        savedLoops.swap(loops_); // break and continue never leave the callee
+        node_ = callee;
+        slotBase_ = base;
+        inlined_.push_back(callee);
+        inlines_.push_back({ out, lastStatement(callee), {} });
+
+        stmt(callee->body.get());
+        patchAll(inlines_.back().exits, here());
+
+        inlines_.pop_back();
+        inlined_.pop_back();
+        loops_.swap(savedLoops);
+        slotBase_ = savedBase;
+        node_ = savedNode;
+        tempTop_ = base;
+    }
+
+    // Functions get their index when first called, so only reachable ones are compiled
+    uint32_t functionIndex(const functionNode* fn) {
+        auto it = functions_.find(fn);
+        if (it != functions_.end()) return it->second;
+        pending_.push_back(fn);
+        return functions_[fn] = (uint32_t)functions_.size();
+    }
+
+    uint32_t expr(const astNode* node, astVarType& t, uint32_t dst = NO_REG) {
+        uint32_t r = exprAt(node, t, dst);
+        if (dst != NO_REG && r != NO_REG && r != dst) emit(moveOp(t), dst, r);
+        return dst != NO_REG && r != NO_REG ? dst : r;
+    }
+
+    // Only leaf loads, plain binary ops and calls write dst directly, anything that
+    // reads variables after its first write goes through a temporary
+    uint32_t exprAt(const astNode* node, astVarType& t, uint32_t dst) {
+        if (!hoisted_.empty()) {
+            auto it = hoisted_.find(node);
+            if (it != hoisted_.end()) {
+                t = it->second.type;
+                return it->second.reg;
+            }
+        }
+        bcReg k;
+        switch (node->type) {
+            case astNodeType::STRING: {
+                k.s = &static_cast<const stringLiteralNode*>(node)->text;
+                t = astVarType::STRING;
+                uint32_t r = target(dst);
+                emit(bcOp::LOADK_S, r, constant(k));
+                return r;
+            }
+            case astNodeType::INT:
+                t = astVarType::INT;
+                return loadInt(static_cast<const intLiteralNode*>(node)->value, dst);
+            case astNodeType::DOUBLE: {
+                k.d = static_cast<const doubleLiteralNode*>(node)->value;
+                t = astVarType::DOUBLE;
+                uint32_t r = target(dst);
+                emit(bcOp::LOADK_D, r, constant(k));
+                return r;
+            }
+            case astNodeType::CHAR:
+                t = astVarType::CHAR;
+                return loadInt((unsigned char)static_cast<const charLiteralNode*>(node)->value, dst);
+            case astNodeType::BOOL:
+                t = astVarType::BOOLEAN;
+                return loadInt(static_cast<const booleanLiteralNode*>(node)->value ? 1 : 0, dst);
+            case astNodeType::VARIABLE: {
+                auto n = static_cast<const variableNode*>(node);
+                t = n->valueType;
+                return readVar(n->slot, n->global, t);
+            }
+            case astNodeType::UNARYOP:
+                return unary(static_cast<const unaryOpNode*>(node), t);
+            case astNodeType::BINARYOP: {
+                auto n = static_cast<const binaryOpNode*>(node);
+                if (n->op == opKind::AND || n->op == opKind::OR) return logical(n, t);
+                astVarType lt, rt;
+                uint32_t l = expr(n->left.get(), lt);
+                uint32_t r = expr(n->right.get(), rt);
+                return binary(n->op, l, lt, r, rt, dst, t);
+            }
+            case astNodeType::ASSIGNOP:
+                return assign(static_cast<const assignOpNode*>(node), t);
+            case astNodeType::FNCALL:
+                return call(static_cast<const fnCallNode*>(node), dst, t);
+            case astNodeType::INDEX: {
+                auto n = static_cast<const indexNode*>(node);
+                astVarType lt, it;
+                uint32_t l = expr(n->list.get(), lt);
+                uint32_t i = expr(n->index.get(), it);
+                t = elementType(lt);
+                uint32_t r = target(dst);
+                emit(t == astVarType::DOUBLE ? bcOp::LGET_D : bcOp::LGET, r, l, i);
+                return r;
+            }
+            case astNodeType::LIST:
+                return list(static_cast<const listNode*>(node), dst, t);
+            case astNodeType::INTERP:
+                return interpolate(static_cast<const interpStringNode*>(node), dst, t);
+            default:
+                fail("Cannot evaluate " + node->describe());
+        }
+    }
+
+    // Returns what was hoisted here, an enclosing loop may have taken some already
+    std::vector<const astNode*> hoist(const std::vector<const astNode*>& nodes) {
+        std::vector<const astNode*> added;
+        for (const astNode* node : nodes) {
+            if (hoisted_.count(node)) continue;
+            astVarType t;
+            uint32_t r = expr(node, t);
+            hoisted_[node] = { r, t };
+            added.push_back(node);
+        }
+        return added;
+    }
+    void unhoist(const std::vector<const astNode*>& nodes) {
+        for (const astNode* node : nodes) hoisted_.erase(node);
+    }
+
+    // The register of an int variable the increment steps by a constant, NO_REG if
+    // it isn't one
+    uint32_t inductionVariable(const astNode* increment, int64_t& step) const {
+        const variableNode* var = nullptr;
+        if (increment && increment->type == astNodeType::UNARYOP) {
+            auto n = static_cast<const unaryOpNode*>(increment);
+            if (!isStep(n->op) || !n->operand || n->operand->type != astNodeType::VARIABLE) return NO_REG;
+            var = static_cast<const variableNode*>(n->operand.get());
+            step = n->op == opKind::PRE_INCREMENT || n->op == opKind::POST_INCREMENT ? 1 : -1;
+            if (var->global || var->valueType != astVarType::INT) return NO_REG;
+            return slotBase_ + var->slot;
+        }
+        if (increment && increment->type == astNodeType::ASSIGNOP) {
+            auto n = static_cast<const assignOpNode*>(increment);
+            if ((n->op != opKind::ASSIGN_ADD && n->op != opKind::ASSIGN_SUB) || n->global ||
+                n->valueType != astVarType::INT || !n->value || n->value->type != astNodeType::INT) {
+                return NO_REG;
+            }
+            int64_t k = static_cast<const intLiteralNode*>(n->value.get())->value;
+            step = n->op == opKind::ASSIGN_ADD ? k : -k;
+            return slotBase_ + n->slot;
+        }
+        return NO_REG;
+    }
+
+    // Iterations of for (int i = a; i op b; i += step) counted up to the unroll
+    // limit, -1 when the bounds aren't literals or there are more
+    int64_t tripCount(const forNode* n, uint32_t induction, int64_t step) const {
+        if (!n->init || n->init->type != astNodeType::VARDECL || !n->condition) return -1;
+        auto init = static_cast<const varDeclNode*>(n->init.get());
+        if (slotBase_ + init->slot != induction || !init->initializer || init->initializer->type != astNodeType::INT) return -1;
+        if (n->condition->type != astNodeType::BINARYOP) return -1;
+        auto cond = static_cast<const binaryOpNode*>(n->condition.get());
+        if (!isComparison(cond->op) || !cond->left || cond->left->type != astNodeType::VARIABLE ||
+            !cond->right || cond->right->type != astNodeType::INT) {
+            return -1;
+        }
+        auto var = static_cast<const variableNode*>(cond->left.get());
+        if (var->global || slotBase_ + var->slot != induction) return -1;
+
+        int64_t i = static_cast<const intLiteralNode*>(init->initializer.get())->value;
+        int64_t bound = static_cast<const intLiteralNode*>(cond->right.get())->value;
+        int64_t trips = 0;
+        for (; trips <= MAX_UNROLL_TRIPS; trips++, i += step) {
+            bool more;
+            switch (cond->op) {
+                case opKind::LESSTHAN: more = i < bound; break;
+                case opKind::MORETHAN: more = i > bound; break;
+                case opKind::LESSTHANEQUAL: more = i <= bound; break;
+                case opKind::MORETHANEQUAL: more = i >= bound; break;
+                case opKind::EQUAL: more = i == bound; break;
+                default: more = i != bound; break;
+            }
+            if (!more) return trips;
+        }
+        return -1;
+    }
+
+    // A variable a kernel reads or writes, slot is NO_SLOT when unused
+    struct varRef {
+        uint32_t slot = NO_SLOT;
+        bool global = false;
+        astVarType type = astVarType::INFERRED;
+    };
+
+    // What a loop body vectorizes to, found before any code is emitted
+    struct kernelPlan {
+        bcKernel::kind shape = bcKernel::SUM;
+        opKind op = opKind::ADD;
+        bool scalarLeft = false;
+        astVarType listType = astVarType::INFERRED;
+        const astNode* scalar = nullptr;
+        varRef acc;
+        varRef lists[3]; // a, b and dst
+        std::vector<int> checked; // into lists
+    };
+    static constexpr int LIST_A = 0, LIST_B = 1, LIST_DST = 2;
+
+    bool isLocal(const astNode* node, uint32_t reg) const {
+        if (!node || node->type != astNodeType::VARIABLE) return false;
+        auto var = static_cast<const variableNode*>(node);
+        return !var->global && slotBase_ + var->slot == reg;
+    }
+    static bool isVar(const astNode* node, uint32_t slot, bool global) {
+        if (!node || node->type != astNodeType::VARIABLE) return false;
+        auto var = static_cast<const variableNode*>(node);
+        return var->slot == slot && var->global == global;
+    }
+    // The only statement of nested bodies, nullptr if there are more
+    static const astNode* single(const astNode* node) {
+        while (node && node->type == astNodeType::BODY) {
+            auto body = static_cast<const bodyNode*>(node);
+            if (body->statements.size() != 1) return nullptr;
+            node = body->statements[0].get();
+        }
+        return node;
+    }
+
+    // Adds x of x[i], where i is the induction variable, all lists of a kernel share a type
+    bool listAt(const astNode* node, uint32_t induction, kernelPlan& plan, int role) const {
+        if (!node || node->type != astNodeType::INDEX) return false;
+        auto n = static_cast<const indexNode*>(node);
+        if (!isLocal(n->index.get(), induction) || !n->list || n->list->type != astNodeType::VARIABLE) return false;
+        auto list = static_cast<const variableNode*>(n->list.get());
+        if (!isListType(list->valueType) || (plan.listType != astVarType::INFERRED && plan.listType != list->valueType)) return false;
+        plan.listType = list->valueType;
+        plan.lists[role] = { list->slot, list->global, list->valueType };
+        return true;
+    }
+
+    // acc += a[i], acc += a[i] * b[i], or the same spelled acc = acc + ...
+    bool planSum(const assignOpNode* n, uint32_t induction, kernelPlan& plan) const {
+        const astNode* term = nullptr;
+        if (n->op == opKind::ASSIGN_ADD) {
+            term = n->value.get();
+        } else if (n->op == opKind::ASSIGN && n->value && n->value->type == astNodeType::BINARYOP) {
+            auto add = static_cast<const binaryOpNode*>(n->value.get());
+            if (add->op != opKind::ADD) return false;
+            if (isVar(add->left.get(), n->slot, n->global)) term = add->right.get();
+            else if (isVar(add->right.get(), n->slot, n->global)) term = add->left.get();
+        }
+        if (!term) return false;
+        if (listAt(term, induction, plan, LIST_A)) {
+            plan.shape = bcKernel::SUM;
+            plan.checked = { LIST_A };
+        } else if (term->type == astNodeType::BINARYOP) {
+            auto mul = static_cast<const binaryOpNode*>(term);
+            if (mul->op != opKind::MUL || !listAt(mul->left.get(), induction, plan, LIST_A) ||
+                !listAt(mul->right.get(), induction, plan, LIST_B)) {
+                return false;
+            }
+            plan.shape = bcKernel::DOT;
+            plan.checked = { LIST_A, LIST_B };
+        } else {
+            return false;
+        }
+        plan.acc = { n->slot, n->global, n->valueType };
+        return n->valueType == elementType(plan.listType);
+    }
+
+    // dst[i] = a[i] op b[i], a[i] op s, s op a[i] or s, and dst[i] op= b[i] or s
+    bool planStore(const assignOpNode* n, uint32_t induction, const loopInvariants& invariants, kernelPlan& plan) const {
+        if (!isLocal(n->index.get(), induction) || !isListType(n->valueType)) return false;
+        plan.listType = n->valueType;
+        plan.lists[LIST_DST] = { n->slot, n->global, n->valueType };
+        const astNode* left = nullptr;
+        const astNode* right = nullptr;
+        if (n->op == opKind::ASSIGN) {
+            if (invariants.invariant(n->value.get())) {
+                plan.shape = bcKernel::FILL;
+                plan.scalar = n->value.get();
+                plan.checked = { LIST_DST };
+                return true;
+            }
+            if (!n->value || n->value->type != astNodeType::BINARYOP) return false;
+            auto value = static_cast<const binaryOpNode*>(n->value.get());
+            plan.op = value->op;
+            left = value->left.get();
+            right = value->right.get();
+            if (!listAt(left, induction, plan, LIST_A)) {
+                if (!invariants.invariant(left) || !listAt(right, induction, plan, LIST_A)) return false;
+                plan.scalarLeft = true;
+                plan.scalar = left;
+            } else if (!listAt(right, induction, plan, LIST_B)) {
+                if (!invariants.invariant(right)) return false;
+                plan.scalar = right;
+            }
+        } else {
+            plan.op = compoundBase(n->op);
+            plan.lists[LIST_A] = plan.lists[LIST_DST];
+            if (!listAt(n->value.get(), induction, plan, LIST_B)) {
+                if (!invariants.invariant(n->value.get())) return false;
+                plan.scalar = n->value.get();
+            }
+        }
+        if (plan.lists[LIST_A].slot != NO_SLOT && n->op == opKind::ASSIGN) plan.checked.push_back(LIST_A);
+        if (plan.lists[LIST_B].slot != NO_SLOT) plan.checked.push_back(LIST_B);
+        plan.checked.push_back(LIST_DST);
+        plan.shape = bcKernel::MAP;
+        switch (plan.op) {
+            case opKind::ADD: case opKind::SUB: case opKind::MUL: return true;
+            case opKind::DIV: return plan.listType == astVarType::DOUBLE_LIST; // integers may divide by zero
+            default: return false;
+        }
+    }
+
+    // if (a[i] cmp s) acc++, with acc an int
+    bool planCount(const ifNode* n, uint32_t induction, const loopInvariants& invariants, kernelPlan& plan) const {
+        const astNode* step = single(n->thenBody.get());
+        if (n->elseBody || !step || !n->condition || n->condition->type != astNodeType::BINARYOP) return false;
+        if (step->type == astNodeType::UNARYOP) {
+            auto inc = static_cast<const unaryOpNode*>(step);
+            if ((inc->op != opKind::PRE_INCREMENT && inc->op != opKind::POST_INCREMENT) || !inc->operand ||
+                inc->operand->type != astNodeType::VARIABLE) {
+                return false;
+            }
+            auto var = static_cast<const variableNode*>(inc->operand.get());
+            plan.acc = { var->slot, var->global, var->valueType };
+        } else if (step->type == astNodeType::ASSIGNOP) {
+            auto add = static_cast<const assignOpNode*>(step);
+            if (add->op != opKind::ASSIGN_ADD || add->index || !add->value || add->value->type != astNodeType::INT ||
+                static_cast<const intLiteralNode*>(add->value.get())->value != 1) {
+                return false;
+            }
+            plan.acc = { add->slot, add->global, add->valueType };
+        } else {
+            return false;
+        }
+        if (plan.acc.type != astVarType::INT) return false;
+
+        auto cond = static_cast<const binaryOpNode*>(n->condition.get());
+        if (!isComparison(cond->op)) return false;
+        plan.op = cond->op;
+        if (listAt(cond->left.get(), induction, plan, LIST_A) && invariants.invariant(cond->right.get())) {
+            plan.scalar = cond->right.get();
+        } else if (listAt(cond->right.get(), induction, plan, LIST_A) && invariants.invariant(cond->left.get())) {
+            // s < a[i] is a[i] > s
+            plan.scalar = cond->left.get();
+            switch (cond->op) {
+                case opKind::LESSTHAN: plan.op = opKind::MORETHAN; break;
+                case opKind::MORETHAN: plan.op = opKind::LESSTHAN; break;
+                case opKind::LESSTHANEQUAL: plan.op = opKind::MORETHANEQUAL; break;
+                case opKind::MORETHANEQUAL: plan.op = opKind::LESSTHANEQUAL; break;
+                default: break;
+            }
+        } else {
+            return false;
+        }
+        plan.shape = bcKernel::COUNT;
+        plan.checked = { LIST_A };
+        return true;
+    }
+
+    // for (...; i < end; i++) over a body one of the kernels covers becomes a VEC,
+    // false when it isn't one and nothing was emitted
+    bool vectorize(const forNode* n, uint32_t induction, const loopInvariants& invariants) {
+        if (!n->condition || n->condition->type != astNodeType::BINARYOP) return false;
+        auto cond = static_cast<const binaryOpNode*>(n->condition.get());
+        if (cond->op != opKind::LESSTHAN || !isLocal(cond->left.get(), induction) || !invariants.invariant(cond->right.get())) {
+            return false;
+        }
+        const astNode* body = single(n->body.get());
+        if (!body) return false;
+        kernelPlan plan;
+        bool planned = false;
+        if (body->type == astNodeType::IF) {
+            planned = planCount(static_cast<const ifNode*>(body), induction, invariants, plan);
+        } else if (body->type == astNodeType::ASSIGNOP) {
+            auto assign = static_cast<const assignOpNode*>(body);
+            planned = assign->index ? planStore(assign, induction, invariants, plan) : planSum(assign, induction, plan);
+        }
+        if (!planned) return false;
+
+        // Operand types are only known once compiled, on a mismatch the code is dropped
+        size_t mark = fn_->code.size();
+        uint32_t saved = tempTop_;
+        auto rollback = [&] {
+            fn_->code.resize(mark);
+            tempTop_ = saved;
+            return false;
+        };
+        bcKernel k;
+        k.shape = plan.shape;
+        k.isDouble = plan.listType == astVarType::DOUBLE_LIST;
+        k.op = plan.op;
+        k.scalarLeft = plan.scalarLeft;
+        k.index = induction;
+        astVarType et;
+        k.end = expr(cond->right.get(), et);
+        if (!isIntClass(et)) return rollback();
+        astVarType element = elementType(plan.listType);
+        if (plan.scalar) {
+            astVarType st;
+            uint32_t s = expr(plan.scalar, st);
+            // Mixed int and double arithmetic would be done in doubles
+            if (!isNumeric(st) || (!k.isDouble && !isIntClass(st) && plan.shape != bcKernel::FILL)) return rollback();
+            k.scalar = convert(s, st, element);
+        }
+        uint32_t regs[3] = { NO_REG, NO_REG, NO_REG };
+        for (int role = 0; role < 3; role++) {
+            const varRef& list = plan.lists[role];
+            if (list.slot != NO_SLOT) regs[role] = readVar(list.slot, list.global, list.type);
+        }
+        k.a = regs[LIST_A];
+        k.b = regs[LIST_B];
+        k.dst = regs[LIST_DST];
+        for (int role : plan.checked) k.checked.push_back(regs[role]);
+        if (plan.acc.slot != NO_SLOT) k.acc = readVar(plan.acc.slot, plan.acc.global, plan.acc.type);
+
+        fn_->kernels.push_back(std::move(k));
+        emit(bcOp::VEC, (uint32_t)(fn_->kernels.size() - 1));
+        if (plan.acc.slot != NO_SLOT) writeBack(plan.acc.slot, plan.acc.global, plan.acc.type, fn_->kernels.back().acc);
+        return true;
+    }
+
+    void forLoop(const forNode* n) {
+        stmt(n->init.get());
+
+        // The induction variable may only change in the increment
+        int64_t step = 0;
+        uint32_t induction = inductionVariable(n->increment.get(), step);
+        loopWrites writes(slotBase_);
+        writes.visit(n->condition.get());
+        writes.visit(n->body.get());
+        if (induction != NO_REG && writes.locals.count(induction)) induction = NO_REG;
+        writes.visit(n->increment.get());
+
+        loopInvariants invariants(writes, slotBase_, induction);
+        invariants.visit(n->condition.get());
+        invariants.visit(n->body.get());
+        std::vector<const astNode*> hoisted = hoist(invariants.found);
+
+        int64_t trips = induction != NO_REG ? tripCount(n, induction, step) : -1;
+        if (trips >= 0 && (uint64_t)trips * bodySize(n->body.get()).nodes <= UNROLL_BUDGET) {
+            // Unrolled, the bounds are known so the condition is never tested
+            std::vector<size_t> breaks;
+            for (int64_t k = 0; k < trips; k++) {
+                loops_.emplace_back();
+                stmt(n->body.get());
+                patchAll(loops_.back().continues, here());
+                stmt(n->increment.get());
+                breaks.insert(breaks.end(), loops_.back().breaks.begin(), loops_.back().breaks.end());
+                loops_.pop_back();
+            }
+            patchAll(breaks, here());
+            unhoist(hoisted);
+            return;
+        }
+        if (induction != NO_REG && step == 1 && vectorize(n, induction, invariants)) {
+            unhoist(hoisted);
+            return;
+        }
+
+        // Strength reduction: i * c lives in a register that grows by step * c
+        std::vector<std::pair<uint32_t, uint32_t>> reduced; // product and increment registers
+        std::vector<const astNode*> products;
+        for (const auto& product : invariants.products) {
+            astVarType ft;
+            uint32_t factor = expr(product.second, ft);
+            if (!isIntClass(ft)) continue;
+            uint32_t r = temp();
+            emit(bcOp::MUL_I, r, induction, factor);
+            uint32_t delta = factor;
+            if (step != 1) {
+                delta = temp();
+                emit(bcOp::MUL_I, delta, factor, loadInt(step, NO_REG));
+            }
+            reduced.emplace_back(r, delta);
+            hoisted_[product.first] = { r, astVarType::INT };
+            products.push_back(product.first);
+        }
+
+        size_t toTest = emit(bcOp::JMP);
+        uint32_t body = here();
+        loops_.emplace_back();
+        stmt(n->body.get());
+        uint32_t next = here();
+        stmt(n->increment.get());
+        for (const auto& r : reduced) emit(bcOp::ADD_I, r.first, r.first, r.second);
+        patch(toTest, here());
+        if (n->condition) {
+            patchAll(jumpIf(n->condition.get(), true), body);
+        } else {
+            emit(bcOp::JMP, body);
+        }
+        patchAll(loops_.back().breaks, here());
+        patchAll(loops_.back().continues, next);
+        loops_.pop_back();
+        unhoist(hoisted);
+        unhoist(products);
+    }
+
+    void stmt(const astNode* node) {
+        if (!node) return;
+        uint32_t saved = tempTop_; // statement results are dead afterwards
+        switch (node->type) {
+            case astNodeType::BODY:
+                for (const auto& s : static_cast<const bodyNode*>(node)->statements) stmt(s.get());
+                break;
+            case astNodeType::VARDECL: {
+                auto n = static_cast<const varDeclNode*>(node);
+                if (n->global) {
+                    uint32_t g = globalIndex(n->slot);
+                    uint32_t r = temp();
+                    if (n->initializer) {
+                        astVarType t;
+                        uint32_t v = expr(n->initializer.get(), t);
+                        convertInto(r, v, t, n->varType);
+                    } else {
+                        loadDefault(n->varType, r);
+                    }
+                    emit(n->varType == astVarType::DOUBLE ? bcOp::GSET_D : bcOp::GSET, g, r);
+                    break;
+                }
+                // Declared after the initializer, which may still see an outer variable in this slot
+                if (n->initializer) {
+                    astVarType t;
+                    uint32_t v = expr(n->initializer.get(), t);
+                    convertInto(slotBase_ + n->slot, v, t, n->varType);
+                } else {
+                    loadDefault(n->varType, slotBase_ + n->slot);
+                }
+                break;
+            }
+            case astNodeType::IF: {
+                auto n = static_cast<const ifNode*>(node);
+                std::vector<size_t> toElse = jumpIf(n->condition.get(), false);
+                stmt(n->thenBody.get());
+                if (n->elseBody) {
+                    size_t toEnd = emit(bcOp::JMP);
+                    patchAll(toElse, here());
+                    stmt(n->elseBody.get());
+                    patch(toEnd, here());
+                } else {
+                    patchAll(toElse, here());
+                }
+                break;
+            }
+            case astNodeType::WHILE: {
+                // Rotated: one conditional branch per iteration
+                auto n = static_cast<const whileNode*>(node);
+                loopWrites writes(slotBase_);
+                writes.visit(n->condition.get());
+                writes.visit(n->body.get());
+                loopInvariants invariants(writes, slotBase_, NO_REG);
+                invariants.visit(n->condition.get());
+                invariants.visit(n->body.get());
+                std::vector<const astNode*> hoisted = hoist(invariants.found);
+                size_t toTest = emit(bcOp::JMP);
+                uint32_t body = here();
+                loops_.emplace_back();
+                stmt(n->body.get());
+                uint32_t test = here();
+                patch(toTest, test);
+                patchAll(jumpIf(n->condition.get(), true), body);
+                patchAll(loops_.back().breaks, here());
+                patchAll(loops_.back().continues, test);
+                loops_.pop_back();
+                unhoist(hoisted);
+                break;
+            }
+            case astNodeType::FOR:
+                forLoop(static_cast<const forNode*>(node));
+                break;
+            case astNodeType::RETURN: {
+                auto n = static_cast<const returnNode*>(node);
+                if (!inlines_.empty()) {
+                    // By index, the value may inline calls of its own and grow inlines_
+                    size_t frame = inlines_.size() - 1;
+                    astVarType t;
+                    if (node_->returnType == astVarType::VOID) {
+                        if (n->value) expr(n->value.get(), t);
+                    } else {
+                        uint32_t v = expr(n->value.get(), t);
+                        convertInto(inlines_[frame].out, v, t, node_->returnType);
+                    }
+                    if (node != inlines_[frame].last) inlines_[frame].exits.push_back(emit(bcOp::JMP));
+                    break;
+                }
+                if (node_->returnType == astVarType::VOID) {
+                    if (n->value) {
+                        astVarType t;
+                        expr(n->value.get(), t);
+                    }
+                    emit(bcOp::RETV);
+                    break;
+                }
+                if (!n->value) fail("Missing return value");
+                astVarType t;
+                uint32_t v = expr(n->value.get(), t);
+                emit(bcOp::RET, convert(v, t, node_->returnType));
+                break;
+            }
+            case astNodeType::BREAK:
+            case astNodeType::CONTINUE:
+                if (loops_.empty()) fail(std::string(node->type == astNodeType::BREAK ? "break" : "continue") + " outside of a loop");
+                (node->type == astNodeType::BREAK ? loops_.back().breaks : loops_.back().continues).push_back(emit(bcOp::JMP));
+                break;
+            case astNodeType::IMPORT:
+            case astNodeType::FUNCTION:
+                break;
+            case astNodeType::UNARYOP: {
+                astVarType t;
+                unary(static_cast<const unaryOpNode*>(node), t, false);
+                break;
+            }
+            default: {
+                astVarType t;
+                expr(node, t);
+                break;
+            }
+        }
+        tempTop_ = saved;
+    }
+
+    void begin(bcFunction& fn, const functionNode* node, uint32_t frameSize) {
+        fn_ = &fn;
+        node_ = node;
+        tempTop_ = frameSize;
+        slotBase_ = 0;
+        fn.registerCount = frameSize;
+        loops_.clear();
+        inlined_.clear();
+        if (node) inlined_.push_back(node);
+    }
+
+    void compileFunction(const functionNode* node) {
+        bcFunction fn;
+        fn.name = std::string(node->name.str());
+        fn.paramCount = (uint32_t)node->params.size();
+        for (const paramNode& param : node->params) fn.paramTypes.push_back(param.type);
+        fn.returnType = node->returnType;
+        begin(fn, node, node->frameSize);
+        stmt(node->body.get());
+        emit(node->returnType == astVarType::VOID ? bcOp::RETV : bcOp::NORET);
+
+        uint32_t index = functions_.at(node);
+        if (prog_.functions.size() <= index) prog_.functions.resize(index + 1);
+        prog_.functions[index] = std::move(fn);
+    }
+
+public:
+    explicit bcCompiler(bcProgram& prog) : prog_(prog) {}
+
+    void compile(const programNode& program, const std::vector<const programNode*>& imports) {
+        std::vector<const programNode*> modules = imports;
+        modules.push_back(&program);
+
+        const functionNode* main = nullptr;
+        symbol mainName = intern("main");
+        for (const programNode* m : modules) {
+            if (!m->resolved) throw runtimeError("Program has not been resolved");
+            for (const auto& decl : m->declarations) {
+                if (!decl) continue;
+                if (decl->type == astNodeType::FUNCTION) {
+                    auto fn = static_cast<const functionNode*>(decl.get());
+                    if (m == &program && fn->name == mainName && !main) main = fn;
+                } else if (decl->type == astNodeType::VARDECL) {
+                    auto var = static_cast<const varDeclNode*>(decl.get());
+                    if (globals_.count(var->slot)) continue;
+                    globals_[var->slot] = (uint32_t)globalTypes_.size();
+                    globalTypes_.push_back(var->varType);
+                }
+            }
+        }
+        if (!main) throw runtimeError("No main function");
+        if (!main->params.empty()) throw runtimeError("main must not take parameters");
+        prog_.globalCount = (uint32_t)globalTypes_.size();
+
+        // Entry: global initializers in import order, then main
+        bcFunction entry;
+        entry.name = "<entry>";
+        entry.returnType = astVarType::INT;
+        begin(entry, nullptr, 0);
+        for (const programNode* m : modules) {
+            for (const auto& decl : m->declarations) {
+                if (decl && decl->type == astNodeType::VARDECL) stmt(decl.get());
+            }
+        }
+        uint32_t result = main->returnType == astVarType::VOID ? NO_REG : temp();
+        emit(bcOp::CALL, result, functionIndex(main), tempTop_);
+        if (result == NO_REG) {
+            result = loadInt(0, NO_REG);
+        } else if (main->returnType != astVarType::INT) {
+            result = convert(result, main->returnType, astVarType::INT);
+        }
+        emit(bcOp::RET, result);
+
+        // Compiling a function can reference more, functions nothing calls are left out
+        for (size_t i = 0; i < pending_.size(); i++) compileFunction(pending_[i]);
+        prog_.entry = (uint32_t)prog_.functions.size();
+        prog_.functions.push_back(std::move(entry));
+    }
+};
+
+} // namespace
+
+std::string_view bcKernelName(bcKernel::kind shape) {
+    switch (shape) {
+        case bcKernel::SUM: return "SUM";
+        case bcKernel::DOT: return "DOT";
+        case bcKernel::MAP: return "MAP";
+        case bcKernel::FILL: return "FILL";
+        default: return "COUNT";
+    }
+}
+
+std::string_view bcOpToString(bcOp op) {
+    return (uint32_t)op < (uint32_t)bcOp::OP_COUNT ? opNames[(uint32_t)op] : "?";
+}
+
+bcProgram compileBytecode(const programNode& program, const std::vector<const programNode*>& imports) {
+    bcProgram prog;
+    bcCompiler(prog).compile(program, imports);
+    return prog;
+}
+
+void bcProgram::print(std::ostream& out) const {
+    for (size_t f = 0; f < functions.size(); f++) {
+        const bcFunction& fn = functions[f];
+        out << "function " << f << " " << fn.name << " (params=" << fn.paramCount
+            << ", registers=" << fn.registerCount << ")\n";
+        for (size_t pc = 0; pc < fn.code.size(); pc++) {
+            const bcInstr& in = fn.code[pc];
+            out << "  " << pc << ": " << bcOpToString(in.op) << " " << (int32_t)in.a << " "
+                << (int32_t)in.b << " " << (int32_t)in.c << "\n";
+        }
+        for (size_t k = 0; k < fn.kernels.size(); k++) {
+            const bcKernel& kernel = fn.kernels[k];
+            out << "  kernel " << k << ": " << bcKernelName(kernel.shape) << (kernel.isDouble ? "_D" : "_I");
+            if (kernel.shape == bcKernel::MAP || kernel.shape == bcKernel::COUNT) out << " " << opToString(kernel.op);
+            out << " i=" << kernel.index << " end=" << (int32_t)kernel.end << " acc=" << (int32_t)kernel.acc
+                << " dst=" << (int32_t)kernel.dst << " a=" << (int32_t)kernel.a << " b=" << (int32_t)kernel.b
+                << " scalar=" << (int32_t)kernel.scalar << (kernel.scalarLeft ? " (left)" : "") << "\n";
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "ast.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Register bytecode lowered from a resolved tree (see resolveProgram), run by vm.
+// Every register has a static type, so registers are untagged and each operation
+// comes in one variant per operand type. int, boolean and char all live in .i
+// (booleans as 0 / 1, chars as 0..255), doubles in .d, strings in .s and lists in .l,
+// which points at the length followed by the elements (.i or .d).
+//
+// Operands are a, b, c. Unless noted, a is the destination and b / c the sources.
+// Jump targets are instruction indices.
+#define QUR_BC_OPS(X) \
+    X(MOV)      /* a = b, int class and string registers */ \
+    X(MOV_D) \
+    X(LOADK)    /* a = constants[b] */ \
+    X(LOADK_D) X(LOADK_S) \
+    X(GGET)     /* a = globals[b] */ \
+    X(GGET_D) \
+    X(GSET)     /* globals[a] = b */ \
+    X(GSET_D) \
+    X(I2D) X(D2I) X(I2B) X(D2B) X(I2C) X(S2B) \
+    X(ADD_I) X(SUB_I) X(MUL_I) X(DIV_I) X(MOD_I) \
+    X(ADD_D) X(SUB_D) X(MUL_D) X(DIV_D) X(MOD_D) \
+    X(LT_I) X(GT_I) X(LE_I) X(GE_I) X(EQ_I) X(NE_I) \
+    X(LT_D) X(GT_D) X(LE_D) X(GE_D) X(EQ_D) X(NE_D) \
+    X(LT_S) X(GT_S) X(LE_S) X(GE_S) X(EQ_S) X(NE_S) \
+    X(NEG_I) X(NEG_D) X(NOT) X(INV_I) \
+    X(INC_I)    /* a += c in place */ \
+    X(INC_D) \
+    X(CONCAT) X(TOSTR_I) X(TOSTR_D) X(TOSTR_B) X(TOSTR_C) \
+    X(JOIN)     /* a = b .. b + c - 1 concatenated, sized and allocated once */ \
+    X(NEWLIST)  /* a = list of b zeros */ \
+    X(LGET)     /* a = b[c], the index is checked */ \
+    X(LGET_D) \
+    X(LSET)     /* a[b] = c */ \
+    X(LSET_D) \
+    X(LEN)      /* a = length of b */ \
+    X(VEC)      /* runs kernels[a] */ \
+    X(JMP)      /* goto a */ \
+    X(JZ)       /* if a == 0 goto b */ \
+    X(JNZ) \
+    X(JLT_I)    /* if a < b goto c, fused compare and branch for loop conditions */ \
+    X(JGT_I) X(JLE_I) X(JGE_I) X(JEQ_I) X(JNE_I) \
+    X(CALL)     /* a = functions[b](registers from c on), a may be NO_REG */ \
+    X(RET)      /* return a */ \
+    X(RETV) \
+    X(NORET)    /* fell off the end of a function with a result */ \
+    X(PRINT_I) X(PRINT_D) X(PRINT_B) X(PRINT_C) X(PRINT_S) \
+    X(PRINT_SP) X(PRINT_NL)
+
+enum class bcOp : uint32_t {
+#define QUR_BC_ENUM(name) name,
+    QUR_BC_OPS(QUR_BC_ENUM)
+#undef QUR_BC_ENUM
+    OP_COUNT,
+};
+
+std::string_view bcOpToString(bcOp op);
+
+constexpr uint32_t NO_REG = 0xFFFFFFFFu;
+
+struct bcInstr {
+    bcOp op;
+    uint32_t a, b, c;
+};
+
+union bcReg {
+    int64_t i;
+    double d;
+    const std::string* s;
+    bcReg* l;
+};
+
+// An element-wise for loop over lists, for (; i < end; i++) with one of these bodies:
+//   SUM    acc += a[i]              DOT    acc += a[i] * b[i]
+//   MAP    dst[i] = a[i] op b[i]    (or a[i] op scalar, scalar op a[i])
+//   FILL   dst[i] = scalar          COUNT  if (a[i] cmp scalar) acc++
+// Operands are registers. Indices from i up to end are checked before anything
+// runs, failing with the index the loop would have failed at, then i is left at
+// end. Doubles are summed in loop order, so results match the loop exactly.
+struct bcKernel {
+    enum kind : uint8_t { SUM, DOT, MAP, FILL, COUNT };
+
+    kind shape;
+    bool isDouble; // of the elements, acc (but COUNT's count) and scalar have the same type
+    opKind op = opKind::ADD; // MAP: + - * /, COUNT: a comparison
+    bool scalarLeft = false; // MAP: scalar op a[i]
+    uint32_t index, end;
+    uint32_t acc = NO_REG;
+    uint32_t dst = NO_REG;
+    uint32_t a = NO_REG, b = NO_REG;
+    uint32_t scalar = NO_REG;
+    std::vector<uint32_t> checked; // lists in the order the loop body indexes them
+};
+
+std::string_view bcKernelName(bcKernel::kind shape);
+
+struct bcFunction {
+    std::string name;
+    uint32_t paramCount = 0;
+    std::vector<astVarType> paramTypes;
+    astVarType returnType = astVarType::VOID;
+    uint32_t registerCount = 0; // params first, then locals, then temporaries
+    std::vector<bcInstr> code;
+    std::vector<bcReg> constants;
+    std::vector<bcKernel> kernels;
+};
+
+struct bcProgram {
+    std::vector<bcFunction> functions;
+    uint32_t entry = 0; // runs global initializers, then main
+    uint32_t globalCount = 0;
+
+    void print(std::ostream& out) const;
+};
+
+// program and its imports must have been resolved and must outlive the result,
+// string constants point into the tree. Operations are picked from the static types
+// the semantic pass annotated, which has already rejected ill-typed programs.
+bcProgram compileBytecode(const programNode& program, const std::vector<const programNode*>& imports = {});
+
+#endif // BYTECODE_H
@@ -0,0 +1,45 @@
+#include "cache.h"
+#include "flatast.h"
+#include "hash.h"
+#include "serialize.h"
+
+#include <cstdio>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+buildCache::buildCache(const std::string& dir) : dir_(dir) {
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+}
+
+uint64_t buildCache::key(const char* data, size_t size) {
+    uint64_t seed = compilerVersionHash() ^ ((uint64_t)AST_FORMAT_VERSION << 56);
+    return fnv1a64(data, size, seed);
+}
+
+std::string buildCache::pathFor(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.qast", (unsigned long long)key);
+    return (fs::path(dir_) / name).string();
+}
+
+bool buildCache::load(uint64_t key, AST& ast) const {
+    std::error_code ec;
+    std::string path = pathFor(key);
+    if ( !fs::exists(path, ec) ) return false; // miss
+    try {
+        astImage image(path);
+        if ( image.sourceHash() != key ) return false;
+        nodePtr<programNode> root = image.toFlat().toProgram(ast.arena());
+        if ( !root ) return false;
+        ast.setRoot(std::move(root));
+        return true;
+    } catch ( const std::exception& ) {
+        return false; // unreadable, corrupt or foreign entry, overwritten by the next store
+    }
+}
+
+void buildCache::store(uint64_t key, const programNode& root) const {
+    writeAST(pathFor(key), flatAST::fromProgram(root), key);
+}
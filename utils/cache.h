@@ -0,0 +1,30 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "ast.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Serialized ASTs on disk, one file per source contents. Entries are never
+// invalidated explicitly: editing a file or upgrading the compiler changes the key.
+// Safe to share between threads and between concurrent compiler processes.
+class buildCache {
+private:
+    std::string dir_;
+
+public:
+    // Creates dir if needed
+    explicit buildCache(const std::string& dir);
+
+    // Content hash of a source file, seeded with the compiler and format versions
+    static uint64_t key(const char* data, size_t size);
+    std::string pathFor(uint64_t key) const;
+
+    // Installs the cached tree as ast's root, false on a miss or an unusable entry
+    bool load(uint64_t key, AST& ast) const;
+    // Best effort, a failed write only costs a reparse next time
+    void store(uint64_t key, const programNode& root) const;
+};
+
+#endif // CACHE_H
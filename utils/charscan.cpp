@@ -0,0 +1,200 @@
+#include "charscan.h"
+
+#if !defined(QUR_SCAN_SCALAR) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define QUR_SCAN_X86 1
+#include <immintrin.h>
+#elif !defined(QUR_SCAN_SCALAR) && defined(__aarch64__)
+#define QUR_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+struct scanKernels {
+    size_t (*blanks)(const char*, size_t, size_t);
+    size_t (*identifier)(const char*, size_t, size_t);
+    size_t (*stringBody)(const char*, size_t, size_t);
+    const char* name;
+};
+
+size_t scalarBlanks(const char* src, size_t i, size_t n) {
+    while ( i < n && (src[i] == ' ' || src[i] == '\t' || src[i] == '\r') ) i++;
+    return i;
+}
+
+size_t scalarIdentifier(const char* src, size_t i, size_t n) {
+    while ( i < n && hasClass(src[i], CHAR_IDENT) ) i++;
+    return i;
+}
+
+size_t scalarStringBody(const char* src, size_t i, size_t n) {
+    while ( i < n && src[i] != '"' && src[i] != '\\' && src[i] != '\n' ) i++;
+    return i;
+}
+
+const scanKernels scalarKernels{ scalarBlanks, scalarIdentifier, scalarStringBody, "scalar" };
+
+#if QUR_SCAN_X86
+// Ranges are tested with signed compares: x - lo is in [0, hi - lo] unsigned exactly
+// when it is below hi - lo + 1 once both are shifted by 0x80
+
+__m128i inRange128(__m128i x, char lo, char hi) {
+    __m128i shifted = _mm_add_epi8(x, _mm_set1_epi8((char)(0x80 - lo)));
+    return _mm_cmpgt_epi8(_mm_set1_epi8((char)(hi - lo + 1 - 0x80)), shifted);
+}
+
+__m128i isIdent128(__m128i x) {
+    __m128i letter = inRange128(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i digit = inRange128(x, '0', '9');
+    __m128i under = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+    return _mm_or_si128(_mm_or_si128(letter, digit), under);
+}
+
+__m128i isBlank128(__m128i x) {
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+                        _mm_cmpeq_epi8(x, _mm_set1_epi8('\r')));
+}
+
+__m128i isStringStop128(__m128i x) {
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))),
+                        _mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+}
+
+// Skips 16-byte blocks while every byte is in the run, the mask marks bytes in it
+template <__m128i (*inRun)(__m128i), size_t (*tail)(const char*, size_t, size_t)>
+size_t skip128(const char* src, size_t i, size_t n) {
+    while ( i + 16 <= n ) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        unsigned stop = ~(unsigned)_mm_movemask_epi8(inRun(x)) & 0xFFFFu;
+        if ( stop ) return i + __builtin_ctz(stop);
+        i += 16;
+    }
+    return tail(src, i, n);
+}
+
+// For the string body the mask marks the stops instead
+size_t stringBody128(const char* src, size_t i, size_t n) {
+    while ( i + 16 <= n ) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        unsigned stop = (unsigned)_mm_movemask_epi8(isStringStop128(x));
+        if ( stop ) return i + __builtin_ctz(stop);
+        i += 16;
+    }
+    return scalarStringBody(src, i, n);
+}
+
+const scanKernels sse2Kernels{ skip128<isBlank128, scalarBlanks>, skip128<isIdent128, scalarIdentifier>,
+                               stringBody128, "sse2" };
+
+#define QUR_AVX2 __attribute__((target("avx2")))
+
+QUR_AVX2 __m256i inRange256(__m256i x, char lo, char hi) {
+    __m256i shifted = _mm256_add_epi8(x, _mm256_set1_epi8((char)(0x80 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(hi - lo + 1 - 0x80)), shifted);
+}
+
+QUR_AVX2 size_t blanks256(const char* src, size_t i, size_t n) {
+    while ( i + 32 <= n ) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i blank = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')));
+        unsigned stop = ~(unsigned)_mm256_movemask_epi8(blank);
+        if ( stop ) return i + __builtin_ctz(stop);
+        i += 32;
+    }
+    return skip128<isBlank128, scalarBlanks>(src, i, n);
+}
+
+QUR_AVX2 size_t identifier256(const char* src, size_t i, size_t n) {
+    while ( i + 32 <= n ) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i letter = inRange256(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i digit = inRange256(x, '0', '9');
+        __m256i under = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+        unsigned stop = ~(unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(letter, digit), under));
+        if ( stop ) return i + __builtin_ctz(stop);
+        i += 32;
+    }
+    return skip128<isIdent128, scalarIdentifier>(src, i, n);
+}
+
+QUR_AVX2 size_t stringBody256(const char* src, size_t i, size_t n) {
+    while ( i + 32 <= n ) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+                                                      _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\'))),
+                                      _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+        unsigned stop = (unsigned)_mm256_movemask_epi8(hit);
+        if ( stop ) return i + __builtin_ctz(stop);
+        i += 32;
+    }
+    return stringBody128(src, i, n);
+}
+
+const scanKernels avx2Kernels{ blanks256, identifier256, stringBody256, "avx2" };
+#endif
+
+#if QUR_SCAN_NEON
+uint8x16_t isIdent128(uint8x16_t x) {
+    uint8x16_t letter = vcltq_u8(vsubq_u8(vorrq_u8(x, vdupq_n_u8(0x20)), vdupq_n_u8('a')), vdupq_n_u8(26));
+    uint8x16_t digit = vcltq_u8(vsubq_u8(x, vdupq_n_u8('0')), vdupq_n_u8(10));
+    return vorrq_u8(vorrq_u8(letter, digit), vceqq_u8(x, vdupq_n_u8('_')));
+}
+
+uint8x16_t isBlank128(uint8x16_t x) {
+    return vorrq_u8(vorrq_u8(vceqq_u8(x, vdupq_n_u8(' ')), vceqq_u8(x, vdupq_n_u8('\t'))), vceqq_u8(x, vdupq_n_u8('\r')));
+}
+
+uint8x16_t isNotStringStop128(uint8x16_t x) {
+    return vmvnq_u8(vorrq_u8(vorrq_u8(vceqq_u8(x, vdupq_n_u8('"')), vceqq_u8(x, vdupq_n_u8('\\'))),
+                             vceqq_u8(x, vdupq_n_u8('\n'))));
+}
+
+// Narrowing the mask leaves four bits per byte in a 64-bit word
+template <uint8x16_t (*inRun)(uint8x16_t), size_t (*tail)(const char*, size_t, size_t)>
+size_t skipNeon(const char* src, size_t i, size_t n) {
+    while ( i + 16 <= n ) {
+        uint8x16_t x = vld1q_u8(reinterpret_cast<const uint8_t*>(src + i));
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(vmvnq_u8(inRun(x))), 4);
+        uint64_t stop = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if ( stop ) return i + (__builtin_ctzll(stop) >> 2);
+        i += 16;
+    }
+    return tail(src, i, n);
+}
+
+const scanKernels neonKernels{ skipNeon<isBlank128, scalarBlanks>, skipNeon<isIdent128, scalarIdentifier>,
+                               skipNeon<isNotStringStop128, scalarStringBody>, "neon" };
+#endif
+
+const scanKernels& kernels() {
+    static const scanKernels& picked = []() -> const scanKernels& {
+#if QUR_SCAN_X86
+        if ( __builtin_cpu_supports("avx2") ) return avx2Kernels;
+        if ( __builtin_cpu_supports("sse2") ) return sse2Kernels;
+#elif QUR_SCAN_NEON
+        return neonKernels;
+#endif
+        return scalarKernels;
+    }();
+    return picked;
+}
+
+} // namespace
+
+size_t skipBlanks(const char* src, size_t i, size_t n) {
+    return kernels().blanks(src, i, n);
+}
+
+size_t skipIdentifier(const char* src, size_t i, size_t n) {
+    return kernels().identifier(src, i, n);
+}
+
+size_t skipStringBody(const char* src, size_t i, size_t n) {
+    return kernels().stringBody(src, i, n);
+}
+
+const char* scanKernelName() {
+    return kernels().name;
+}
@@ -0,0 +1,45 @@
+#ifndef CHARSCAN_H
+#define CHARSCAN_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Byte classes used by the lexer, the same as the <cctype> functions in the C locale
+enum charClass : uint8_t {
+    CHAR_SPACE = 1 << 0, // ' ', \t, \n, \v, \f, \r
+    CHAR_ALPHA = 1 << 1, // a-z, A-Z, _
+    CHAR_DIGIT = 1 << 2, // 0-9
+    CHAR_IDENT = CHAR_ALPHA | CHAR_DIGIT,
+};
+
+constexpr std::array<uint8_t, 256> charClasses = [] {
+    std::array<uint8_t, 256> classes{};
+    for ( char c : { ' ', '\t', '\n', '\v', '\f', '\r' } ) classes[(unsigned char)c] |= CHAR_SPACE;
+    for ( int c = 'a'; c <= 'z'; c++ ) classes[c] |= CHAR_ALPHA;
+    for ( int c = 'A'; c <= 'Z'; c++ ) classes[c] |= CHAR_ALPHA;
+    classes['_'] |= CHAR_ALPHA;
+    for ( int c = '0'; c <= '9'; c++ ) classes[c] |= CHAR_DIGIT;
+    return classes;
+}();
+
+inline bool hasClass(char c, uint8_t mask) {
+    return charClasses[(unsigned char)c] & mask;
+}
+
+// Run scanners over src[i, n). Each returns the index of the first byte at or after i
+// that ends the run, n if the run reaches the end. Whole blocks are compared at once
+// with the widest vector unit the CPU has (AVX2 or SSE2 on x86-64, NEON on ARM),
+// picked on first use, and a scalar loop finishes the tail or runs everywhere else.
+
+// Space, \t and \r, newlines are left to the caller for line tracking
+size_t skipBlanks(const char* src, size_t i, size_t n);
+// a-z, A-Z, 0-9 and _
+size_t skipIdentifier(const char* src, size_t i, size_t n);
+// Stops at '"', '\\' or '\n'
+size_t skipStringBody(const char* src, size_t i, size_t n);
+
+// Scanners in use: "avx2", "sse2", "neon" or "scalar"
+const char* scanKernelName();
+
+#endif // CHARSCAN_H
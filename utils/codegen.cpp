@@ -0,0 +1,1487 @@
+#include "codegen.h"
+#include "interp.h"
+#include "version.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+namespace {
+
+// Register classes, a bytecode register used as both gets one vreg per class
+enum regClass : uint32_t { GP = 0, FP = 1 };
+
+// Allocatable registers in order of preference. [0, 4) are argument registers,
+// only free for intervals that never meet a call, 4 is caller-saved, the rest
+// callee-saved. rax, rcx, rdx and r11 are scratch.
+const char* const GP_NAMES[] = { "%rsi", "%rdi", "%r8", "%r9", "%r10", "%rbx", "%r12", "%r13", "%r14", "%r15" };
+constexpr int GP_COUNT = 10;
+constexpr int GP_NO_ARGS = 4;
+constexpr int GP_CALLEE_SAVED = 5;
+// [0, 8) are argument registers, xmm14 and xmm15 are scratch
+const char* const FP_NAMES[] = { "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6",
+                                 "%xmm7", "%xmm8", "%xmm9", "%xmm10", "%xmm11", "%xmm12", "%xmm13" };
+constexpr int FP_COUNT = 14;
+constexpr int FP_NO_ARGS = 8;
+
+const char* const ARG_GP[] = { "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9" };
+constexpr uint32_t ARG_GP_COUNT = 6;
+constexpr uint32_t ARG_FP_COUNT = 8;
+
+// Condition codes in the order of LT GT LE GE EQ NE
+const char* const CONDITIONS[] = { "l", "g", "le", "ge", "e", "ne" };
+
+// Shared by every program: string helpers and runtime errors, on top of libc
+const char* const RUNTIME = R"(# (a, b) -> a + b
+.Lrt_concat:
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    subq $8, %rsp
+    movq %rdi, %rbx
+    movq %rsi, %r12
+    call strlen@PLT
+    movq %rax, %r13
+    movq %r12, %rdi
+    call strlen@PLT
+    movq %rax, %r14
+    leaq 1(%r13,%r14), %rdi
+    call malloc@PLT
+    movq %rax, %rdi
+    movq %rbx, %rsi
+    movq %rax, %rbx
+    movq %r13, %rdx
+    call memcpy@PLT
+    leaq (%rbx,%r13), %rdi
+    movq %r12, %rsi
+    leaq 1(%r14), %rdx
+    call memcpy@PLT
+    movq %rbx, %rax
+    addq $8, %rsp
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    ret
+# (rdi = array of rsi strings) -> all of them in order, in one allocation
+.Lrt_join:
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rdi, %rbx
+    movq %rsi, %r12
+    xorl %r13d, %r13d
+    xorl %r14d, %r14d
+1:
+    cmpq %r12, %r14
+    jae 2f
+    movq (%rbx,%r14,8), %rdi
+    call strlen@PLT
+    addq %rax, %r13
+    incq %r14
+    jmp 1b
+2:
+    leaq 1(%r13), %rdi
+    call malloc@PLT
+    movq %rax, %r15
+    movb $0, (%rax)
+    movq %rax, %rdi
+    xorl %r14d, %r14d
+3:
+    cmpq %r12, %r14
+    jae 4f
+    movq (%rbx,%r14,8), %rsi
+    call stpcpy@PLT
+    movq %rax, %rdi
+    incq %r14
+    jmp 3b
+4:
+    movq %r15, %rax
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    ret
+# int -> string
+.Lrt_itos:
+    pushq %rbx
+    pushq %r12
+    subq $8, %rsp
+    movq %rdi, %r12
+    movl $32, %edi
+    call malloc@PLT
+    movq %rax, %rbx
+    movq %rax, %rdi
+    movl $32, %esi
+    leaq .Lfmt_i(%rip), %rdx
+    movq %r12, %rcx
+    xorl %eax, %eax
+    call snprintf@PLT
+    movq %rbx, %rax
+    addq $8, %rsp
+    popq %r12
+    popq %rbx
+    ret
+# double -> string
+.Lrt_dtos:
+    pushq %rbx
+    subq $16, %rsp
+    movsd %xmm0, (%rsp)
+    movl $32, %edi
+    call malloc@PLT
+    movq %rax, %rbx
+    movq %rax, %rdi
+    movl $32, %esi
+    leaq .Lfmt_d(%rip), %rdx
+    movsd (%rsp), %xmm0
+    movl $1, %eax
+    call snprintf@PLT
+    movq %rbx, %rax
+    addq $16, %rsp
+    popq %rbx
+    ret
+# char -> string
+.Lrt_ctos:
+    pushq %rbx
+    movq %rdi, %rbx
+    movl $2, %edi
+    call malloc@PLT
+    movb %bl, (%rax)
+    movb $0, 1(%rax)
+    popq %rbx
+    ret
+# Reports the message in rdi and exits, after the output printed so far
+.Lrt_fail:
+    subq $8, %rsp
+    movq %rdi, %rbx
+    xorl %edi, %edi
+    call fflush@PLT
+    movq %rbx, %rdx
+    movq stderr@GOTPCREL(%rip), %rax
+    movq (%rax), %rdi
+    leaq .Lfmt_err(%rip), %rsi
+    xorl %eax, %eax
+    call fprintf@PLT
+    movl $1, %edi
+    call exit@PLT
+.Lrt_divzero:
+    leaq .Lmsg_div(%rip), %rdi
+    call .Lrt_fail
+# Reports the format in rdi with the numbers in rsi and rdx and exits, like .Lrt_fail
+.Lrt_failf:
+    subq $8, %rsp
+    movq %rdi, %rbx
+    movq %rsi, %r12
+    movq %rdx, %r13
+    xorl %edi, %edi
+    call fflush@PLT
+    movq %r13, %rcx
+    movq %r12, %rdx
+    movq %rbx, %rsi
+    movq stderr@GOTPCREL(%rip), %rax
+    movq (%rax), %rdi
+    xorl %eax, %eax
+    call fprintf@PLT
+    movl $1, %edi
+    call exit@PLT
+# Index rax out of range for the list in rcx, jumped to with any stack alignment
+.Lrt_range:
+    movq %rax, %rsi
+    movq (%rcx), %rdx
+    leaq .Lfmt_range(%rip), %rdi
+    andq $-16, %rsp
+    call .Lrt_failf
+# length -> list of that many zeros, the length is stored in front
+.Lrt_newlist:
+    pushq %rbx
+    movq %rdi, %rbx
+    testq %rdi, %rdi
+    js 1f
+    leaq 1(%rdi), %rdi
+    movl $8, %esi
+    call calloc@PLT
+    movq %rbx, (%rax)
+    popq %rbx
+    ret
+1:
+    movq %rdi, %rsi
+    leaq .Lfmt_length(%rip), %rdi
+    call .Lrt_failf
+)";
+
+const char* const RUNTIME_DATA = R"(.Lfmt_i:
+    .string "%ld"
+.Lfmt_d:
+    .string "%g"
+.Lfmt_s:
+    .string "%s"
+.Lfmt_err:
+    .string "Runtime Error: %s\n"
+.Ltrue:
+    .string "true"
+.Lfalse:
+    .string "false"
+.Lmsg_div:
+    .string "Division by zero"
+.Lfmt_range:
+    .string "Runtime Error: Index %ld out of range for list of length %ld\n"
+.Lfmt_length:
+    .string "Runtime Error: Negative list length %ld\n"
+    .balign 16
+.Lsign:
+    .quad 0x8000000000000000, 0
+)";
+
+bool isReg(const std::string& operand) {
+    return !operand.empty() && operand[0] == '%';
+}
+
+// Instructions that call out, clobbering the caller-saved registers
+bool isCall(bcOp op) {
+    switch (op) {
+        case bcOp::CALL:
+        case bcOp::CONCAT:
+        case bcOp::JOIN:
+        case bcOp::TOSTR_I:
+        case bcOp::TOSTR_D:
+        case bcOp::TOSTR_C:
+        case bcOp::LT_S: case bcOp::GT_S: case bcOp::LE_S:
+        case bcOp::GE_S: case bcOp::EQ_S: case bcOp::NE_S:
+        case bcOp::PRINT_I: case bcOp::PRINT_D: case bcOp::PRINT_B: case bcOp::PRINT_C:
+        case bcOp::PRINT_S: case bcOp::PRINT_SP: case bcOp::PRINT_NL:
+        case bcOp::NEWLIST: case bcOp::VEC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+regClass classOf(astVarType t) {
+    return t == astVarType::DOUBLE ? FP : GP;
+}
+
+// Literal text and doubles, emitted once after the code
+class dataPool {
+private:
+    std::map<std::string, uint32_t> strings_;
+    std::map<uint64_t, uint32_t> doubles_;
+
+public:
+    std::string text(const std::string& bytes) {
+        auto it = strings_.emplace(bytes, (uint32_t)strings_.size()).first;
+        return ".LS" + std::to_string(it->second);
+    }
+    std::string number(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        auto it = doubles_.emplace(bits, (uint32_t)doubles_.size()).first;
+        return ".LD" + std::to_string(it->second);
+    }
+
+    void emit(std::ostream& out) const {
+        for (const auto& kv : strings_) {
+            out << ".LS" << kv.second << ":\n    .string \"";
+            for (unsigned char c : kv.first) {
+                if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') {
+                    out << c;
+                } else {
+                    const char digits[] = { '\\', (char)('0' + (c >> 6)), (char)('0' + ((c >> 3) & 7)), (char)('0' + (c & 7)), 0 };
+                    out << digits;
+                }
+            }
+            out << "\"\n";
+        }
+        if (!doubles_.empty()) out << "    .balign 8\n";
+        for (const auto& kv : doubles_) {
+            out << ".LD" << kv.second << ":\n    .quad " << kv.first << "\n";
+        }
+    }
+};
+
+// Condition code of a comparison, as ordered in CONDITIONS
+uint32_t conditionOf(opKind op) {
+    switch (op) {
+        case opKind::LESSTHAN: return 0;
+        case opKind::MORETHAN: return 1;
+        case opKind::LESSTHANEQUAL: return 2;
+        case opKind::MORETHANEQUAL: return 3;
+        case opKind::EQUAL: return 4;
+        default: return 5;
+    }
+}
+
+// Operands of a kernel helper in argument order: i, end, the lists among a, b and
+// dst, then acc and scalar, each in the next argument register of its class
+struct kernelOperands {
+    std::vector<uint32_t> gp, fp; // bytecode registers
+    int list[3] = { -1, -1, -1 }; // a, b and dst, into gp
+    int acc = -1, scalar = -1; // into gp or fp
+    bool accFP = false, scalarFP = false;
+    std::vector<int> checked; // into list
+};
+
+kernelOperands operandsOf(const bcKernel& k) {
+    kernelOperands ops;
+    ops.gp = { k.index, k.end };
+    const uint32_t lists[3] = { k.a, k.b, k.dst };
+    for (int role = 0; role < 3; role++) {
+        if (lists[role] == NO_REG) continue;
+        ops.list[role] = (int)ops.gp.size();
+        ops.gp.push_back(lists[role]);
+    }
+    for (uint32_t r : k.checked) {
+        for (int role = 0; role < 3; role++) {
+            if (lists[role] != r) continue;
+            // The same register may be indexed twice, as in a[i] = a[i] + 1
+            if (std::find(ops.checked.begin(), ops.checked.end(), role) == ops.checked.end()) ops.checked.push_back(role);
+            break;
+        }
+    }
+    if (k.acc != NO_REG) {
+        ops.accFP = k.isDouble && k.shape != bcKernel::COUNT;
+        std::vector<uint32_t>& regs = ops.accFP ? ops.fp : ops.gp;
+        ops.acc = (int)regs.size();
+        regs.push_back(k.acc);
+    }
+    if (k.scalar != NO_REG) {
+        ops.scalarFP = k.isDouble;
+        std::vector<uint32_t>& regs = ops.scalarFP ? ops.fp : ops.gp;
+        ops.scalar = (int)regs.size();
+        regs.push_back(k.scalar);
+    }
+    return ops;
+}
+
+// Out of line loops for VEC, one helper per kernel shape, emitted after the
+// functions. A helper takes kernelOperands and returns i in rax and acc in rdx or
+// xmm0, clobbering only caller-saved registers. Vector loops are SSE2, so two
+// lanes, with a scalar loop for the rest. 64-bit integer multiplies and compares
+// have no SSE2 form and stay scalar, and so do double sums, to keep their order.
+class kernelPool {
+private:
+    std::map<std::string, std::string> labels_; // by shape
+    std::ostringstream code_;
+
+    void ins(const std::string& m) { code_ << "    " << m << "\n"; }
+    void ins(const std::string& m, const std::string& a) { code_ << "    " << m << " " << a << "\n"; }
+    void ins(const std::string& m, const std::string& a, const std::string& b) {
+        code_ << "    " << m << " " << a << ", " << b << "\n";
+    }
+    void ins(const std::string& m, const std::string& a, const std::string& b, const std::string& c) {
+        code_ << "    " << m << " " << a << ", " << b << ", " << c << "\n";
+    }
+    void at(const std::string& label) { code_ << label << ":\n"; }
+
+    // Element i + lane of the list in reg
+    static std::string element(const std::string& reg, int lane = 0) {
+        return std::to_string(8 + 8 * lane) + "(" + reg + ",%rdi,8)";
+    }
+
+    static std::string key(const bcKernel& k, const kernelOperands& ops) {
+        std::string key = std::string(bcKernelName(k.shape)) + (k.isDouble ? "_D " : "_I ") + std::string(opToString(k.op));
+        if (k.scalarLeft) key += " left";
+        for (int role = 0; role < 3; role++) key += ops.list[role] >= 0 ? " L" : " -";
+        key += " checked";
+        for (int role : ops.checked) key += " " + std::to_string(role);
+        return key;
+    }
+
+    // Steps i over [i, end) in blocks of width, then one at a time
+    template <typename Block, typename Finish, typename Step>
+    void loops(const std::string& label, int width, Block block, Finish finish, Step step) {
+        if (width > 1) {
+            ins("leaq", std::to_string(width) + "(%rdi)", "%rax");
+            ins("cmpq", "%rsi", "%rax");
+            ins("jg", label + "_tail");
+            at(label + "_block");
+            block();
+            ins("addq", "$" + std::to_string(width), "%rdi");
+            ins("leaq", std::to_string(width) + "(%rdi)", "%rax");
+            ins("cmpq", "%rsi", "%rax");
+            ins("jle", label + "_block");
+            at(label + "_tail");
+            finish();
+            ins("cmpq", "%rsi", "%rdi");
+            ins("jge", label + "_done");
+        }
+        at(label + "_step");
+        step();
+        ins("incq", "%rdi");
+        ins("cmpq", "%rsi", "%rdi");
+        ins("jl", label + "_step");
+    }
+
+    // Sums the lanes of the integer vector in reg into dst
+    void addLanes(const std::string& reg, const std::string& dst) {
+        ins("pshufd", "$0x4e", reg, "%xmm6");
+        ins("paddq", "%xmm6", reg);
+        ins("movq", reg, "%rax");
+        ins("addq", "%rax", dst);
+    }
+
+    void generate(const bcKernel& k, const kernelOperands& ops, const std::string& label) {
+        std::string list[3];
+        for (int role = 0; role < 3; role++) {
+            if (ops.list[role] >= 0) list[role] = ARG_GP[ops.list[role]];
+        }
+        const std::string& a = list[0];
+        const std::string& b = list[1];
+        const std::string& dst = list[2];
+        std::string acc = ops.acc < 0 ? "" : ops.accFP ? FP_NAMES[ops.acc] : ARG_GP[ops.acc];
+        std::string scalar = ops.scalar < 0 ? "" : ops.scalarFP ? FP_NAMES[ops.scalar] : ARG_GP[ops.scalar];
+
+        code_ << "\n# VEC " << key(k, ops) << "\n" << label << ":\n";
+        ins("cmpq", "%rsi", "%rdi");
+        ins("jge", label + "_done");
+        // The first index some list doesn't have, end when there is none
+        ins("movq", "%rsi", "%rax");
+        ins("testq", "%rdi", "%rdi");
+        ins("js", label + "_negative");
+        for (int role : ops.checked) {
+            ins("movq", "(" + list[role] + ")", "%r11");
+            ins("cmpq", "%rax", "%r11");
+            ins("jge", label + "_fits" + std::to_string(role));
+            ins("movq", "%r11", "%rax");
+            ins("cmpq", "%rdi", "%rax");
+            ins("cmovl", "%rdi", "%rax");
+            at(label + "_fits" + std::to_string(role));
+        }
+        ins("cmpq", "%rsi", "%rax");
+        ins("jne", label + "_fail");
+
+        // Scalars are broadcast to both lanes, the low lane still serves the scalar loop
+        if (!scalar.empty()) {
+            if (k.isDouble) {
+                ins("unpcklpd", scalar, scalar);
+            } else {
+                ins("movq", scalar, "%xmm7");
+                ins("punpcklqdq", "%xmm7", "%xmm7");
+            }
+        }
+        const std::string vscalar = k.isDouble ? scalar : "%xmm7";
+        const char* packed = "";
+        const char* single = "";
+        const char* integer = "";
+        switch (k.op) {
+            case opKind::ADD: packed = "addpd"; single = "addsd"; integer = "addq"; break;
+            case opKind::SUB: packed = "subpd"; single = "subsd"; integer = "subq"; break;
+            case opKind::MUL: packed = "mulpd"; single = "mulsd"; integer = "imulq"; break;
+            default: packed = "divpd"; single = "divsd"; break;
+        }
+        bool commutative = k.op == opKind::ADD || k.op == opKind::MUL;
+        auto none = [] {};
+
+        switch (k.shape) {
+            case bcKernel::SUM:
+                if (k.isDouble) {
+                    loops(label, 1, none, none, [&] { ins("addsd", element(a), acc); });
+                    break;
+                }
+                ins("pxor", "%xmm2", "%xmm2");
+                ins("pxor", "%xmm3", "%xmm3");
+                loops(label, 4, [&] {
+                    ins("movdqu", element(a), "%xmm4");
+                    ins("paddq", "%xmm4", "%xmm2");
+                    ins("movdqu", element(a, 2), "%xmm5");
+                    ins("paddq", "%xmm5", "%xmm3");
+                }, [&] {
+                    ins("paddq", "%xmm3", "%xmm2");
+                    addLanes("%xmm2", acc);
+                }, [&] { ins("addq", element(a), acc); });
+                break;
+            case bcKernel::DOT:
+                loops(label, 1, none, none, [&] {
+                    if (k.isDouble) {
+                        ins("movsd", element(a), "%xmm2");
+                        ins("mulsd", element(b), "%xmm2");
+                        ins("addsd", "%xmm2", acc);
+                    } else {
+                        ins("movq", element(a), "%rax");
+                        ins("imulq", element(b), "%rax");
+                        ins("addq", "%rax", acc);
+                    }
+                });
+                break;
+            case bcKernel::MAP: {
+                bool swapped = k.scalarLeft && !commutative;
+                if (k.isDouble) {
+                    loops(label, 2, [&] {
+                        ins("movupd", element(a), "%xmm2");
+                        std::string other = vscalar;
+                        if (!b.empty()) {
+                            ins("movupd", element(b), "%xmm3");
+                            other = "%xmm3";
+                        }
+                        if (swapped) {
+                            ins("movapd", vscalar, "%xmm3");
+                            ins(packed, "%xmm2", "%xmm3");
+                            ins("movupd", "%xmm3", element(dst));
+                        } else {
+                            ins(packed, other, "%xmm2");
+                            ins("movupd", "%xmm2", element(dst));
+                        }
+                    }, none, [&] {
+                        if (swapped) {
+                            ins("movapd", scalar, "%xmm3");
+                            ins(single, element(a), "%xmm3");
+                            ins("movsd", "%xmm3", element(dst));
+                        } else {
+                            ins("movsd", element(a), "%xmm2");
+                            ins(single, b.empty() ? scalar : element(b), "%xmm2");
+                            ins("movsd", "%xmm2", element(dst));
+                        }
+                    });
+                    break;
+                }
+                auto step = [&] {
+                    if (swapped) {
+                        ins("movq", scalar, "%rax");
+                        ins(integer, element(a), "%rax");
+                    } else {
+                        ins("movq", element(a), "%rax");
+                        ins(integer, b.empty() ? scalar : element(b), "%rax");
+                    }
+                    ins("movq", "%rax", element(dst));
+                };
+                if (k.op == opKind::MUL) {
+                    loops(label, 1, none, none, step);
+                    break;
+                }
+                const char* lanes = k.op == opKind::ADD ? "paddq" : "psubq";
+                loops(label, 2, [&] {
+                    ins("movdqu", element(a), "%xmm2");
+                    std::string other = vscalar;
+                    if (!b.empty()) {
+                        ins("movdqu", element(b), "%xmm3");
+                        other = "%xmm3";
+                    }
+                    if (swapped) {
+                        ins("movdqa", vscalar, "%xmm3");
+                        ins(lanes, "%xmm2", "%xmm3");
+                        ins("movdqu", "%xmm3", element(dst));
+                    } else {
+                        ins(lanes, other, "%xmm2");
+                        ins("movdqu", "%xmm2", element(dst));
+                    }
+                }, none, step);
+                break;
+            }
+            case bcKernel::FILL:
+                loops(label, 2, [&] {
+                    ins(k.isDouble ? "movupd" : "movdqu", vscalar, element(dst));
+                }, none, [&] {
+                    ins(k.isDouble ? "movsd" : "movq", scalar, element(dst));
+                });
+                break;
+            case bcKernel::COUNT: {
+                if (!k.isDouble) {
+                    loops(label, 1, none, none, [&] {
+                        ins("xorl", "%eax", "%eax");
+                        ins("cmpq", scalar, element(a));
+                        ins(std::string("set") + CONDITIONS[conditionOf(k.op)], "%al");
+                        ins("addq", "%rax", acc);
+                    });
+                    break;
+                }
+                // All ones where the comparison holds, so subtracting the mask counts;
+                // > and >= are < and <= with the operands swapped
+                bool swapped = k.op == opKind::MORETHAN || k.op == opKind::MORETHANEQUAL;
+                const char* predicate = "eq";
+                switch (k.op) {
+                    case opKind::LESSTHAN: case opKind::MORETHAN: predicate = "lt"; break;
+                    case opKind::LESSTHANEQUAL: case opKind::MORETHANEQUAL: predicate = "le"; break;
+                    case opKind::NOTEQUAL: predicate = "neq"; break;
+                    default: break;
+                }
+                auto mask = [&](const char* form, const char* move, const std::string& x) {
+                    std::string m = std::string("cmp") + predicate + form;
+                    if (swapped) {
+                        ins(move, scalar, "%xmm3");
+                        ins(m, x, "%xmm3");
+                        return std::string("%xmm3");
+                    }
+                    ins(m, scalar, x);
+                    return x;
+                };
+                ins("pxor", "%xmm4", "%xmm4");
+                loops(label, 2, [&] {
+                    ins("movupd", element(a), "%xmm2");
+                    ins("psubq", mask("pd", "movapd", "%xmm2"), "%xmm4");
+                }, [&] {
+                    addLanes("%xmm4", acc);
+                }, [&] {
+                    ins("movsd", element(a), "%xmm2");
+                    ins("movq", mask("sd", "movapd", "%xmm2"), "%rax");
+                    ins("subq", "%rax", acc);
+                });
+                break;
+            }
+        }
+
+        at(label + "_done");
+        ins("movq", "%rdi", "%rax");
+        if (!acc.empty() && !ops.accFP && acc != "%rdx") ins("movq", acc, "%rdx");
+        ins("ret");
+        // Fails on the first list the body indexes there
+        at(label + "_negative");
+        ins("movq", "%rdi", "%rax");
+        at(label + "_fail");
+        for (int role : ops.checked) {
+            ins("cmpq", "(" + list[role] + ")", "%rax");
+            ins("jb", label + "_in" + std::to_string(role));
+            ins("movq", list[role], "%rcx");
+            ins("jmp", ".Lrt_range");
+            at(label + "_in" + std::to_string(role));
+        }
+        ins("ud2");
+    }
+
+public:
+    // Of the helper running k, generated on first use
+    std::string label(const bcKernel& k, const kernelOperands& ops) {
+        auto inserted = labels_.emplace(key(k, ops), ".Lk" + std::to_string(labels_.size()));
+        if (inserted.second) generate(k, ops, inserted.first->second);
+        return inserted.first->second;
+    }
+
+    void emit(std::ostream& out) const { out << code_.str(); }
+};
+
+// Allocates and emits one bcFunction
+class functionEmitter {
+private:
+    struct interval {
+        uint32_t vreg;
+        uint32_t start = 0xFFFFFFFFu;
+        uint32_t end = 0;
+        int lo = 0, hi = 0; // allowed register range
+        int reg = -1;
+        int slot = -1; // spill slot when reg < 0
+    };
+
+    const bcProgram& prog_;
+    const bcFunction& fn_;
+    const std::vector<std::string>& labels_; // of every function
+    uint32_t index_;
+    dataPool& data_;
+    kernelPool& kernels_;
+    std::ostream& out_;
+
+    std::vector<interval> intervals_;
+    std::vector<int> intervalOf_; // by vreg, -1 if never used
+    std::vector<int> saved_; // callee-saved registers pushed by the prologue
+    int slots_ = 0;
+
+    static uint32_t vreg(uint32_t reg, regClass c) { return reg * 2 + c; }
+
+    regClass returnClass(const bcFunction& fn) const { return classOf(fn.returnType); }
+
+    void access(const bcInstr& in, std::vector<uint32_t>& uses, std::vector<uint32_t>& defs) const {
+        uses.clear();
+        defs.clear();
+        auto use = [&](uint32_t r, regClass c) { uses.push_back(vreg(r, c)); };
+        auto def = [&](uint32_t r, regClass c) { defs.push_back(vreg(r, c)); };
+        switch (in.op) {
+            case bcOp::MOV: case bcOp::I2B: case bcOp::I2C: case bcOp::S2B: case bcOp::NEG_I:
+            case bcOp::NOT: case bcOp::INV_I: case bcOp::TOSTR_I: case bcOp::TOSTR_B: case bcOp::TOSTR_C:
+                def(in.a, GP); use(in.b, GP); break;
+            case bcOp::MOV_D: case bcOp::NEG_D:
+                def(in.a, FP); use(in.b, FP); break;
+            case bcOp::LOADK: case bcOp::LOADK_S: case bcOp::GGET:
+                def(in.a, GP); break;
+            case bcOp::LOADK_D: case bcOp::GGET_D:
+                def(in.a, FP); break;
+            case bcOp::GSET: use(in.b, GP); break;
+            case bcOp::GSET_D: use(in.b, FP); break;
+            case bcOp::I2D: def(in.a, FP); use(in.b, GP); break;
+            case bcOp::D2I: case bcOp::D2B: case bcOp::TOSTR_D:
+                def(in.a, GP); use(in.b, FP); break;
+            case bcOp::ADD_I: case bcOp::SUB_I: case bcOp::MUL_I: case bcOp::DIV_I: case bcOp::MOD_I:
+            case bcOp::LT_I: case bcOp::GT_I: case bcOp::LE_I: case bcOp::GE_I: case bcOp::EQ_I: case bcOp::NE_I:
+            case bcOp::LT_S: case bcOp::GT_S: case bcOp::LE_S: case bcOp::GE_S: case bcOp::EQ_S: case bcOp::NE_S:
+            case bcOp::CONCAT:
+                def(in.a, GP); use(in.b, GP); use(in.c, GP); break;
+            case bcOp::ADD_D: case bcOp::SUB_D: case bcOp::MUL_D: case bcOp::DIV_D: case bcOp::MOD_D:
+                def(in.a, FP); use(in.b, FP); use(in.c, FP); break;
+            case bcOp::LT_D: case bcOp::GT_D: case bcOp::LE_D: case bcOp::GE_D: case bcOp::EQ_D: case bcOp::NE_D:
+                def(in.a, GP); use(in.b, FP); use(in.c, FP); break;
+            case bcOp::INC_I: def(in.a, GP); use(in.a, GP); break;
+            case bcOp::INC_D: def(in.a, FP); use(in.a, FP); break;
+            case bcOp::JZ: case bcOp::JNZ:
+            case bcOp::PRINT_I: case bcOp::PRINT_B: case bcOp::PRINT_C: case bcOp::PRINT_S:
+                use(in.a, GP); break;
+            case bcOp::PRINT_D: use(in.a, FP); break;
+            case bcOp::JLT_I: case bcOp::JGT_I: case bcOp::JLE_I: case bcOp::JGE_I: case bcOp::JEQ_I: case bcOp::JNE_I:
+                use(in.a, GP); use(in.b, GP); break;
+            case bcOp::CALL: {
+                const bcFunction& callee = prog_.functions[in.b];
+                for (uint32_t i = 0; i < callee.paramCount; i++) use(in.c + i, classOf(callee.paramTypes[i]));
+                if (in.a != NO_REG) def(in.a, returnClass(callee));
+                break;
+            }
+            case bcOp::JOIN:
+                for (uint32_t i = 0; i < in.c; i++) use(in.b + i, GP);
+                def(in.a, GP);
+                break;
+            case bcOp::RET: use(in.a, returnClass(fn_)); break;
+            case bcOp::NEWLIST: case bcOp::LEN: def(in.a, GP); use(in.b, GP); break;
+            case bcOp::LGET: def(in.a, GP); use(in.b, GP); use(in.c, GP); break;
+            case bcOp::LGET_D: def(in.a, FP); use(in.b, GP); use(in.c, GP); break;
+            case bcOp::LSET: use(in.a, GP); use(in.b, GP); use(in.c, GP); break;
+            case bcOp::LSET_D: use(in.a, GP); use(in.b, GP); use(in.c, FP); break;
+            case bcOp::VEC: {
+                const bcKernel& k = fn_.kernels[in.a];
+                kernelOperands ops = operandsOf(k);
+                for (uint32_t r : ops.gp) use(r, GP);
+                for (uint32_t r : ops.fp) use(r, FP);
+                def(k.index, GP);
+                if (k.acc != NO_REG) def(k.acc, ops.accFP ? FP : GP);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    // Where control goes after instruction i, at most two places
+    size_t successors(size_t i, uint32_t next[2]) const {
+        const bcInstr& in = fn_.code[i];
+        uint32_t fall = (uint32_t)i + 1;
+        switch (in.op) {
+            case bcOp::JMP: next[0] = in.a; return 1;
+            case bcOp::JZ: case bcOp::JNZ: next[0] = in.b; next[1] = fall; return 2;
+            case bcOp::JLT_I: case bcOp::JGT_I: case bcOp::JLE_I: case bcOp::JGE_I: case bcOp::JEQ_I: case bcOp::JNE_I:
+                next[0] = in.c; next[1] = fall; return 2;
+            case bcOp::RET: case bcOp::RETV: case bcOp::NORET: return 0;
+            default: next[0] = fall; return fall < fn_.code.size() ? 1 : 0;
+        }
+    }
+
+    // Live intervals from backward liveness, one per vreg, spanning every point where it is live
+    void computeIntervals() {
+        size_t n = fn_.code.size();
+        size_t vregs = 2 * (size_t)fn_.registerCount;
+        size_t words = (vregs + 63) / 64;
+        std::vector<std::vector<uint32_t>> uses(n), defs(n);
+        for (size_t i = 0; i < n; i++) access(fn_.code[i], uses[i], defs[i]);
+
+        std::vector<uint64_t> liveIn(n * words, 0);
+        std::vector<uint64_t> live(words);
+        auto liveOut = [&](size_t i) {
+            std::fill(live.begin(), live.end(), 0);
+            uint32_t next[2];
+            size_t count = successors(i, next);
+            for (size_t s = 0; s < count; s++) {
+                for (size_t w = 0; w < words; w++) live[w] |= liveIn[next[s] * words + w];
+            }
+        };
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = n; i-- > 0;) {
+                liveOut(i);
+                for (uint32_t v : defs[i]) live[v / 64] &= ~(1ull << (v % 64));
+                for (uint32_t v : uses[i]) live[v / 64] |= 1ull << (v % 64);
+                if (!std::equal(live.begin(), live.end(), liveIn.begin() + i * words)) {
+                    std::copy(live.begin(), live.end(), liveIn.begin() + i * words);
+                    changed = true;
+                }
+            }
+        }
+
+        intervalOf_.assign(vregs, -1);
+        auto extend = [&](uint32_t v, uint32_t at) {
+            if (intervalOf_[v] < 0) {
+                intervalOf_[v] = (int)intervals_.size();
+                intervals_.push_back({});
+                intervals_.back().vreg = v;
+            }
+            interval& iv = intervals_[intervalOf_[v]];
+            iv.start = std::min(iv.start, at);
+            iv.end = std::max(iv.end, at);
+        };
+        auto extendAll = [&](const uint64_t* bits, uint32_t at) {
+            for (size_t w = 0; w < words; w++) {
+                for (uint64_t word = bits[w]; word; word &= word - 1) {
+                    extend((uint32_t)(w * 64 + __builtin_ctzll(word)), at);
+                }
+            }
+        };
+        // Which registers an interval may use depends on the calls it meets
+        std::vector<uint8_t> touches(vregs, 0), crosses(vregs, 0);
+        for (size_t i = 0; i < n; i++) {
+            extendAll(&liveIn[i * words], (uint32_t)i);
+            liveOut(i);
+            extendAll(live.data(), (uint32_t)i);
+            for (uint32_t v : uses[i]) extend(v, (uint32_t)i);
+            for (uint32_t v : defs[i]) extend(v, (uint32_t)i);
+            if (!isCall(fn_.code[i].op)) continue;
+            for (uint32_t v : uses[i]) touches[v] = 1;
+            for (uint32_t v : defs[i]) {
+                touches[v] = 1;
+                live[v / 64] &= ~(1ull << (v % 64));
+            }
+            // Live after the call without being its result, so it must survive it
+            for (size_t w = 0; w < words; w++) {
+                for (uint64_t word = live[w]; word; word &= word - 1) crosses[w * 64 + __builtin_ctzll(word)] = 1;
+            }
+        }
+        // Parameters arrive in argument registers, keep them out of the way
+        for (uint32_t i = 0; i < fn_.paramCount; i++) touches[vreg(i, classOf(fn_.paramTypes[i]))] = 1;
+
+        for (interval& iv : intervals_) {
+            if (iv.vreg % 2 == GP) {
+                iv.lo = crosses[iv.vreg] ? GP_CALLEE_SAVED : touches[iv.vreg] ? GP_NO_ARGS : 0;
+                iv.hi = GP_COUNT;
+            } else {
+                iv.lo = touches[iv.vreg] || crosses[iv.vreg] ? FP_NO_ARGS : 0;
+                iv.hi = crosses[iv.vreg] ? iv.lo : FP_COUNT;
+            }
+        }
+    }
+
+    void allocate() {
+        std::vector<size_t> order(intervals_.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+            const interval& a = intervals_[x];
+            const interval& b = intervals_[y];
+            return a.start != b.start ? a.start < b.start : a.vreg < b.vreg;
+        });
+
+        bool gpFree[GP_COUNT], fpFree[FP_COUNT];
+        std::fill(std::begin(gpFree), std::end(gpFree), true);
+        std::fill(std::begin(fpFree), std::end(fpFree), true);
+        auto freeSet = [&](const interval& iv) { return iv.vreg % 2 == GP ? gpFree : fpFree; };
+        std::vector<size_t> active;
+
+        for (size_t id : order) {
+            interval& cur = intervals_[id];
+            // Expire intervals that ended strictly before this one starts
+            active.erase(std::remove_if(active.begin(), active.end(), [&](size_t a) {
+                interval& iv = intervals_[a];
+                if (iv.end >= cur.start) return false;
+                freeSet(iv)[iv.reg] = true;
+                return true;
+            }), active.end());
+
+            bool* free = freeSet(cur);
+            for (int r = cur.lo; r < cur.hi; r++) {
+                if (free[r]) {
+                    cur.reg = r;
+                    free[r] = false;
+                    break;
+                }
+            }
+            if (cur.reg < 0) {
+                // Spill whichever interval allowed here ends last
+                auto victim = active.end();
+                for (auto it = active.begin(); it != active.end(); ++it) {
+                    const interval& iv = intervals_[*it];
+                    if (iv.vreg % 2 != cur.vreg % 2 || iv.reg < cur.lo || iv.reg >= cur.hi) continue;
+                    if (victim == active.end() || iv.end > intervals_[*victim].end) victim = it;
+                }
+                if (victim != active.end() && intervals_[*victim].end > cur.end) {
+                    interval& spilled = intervals_[*victim];
+                    cur.reg = spilled.reg;
+                    spilled.reg = -1;
+                    spilled.slot = slots_++;
+                    active.erase(victim);
+                } else {
+                    cur.slot = slots_++;
+                }
+            }
+            if (cur.reg >= 0) active.push_back(id);
+        }
+
+        for (int r = GP_CALLEE_SAVED; r < GP_COUNT; r++) {
+            for (const interval& iv : intervals_) {
+                if (iv.vreg % 2 == GP && iv.reg == r) {
+                    saved_.push_back(r);
+                    break;
+                }
+            }
+        }
+    }
+
+    std::string loc(uint32_t reg, regClass c) const {
+        uint32_t v = vreg(reg, c);
+        if (v >= intervalOf_.size() || intervalOf_[v] < 0) throw runtimeError("Register " + std::to_string(reg) + " is never live in '" + fn_.name + "'");
+        const interval& iv = intervals_[intervalOf_[v]];
+        if (iv.reg >= 0) return c == GP ? GP_NAMES[iv.reg] : FP_NAMES[iv.reg];
+        return std::to_string(-8 * ((int)saved_.size() + iv.slot + 1)) + "(%rbp)";
+    }
+    std::string gp(uint32_t reg) const { return loc(reg, GP); }
+    std::string fp(uint32_t reg) const { return loc(reg, FP); }
+    bool live(uint32_t reg, regClass c) const {
+        uint32_t v = vreg(reg, c);
+        return v < intervalOf_.size() && intervalOf_[v] >= 0;
+    }
+
+    std::string label(uint32_t pc) const { return ".Lf" + std::to_string(index_) + "_" + std::to_string(pc); }
+    std::string epilogue() const { return ".Lf" + std::to_string(index_) + "_ret"; }
+    static std::string imm(int64_t v) { return "$" + std::to_string(v); }
+    static std::string global(uint32_t g) { return ".Lglobals+" + std::to_string(8 * (uint64_t)g) + "(%rip)"; }
+
+    void ins(const std::string& m) { out_ << "    " << m << "\n"; }
+    void ins(const std::string& m, const std::string& a) { out_ << "    " << m << " " << a << "\n"; }
+    void ins(const std::string& m, const std::string& a, const std::string& b) {
+        out_ << "    " << m << " " << a << ", " << b << "\n";
+    }
+
+    void moveGP(const std::string& dst, const std::string& src) {
+        if (dst == src) return;
+        if (!isReg(dst) && !isReg(src)) {
+            ins("movq", src, "%rax");
+            ins("movq", "%rax", dst);
+        } else {
+            ins("movq", src, dst);
+        }
+    }
+    void moveFP(const std::string& dst, const std::string& src) {
+        if (dst == src) return;
+        if (isReg(dst) && isReg(src)) {
+            ins("movapd", src, dst);
+        } else if (!isReg(dst) && !isReg(src)) {
+            ins("movsd", src, "%xmm15");
+            ins("movsd", "%xmm15", dst);
+        } else {
+            ins("movsd", src, dst);
+        }
+    }
+    // Operand in a register, loaded into scratch when spilled
+    std::string fpReg(const std::string& operand, const char* scratch) {
+        if (isReg(operand)) return operand;
+        moveFP(scratch, operand);
+        return scratch;
+    }
+
+    void binaryGP(const char* m, const std::string& a, const std::string& b, const std::string& c, bool commutative) {
+        if (isReg(a) && a != c) {
+            moveGP(a, b);
+            ins(m, c, a);
+        } else if (isReg(a) && commutative) {
+            ins(m, b, a);
+        } else {
+            moveGP("%rax", b);
+            ins(m, c, "%rax");
+            moveGP(a, "%rax");
+        }
+    }
+    void binaryFP(const char* m, const std::string& a, const std::string& b, const std::string& c, bool commutative) {
+        if (isReg(a) && a != c) {
+            moveFP(a, b);
+            ins(m, c, a);
+        } else if (isReg(a) && commutative) {
+            ins(m, b, a);
+        } else {
+            moveFP("%xmm15", b);
+            ins(m, c, "%xmm15");
+            moveFP(a, "%xmm15");
+        }
+    }
+
+    // Flags for a - b
+    void compare(const std::string& a, const std::string& b) {
+        if (!isReg(a) && !isReg(b)) {
+            moveGP("%rax", a);
+            ins("cmpq", b, "%rax");
+        } else {
+            ins("cmpq", b, a);
+        }
+    }
+    void testZero(const std::string& a) {
+        if (isReg(a)) ins("testq", a, a);
+        else ins("cmpq", "$0", a);
+    }
+
+    void divide(const bcInstr& in, bool remainder) {
+        moveGP("%rcx", gp(in.c));
+        ins("testq", "%rcx", "%rcx");
+        ins("je", ".Lrt_divzero");
+        moveGP("%rax", gp(in.b));
+        // INT64_MIN / -1 traps, the result wraps instead
+        ins("cmpq", "$-1", "%rcx");
+        ins("jne", "1f");
+        if (remainder) ins("xorl", "%eax", "%eax");
+        else ins("negq", "%rax");
+        ins("jmp", "2f");
+        out_ << "1:\n";
+        ins("cqto");
+        ins("idivq", "%rcx");
+        if (remainder) ins("movq", "%rdx", "%rax");
+        out_ << "2:\n";
+        moveGP(gp(in.a), "%rax");
+    }
+
+    void compareDouble(const bcInstr& in, uint32_t which) {
+        ins("xorl", "%ecx", "%ecx");
+        // ucomisd sets the unsigned flags, < and <= are > and >= swapped
+        bool swap = which == 0 || which == 2;
+        std::string left = swap ? fp(in.c) : fp(in.b);
+        std::string right = swap ? fp(in.b) : fp(in.c);
+        ins("ucomisd", right, fpReg(left, "%xmm15"));
+        switch (which) {
+            case 0: case 1: ins("seta", "%cl"); break;
+            case 2: case 3: ins("setae", "%cl"); break;
+            case 4: ins("sete", "%cl"); ins("setnp", "%al"); ins("andb", "%al", "%cl"); break;
+            default: ins("setne", "%cl"); ins("setp", "%al"); ins("orb", "%al", "%cl"); break;
+        }
+        moveGP(gp(in.a), "%rcx");
+    }
+
+    void call(const bcInstr& in) {
+        const bcFunction& callee = prog_.functions[in.b];
+        std::vector<std::pair<std::string, regClass>> onStack;
+        std::vector<std::pair<std::string, std::string>> gpArgs, fpArgs; // destination, source
+        for (uint32_t i = 0; i < callee.paramCount; i++) {
+            regClass c = classOf(callee.paramTypes[i]);
+            std::string src = loc(in.c + i, c);
+            if (c == GP && gpArgs.size() < ARG_GP_COUNT) gpArgs.emplace_back(ARG_GP[gpArgs.size()], src);
+            else if (c == FP && fpArgs.size() < ARG_FP_COUNT) fpArgs.emplace_back(FP_NAMES[fpArgs.size()], src);
+            else onStack.emplace_back(src, c);
+        }
+        // Stack arguments are pushed last to first, keeping rsp 16 byte aligned at the call
+        size_t stackBytes = 8 * (onStack.size() + onStack.size() % 2);
+        if (onStack.size() % 2) ins("subq", "$8", "%rsp");
+        for (auto it = onStack.rbegin(); it != onStack.rend(); ++it) {
+            if (it->second == FP && isReg(it->first)) {
+                ins("subq", "$8", "%rsp");
+                ins("movsd", it->first, "(%rsp)");
+            } else {
+                ins("pushq", it->first);
+            }
+        }
+        // Sources never live in argument registers, see computeIntervals
+        for (const auto& arg : gpArgs) moveGP(arg.first, arg.second);
+        for (const auto& arg : fpArgs) moveFP(arg.first, arg.second);
+        ins("call", labels_[in.b]);
+        if (stackBytes) ins("addq", imm((int64_t)stackBytes), "%rsp");
+        if (in.a != NO_REG) {
+            if (classOf(callee.returnType) == FP) moveFP(fp(in.a), "%xmm0");
+            else moveGP(gp(in.a), "%rax");
+        }
+    }
+
+    // list in rcx and index in rax, checked against the length
+    void loadElement(const std::string& list, const std::string& index) {
+        moveGP("%rcx", list);
+        moveGP("%rax", index);
+        ins("cmpq", "(%rcx)", "%rax");
+        ins("jae", ".Lrt_range");
+    }
+
+    void callPrintf(const char* format, bool vector) {
+        ins("leaq", std::string(format) + "(%rip)", "%rdi");
+        ins(vector ? "movl" : "xorl", vector ? "$1" : "%eax", "%eax");
+        ins("call", "printf@PLT");
+    }
+
+    void emit(const bcInstr& in, size_t pc) {
+        uint32_t which;
+        switch (in.op) {
+            case bcOp::MOV: moveGP(gp(in.a), gp(in.b)); break;
+            case bcOp::MOV_D: moveFP(fp(in.a), fp(in.b)); break;
+            case bcOp::LOADK: {
+                int64_t v = fn_.constants[in.b].i;
+                std::string a = gp(in.a);
+                if (v >= INT32_MIN && v <= INT32_MAX) {
+                    ins("movq", imm(v), a);
+                } else {
+                    ins("movabsq", imm(v), "%rax");
+                    moveGP(a, "%rax");
+                }
+                break;
+            }
+            case bcOp::LOADK_D:
+                moveFP(fp(in.a), data_.number(fn_.constants[in.b].d) + "(%rip)");
+                break;
+            case bcOp::LOADK_S: {
+                std::string a = gp(in.a);
+                std::string address = data_.text(*fn_.constants[in.b].s) + "(%rip)";
+                if (isReg(a)) {
+                    ins("leaq", address, a);
+                } else {
+                    ins("leaq", address, "%rax");
+                    ins("movq", "%rax", a);
+                }
+                break;
+            }
+            case bcOp::GGET: moveGP(gp(in.a), global(in.b)); break;
+            case bcOp::GGET_D: moveFP(fp(in.a), global(in.b)); break;
+            case bcOp::GSET: moveGP(global(in.a), gp(in.b)); break;
+            case bcOp::GSET_D: moveFP(global(in.a), fp(in.b)); break;
+
+            case bcOp::I2D: {
+                std::string a = fp(in.a);
+                std::string dst = isReg(a) ? a : "%xmm15";
+                ins("cvtsi2sdq", gp(in.b), dst);
+                moveFP(a, dst);
+                break;
+            }
+            case bcOp::D2I: {
+                std::string a = gp(in.a);
+                std::string dst = isReg(a) ? a : "%rax";
+                ins("cvttsd2siq", fp(in.b), dst);
+                moveGP(a, dst);
+                break;
+            }
+            case bcOp::I2B:
+            case bcOp::NOT:
+                ins("xorl", "%ecx", "%ecx");
+                testZero(gp(in.b));
+                ins(in.op == bcOp::NOT ? "sete" : "setne", "%cl");
+                moveGP(gp(in.a), "%rcx");
+                break;
+            case bcOp::D2B:
+                ins("xorl", "%ecx", "%ecx");
+                ins("xorpd", "%xmm15", "%xmm15");
+                ins("ucomisd", fp(in.b), "%xmm15");
+                ins("setne", "%cl");
+                ins("setp", "%al");
+                ins("orb", "%al", "%cl");
+                moveGP(gp(in.a), "%rcx");
+                break;
+            case bcOp::I2C:
+                moveGP("%rax", gp(in.b));
+                ins("movzbl", "%al", "%eax");
+                moveGP(gp(in.a), "%rax");
+                break;
+            case bcOp::S2B:
+                moveGP("%rax", gp(in.b));
+                ins("xorl", "%ecx", "%ecx");
+                ins("cmpb", "$0", "(%rax)");
+                ins("setne", "%cl");
+                moveGP(gp(in.a), "%rcx");
+                break;
+
+            case bcOp::ADD_I: binaryGP("addq", gp(in.a), gp(in.b), gp(in.c), true); break;
+            case bcOp::SUB_I: binaryGP("subq", gp(in.a), gp(in.b), gp(in.c), false); break;
+            case bcOp::MUL_I: binaryGP("imulq", gp(in.a), gp(in.b), gp(in.c), true); break;
+            case bcOp::DIV_I: divide(in, false); break;
+            case bcOp::MOD_I: divide(in, true); break;
+            case bcOp::ADD_D: binaryFP("addsd", fp(in.a), fp(in.b), fp(in.c), true); break;
+            case bcOp::SUB_D: binaryFP("subsd", fp(in.a), fp(in.b), fp(in.c), false); break;
+            case bcOp::MUL_D: binaryFP("mulsd", fp(in.a), fp(in.b), fp(in.c), true); break;
+            case bcOp::DIV_D: binaryFP("divsd", fp(in.a), fp(in.b), fp(in.c), false); break;
+            case bcOp::MOD_D:
+                // fprem computes fmod exactly, without linking libm
+                moveFP("%xmm14", fp(in.c));
+                moveFP("%xmm15", fp(in.b));
+                ins("movsd", "%xmm14", "-16(%rsp)");
+                ins("fldl", "-16(%rsp)");
+                ins("movsd", "%xmm15", "-8(%rsp)");
+                ins("fldl", "-8(%rsp)");
+                out_ << "1:\n";
+                ins("fprem");
+                ins("fnstsw", "%ax");
+                ins("testw", "$0x400", "%ax");
+                ins("jnz", "1b");
+                ins("fstp", "%st(1)");
+                ins("fstpl", "-8(%rsp)");
+                moveFP(fp(in.a), "-8(%rsp)");
+                break;
+
+            case bcOp::LT_I: case bcOp::GT_I: case bcOp::LE_I: case bcOp::GE_I: case bcOp::EQ_I: case bcOp::NE_I:
+                which = (uint32_t)in.op - (uint32_t)bcOp::LT_I;
+                ins("xorl", "%ecx", "%ecx");
+                compare(gp(in.b), gp(in.c));
+                ins(std::string("set") + CONDITIONS[which], "%cl");
+                moveGP(gp(in.a), "%rcx");
+                break;
+            case bcOp::LT_D: case bcOp::GT_D: case bcOp::LE_D: case bcOp::GE_D: case bcOp::EQ_D: case bcOp::NE_D:
+                compareDouble(in, (uint32_t)in.op - (uint32_t)bcOp::LT_D);
+                break;
+            case bcOp::LT_S: case bcOp::GT_S: case bcOp::LE_S: case bcOp::GE_S: case bcOp::EQ_S: case bcOp::NE_S:
+                which = (uint32_t)in.op - (uint32_t)bcOp::LT_S;
+                moveGP("%rdi", gp(in.b));
+                moveGP("%rsi", gp(in.c));
+                ins("call", "strcmp@PLT");
+                ins("xorl", "%ecx", "%ecx");
+                ins("testl", "%eax", "%eax");
+                ins(std::string("set") + CONDITIONS[which], "%cl");
+                moveGP(gp(in.a), "%rcx");
+                break;
+
+            case bcOp::NEG_I:
+            case bcOp::INV_I:
+                moveGP("%rax", gp(in.b));
+                ins(in.op == bcOp::NEG_I ? "negq" : "notq", "%rax");
+                moveGP(gp(in.a), "%rax");
+                break;
+            case bcOp::NEG_D:
+                moveFP("%xmm15", fp(in.b));
+                ins("xorpd", ".Lsign(%rip)", "%xmm15");
+                moveFP(fp(in.a), "%xmm15");
+                break;
+            case bcOp::INC_I:
+                ins("addq", imm((int32_t)in.c), gp(in.a));
+                break;
+            case bcOp::INC_D: {
+                std::string a = fp(in.a);
+                ins("movq", imm((int32_t)in.c), "%rax");
+                ins("cvtsi2sdq", "%rax", "%xmm15");
+                if (isReg(a)) {
+                    ins("addsd", "%xmm15", a);
+                } else {
+                    ins("movsd", a, "%xmm14");
+                    ins("addsd", "%xmm15", "%xmm14");
+                    ins("movsd", "%xmm14", a);
+                }
+                break;
+            }
+
+            case bcOp::CONCAT:
+                moveGP("%rdi", gp(in.b));
+                moveGP("%rsi", gp(in.c));
+                ins("call", ".Lrt_concat");
+                moveGP(gp(in.a), "%rax");
+                break;
+            case bcOp::JOIN: {
+                // The pieces go in an array on the stack, rsp stays 16 byte aligned
+                int64_t bytes = 8 * (int64_t)(in.c + in.c % 2);
+                ins("subq", imm(bytes), "%rsp");
+                for (uint32_t i = 0; i < in.c; i++) moveGP(std::to_string(8 * i) + "(%rsp)", gp(in.b + i));
+                ins("movq", "%rsp", "%rdi");
+                ins("movl", imm(in.c), "%esi");
+                ins("call", ".Lrt_join");
+                ins("addq", imm(bytes), "%rsp");
+                moveGP(gp(in.a), "%rax");
+                break;
+            }
+            case bcOp::TOSTR_I:
+                moveGP("%rdi", gp(in.b));
+                ins("call", ".Lrt_itos");
+                moveGP(gp(in.a), "%rax");
+                break;
+            case bcOp::TOSTR_D:
+                moveFP("%xmm0", fp(in.b));
+                ins("call", ".Lrt_dtos");
+                moveGP(gp(in.a), "%rax");
+                break;
+            case bcOp::TOSTR_B:
+                ins("leaq", ".Ltrue(%rip)", "%rax");
+                ins("leaq", ".Lfalse(%rip)", "%rcx");
+                testZero(gp(in.b));
+                ins("cmove", "%rcx", "%rax");
+                moveGP(gp(in.a), "%rax");
+                break;
+            case bcOp::TOSTR_C:
+                moveGP("%rdi", gp(in.b));
+                ins("call", ".Lrt_ctos");
+                moveGP(gp(in.a), "%rax");
+                break;
+
+            case bcOp::NEWLIST:
+                moveGP("%rdi", gp(in.b));
+                ins("call", ".Lrt_newlist");
+                moveGP(gp(in.a), "%rax");
+                break;
+            // Lists hold their length in front, an index is in range when it is below
+            // that unsigned
+            case bcOp::LGET:
+            case bcOp::LGET_D:
+                loadElement(gp(in.b), gp(in.c));
+                if (in.op == bcOp::LGET) {
+                    ins("movq", "8(%rcx,%rax,8)", "%rax");
+                    moveGP(gp(in.a), "%rax");
+                } else {
+                    moveFP(fp(in.a), "8(%rcx,%rax,8)");
+                }
+                break;
+            case bcOp::LSET:
+            case bcOp::LSET_D: {
+                loadElement(gp(in.a), gp(in.b));
+                if (in.op == bcOp::LSET) {
+                    std::string c = gp(in.c);
+                    if (!isReg(c)) {
+                        ins("movq", c, "%rdx");
+                        c = "%rdx";
+                    }
+                    ins("movq", c, "8(%rcx,%rax,8)");
+                } else {
+                    ins("movsd", fpReg(fp(in.c), "%xmm15"), "8(%rcx,%rax,8)");
+                }
+                break;
+            }
+            case bcOp::LEN:
+                moveGP("%rax", gp(in.b));
+                ins("movq", "(%rax)", "%rax");
+                moveGP(gp(in.a), "%rax");
+                break;
+            case bcOp::VEC: {
+                const bcKernel& k = fn_.kernels[in.a];
+                kernelOperands ops = operandsOf(k);
+                // Sources never live in argument registers, VEC is a call
+                for (size_t i = 0; i < ops.gp.size(); i++) moveGP(ARG_GP[i], gp(ops.gp[i]));
+                for (size_t i = 0; i < ops.fp.size(); i++) moveFP(FP_NAMES[i], fp(ops.fp[i]));
+                ins("call", kernels_.label(k, ops));
+                moveGP(gp(k.index), "%rax");
+                if (k.acc != NO_REG) {
+                    if (ops.accFP) moveFP(fp(k.acc), "%xmm0");
+                    else moveGP(gp(k.acc), "%rdx");
+                }
+                break;
+            }
+
+            case bcOp::JMP:
+                if (in.a != pc + 1) ins("jmp", label(in.a));
+                break;
+            case bcOp::JZ:
+            case bcOp::JNZ:
+                testZero(gp(in.a));
+                ins(in.op == bcOp::JZ ? "je" : "jne", label(in.b));
+                break;
+            case bcOp::JLT_I: case bcOp::JGT_I: case bcOp::JLE_I: case bcOp::JGE_I: case bcOp::JEQ_I: case bcOp::JNE_I:
+                which = (uint32_t)in.op - (uint32_t)bcOp::JLT_I;
+                compare(gp(in.a), gp(in.b));
+                ins(std::string("j") + CONDITIONS[which], label(in.c));
+                break;
+
+            case bcOp::CALL: call(in); break;
+            case bcOp::RET:
+                if (returnClass(fn_) == FP) moveFP("%xmm0", fp(in.a));
+                else moveGP("%rax", gp(in.a));
+                if (pc + 1 != fn_.code.size()) ins("jmp", epilogue());
+                break;
+            case bcOp::RETV:
+                if (pc + 1 != fn_.code.size()) ins("jmp", epilogue());
+                break;
+            case bcOp::NORET:
+                ins("leaq", data_.text("Function '" + fn_.name + "' did not return a value") + "(%rip)", "%rdi");
+                ins("call", ".Lrt_fail");
+                break;
+
+            case bcOp::PRINT_I:
+                moveGP("%rsi", gp(in.a));
+                callPrintf(".Lfmt_i", false);
+                break;
+            case bcOp::PRINT_D:
+                moveFP("%xmm0", fp(in.a));
+                callPrintf(".Lfmt_d", true);
+                break;
+            case bcOp::PRINT_B:
+                ins("leaq", ".Ltrue(%rip)", "%rsi");
+                ins("leaq", ".Lfalse(%rip)", "%rax");
+                testZero(gp(in.a));
+                ins("cmove", "%rax", "%rsi");
+                callPrintf(".Lfmt_s", false);
+                break;
+            case bcOp::PRINT_C:
+                moveGP("%rdi", gp(in.a));
+                ins("andl", "$255", "%edi");
+                ins("call", "putchar@PLT");
+                break;
+            case bcOp::PRINT_S:
+                moveGP("%rsi", gp(in.a));
+                callPrintf(".Lfmt_s", false);
+                break;
+            case bcOp::PRINT_SP:
+            case bcOp::PRINT_NL:
+                ins("movl", in.op == bcOp::PRINT_SP ? "$32" : "$10", "%edi");
+                ins("call", "putchar@PLT");
+                break;
+
+            default:
+                throw runtimeError("Cannot generate code for " + std::string(bcOpToString(in.op)));
+        }
+    }
+
+public:
+    functionEmitter(const bcProgram& prog, uint32_t index, const std::vector<std::string>& labels,
+                    dataPool& data, kernelPool& kernels, std::ostream& out)
+        : prog_(prog), fn_(prog.functions[index]), labels_(labels), index_(index), data_(data), kernels_(kernels), out_(out) {}
+
+    void run() {
+        computeIntervals();
+        allocate();
+
+        std::vector<bool> targets(fn_.code.size() + 1, false);
+        for (const bcInstr& in : fn_.code) {
+            switch (in.op) {
+                case bcOp::JMP: targets[in.a] = true; break;
+                case bcOp::JZ: case bcOp::JNZ: targets[in.b] = true; break;
+                case bcOp::JLT_I: case bcOp::JGT_I: case bcOp::JLE_I: case bcOp::JGE_I: case bcOp::JEQ_I: case bcOp::JNE_I:
+                    targets[in.c] = true;
+                    break;
+                default: break;
+            }
+        }
+
+        // Frame: saved registers, then spill slots, rsp stays 16 byte aligned
+        out_ << "\n# " << fn_.name << "\n    .p2align 4\n" << labels_[index_] << ":\n";
+        ins("pushq", "%rbp");
+        ins("movq", "%rsp", "%rbp");
+        for (int r : saved_) ins("pushq", GP_NAMES[r]);
+        int frame = 8 * slots_;
+        if ((8 * (int)saved_.size() + frame) % 16) frame += 8;
+        if (frame) ins("subq", imm(frame), "%rsp");
+
+        uint32_t gpIndex = 0, fpIndex = 0, stackIndex = 0;
+        for (uint32_t i = 0; i < fn_.paramCount; i++) {
+            regClass c = classOf(fn_.paramTypes[i]);
+            std::string src;
+            if (c == GP && gpIndex < ARG_GP_COUNT) src = ARG_GP[gpIndex++];
+            else if (c == FP && fpIndex < ARG_FP_COUNT) src = FP_NAMES[fpIndex++];
+            else src = std::to_string(16 + 8 * stackIndex++) + "(%rbp)";
+            if (!live(i, c)) continue;
+            if (c == GP) moveGP(gp(i), src);
+            else moveFP(fp(i), src);
+        }
+
+        for (size_t pc = 0; pc < fn_.code.size(); pc++) {
+            if (targets[pc]) out_ << label((uint32_t)pc) << ":\n";
+            emit(fn_.code[pc], pc);
+        }
+        if (targets[fn_.code.size()]) out_ << label((uint32_t)fn_.code.size()) << ":\n";
+
+        out_ << epilogue() << ":\n";
+        if (saved_.empty()) {
+            ins("movq", "%rbp", "%rsp");
+        } else {
+            ins("leaq", std::to_string(-8 * (int)saved_.size()) + "(%rbp)", "%rsp");
+            for (auto it = saved_.rbegin(); it != saved_.rend(); ++it) ins("popq", GP_NAMES[*it]);
+        }
+        ins("popq", "%rbp");
+        ins("ret");
+    }
+};
+
+std::string symbolName(const bcFunction& fn, size_t index) {
+    std::string name = "qur" + std::to_string(index) + "_";
+    for (char c : fn.name) name += std::isalnum((unsigned char)c) ? c : '_';
+    return name;
+}
+
+} // namespace
+
+void codeGenerator::generate(const bcProgram& program) {
+    std::vector<std::string> labels;
+    for (size_t i = 0; i < program.functions.size(); i++) {
+        labels.push_back(i == program.entry ? "qur_entry" : symbolName(program.functions[i], i));
+    }
+
+    dataPool data;
+    kernelPool kernels;
+    out_ << "# Generated by qur " << QUR_VERSION << "\n";
+    out_ << "    .text\n" << RUNTIME;
+    for (uint32_t i = 0; i < program.functions.size(); i++) {
+        functionEmitter(program, i, labels, data, kernels, out_).run();
+    }
+    kernels.emit(out_);
+
+    out_ << "\n    .globl main\n    .type main, @function\nmain:\n";
+    out_ << "    subq $8, %rsp\n    call qur_entry\n    addq $8, %rsp\n    ret\n";
+
+    out_ << "\n    .section .rodata\n" << RUNTIME_DATA;
+    data.emit(out_);
+    if (program.globalCount) {
+        out_ << "\n    .bss\n    .balign 8\n.Lglobals:\n    .zero " << 8 * (uint64_t)program.globalCount << "\n";
+    }
+    out_ << "\n    .section .note.GNU-stack,\"\",@progbits\n";
+}
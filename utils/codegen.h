@@ -0,0 +1,27 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "bytecode.h"
+#include <ostream>
+
+// Native back end: lowers bcProgram to x86-64 assembly for System V targets, in
+// GNU as syntax, with a C main() that runs the entry function. The output links
+// against the C library only, e.g. `cc out.s -o prog`.
+//
+// Bytecode registers are split by class (integer and string registers go to
+// general purpose registers, doubles to xmm) and assigned by linear scan over live
+// intervals. Intervals that live across a call only get callee-saved registers, so
+// doubles live across calls are spilled, as System V has no callee-saved xmm.
+// Parameters and results follow the System V calling convention. VEC kernels become
+// calls to shared helpers with SSE2 loops, emitted after the functions.
+class codeGenerator {
+private:
+    std::ostream& out_;
+
+public:
+    explicit codeGenerator(std::ostream& out) : out_(out) {}
+
+    void generate(const bcProgram& program);
+};
+
+#endif // CODEGEN_H
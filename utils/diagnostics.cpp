@@ -0,0 +1,34 @@
+#include "diagnostics.h"
+
+#include <algorithm>
+
+bool diagnosticEngine::report(diagStage stage, const sourceSpan& span, std::string message) {
+    if ( full() ) return false;
+    if ( stage == diagStage::PARSER ) parserErrors_++;
+    entries_.push_back({ stage, span, std::move(message) });
+    return true;
+}
+
+void diagnosticEngine::clear() {
+    entries_.clear();
+    parserErrors_ = 0;
+}
+
+void diagnosticEngine::print(std::ostream& out) const {
+    // An eager lexer reports all of its errors before parsing starts, a streaming one
+    // as the parser gets to them, so both are put in source order. Errors without a
+    // position are at the end of the file.
+    std::vector<const diagnostic*> ordered;
+    ordered.reserve(entries_.size());
+    for ( const diagnostic& d : entries_ ) ordered.push_back(&d);
+    auto position = [](const diagnostic* d) { return d->span.line ? d->span.offset : UINT32_MAX; };
+    std::stable_sort(ordered.begin(), ordered.end(),
+                     [&](const diagnostic* a, const diagnostic* b) { return position(a) < position(b); });
+    for ( const diagnostic* d : ordered ) {
+        out << (d->stage == diagStage::LEXER ? "Lexer error: " : "Parse error: ") << d->message << '\n';
+    }
+    if ( full() ) {
+        out << "Too many errors, stopped after " << entries_.size() << '\n';
+    }
+    out << std::flush;
+}
@@ -0,0 +1,64 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Where a diagnostic points in its file. Line and column are 1-based, 0 when unknown.
+struct sourceSpan {
+    uint32_t line = 0;
+    uint32_t column = 0;
+    uint32_t offset = 0; // byte offset of the first character
+    uint32_t length = 0;
+};
+
+enum class diagStage : uint8_t {
+    LEXER,
+    PARSER,
+};
+
+struct diagnostic {
+    diagStage stage;
+    sourceSpan span;
+    std::string message; // complete, position included
+};
+
+// Errors found while lexing and parsing one file, collected in the order they were
+// found instead of being thrown, so scanning and parsing carry on past each one.
+// At the limit the file is treated as hopeless: further reports are dropped, the
+// lexer stops formatting messages and the parser stops parsing.
+class diagnosticEngine {
+private:
+    std::vector<diagnostic> entries_;
+    size_t limit_;
+    size_t parserErrors_ = 0;
+
+public:
+    static constexpr size_t DEFAULT_LIMIT = 100;
+
+    // 0 keeps every error
+    explicit diagnosticEngine(size_t limit = DEFAULT_LIMIT) : limit_(limit) {}
+
+    void setLimit(size_t limit) { limit_ = limit; }
+    size_t limit() const { return limit_; }
+    // True once the limit is reached, callers can skip building the message and
+    // parsing stops, so the file may have had more errors than were kept
+    bool full() const { return limit_ && entries_.size() >= limit_; }
+    // Records an error, false if it was dropped because the limit was already reached
+    bool report(diagStage stage, const sourceSpan& span, std::string message);
+
+    bool empty() const { return entries_.empty(); }
+    size_t size() const { return entries_.size(); }
+    bool hasParserErrors() const { return parserErrors_ > 0; }
+    const std::vector<diagnostic>& entries() const { return entries_; }
+    void clear();
+
+    // One line per error in source order, "Lexer error: ..." or "Parse error: ...",
+    // and a last line saying so when the limit was reached
+    void print(std::ostream& out) const;
+};
+
+#endif // DIAGNOSTICS_H
@@ -0,0 +1,221 @@
+#include "document.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+
+namespace {
+
+// STRING and CHAR are both a literal, which starts at the quote before its offset,
+// and a keyword. Lexing is never restarted or lined up at one, the rest start at
+// their offset.
+bool isQuoted(const compactToken& tok) {
+    return tok.type == TokenType::STRING || tok.type == TokenType::CHAR;
+}
+
+// One past the last byte the lexer looked at for tok: its closing quote, if any, and
+// the byte that ended it. An edit from there on leaves tok as it is.
+size_t tokenReach(const compactToken& tok) {
+    return tok.offset + tok.length + (isQuoted(tok) ? 2 : 1);
+}
+
+// Old nodes are dropped from the tree but stay in the arena until the next full
+// parse, which happens once they take up more than the live tree
+constexpr size_t MIN_GARBAGE = 1 << 20;
+
+} // namespace
+
+sourceDocument::sourceDocument(const std::string& name, std::string text) : name_(name) {
+    sourceBuffer buffer;
+    buffer.assign(std::move(text));
+    lex_ = std::make_unique<lexer>(std::move(buffer), name_, tokenFlow::STREAMING, 0);
+    while ( !lex_->atEnd() ) {
+        tokens_.push_back(lex_->next());
+    }
+    lexErrors_ = lex_->diagnostics().entries();
+    lex_->diagnostics().clear();
+    lastRelexed_ = tokens_.size();
+    parseAll();
+}
+
+sourceDocument::~sourceDocument() = default;
+
+void sourceDocument::parseAll() {
+    steps_.clear();
+    parser_ = std::make_unique<AST>(lex_->sourceData(), tokens_.data(), tokens_.size());
+    parser_->diagnostics().setLimit(0);
+    root_ = nodePtr<programNode>(parser_->arena().make<programNode>());
+    lastReparsed_ = reparse(0, 0, 0, 0, false);
+    liveBytes_ = parser_->arena().bytesUsed();
+}
+
+size_t sourceDocument::reparse(size_t firstStep, size_t keptFrom, std::ptrdiff_t shift, std::ptrdiff_t moved,
+                               bool linesMoved) {
+    AST& parser = *parser_;
+    std::vector<step> parsed;
+    std::vector<nodePtr<astNode>> nodes;
+    size_t at = firstStep < steps_.size() ? steps_[firstStep].begin : 0;
+    size_t next = firstStep; // old step the parse may line up with
+    bool linedUp = false;
+    while ( at < tokens_.size() ) {
+        while ( next < steps_.size() &&
+                (steps_[next].begin < keptFrom || (std::ptrdiff_t)steps_[next].begin + shift < (std::ptrdiff_t)at) ) {
+            next++;
+        }
+        if ( next < steps_.size() && (std::ptrdiff_t)steps_[next].begin + shift == (std::ptrdiff_t)at ) {
+            linedUp = true; // the same tokens from here on, so the same steps
+            break;
+        }
+        size_t end;
+        auto decl = parser.parseDeclarationAt(at, end);
+        parsed.push_back({ at, end, decl != nullptr, parser.diagnostics().entries() });
+        parser.diagnostics().clear();
+        if ( decl ) nodes.push_back(std::move(decl));
+        at = end;
+    }
+    if ( !linedUp ) next = steps_.size();
+
+    auto declared = [](const step& s) { return s.declared; };
+    auto& decls = root_->declarations;
+    auto firstNode = decls.begin() + std::count_if(steps_.begin(), steps_.begin() + firstStep, declared);
+    auto oldNodes = std::count_if(steps_.begin() + firstStep, steps_.begin() + next, declared);
+    firstNode = decls.erase(firstNode, firstNode + oldNodes);
+    decls.insert(firstNode, std::make_move_iterator(nodes.begin()), std::make_move_iterator(nodes.end()));
+
+    size_t count = parsed.size();
+    for ( size_t i = next; i < steps_.size(); i++ ) {
+        step& s = steps_[i];
+        s.begin += shift;
+        s.end += shift;
+        if ( s.errors.empty() ) continue;
+        if ( linesMoved ) {
+            size_t end;
+            parser.parseDeclarationAt(s.begin, end);
+            s.errors = parser.diagnostics().entries();
+            parser.diagnostics().clear();
+            count++;
+            continue;
+        }
+        for ( diagnostic& d : s.errors ) {
+            if ( d.span.line ) d.span.offset = (uint32_t)((std::ptrdiff_t)d.span.offset + moved);
+        }
+    }
+    steps_.erase(steps_.begin() + firstStep, steps_.begin() + next);
+    steps_.insert(steps_.begin() + firstStep, std::make_move_iterator(parsed.begin()), std::make_move_iterator(parsed.end()));
+    return count;
+}
+
+void sourceDocument::apply(const sourceEdit& edit) {
+    std::string_view before = text();
+    if ( edit.offset > before.size() || edit.length > before.size() - edit.offset ) {
+        throw documentError(name_ + ": edit of " + std::to_string(edit.length) + " byte(s) at offset " +
+                            std::to_string(edit.offset) + " is past the end of the text");
+    }
+    std::string after;
+    after.reserve(before.size() - edit.length + edit.text.size());
+    after.append(before.substr(0, edit.offset));
+    after.append(edit.text);
+    after.append(before.substr(edit.offset + edit.length));
+    std::ptrdiff_t delta = (std::ptrdiff_t)edit.text.size() - (std::ptrdiff_t)edit.length;
+    size_t editEnd = edit.offset + edit.text.size(); // in the new text
+
+    // Lexing starts again at the last token the edit can't have changed, whose line
+    // and column give the lexer its position
+    size_t first = std::partition_point(tokens_.begin(), tokens_.end(),
+                                        [&](const compactToken& tok) { return tokenReach(tok) <= edit.offset; }) -
+                   tokens_.begin();
+    while ( first > 0 && isQuoted(tokens_[first - 1]) ) first--;
+    size_t pos = 0, lineStart = 0;
+    int row = 1;
+    if ( first > 0 && tokens_[first - 1].column < compactToken::MAX_COLUMN ) {
+        const compactToken& tok = tokens_[--first];
+        pos = tok.offset;
+        row = (int)tok.line;
+        lineStart = pos - (tok.column - 1);
+    } else {
+        first = 0;
+    }
+
+    sourceBuffer buffer;
+    buffer.assign(std::move(after));
+    auto lex = std::make_unique<lexer>(std::move(buffer), name_, tokenFlow::STREAMING, 0);
+    lex->restart(pos, row, lineStart);
+    const char* src = lex->sourceData();
+
+    // Past the end of the edit the text is the old one moved by delta. The first token
+    // there that the old text had too, at the same column, was scanned with the lexer
+    // in the same state and is followed by the same tokens as before.
+    std::vector<compactToken> relexed;
+    size_t kept = tokens_.size(); // first old token lexed the same, none until found
+    size_t candidate = first;
+    int lineDelta = 0;
+    while ( !lex->atEnd() ) {
+        compactToken tok = lex->next();
+        if ( tok.offset >= editEnd && !isQuoted(tok) && tok.column < compactToken::MAX_COLUMN ) {
+            size_t oldOffset = (size_t)((std::ptrdiff_t)tok.offset - delta);
+            while ( candidate < tokens_.size() && tokens_[candidate].offset < oldOffset ) candidate++;
+            if ( candidate < tokens_.size() && tokens_[candidate].offset == oldOffset &&
+                 tokens_[candidate].type == tok.type && tokens_[candidate].length == tok.length &&
+                 tokens_[candidate].column == tok.column ) {
+                kept = candidate;
+                lineDelta = (int)tok.line - (int)tokens_[candidate].line;
+                break;
+            }
+        }
+        relexed.push_back(tok);
+    }
+    lastRelexed_ = relexed.size();
+
+    // Lexer errors between the restart and the kept tokens are the new lexer's
+    size_t keptStart = kept < tokens_.size() ? tokens_[kept].offset : SIZE_MAX; // in the old text
+    auto firstError = std::partition_point(lexErrors_.begin(), lexErrors_.end(),
+                                           [&](const diagnostic& d) { return d.span.offset < pos; });
+    auto lastError = std::partition_point(firstError, lexErrors_.end(),
+                                          [&](const diagnostic& d) { return d.span.offset < keptStart; });
+    for ( auto it = lastError; it != lexErrors_.end(); ++it ) {
+        it->span.offset = (uint32_t)((std::ptrdiff_t)it->span.offset + delta);
+        if ( lineDelta ) {
+            it->span.line = (uint32_t)((int)it->span.line + lineDelta);
+            it->message = lexer::unexpectedCharacter(std::string_view(src + it->span.offset, it->span.length), it->span);
+        }
+    }
+    firstError = lexErrors_.erase(firstError, lastError);
+    const std::vector<diagnostic>& found = lex->diagnostics().entries();
+    lexErrors_.insert(firstError, found.begin(), found.end());
+    lex->diagnostics().clear();
+
+    for ( size_t i = kept; i < tokens_.size(); i++ ) {
+        compactToken& tok = tokens_[i];
+        tok.offset = (uint32_t)((std::ptrdiff_t)tok.offset + delta);
+        tok.line = (uint32_t)((int)tok.line + lineDelta);
+    }
+    tokens_.erase(tokens_.begin() + first, tokens_.begin() + kept);
+    tokens_.insert(tokens_.begin() + first, relexed.begin(), relexed.end());
+    lex_ = std::move(lex);
+
+    if ( parser_->arena().bytesUsed() > 2 * liveBytes_ + MIN_GARBAGE ) {
+        parseAll();
+        return;
+    }
+    parser_->setTokens(src, tokens_.data(), tokens_.size());
+    root_->resolved = false;
+    root_->globalCount = 0;
+    // The first step that looked at a changed token, its lookahead included
+    size_t firstStep = std::partition_point(steps_.begin(), steps_.end(), [&](const step& s) { return s.end < first; }) -
+                       steps_.begin();
+    std::ptrdiff_t shift = (std::ptrdiff_t)(first + relexed.size()) - (std::ptrdiff_t)kept;
+    lastReparsed_ = reparse(firstStep, kept, shift, delta, lineDelta != 0);
+}
+
+bool sourceDocument::ok() const {
+    return lexErrors_.empty() && std::all_of(steps_.begin(), steps_.end(), [](const step& s) { return s.errors.empty(); });
+}
+
+void sourceDocument::diagnostics(diagnosticEngine& out) const {
+    for ( const diagnostic& d : lexErrors_ ) {
+        out.report(d.stage, d.span, d.message);
+    }
+    for ( const step& s : steps_ ) {
+        for ( const diagnostic& d : s.errors ) out.report(d.stage, d.span, d.message);
+    }
+}
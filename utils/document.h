@@ -0,0 +1,93 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include "lexer.h"
+#include "ast.h"
+#include "diagnostics.h"
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+class documentError : public std::exception {
+private:
+    std::string msg_;
+
+public:
+    documentError(const std::string& msg) : msg_(msg) {}
+    const char* what() const noexcept override {
+        return msg_.c_str();
+    }
+};
+
+// Replaces length bytes at offset, both in the text as it was before the edit
+struct sourceEdit {
+    size_t offset = 0;
+    size_t length = 0;
+    std::string text;
+};
+
+// A source file held in memory and kept lexed and parsed as it is edited, for
+// diagnostics on every keystroke. An edit is lexed again from the last token before
+// it until the new tokens line up with the old ones past it, tokens after that are
+// only moved. Top-level declarations whose tokens the edit did not touch keep their
+// nodes, the others are parsed again until the parse lines up with the old one.
+// The result matches lexing and parsing the whole text again, with no error limit.
+class sourceDocument {
+private:
+    // One step of the top-level parse, see AST::parseDeclarationAt. Steps follow each
+    // other without gaps and cover every token.
+    struct step {
+        size_t begin; // first token
+        size_t end; // the next step's first token, looked at by this one too
+        bool declared; // has a node in root_, null steps are stray separators or errors
+        std::vector<diagnostic> errors;
+    };
+
+    std::string name_;
+    std::unique_ptr<lexer> lex_; // owns the text, streaming so it can be restarted
+    std::vector<compactToken> tokens_;
+    std::vector<diagnostic> lexErrors_; // in source order
+    std::vector<step> steps_;
+    std::unique_ptr<AST> parser_; // its arena owns every node, old ones until the next full parse
+    nodePtr<programNode> root_;
+    size_t liveBytes_ = 0; // arena use after the last full parse
+    size_t lastRelexed_ = 0;
+    size_t lastReparsed_ = 0;
+
+    void parseAll();
+    // Parses steps from the start of steps_[firstStep] until one starts where an old
+    // step did that starts at or after old token keptFrom, tokens from there on having
+    // moved by shift and their text by moved bytes, and puts them in place of the old
+    // steps in between. Steps kept after that with errors are parsed again when
+    // linesMoved, as their messages give lines. Returns the number of steps parsed.
+    size_t reparse(size_t firstStep, size_t keptFrom, std::ptrdiff_t shift, std::ptrdiff_t moved, bool linesMoved);
+
+public:
+    // name is only used in messages
+    sourceDocument(const std::string& name, std::string text);
+    ~sourceDocument();
+    sourceDocument(const sourceDocument&) = delete;
+    sourceDocument& operator=(const sourceDocument&) = delete;
+
+    // Throws documentError if the edit reaches past the end of the text. The tree and
+    // tokens from before are invalid afterwards.
+    void apply(const sourceEdit& edit);
+
+    std::string_view text() const { return std::string_view(lex_->sourceData(), lex_->sourceSize()); }
+    const std::vector<compactToken>& tokens() const { return tokens_; }
+    // Every declaration that parsed, in source order, as parsed: sema annotations
+    // are reset by each edit
+    const programNode* program() const { return root_.get(); }
+    bool ok() const;
+    // Adds the lexer and parse errors to out, which puts them in source order and
+    // applies its own limit
+    void diagnostics(diagnosticEngine& out) const;
+
+    // Tokens scanned and declarations parsed by the last edit, or by construction
+    size_t relexedTokens() const { return lastRelexed_; }
+    size_t reparsedDeclarations() const { return lastReparsed_; }
+};
+
+#endif // DOCUMENT_H
@@ -0,0 +1,323 @@
+#include "flatast.h"
+
+#include <cstring>
+
+flatAST flatAST::fromProgram(const programNode& root) {
+    flatAST flat;
+    flat.add(&root);
+    return flat;
+}
+
+flatAST flatAST::fromParts(std::vector<flatNode> nodes, std::vector<nodeId> children,
+                           std::vector<std::string> strings) {
+    flatAST flat;
+    flat.nodes_ = std::move(nodes);
+    flat.children_ = std::move(children);
+    flat.strings_ = std::move(strings);
+    return flat;
+}
+
+nodePtr<programNode> flatAST::toProgram(astArena& arena) const {
+    if (root() == NO_NODE || nodes_[root()].kind != astNodeType::PROGRAM) return nullptr;
+    return buildAs<programNode>(arena, root());
+}
+
+flatAST::childRange flatAST::children(nodeId id) const {
+    const flatNode& n = nodes_[id];
+    const nodeId* first = children_.data() + n.firstChild;
+    return { first, first + n.childCount };
+}
+
+nodeId flatAST::child(nodeId id, size_t slot) const {
+    const flatNode& n = nodes_[id];
+    return slot < n.childCount ? children_[n.firstChild + slot] : NO_NODE;
+}
+
+double flatAST::doubleValue(nodeId id) const {
+    double value;
+    uint64_t bits = nodes_[id].payload;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t flatAST::addString(const std::string& str) {
+    strings_.push_back(str);
+    return (uint32_t)(strings_.size() - 1);
+}
+
+nodeId flatAST::reserve(astNodeType kind, size_t childCount) {
+    nodeId id = (nodeId)nodes_.size();
+    flatNode n{};
+    n.kind = kind;
+    n.op = opKind::UNKNOWN;
+    n.varType = astVarType::INFERRED;
+    n.firstChild = (uint32_t)children_.size();
+    n.childCount = (uint32_t)childCount;
+    nodes_.push_back(n);
+    children_.resize(children_.size() + childCount, NO_NODE);
+    return id;
+}
+
+nodeId flatAST::add(const astNode* node) {
+    if (!node) return NO_NODE;
+
+    // Collect the fixed child slots first so the range is contiguous
+    std::vector<const astNode*> slots;
+    switch (node->type) {
+        case astNodeType::UNARYOP:
+            slots = { static_cast<const unaryOpNode*>(node)->operand.get() };
+            break;
+        case astNodeType::BINARYOP: {
+            auto n = static_cast<const binaryOpNode*>(node);
+            slots = { n->left.get(), n->right.get() };
+            break;
+        }
+        case astNodeType::ASSIGNOP: {
+            auto n = static_cast<const assignOpNode*>(node);
+            slots = { n->value.get(), n->index.get() };
+            break;
+        }
+        case astNodeType::FNCALL:
+            for (const auto& arg : static_cast<const fnCallNode*>(node)->args) slots.push_back(arg.get());
+            break;
+        case astNodeType::INDEX: {
+            auto n = static_cast<const indexNode*>(node);
+            slots = { n->list.get(), n->index.get() };
+            break;
+        }
+        case astNodeType::LIST: {
+            auto n = static_cast<const listNode*>(node);
+            slots = { n->length.get() };
+            for (const auto& element : n->elements) slots.push_back(element.get());
+            break;
+        }
+        case astNodeType::INTERP: {
+            auto n = static_cast<const interpStringNode*>(node);
+            for (size_t i = 0; i < n->segments.size(); i++) {
+                slots.push_back(nullptr); // segment, added below
+                if (i < n->parts.size()) slots.push_back(n->parts[i].get());
+            }
+            break;
+        }
+        case astNodeType::IF: {
+            auto n = static_cast<const ifNode*>(node);
+            slots = { n->condition.get(), n->thenBody.get(), n->elseBody.get() };
+            break;
+        }
+        case astNodeType::FOR: {
+            auto n = static_cast<const forNode*>(node);
+            slots = { n->init.get(), n->condition.get(), n->increment.get(), n->body.get() };
+            break;
+        }
+        case astNodeType::WHILE: {
+            auto n = static_cast<const whileNode*>(node);
+            slots = { n->condition.get(), n->body.get() };
+            break;
+        }
+        case astNodeType::RETURN:
+            slots = { static_cast<const returnNode*>(node)->value.get() };
+            break;
+        case astNodeType::VARDECL:
+            slots = { static_cast<const varDeclNode*>(node)->initializer.get() };
+            break;
+        case astNodeType::FUNCTION:
+            slots = { static_cast<const functionNode*>(node)->body.get() };
+            break;
+        case astNodeType::BODY:
+            for (const auto& stmt : static_cast<const bodyNode*>(node)->statements) slots.push_back(stmt.get());
+            break;
+        case astNodeType::PROGRAM:
+            for (const auto& decl : static_cast<const programNode*>(node)->declarations) slots.push_back(decl.get());
+            break;
+        default:
+            break;
+    }
+
+    size_t paramCount = 0;
+    if (node->type == astNodeType::FUNCTION) {
+        paramCount = static_cast<const functionNode*>(node)->params.size();
+    }
+    nodeId id = reserve(node->type, slots.size() + paramCount);
+
+    // Own payload, written by index since children may grow nodes_
+    switch (node->type) {
+        case astNodeType::STRING:
+            nodes_[id].payload = addString(static_cast<const stringLiteralNode*>(node)->value);
+            break;
+        case astNodeType::INT:
+            nodes_[id].payload = (uint64_t)(int64_t)static_cast<const intLiteralNode*>(node)->value;
+            break;
+        case astNodeType::DOUBLE: {
+            double value = static_cast<const doubleLiteralNode*>(node)->value;
+            std::memcpy(&nodes_[id].payload, &value, sizeof(value));
+            break;
+        }
+        case astNodeType::CHAR:
+            nodes_[id].payload = (unsigned char)static_cast<const charLiteralNode*>(node)->value;
+            break;
+        case astNodeType::BOOL:
+            nodes_[id].payload = static_cast<const booleanLiteralNode*>(node)->value ? 1 : 0;
+            break;
+        case astNodeType::VARIABLE: {
+            auto n = static_cast<const variableNode*>(node);
+            nodes_[id].payload = n->name.id;
+            nodes_[id].varType = n->varType;
+            break;
+        }
+        case astNodeType::UNARYOP:
+            nodes_[id].op = static_cast<const unaryOpNode*>(node)->op;
+            break;
+        case astNodeType::BINARYOP:
+            nodes_[id].op = static_cast<const binaryOpNode*>(node)->op;
+            break;
+        case astNodeType::ASSIGNOP: {
+            auto n = static_cast<const assignOpNode*>(node);
+            nodes_[id].op = n->op;
+            nodes_[id].payload = n->targetName.id;
+            break;
+        }
+        case astNodeType::FNCALL:
+            nodes_[id].payload = static_cast<const fnCallNode*>(node)->name.id;
+            break;
+        case astNodeType::LIST:
+            nodes_[id].varType = static_cast<const listNode*>(node)->varType;
+            break;
+        case astNodeType::IMPORT:
+            nodes_[id].payload = addString(static_cast<const importNode*>(node)->path);
+            break;
+        case astNodeType::VARDECL: {
+            auto n = static_cast<const varDeclNode*>(node);
+            nodes_[id].payload = n->name.id;
+            nodes_[id].varType = n->varType;
+            break;
+        }
+        case astNodeType::FUNCTION: {
+            auto n = static_cast<const functionNode*>(node);
+            nodes_[id].payload = n->name.id;
+            nodes_[id].varType = n->returnType;
+            break;
+        }
+        default:
+            break;
+    }
+
+    uint32_t first = nodes_[id].firstChild;
+    for (size_t i = 0; i < slots.size(); i++) {
+        nodeId childId;
+        if (node->type == astNodeType::INTERP && i % 2 == 0) {
+            childId = reserve(astNodeType::STRING, 0);
+            const std::string& segment = static_cast<const interpStringNode*>(node)->segments[i / 2];
+            nodes_[childId].payload = addString(encodeEscapes(segment));
+        } else {
+            childId = add(slots[i]);
+        }
+        children_[first + i] = childId;
+    }
+    if (paramCount) {
+        auto fn = static_cast<const functionNode*>(node);
+        for (size_t i = 0; i < paramCount; i++) {
+            nodeId param = reserve(astNodeType::VARDECL, 0);
+            nodes_[param].payload = fn->params[i].name.id;
+            nodes_[param].varType = fn->params[i].type;
+            children_[first + slots.size() + i] = param;
+        }
+    }
+    return id;
+}
+
+void flatAST::print(std::ostream& out) const {
+    if (root() != NO_NODE) printFlatNode(*this, out, root(), 0);
+}
+
+astNode* flatAST::build(astArena& arena, nodeId id) const {
+    if (id == NO_NODE) return nullptr;
+    const flatNode& n = nodes_[id];
+    switch (n.kind) {
+        case astNodeType::STRING:
+            return arena.make<stringLiteralNode>(stringValue(id));
+        case astNodeType::INT:
+            return arena.make<intLiteralNode>((int)intValue(id));
+        case astNodeType::DOUBLE:
+            return arena.make<doubleLiteralNode>(doubleValue(id));
+        case astNodeType::CHAR:
+            return arena.make<charLiteralNode>(charValue(id));
+        case astNodeType::BOOL:
+            return arena.make<booleanLiteralNode>(boolValue(id));
+        case astNodeType::VARIABLE:
+            return arena.make<variableNode>(name(id), n.varType);
+        case astNodeType::UNARYOP:
+            return arena.make<unaryOpNode>(n.op, buildAs<expressionNode>(arena, child(id, 0)));
+        case astNodeType::BINARYOP:
+            return arena.make<binaryOpNode>(n.op, buildAs<expressionNode>(arena, child(id, 0)),
+                                            buildAs<expressionNode>(arena, child(id, 1)));
+        case astNodeType::ASSIGNOP:
+            return arena.make<assignOpNode>(name(id), buildAs<expressionNode>(arena, child(id, 0)), n.op,
+                                            buildAs<expressionNode>(arena, child(id, 1)));
+        case astNodeType::FNCALL: {
+            std::vector<nodePtr<expressionNode>> args;
+            for (nodeId arg : children(id)) args.push_back(buildAs<expressionNode>(arena, arg));
+            return arena.make<fnCallNode>(name(id), std::move(args));
+        }
+        case astNodeType::INDEX:
+            return arena.make<indexNode>(buildAs<expressionNode>(arena, child(id, 0)),
+                                         buildAs<expressionNode>(arena, child(id, 1)));
+        case astNodeType::LIST: {
+            std::vector<nodePtr<expressionNode>> elements;
+            childRange kids = children(id);
+            for (size_t i = 1; i < kids.size(); i++) elements.push_back(buildAs<expressionNode>(arena, kids[i]));
+            return arena.make<listNode>(n.varType, std::move(elements), buildAs<expressionNode>(arena, child(id, 0)));
+        }
+        case astNodeType::INTERP: {
+            std::vector<std::string> segments;
+            std::vector<nodePtr<expressionNode>> parts;
+            childRange kids = children(id);
+            for (size_t i = 0; i < kids.size(); i++) {
+                if (i % 2 == 0) segments.push_back(decodeEscapes(stringValue(kids[i])));
+                else parts.push_back(buildAs<expressionNode>(arena, kids[i]));
+            }
+            return arena.make<interpStringNode>(std::move(segments), std::move(parts));
+        }
+        case astNodeType::IMPORT:
+            return arena.make<importNode>(stringValue(id));
+        case astNodeType::IF:
+            return arena.make<ifNode>(buildAs<expressionNode>(arena, child(id, 0)),
+                                      buildAs<astNode>(arena, child(id, 1)),
+                                      buildAs<astNode>(arena, child(id, 2)));
+        case astNodeType::FOR:
+            return arena.make<forNode>(buildAs<astNode>(arena, child(id, 0)),
+                                       buildAs<expressionNode>(arena, child(id, 1)),
+                                       buildAs<expressionNode>(arena, child(id, 2)),
+                                       buildAs<astNode>(arena, child(id, 3)));
+        case astNodeType::WHILE:
+            return arena.make<whileNode>(buildAs<expressionNode>(arena, child(id, 0)),
+                                         buildAs<astNode>(arena, child(id, 1)));
+        case astNodeType::RETURN:
+            return arena.make<returnNode>(buildAs<expressionNode>(arena, child(id, 0)));
+        case astNodeType::BREAK:
+            return arena.make<breakNode>();
+        case astNodeType::CONTINUE:
+            return arena.make<continueNode>();
+        case astNodeType::VARDECL:
+            return arena.make<varDeclNode>(n.varType, name(id), buildAs<expressionNode>(arena, child(id, 0)));
+        case astNodeType::FUNCTION: {
+            std::vector<paramNode> params;
+            childRange kids = children(id);
+            for (size_t i = 1; i < kids.size(); i++) {
+                params.emplace_back(nodes_[kids[i]].varType, name(kids[i]));
+            }
+            return arena.make<functionNode>(n.varType, name(id), std::move(params), buildAs<astNode>(arena, child(id, 0)));
+        }
+        case astNodeType::BODY: {
+            std::vector<nodePtr<astNode>> statements;
+            for (nodeId stmt : children(id)) statements.push_back(buildAs<astNode>(arena, stmt));
+            return arena.make<bodyNode>(std::move(statements));
+        }
+        case astNodeType::PROGRAM: {
+            std::vector<nodePtr<astNode>> decls;
+            for (nodeId decl : children(id)) decls.push_back(buildAs<astNode>(arena, decl));
+            return arena.make<programNode>(std::move(decls));
+        }
+        default:
+            return nullptr;
+    }
+}
@@ -0,0 +1,235 @@
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include "ast.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using nodeId = uint32_t;
+constexpr nodeId NO_NODE = 0xFFFFFFFFu;
+
+// One node of a flatAST. Children live in a contiguous range of the child
+// index list, with fixed positions per kind (missing optional children are NO_NODE):
+//   UNARYOP [operand]            BINARYOP [left, right]     ASSIGNOP [value, index]
+//   FNCALL [args...]              INDEX [list, index]        LIST [length, elements...]
+//   IF [condition, then, else]    FOR [init, condition, increment, body]
+//   WHILE [condition, body]       RETURN [value]             VARDECL [initializer]
+//   FUNCTION [body, params...]    BODY [statements...]       PROGRAM [declarations...]
+//   INTERP [segment, part, segment, ..., segment]
+// Function parameters are VARDECL nodes without an initializer slot. Interpolation
+// segments are STRING nodes, which always hold the text as written, escapes included.
+struct flatNode {
+    astNodeType kind;
+    opKind op; // operator nodes only
+    astVarType varType; // VARIABLE, VARDECL, LIST and FUNCTION (return type)
+    uint8_t reserved;
+    uint32_t firstChild; // index into the child list
+    uint32_t childCount;
+    uint64_t payload; // literal bits, symbol id, or string index for STRING / IMPORT
+};
+static_assert(sizeof(flatNode) == 24, "flatNode is written to disk as is");
+
+// Data oriented AST: every node in one array indexed by nodeId, in pre-order,
+// so a linear walk over nodes() visits the program in source order.
+class flatAST {
+private:
+    std::vector<flatNode> nodes_;
+    std::vector<nodeId> children_;
+    std::vector<std::string> strings_;
+
+    nodeId add(const astNode* node);
+    nodeId reserve(astNodeType kind, size_t childCount);
+    uint32_t addString(const std::string& str);
+    astNode* build(astArena& arena, nodeId id) const;
+    template <class T>
+    nodePtr<T> buildAs(astArena& arena, nodeId id) const {
+        return nodePtr<T>(static_cast<T*>(build(arena, id)));
+    }
+
+public:
+    // Converts an existing tree, the result does not reference it afterwards
+    static flatAST fromProgram(const programNode& root);
+    // Adopts already laid out arrays, e.g. read back from disk
+    static flatAST fromParts(std::vector<flatNode> nodes, std::vector<nodeId> children,
+                             std::vector<std::string> strings);
+    // Rebuilds a node tree in the given arena
+    nodePtr<programNode> toProgram(astArena& arena) const;
+
+    struct childRange {
+        const nodeId* first;
+        const nodeId* last;
+        const nodeId* begin() const { return first; }
+        const nodeId* end() const { return last; }
+        size_t size() const { return (size_t)(last - first); }
+        nodeId operator[](size_t i) const { return first[i]; }
+    };
+
+    nodeId root() const { return nodes_.empty() ? NO_NODE : 0; }
+    size_t size() const { return nodes_.size(); }
+    const std::vector<flatNode>& nodes() const { return nodes_; }
+    const flatNode& node(nodeId id) const { return nodes_[id]; }
+    childRange children(nodeId id) const;
+    nodeId child(nodeId id, size_t slot) const;
+
+    // Payload accessors, valid for the matching kinds
+    int64_t intValue(nodeId id) const { return (int64_t)nodes_[id].payload; }
+    double doubleValue(nodeId id) const;
+    char charValue(nodeId id) const { return (char)nodes_[id].payload; }
+    bool boolValue(nodeId id) const { return nodes_[id].payload != 0; }
+    symbol name(nodeId id) const { return symbol{ (symbolId)nodes_[id].payload }; }
+    const std::string& stringValue(nodeId id) const { return strings_[nodes_[id].payload]; }
+    const std::vector<nodeId>& childList() const { return children_; }
+    const std::vector<std::string>& strings() const { return strings_; }
+
+    // Same layout as the tree printer
+    void print(std::ostream& out) const;
+};
+
+// Tree printer layout over anything with flatAST's accessors, see astImage
+template <class View>
+void printFlatNode(const View& view, std::ostream& out, nodeId id, int indent) {
+    if (id == NO_NODE) return;
+    const flatNode& n = view.node(id);
+    std::string pad(indent, ' ');
+    switch (n.kind) {
+        case astNodeType::STRING:
+            out << pad << "string(\"" << view.stringValue(id) << "\")\n";
+            break;
+        case astNodeType::INT:
+            out << pad << "int(" << view.intValue(id) << ")\n";
+            break;
+        case astNodeType::DOUBLE:
+            out << pad << "double(" << view.doubleValue(id) << ")\n";
+            break;
+        case astNodeType::CHAR:
+            out << pad << "char('" << view.charValue(id) << "')\n";
+            break;
+        case astNodeType::BOOL:
+            out << pad << "bool(" << (view.boolValue(id) ? "true" : "false") << ")\n";
+            break;
+        case astNodeType::VARIABLE:
+            out << pad << "Variable(\"" << view.name(id) << "\", type=" << (int)n.varType << ")\n";
+            break;
+        case astNodeType::UNARYOP:
+            out << pad << "UnaryOp(" << n.op << ")\n";
+            printFlatNode(view, out, view.child(id, 0), indent + 2);
+            break;
+        case astNodeType::BINARYOP:
+            out << pad << "BinaryOp(" << n.op << ")\n";
+            printFlatNode(view, out, view.child(id, 0), indent + 2);
+            printFlatNode(view, out, view.child(id, 1), indent + 2);
+            break;
+        case astNodeType::ASSIGNOP:
+            out << pad << "AssignOp(target=\"" << view.name(id) << "\", op=\"" << n.op << "\")\n";
+            if (view.child(id, 1) != NO_NODE) {
+                out << pad << "  Index:\n";
+                printFlatNode(view, out, view.child(id, 1), indent + 4);
+                out << pad << "  Value:\n";
+                printFlatNode(view, out, view.child(id, 0), indent + 4);
+                break;
+            }
+            printFlatNode(view, out, view.child(id, 0), indent + 2);
+            break;
+        case astNodeType::FNCALL:
+            out << pad << "FnCall(\"" << view.name(id) << "\")\n";
+            for (nodeId arg : view.children(id)) printFlatNode(view, out, arg, indent + 2);
+            break;
+        case astNodeType::INDEX:
+            out << pad << "Index\n";
+            printFlatNode(view, out, view.child(id, 0), indent + 2);
+            printFlatNode(view, out, view.child(id, 1), indent + 2);
+            break;
+        case astNodeType::LIST: {
+            out << pad << "List(type=" << (int)n.varType << ")\n";
+            if (view.child(id, 0) != NO_NODE) {
+                out << pad << "  Length:\n";
+                printFlatNode(view, out, view.child(id, 0), indent + 4);
+            }
+            auto kids = view.children(id);
+            for (size_t i = 1; i < kids.size(); i++) printFlatNode(view, out, kids[i], indent + 2);
+            break;
+        }
+        case astNodeType::INTERP:
+            out << pad << "Interpolation\n";
+            for (nodeId kid : view.children(id)) printFlatNode(view, out, kid, indent + 2);
+            break;
+        case astNodeType::IMPORT:
+            out << pad << "Import(" << view.stringValue(id) << ")\n";
+            break;
+        case astNodeType::IF:
+            out << pad << "IfStatement\n";
+            out << pad << "  Condition:\n";
+            printFlatNode(view, out, view.child(id, 0), indent + 4);
+            out << pad << "  Then:\n";
+            printFlatNode(view, out, view.child(id, 1), indent + 4);
+            if (view.child(id, 2) != NO_NODE) {
+                out << pad << "  Else:\n";
+                printFlatNode(view, out, view.child(id, 2), indent + 4);
+            }
+            break;
+        case astNodeType::FOR:
+            out << pad << "ForLoop\n";
+            out << pad << "  Init:\n";
+            printFlatNode(view, out, view.child(id, 0), indent + 4);
+            out << pad << "  Condition:\n";
+            printFlatNode(view, out, view.child(id, 1), indent + 4);
+            out << pad << "  Increment:\n";
+            printFlatNode(view, out, view.child(id, 2), indent + 4);
+            out << pad << "  Body:\n";
+            printFlatNode(view, out, view.child(id, 3), indent + 4);
+            break;
+        case astNodeType::WHILE:
+            out << pad << "WhileLoop\n";
+            out << pad << "  Condition:\n";
+            printFlatNode(view, out, view.child(id, 0), indent + 4);
+            out << pad << "  Body:\n";
+            printFlatNode(view, out, view.child(id, 1), indent + 4);
+            break;
+        case astNodeType::RETURN:
+            out << pad << "Return\n";
+            printFlatNode(view, out, view.child(id, 0), indent + 2);
+            break;
+        case astNodeType::BREAK:
+            out << pad << "Break\n";
+            break;
+        case astNodeType::CONTINUE:
+            out << pad << "Continue\n";
+            break;
+        case astNodeType::VARDECL:
+            out << pad << "VarDecl(\"" << view.name(id) << "\", type=" << (int)n.varType << ")\n";
+            if (view.child(id, 0) != NO_NODE) {
+                out << pad << "  Initializer:\n";
+                printFlatNode(view, out, view.child(id, 0), indent + 4);
+            }
+            break;
+        case astNodeType::FUNCTION: {
+            out << pad << "Function(\"" << view.name(id) << "\", returnType=" << (int)n.varType << ")\n";
+            out << pad << "  Params:\n";
+            auto kids = view.children(id);
+            for (size_t i = 1; i < kids.size(); i++) {
+                const flatNode& param = view.node(kids[i]);
+                out << pad << "    Param(\"" << view.name(kids[i]) << "\", type=" << (int)param.varType << ")\n";
+            }
+            if (view.child(id, 0) != NO_NODE) {
+                out << pad << "  Body:\n";
+                printFlatNode(view, out, view.child(id, 0), indent + 4);
+            }
+            break;
+        }
+        case astNodeType::BODY:
+            out << pad << "Body {\n";
+            for (nodeId stmt : view.children(id)) printFlatNode(view, out, stmt, indent + 2);
+            out << pad << "}\n";
+            break;
+        case astNodeType::PROGRAM:
+            out << pad << "Program\n";
+            for (nodeId decl : view.children(id)) printFlatNode(view, out, decl, indent + 2);
+            break;
+        default:
+            break;
+    }
+}
+
+#endif // FLATAST_H
@@ -0,0 +1,520 @@
+#include "fold.h"
+#include "visitor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// A literal's value as the runtime sees it
+struct constant {
+    astVarType type = astVarType::VOID;
+    int64_t i = 0; // int, boolean, char
+    double d = 0.0;
+    const std::string* s = nullptr;
+};
+
+bool isIntClass(astVarType t) {
+    return t == astVarType::INT || t == astVarType::BOOLEAN || t == astVarType::CHAR;
+}
+
+bool isComparison(opKind op) {
+    switch (op) {
+        case opKind::LESSTHAN:
+        case opKind::MORETHAN:
+        case opKind::LESSTHANEQUAL:
+        case opKind::MORETHANEQUAL:
+        case opKind::EQUAL:
+        case opKind::NOTEQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+template <class T>
+bool compare(opKind op, T l, T r) {
+    switch (op) {
+        case opKind::LESSTHAN: return l < r;
+        case opKind::MORETHAN: return l > r;
+        case opKind::LESSTHANEQUAL: return l <= r;
+        case opKind::MORETHANEQUAL: return l >= r;
+        case opKind::EQUAL: return l == r;
+        default: return l != r;
+    }
+}
+
+bool truth(const constant& c) {
+    if (c.type == astVarType::DOUBLE) return c.d != 0.0;
+    if (c.type == astVarType::STRING) return !c.s->empty();
+    return c.i != 0;
+}
+
+double asDouble(const constant& c) {
+    return c.type == astVarType::DOUBLE ? c.d : (double)c.i;
+}
+
+bool isNumeric(astVarType t) {
+    return isIntClass(t) || t == astVarType::DOUBLE;
+}
+
+bool endsFlow(const astNode* node) {
+    return node && (node->type == astNodeType::RETURN || node->type == astNodeType::BREAK || node->type == astNodeType::CONTINUE);
+}
+
+// Whether a subtree reads or writes a name
+class nameUse : public astVisitor<nameUse> {
+private:
+    symbolId name_;
+
+public:
+    bool found = false;
+
+    explicit nameUse(symbolId name) : name_(name) {}
+
+    void visitVariable(const variableNode* n) { found = found || n->name.id == name_; }
+    void visitAssignOp(const assignOpNode* n) {
+        found = found || n->targetName.id == name_;
+        visitChildren(n);
+    }
+};
+
+class constantFolder {
+private:
+    astArena& arena_;
+    std::unordered_map<symbolId, astVarType> functions_; // return types in this program
+    std::unordered_map<symbolId, astVarType> globals_;
+    std::vector<std::pair<symbolId, astVarType>> locals_; // innermost last
+    std::vector<size_t> scopes_;
+    std::unordered_set<const varDeclNode*> removable_; // if nothing reads them
+
+    void pushScope() { scopes_.push_back(locals_.size()); }
+    void popScope() {
+        locals_.resize(scopes_.back());
+        scopes_.pop_back();
+    }
+
+    // Declared type of a name, INFERRED when it comes from an import
+    astVarType typeOfName(symbol name) const {
+        for (auto it = locals_.rbegin(); it != locals_.rend(); ++it) {
+            if (it->first == name.id) return it->second;
+        }
+        auto global = globals_.find(name.id);
+        return global != globals_.end() ? global->second : astVarType::INFERRED;
+    }
+
+    // Static type of an expression where it can be told without resolving imports
+    astVarType typeOf(const astNode* node) const {
+        if (!node) return astVarType::INFERRED;
+        switch (node->type) {
+            case astNodeType::STRING: return astVarType::STRING;
+            case astNodeType::INTERP: return astVarType::STRING;
+            case astNodeType::INT: return astVarType::INT;
+            case astNodeType::DOUBLE: return astVarType::DOUBLE;
+            case astNodeType::CHAR: return astVarType::CHAR;
+            case astNodeType::BOOL: return astVarType::BOOLEAN;
+            case astNodeType::VARIABLE: return typeOfName(static_cast<const variableNode*>(node)->name);
+            case astNodeType::ASSIGNOP: {
+                auto n = static_cast<const assignOpNode*>(node);
+                astVarType t = typeOfName(n->targetName);
+                return n->index ? (isListType(t) ? elementType(t) : astVarType::INFERRED) : t;
+            }
+            case astNodeType::FNCALL: {
+                auto it = functions_.find(static_cast<const fnCallNode*>(node)->name.id);
+                return it != functions_.end() ? it->second : astVarType::INFERRED;
+            }
+            case astNodeType::UNARYOP: {
+                auto n = static_cast<const unaryOpNode*>(node);
+                astVarType t = typeOf(n->operand.get());
+                switch (n->op) {
+                    case opKind::NOT: return astVarType::BOOLEAN;
+                    case opKind::SUB: return t == astVarType::DOUBLE ? t : isIntClass(t) ? astVarType::INT : astVarType::INFERRED;
+                    case opKind::INVERT: return t == astVarType::BOOLEAN ? t : isIntClass(t) ? astVarType::INT : astVarType::INFERRED;
+                    default: return t;
+                }
+            }
+            case astNodeType::BINARYOP: {
+                auto n = static_cast<const binaryOpNode*>(node);
+                if (isComparison(n->op) || n->op == opKind::AND || n->op == opKind::OR) return astVarType::BOOLEAN;
+                astVarType l = typeOf(n->left.get());
+                astVarType r = typeOf(n->right.get());
+                if (l == astVarType::STRING || r == astVarType::STRING) {
+                    return n->op == opKind::ADD ? astVarType::STRING : astVarType::INFERRED;
+                }
+                if (l == astVarType::DOUBLE && (r == l || isIntClass(r))) return l;
+                if (r == astVarType::DOUBLE && isIntClass(l)) return r;
+                return isIntClass(l) && isIntClass(r) ? astVarType::INT : astVarType::INFERRED;
+            }
+            default:
+                return astVarType::INFERRED;
+        }
+    }
+
+    // Static type of an expression that has no effects and can't fail, INFERRED otherwise
+    astVarType pureType(const astNode* node) const {
+        if (!node) return astVarType::INFERRED;
+        switch (node->type) {
+            case astNodeType::STRING:
+            case astNodeType::INT:
+            case astNodeType::DOUBLE:
+            case astNodeType::CHAR:
+            case astNodeType::BOOL:
+            case astNodeType::VARIABLE:
+                return typeOf(node);
+            case astNodeType::UNARYOP: {
+                auto n = static_cast<const unaryOpNode*>(node);
+                if (n->op != opKind::NOT && n->op != opKind::SUB && n->op != opKind::INVERT) return astVarType::INFERRED;
+                return pureType(n->operand.get()) != astVarType::INFERRED ? typeOf(n) : astVarType::INFERRED;
+            }
+            case astNodeType::BINARYOP: {
+                auto n = static_cast<const binaryOpNode*>(node);
+                astVarType l = pureType(n->left.get());
+                astVarType r = pureType(n->right.get());
+                if (l == astVarType::INFERRED || r == astVarType::INFERRED) return astVarType::INFERRED;
+                if (n->op == opKind::AND || n->op == opKind::OR) return astVarType::BOOLEAN;
+                if (isComparison(n->op)) {
+                    bool comparable = (isNumeric(l) && isNumeric(r)) || (l == astVarType::STRING && r == astVarType::STRING);
+                    return comparable ? astVarType::BOOLEAN : astVarType::INFERRED;
+                }
+                // Integer division by anything but a known non-zero can fail
+                if ((n->op == opKind::DIV || n->op == opKind::MOD) && isIntClass(l) && isIntClass(r) &&
+                    (n->right->type != astNodeType::INT || isIntLiteral(n->right.get(), 0))) {
+                    return astVarType::INFERRED;
+                }
+                return typeOf(n);
+            }
+            case astNodeType::INTERP:
+                for (const auto& part : static_cast<const interpStringNode*>(node)->parts) {
+                    astVarType t = pureType(part.get());
+                    if (t == astVarType::INFERRED || t == astVarType::VOID || isListType(t)) return astVarType::INFERRED;
+                }
+                return astVarType::STRING;
+            default:
+                return astVarType::INFERRED;
+        }
+    }
+
+    // Text of a literal as it would be interpolated. Doubles are left to the
+    // runtime, whose formatting depends on the back end.
+    static bool literalText(const astNode* node, std::string& text) {
+        switch (node ? node->type : astNodeType::GENERIC) {
+            case astNodeType::STRING: text = static_cast<const stringLiteralNode*>(node)->text; return true;
+            case astNodeType::INT: text = std::to_string(static_cast<const intLiteralNode*>(node)->value); return true;
+            case astNodeType::CHAR: text = std::string(1, static_cast<const charLiteralNode*>(node)->value); return true;
+            case astNodeType::BOOL: text = static_cast<const booleanLiteralNode*>(node)->value ? "true" : "false"; return true;
+            default: return false;
+        }
+    }
+
+    // Statements after one that always leaves the block, and declarations whose
+    // initializer has no effect and that nothing in the rest of the block mentions
+    void dropDead(std::vector<nodePtr<astNode>>& list) {
+        auto end = std::find_if(list.begin(), list.end(), [](const nodePtr<astNode>& s) { return endsFlow(s.get()); });
+        if (end != list.end()) list.erase(end + 1, list.end());
+        // Backwards, so a declaration only read by a dead one goes too
+        for (size_t i = list.size(); i-- > 0;) {
+            if (!list[i] || list[i]->type != astNodeType::VARDECL) continue;
+            auto decl = static_cast<const varDeclNode*>(list[i].get());
+            if (!removable_.count(decl)) continue;
+            nameUse use(decl->name.id);
+            for (size_t j = i + 1; j < list.size() && !use.found; j++) use.visit(list[j].get());
+            if (!use.found) list[i] = nullptr;
+        }
+    }
+
+    static bool constantOf(const astNode* node, constant& c) {
+        if (!node) return false;
+        switch (node->type) {
+            case astNodeType::INT: c.type = astVarType::INT; c.i = static_cast<const intLiteralNode*>(node)->value; return true;
+            case astNodeType::BOOL: c.type = astVarType::BOOLEAN; c.i = static_cast<const booleanLiteralNode*>(node)->value; return true;
+            case astNodeType::CHAR: c.type = astVarType::CHAR; c.i = (unsigned char)static_cast<const charLiteralNode*>(node)->value; return true;
+            case astNodeType::DOUBLE: c.type = astVarType::DOUBLE; c.d = static_cast<const doubleLiteralNode*>(node)->value; return true;
+            case astNodeType::STRING: c.type = astVarType::STRING; c.s = &static_cast<const stringLiteralNode*>(node)->value; return true;
+            default: return false;
+        }
+    }
+
+    static bool isIntLiteral(const astNode* node, int value) {
+        return node && node->type == astNodeType::INT && static_cast<const intLiteralNode*>(node)->value == value;
+    }
+    static bool isDoubleLiteral(const astNode* node, double value) {
+        return node && node->type == astNodeType::DOUBLE && static_cast<const doubleLiteralNode*>(node)->value == value &&
+               !std::signbit(static_cast<const doubleLiteralNode*>(node)->value);
+    }
+
+    nodePtr<expressionNode> makeInt(int64_t v) {
+        // intLiteralNode holds an int, wider results stay runtime arithmetic
+        if (v < INT32_MIN || v > INT32_MAX) return nullptr;
+        return nodePtr<expressionNode>(arena_.make<intLiteralNode>((int)v));
+    }
+    nodePtr<expressionNode> makeBool(bool v) { return nodePtr<expressionNode>(arena_.make<booleanLiteralNode>(v)); }
+    nodePtr<expressionNode> makeDouble(double v) { return nodePtr<expressionNode>(arena_.make<doubleLiteralNode>(v)); }
+
+    nodePtr<expressionNode> foldUnary(opKind op, const constant& c) {
+        if (c.type == astVarType::STRING) {
+            return op == opKind::NOT ? makeBool(!truth(c)) : nullptr;
+        }
+        switch (op) {
+            case opKind::NOT: return makeBool(!truth(c));
+            case opKind::SUB:
+                if (c.type == astVarType::DOUBLE) return makeDouble(-c.d);
+                return makeInt((int64_t)(0 - (uint64_t)c.i));
+            case opKind::INVERT:
+                if (c.type == astVarType::BOOLEAN) return makeBool(c.i == 0);
+                if (c.type == astVarType::DOUBLE) return nullptr;
+                return makeInt(~c.i);
+            default:
+                return nullptr;
+        }
+    }
+
+    nodePtr<expressionNode> foldBinary(opKind op, const constant& l, const constant& r) {
+        if (op == opKind::AND) return makeBool(truth(l) && truth(r));
+        if (op == opKind::OR) return makeBool(truth(l) || truth(r));
+        if (l.type == astVarType::STRING || r.type == astVarType::STRING) {
+            if (op == opKind::ADD && l.type == r.type) {
+                return nodePtr<expressionNode>(arena_.make<stringLiteralNode>(*l.s + *r.s));
+            }
+            return nullptr;
+        }
+        if (l.type == astVarType::DOUBLE || r.type == astVarType::DOUBLE) {
+            double a = asDouble(l), b = asDouble(r);
+            if (isComparison(op)) return makeBool(compare(op, a, b));
+            switch (op) {
+                case opKind::ADD: return makeDouble(a + b);
+                case opKind::SUB: return makeDouble(a - b);
+                case opKind::MUL: return makeDouble(a * b);
+                case opKind::DIV: return makeDouble(a / b);
+                case opKind::MOD: return makeDouble(std::fmod(a, b));
+                default: return nullptr;
+            }
+        }
+        int64_t a = l.i, b = r.i;
+        if (isComparison(op)) return makeBool(compare(op, a, b));
+        switch (op) {
+            case opKind::ADD: return makeInt((int64_t)((uint64_t)a + (uint64_t)b));
+            case opKind::SUB: return makeInt((int64_t)((uint64_t)a - (uint64_t)b));
+            case opKind::MUL: return makeInt((int64_t)((uint64_t)a * (uint64_t)b));
+            case opKind::DIV:
+                if (b == 0) return nullptr; // reported at runtime
+                return makeInt(b == -1 ? (int64_t)(0 - (uint64_t)a) : a / b);
+            case opKind::MOD:
+                if (b == 0) return nullptr;
+                return makeInt(b == -1 ? 0 : a % b);
+            default:
+                return nullptr;
+        }
+    }
+
+    // x op identity, where the identity may not change the type of x
+    bool isIdentity(opKind op, const astNode* other, const astNode* side, bool sideIsRight) const {
+        astVarType t = typeOf(other);
+        if (t != astVarType::INT && t != astVarType::DOUBLE) return false;
+        bool doubleOk = t == astVarType::DOUBLE;
+        switch (op) {
+            case opKind::ADD: // -0.0 + 0 is 0.0, so only for ints
+                return t == astVarType::INT && isIntLiteral(side, 0);
+            case opKind::SUB:
+                return sideIsRight && (isIntLiteral(side, 0) || (doubleOk && isDoubleLiteral(side, 0.0)));
+            case opKind::MUL:
+                return isIntLiteral(side, 1) || (doubleOk && isDoubleLiteral(side, 1.0));
+            case opKind::DIV:
+                return sideIsRight && (isIntLiteral(side, 1) || (doubleOk && isDoubleLiteral(side, 1.0)));
+            default:
+                return false;
+        }
+    }
+
+    void expr(nodePtr<expressionNode>& slot) {
+        if (!slot) return;
+        switch (slot->type) {
+            case astNodeType::UNARYOP: {
+                auto n = static_cast<unaryOpNode*>(slot.get());
+                expr(n->operand);
+                constant c;
+                if (constantOf(n->operand.get(), c)) {
+                    if (auto folded = foldUnary(n->op, c)) slot = std::move(folded);
+                }
+                break;
+            }
+            case astNodeType::BINARYOP: {
+                auto n = static_cast<binaryOpNode*>(slot.get());
+                expr(n->left);
+                expr(n->right);
+                constant l, r;
+                bool leftConstant = constantOf(n->left.get(), l);
+                bool rightConstant = constantOf(n->right.get(), r);
+                if (leftConstant && rightConstant) {
+                    if (auto folded = foldBinary(n->op, l, r)) slot = std::move(folded);
+                } else if (leftConstant && (n->op == opKind::AND || n->op == opKind::OR) && truth(l) == (n->op == opKind::OR)) {
+                    // Short circuits: the right side is never evaluated
+                    slot = makeBool(truth(l));
+                } else if (isIdentity(n->op, n->left.get(), n->right.get(), true)) {
+                    slot = std::move(n->left);
+                } else if (isIdentity(n->op, n->right.get(), n->left.get(), false)) {
+                    slot = std::move(n->right);
+                }
+                break;
+            }
+            case astNodeType::ASSIGNOP: {
+                auto n = static_cast<assignOpNode*>(slot.get());
+                expr(n->index);
+                expr(n->value);
+                break;
+            }
+            case astNodeType::FNCALL:
+                for (auto& arg : static_cast<fnCallNode*>(slot.get())->args) expr(arg);
+                break;
+            case astNodeType::INDEX: {
+                auto n = static_cast<indexNode*>(slot.get());
+                expr(n->list);
+                expr(n->index);
+                break;
+            }
+            case astNodeType::LIST: {
+                auto n = static_cast<listNode*>(slot.get());
+                expr(n->length);
+                for (auto& element : n->elements) expr(element);
+                break;
+            }
+            case astNodeType::INTERP: {
+                // Literal parts join the text around them
+                auto n = static_cast<interpStringNode*>(slot.get());
+                std::vector<std::string> segments{ n->segments[0] };
+                std::vector<nodePtr<expressionNode>> parts;
+                for (size_t i = 0; i < n->parts.size(); i++) {
+                    expr(n->parts[i]);
+                    std::string text;
+                    if (literalText(n->parts[i].get(), text)) {
+                        segments.back() += text + n->segments[i + 1];
+                    } else {
+                        parts.push_back(std::move(n->parts[i]));
+                        segments.push_back(n->segments[i + 1]);
+                    }
+                }
+                if (parts.empty()) {
+                    slot = nodePtr<expressionNode>(arena_.make<stringLiteralNode>(encodeEscapes(segments[0])));
+                } else {
+                    n->segments = std::move(segments);
+                    n->parts = std::move(parts);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    // Folds a statement in place, clearing it when it has no effect left
+    void stmt(nodePtr<astNode>& slot) {
+        if (!slot) return;
+        switch (slot->type) {
+            case astNodeType::BODY: {
+                auto n = static_cast<bodyNode*>(slot.get());
+                pushScope();
+                for (auto& s : n->statements) stmt(s);
+                popScope();
+                auto& list = n->statements;
+                dropDead(list);
+                list.erase(std::remove_if(list.begin(), list.end(), [](const nodePtr<astNode>& s) { return !s; }), list.end());
+                break;
+            }
+            case astNodeType::VARDECL: {
+                auto n = static_cast<varDeclNode*>(slot.get());
+                expr(n->initializer);
+                // Typed before the name is declared, the initializer still sees the outer one
+                astVarType t = n->initializer ? pureType(n->initializer.get()) : n->varType;
+                if (t == n->varType || (isNumeric(t) && isNumeric(n->varType))) removable_.insert(n);
+                locals_.emplace_back(n->name.id, n->varType);
+                break;
+            }
+            case astNodeType::IF: {
+                auto n = static_cast<ifNode*>(slot.get());
+                expr(n->condition);
+                stmt(n->thenBody);
+                stmt(n->elseBody);
+                constant c;
+                if (!constantOf(n->condition.get(), c)) break;
+                nodePtr<astNode>& taken = truth(c) ? n->thenBody : n->elseBody;
+                nodePtr<astNode>& dropped = truth(c) ? n->elseBody : n->thenBody;
+                // A bare declaration in a branch is still in scope after the if
+                if (dropped && dropped->type == astNodeType::VARDECL) break;
+                nodePtr<astNode> kept = std::move(taken);
+                slot = std::move(kept);
+                break;
+            }
+            case astNodeType::WHILE: {
+                auto n = static_cast<whileNode*>(slot.get());
+                expr(n->condition);
+                stmt(n->body);
+                constant c;
+                if (constantOf(n->condition.get(), c) && !truth(c)) slot = nullptr;
+                break;
+            }
+            case astNodeType::FOR: {
+                auto n = static_cast<forNode*>(slot.get());
+                pushScope(); // the init declaration belongs to the loop
+                stmt(n->init);
+                expr(n->condition);
+                expr(n->increment);
+                stmt(n->body);
+                popScope();
+                break;
+            }
+            case astNodeType::RETURN:
+                expr(static_cast<returnNode*>(slot.get())->value);
+                break;
+            case astNodeType::UNARYOP:
+            case astNodeType::BINARYOP:
+            case astNodeType::ASSIGNOP:
+            case astNodeType::FNCALL:
+            case astNodeType::INDEX:
+            case astNodeType::LIST:
+            case astNodeType::INTERP: {
+                // Expression statements keep their node type, so fold through a typed handle
+                nodePtr<expressionNode> e(static_cast<expressionNode*>(slot.release()));
+                expr(e);
+                slot.reset(e.release());
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+public:
+    explicit constantFolder(astArena& arena) : arena_(arena) {}
+
+    void fold(programNode& program) {
+        for (const auto& decl : program.declarations) {
+            if (!decl) continue;
+            if (decl->type == astNodeType::FUNCTION) {
+                auto fn = static_cast<const functionNode*>(decl.get());
+                functions_.emplace(fn->name.id, fn->returnType);
+            } else if (decl->type == astNodeType::VARDECL) {
+                auto var = static_cast<const varDeclNode*>(decl.get());
+                globals_.emplace(var->name.id, var->varType);
+            }
+        }
+        for (auto& decl : program.declarations) {
+            if (!decl) continue;
+            if (decl->type == astNodeType::FUNCTION) {
+                auto fn = static_cast<functionNode*>(decl.get());
+                pushScope();
+                for (const paramNode& param : fn->params) locals_.emplace_back(param.name.id, param.type);
+                stmt(fn->body);
+                popScope();
+            } else if (decl->type == astNodeType::VARDECL) {
+                expr(static_cast<varDeclNode*>(decl.get())->initializer);
+            }
+        }
+    }
+};
+
+} // namespace
+
+void foldConstants(programNode& program, astArena& arena) {
+    constantFolder(arena).fold(program);
+}
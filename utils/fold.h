@@ -0,0 +1,22 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "ast.h"
+
+// Optimization pass run right after parsing, rewrites the tree in place:
+//   - operators whose operands are all literals become literals, following the
+//     runtime's typing (int | boolean | char arithmetic gives int, comparisons boolean)
+//   - x + 0, x - 0, x * 1 and x / 1 become x where the type of x is known and
+//     the result type would not change
+//   - if statements with a literal condition keep only the branch taken, and
+//     while loops with a false condition are dropped
+//   - literal parts of interpolated strings join the text around them
+//   - statements after a return, break or continue are dropped, and so are local
+//     declarations nothing later in their block mentions, when the initializer
+//     has no effects and can't fail
+// Anything that fails or depends on the target at runtime is left alone, such as
+// division by zero and int results that do not fit a literal. New literals are
+// allocated in arena.
+void foldConstants(programNode& program, astArena& arena);
+
+#endif // FOLD_H
@@ -0,0 +1,539 @@
+#include "interp.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+constexpr unsigned MAX_CALL_DEPTH = 2000; // each call also nests a few native frames
+
+const std::string EMPTY_STRING;
+
+std::string_view kindName(valueKind kind) {
+    switch (kind) {
+        case valueKind::INT: return "int";
+        case valueKind::DOUBLE: return "double";
+        case valueKind::BOOL: return "boolean";
+        case valueKind::CHAR: return "char";
+        case valueKind::STRING: return "string";
+        case valueKind::LIST: return "list";
+        default: return "void";
+    }
+}
+
+// INFERRED maps to NONE, meaning the value is kept as it is
+valueKind kindOf(astVarType type) {
+    switch (type) {
+        case astVarType::INT: return valueKind::INT;
+        case astVarType::DOUBLE: return valueKind::DOUBLE;
+        case astVarType::BOOLEAN: return valueKind::BOOL;
+        case astVarType::CHAR: return valueKind::CHAR;
+        case astVarType::STRING: return valueKind::STRING;
+        case astVarType::INT_LIST:
+        case astVarType::DOUBLE_LIST:
+            return valueKind::LIST;
+        default: return valueKind::NONE;
+    }
+}
+
+bool isNumeric(valueKind kind) {
+    return kind == valueKind::INT || kind == valueKind::DOUBLE || kind == valueKind::BOOL || kind == valueKind::CHAR;
+}
+
+int64_t asInt(const value& v) {
+    switch (v.kind) {
+        case valueKind::INT: return v.i;
+        case valueKind::DOUBLE: return (int64_t)v.d;
+        case valueKind::BOOL: return v.b ? 1 : 0;
+        case valueKind::CHAR: return (unsigned char)v.c;
+        default: return 0;
+    }
+}
+
+double asDouble(const value& v) {
+    return v.kind == valueKind::DOUBLE ? v.d : (double)asInt(v);
+}
+
+bool truthy(const value& v) {
+    switch (v.kind) {
+        case valueKind::DOUBLE: return v.d != 0.0;
+        case valueKind::STRING: return !v.s->empty();
+        case valueKind::NONE: return false;
+        default: return asInt(v) != 0;
+    }
+}
+
+value convert(const value& v, valueKind to) {
+    if (to == valueKind::NONE || v.kind == to) return v;
+    if (to == valueKind::STRING || !isNumeric(v.kind)) {
+        throw runtimeError("Cannot convert " + std::string(kindName(v.kind)) + " to " + std::string(kindName(to)));
+    }
+    switch (to) {
+        case valueKind::INT: return value::ofInt(asInt(v));
+        case valueKind::DOUBLE: return value::ofDouble(asDouble(v));
+        case valueKind::BOOL: return value::ofBool(truthy(v));
+        default: return value::ofChar((char)asInt(v));
+    }
+}
+
+value defaultOf(astVarType type) {
+    switch (type) {
+        case astVarType::INT: return value::ofInt(0);
+        case astVarType::DOUBLE: return value::ofDouble(0.0);
+        case astVarType::BOOLEAN: return value::ofBool(false);
+        case astVarType::CHAR: return value::ofChar('\0');
+        case astVarType::STRING: return value::ofString(&EMPTY_STRING);
+        default: return value();
+    }
+}
+
+// Integer arithmetic wraps instead of overflowing
+int64_t wrap(uint64_t v) { return (int64_t)v; }
+
+opKind compoundBase(opKind op) {
+    switch (op) {
+        case opKind::ASSIGN_ADD: return opKind::ADD;
+        case opKind::ASSIGN_SUB: return opKind::SUB;
+        case opKind::ASSIGN_MUL: return opKind::MUL;
+        case opKind::ASSIGN_DIV: return opKind::DIV;
+        case opKind::ASSIGN_MOD: return opKind::MOD;
+        default: return opKind::UNKNOWN;
+    }
+}
+
+const functionNode* findFunction(const programNode& program, symbol name) {
+    for (const auto& decl : program.declarations) {
+        if (decl && decl->type == astNodeType::FUNCTION) {
+            auto fn = static_cast<const functionNode*>(decl.get());
+            if (fn->name == name) return fn;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+interpreter::interpreter(std::ostream& out, size_t stackSlots) : out_(out), stack_(stackSlots) {}
+
+int64_t interpreter::run(const programNode& program, const std::vector<const programNode*>& imports) {
+    if (!program.resolved) throw runtimeError("Program has not been resolved");
+    for (const programNode* imp : imports) {
+        if (!imp->resolved) throw runtimeError("Import has not been resolved");
+    }
+    const functionNode* entry = findFunction(program, intern("main"));
+    if (!entry) throw runtimeError("No main function");
+    if (!entry->params.empty()) throw runtimeError("main must not take parameters");
+
+    globals_.assign(globalSlotCount(), value());
+    fp_ = 0;
+    top_ = 0;
+    depth_ = 0;
+    calls_ = 0;
+    entered_ = 0;
+    std::vector<const programNode*> modules = imports;
+    modules.push_back(&program);
+    for (const programNode* m : modules) {
+        for (const auto& decl : m->declarations) {
+            if (decl && decl->type == astNodeType::VARDECL) exec(decl.get());
+        }
+    }
+    value result = invoke(entry, nullptr);
+    out_.flush();
+    return result.kind == valueKind::NONE ? 0 : asInt(result);
+}
+
+value interpreter::invoke(const functionNode* fn, const fnCallNode* site) {
+    size_t base = top_;
+    if (base + fn->frameSize > stack_.size() || depth_ >= MAX_CALL_DEPTH) {
+        throw runtimeError("Stack overflow calling '" + std::string(fn->name.str()) + "'");
+    }
+    // Arguments land in the callee's parameter slots, nested calls build above them
+    if (site) {
+        for (size_t i = 0; i < site->args.size(); i++) {
+            value arg = convert(eval(site->args[i].get()), kindOf(fn->params[i].type));
+            stack_[top_++] = arg;
+        }
+    }
+    size_t savedFp = fp_;
+    uint64_t savedEntered = entered_;
+    fp_ = base;
+    top_ = base + fn->frameSize;
+    depth_++;
+    // main is called from run, which holds no strings of its own
+    entered_ = site ? ++calls_ : 0;
+
+    result_ = value();
+    flow f = exec(fn->body.get());
+    value result = f == flow::RETURN ? result_ : value();
+
+    depth_--;
+    fp_ = savedFp;
+    entered_ = savedEntered;
+    top_ = base;
+    if (fn->returnType == astVarType::VOID) return value();
+    if (result.kind == valueKind::NONE) {
+        throw runtimeError("Function '" + std::string(fn->name.str()) + "' did not return a value");
+    }
+    return convert(result, kindOf(fn->returnType));
+}
+
+value interpreter::call(const fnCallNode* n) {
+    if (n->callee) return invoke(n->callee, n);
+    if (n->name == len_) return value::ofInt((int64_t)eval(n->args[0].get()).l->size());
+    return builtinPrint(n);
+}
+
+value interpreter::newList(astVarType type, int64_t length) {
+    if (length < 0) throw runtimeError("Negative list length " + std::to_string(length));
+    std::vector<value>& list = lists_.make(calls_);
+    list.assign((size_t)length, defaultOf(elementType(type)));
+    return value::ofList(&list);
+}
+
+value& interpreter::element(const value& list, const value& index) {
+    int64_t i = asInt(index);
+    std::vector<value>& elements = *list.l;
+    if (i < 0 || (uint64_t)i >= elements.size()) {
+        throw runtimeError("Index " + std::to_string(i) + " out of range for list of length " + std::to_string(elements.size()));
+    }
+    return elements[(size_t)i];
+}
+
+value interpreter::builtinPrint(const fnCallNode* n) {
+    for (size_t i = 0; i < n->args.size(); i++) {
+        if (i) out_ << ' ';
+        const astNode* arg = n->args[i].get();
+        if (arg && arg->type == astNodeType::INTERP) {
+            // Written piece by piece, the joined string is never needed
+            auto interp = static_cast<const interpStringNode*>(arg);
+            for (size_t j = 0; j < interp->parts.size(); j++) {
+                out_ << interp->segments[j];
+                write(eval(interp->parts[j].get()));
+            }
+            out_ << interp->segments.back();
+            continue;
+        }
+        write(eval(arg));
+    }
+    out_ << '\n';
+    return value();
+}
+
+void interpreter::write(const value& v) {
+    switch (v.kind) {
+        case valueKind::INT: out_ << v.i; break;
+        case valueKind::DOUBLE: out_ << v.d; break;
+        case valueKind::BOOL: out_ << (v.b ? "true" : "false"); break;
+        case valueKind::CHAR: out_ << v.c; break;
+        case valueKind::STRING: out_ << *v.s; break;
+        default:
+            break;
+    }
+}
+
+interpreter::flow interpreter::exec(const astNode* node) {
+    if (!node) return flow::NORMAL;
+    switch (node->type) {
+        case astNodeType::BODY:
+            for (const auto& stmt : static_cast<const bodyNode*>(node)->statements) {
+                if (strings_.full() || lists_.full()) collect();
+                flow f = exec(stmt.get());
+                if (f != flow::NORMAL) return f;
+            }
+            return flow::NORMAL;
+        case astNodeType::VARDECL: {
+            auto n = static_cast<const varDeclNode*>(node);
+            if (n->initializer) {
+                local(n->slot, n->global) = convert(eval(n->initializer.get()), kindOf(n->varType));
+            } else {
+                local(n->slot, n->global) = isListType(n->varType) ? newList(n->varType, 0) : defaultOf(n->varType);
+            }
+            return flow::NORMAL;
+        }
+        case astNodeType::IF: {
+            auto n = static_cast<const ifNode*>(node);
+            return truthy(eval(n->condition.get())) ? exec(n->thenBody.get()) : exec(n->elseBody.get());
+        }
+        case astNodeType::WHILE: {
+            auto n = static_cast<const whileNode*>(node);
+            while (truthy(eval(n->condition.get()))) {
+                flow f = exec(n->body.get());
+                if (f == flow::BREAK) break;
+                if (f == flow::RETURN) return f;
+            }
+            return flow::NORMAL;
+        }
+        case astNodeType::FOR: {
+            auto n = static_cast<const forNode*>(node);
+            for (exec(n->init.get()); !n->condition || truthy(eval(n->condition.get())); eval(n->increment.get())) {
+                flow f = exec(n->body.get());
+                if (f == flow::BREAK) break;
+                if (f == flow::RETURN) return f;
+            }
+            return flow::NORMAL;
+        }
+        case astNodeType::RETURN: {
+            auto n = static_cast<const returnNode*>(node);
+            result_ = n->value ? eval(n->value.get()) : value();
+            return flow::RETURN;
+        }
+        case astNodeType::BREAK:
+            return flow::BREAK;
+        case astNodeType::CONTINUE:
+            return flow::CONTINUE;
+        case astNodeType::IMPORT:
+        case astNodeType::FUNCTION:
+            return flow::NORMAL;
+        default:
+            eval(node); // expression statement
+            return flow::NORMAL;
+    }
+}
+
+// Runs between statements, where the current function holds its values in its
+// frame. Its callers may still hold strings and lists in the middle of an expression,
+// but those were all made before it was entered, only ones made since are freed.
+// Lists only hold numbers, so nothing is reached through them.
+void interpreter::collect() {
+    std::vector<const void*> held;
+    auto hold = [&](const value& v) {
+        if (v.kind == valueKind::STRING) held.push_back(v.s);
+        if (v.kind == valueKind::LIST) held.push_back(v.l);
+    };
+    for (size_t i = 0; i < top_; i++) hold(stack_[i]);
+    for (const value& v : globals_) hold(v);
+    hold(result_);
+    strings_.sweep(held, entered_);
+    lists_.sweep(held, entered_);
+}
+
+value interpreter::eval(const astNode* node) {
+    if (!node) return value();
+    switch (node->type) {
+        case astNodeType::STRING: return value::ofString(&static_cast<const stringLiteralNode*>(node)->text);
+        case astNodeType::INT: return value::ofInt(static_cast<const intLiteralNode*>(node)->value);
+        case astNodeType::DOUBLE: return value::ofDouble(static_cast<const doubleLiteralNode*>(node)->value);
+        case astNodeType::CHAR: return value::ofChar(static_cast<const charLiteralNode*>(node)->value);
+        case astNodeType::BOOL: return value::ofBool(static_cast<const booleanLiteralNode*>(node)->value);
+        case astNodeType::VARIABLE: {
+            auto n = static_cast<const variableNode*>(node);
+            return local(n->slot, n->global);
+        }
+        case astNodeType::UNARYOP: return evalUnary(static_cast<const unaryOpNode*>(node));
+        case astNodeType::BINARYOP: return evalBinary(static_cast<const binaryOpNode*>(node));
+        case astNodeType::ASSIGNOP: return evalAssign(static_cast<const assignOpNode*>(node));
+        case astNodeType::FNCALL: return call(static_cast<const fnCallNode*>(node));
+        case astNodeType::INDEX: {
+            auto n = static_cast<const indexNode*>(node);
+            value list = eval(n->list.get());
+            return element(list, eval(n->index.get()));
+        }
+        case astNodeType::LIST: return evalList(static_cast<const listNode*>(node));
+        case astNodeType::INTERP: return evalInterp(static_cast<const interpStringNode*>(node));
+        default: throw runtimeError("Cannot evaluate " + node->describe());
+    }
+}
+
+value interpreter::evalUnary(const unaryOpNode* n) {
+    switch (n->op) {
+        case opKind::PRE_INCREMENT:
+        case opKind::PRE_DECREMENT:
+        case opKind::POST_INCREMENT:
+        case opKind::POST_DECREMENT: {
+            if (!n->operand || n->operand->type != astNodeType::VARIABLE) {
+                throw runtimeError("Operand of " + std::string(opToString(n->op)) + " must be a variable");
+            }
+            auto var = static_cast<const variableNode*>(n->operand.get());
+            value& target = local(var->slot, var->global);
+            if (!isNumeric(target.kind)) {
+                throw runtimeError("Cannot apply " + std::string(opToString(n->op)) + " to " + std::string(kindName(target.kind)));
+            }
+            value old = target;
+            int delta = (n->op == opKind::PRE_INCREMENT || n->op == opKind::POST_INCREMENT) ? 1 : -1;
+            if (target.kind == valueKind::DOUBLE) {
+                target.d += delta;
+            } else {
+                target = convert(value::ofInt(wrap((uint64_t)asInt(target) + (uint64_t)delta)), target.kind);
+            }
+            return (n->op == opKind::POST_INCREMENT || n->op == opKind::POST_DECREMENT) ? old : target;
+        }
+        default:
+            break;
+    }
+
+    value v = eval(n->operand.get());
+    switch (n->op) {
+        case opKind::NOT:
+            return value::ofBool(!truthy(v));
+        case opKind::SUB:
+            if (v.kind == valueKind::DOUBLE) return value::ofDouble(-v.d);
+            if (isNumeric(v.kind)) return value::ofInt(wrap(0 - (uint64_t)asInt(v)));
+            break;
+        case opKind::INVERT:
+            if (v.kind == valueKind::BOOL) return value::ofBool(!v.b);
+            if (v.kind == valueKind::INT || v.kind == valueKind::CHAR) return value::ofInt(~asInt(v));
+            break;
+        default:
+            break;
+    }
+    throw runtimeError("Cannot apply " + std::string(opToString(n->op)) + " to " + std::string(kindName(v.kind)));
+}
+
+namespace {
+
+// Longest text of a number, "%g" of a double is the same as writing it to a stream
+constexpr size_t MAX_NUMBER_TEXT = 24;
+
+// At least the length appendText adds for v
+size_t textSize(const value& v) {
+    return v.kind == valueKind::STRING ? v.s->size() : MAX_NUMBER_TEXT;
+}
+
+void appendText(std::string& out, const value& v) {
+    char text[MAX_NUMBER_TEXT];
+    switch (v.kind) {
+        case valueKind::STRING: out += *v.s; break;
+        case valueKind::CHAR: out += v.c; break;
+        case valueKind::BOOL: out += v.b ? "true" : "false"; break;
+        case valueKind::DOUBLE: out.append(text, (size_t)std::snprintf(text, sizeof(text), "%g", v.d)); break;
+        case valueKind::INT: out.append(text, std::to_chars(text, text + sizeof(text), v.i).ptr); break;
+        default: break;
+    }
+}
+
+// Shared by binaryOpNode and compound assignment, AND / OR are handled by the caller
+value arithmetic(opKind op, const value& l, const value& r, stringStore& strings, uint64_t born) {
+    if (l.kind == valueKind::STRING || r.kind == valueKind::STRING) {
+        if (op == opKind::ADD) {
+            std::string& text = strings.make(born);
+            text.reserve(textSize(l) + textSize(r));
+            appendText(text, l);
+            appendText(text, r);
+            return value::ofString(&text);
+        }
+        if (l.kind == valueKind::STRING && r.kind == valueKind::STRING) {
+            int cmp = l.s->compare(*r.s);
+            switch (op) {
+                case opKind::EQUAL: return value::ofBool(cmp == 0);
+                case opKind::NOTEQUAL: return value::ofBool(cmp != 0);
+                case opKind::LESSTHAN: return value::ofBool(cmp < 0);
+                case opKind::MORETHAN: return value::ofBool(cmp > 0);
+                case opKind::LESSTHANEQUAL: return value::ofBool(cmp <= 0);
+                case opKind::MORETHANEQUAL: return value::ofBool(cmp >= 0);
+                default: break;
+            }
+        }
+        throw runtimeError("Operator " + std::string(opToString(op)) + " is not defined for " +
+                           std::string(kindName(l.kind)) + " and " + std::string(kindName(r.kind)));
+    }
+    if (!isNumeric(l.kind) || !isNumeric(r.kind)) {
+        throw runtimeError("Operator " + std::string(opToString(op)) + " needs values, got void");
+    }
+
+    if (l.kind == valueKind::DOUBLE || r.kind == valueKind::DOUBLE) {
+        double a = asDouble(l), b = asDouble(r);
+        switch (op) {
+            case opKind::ADD: return value::ofDouble(a + b);
+            case opKind::SUB: return value::ofDouble(a - b);
+            case opKind::MUL: return value::ofDouble(a * b);
+            case opKind::DIV: return value::ofDouble(a / b);
+            case opKind::MOD: return value::ofDouble(std::fmod(a, b));
+            case opKind::LESSTHAN: return value::ofBool(a < b);
+            case opKind::MORETHAN: return value::ofBool(a > b);
+            case opKind::LESSTHANEQUAL: return value::ofBool(a <= b);
+            case opKind::MORETHANEQUAL: return value::ofBool(a >= b);
+            case opKind::EQUAL: return value::ofBool(a == b);
+            case opKind::NOTEQUAL: return value::ofBool(a != b);
+            default: break;
+        }
+    } else {
+        int64_t a = asInt(l), b = asInt(r);
+        switch (op) {
+            case opKind::ADD: return value::ofInt(wrap((uint64_t)a + (uint64_t)b));
+            case opKind::SUB: return value::ofInt(wrap((uint64_t)a - (uint64_t)b));
+            case opKind::MUL: return value::ofInt(wrap((uint64_t)a * (uint64_t)b));
+            case opKind::DIV:
+            case opKind::MOD:
+                if (b == 0) throw runtimeError("Division by zero");
+                if (b == -1) return value::ofInt(op == opKind::DIV ? wrap(0 - (uint64_t)a) : 0);
+                return value::ofInt(op == opKind::DIV ? a / b : a % b);
+            case opKind::LESSTHAN: return value::ofBool(a < b);
+            case opKind::MORETHAN: return value::ofBool(a > b);
+            case opKind::LESSTHANEQUAL: return value::ofBool(a <= b);
+            case opKind::MORETHANEQUAL: return value::ofBool(a >= b);
+            case opKind::EQUAL: return value::ofBool(a == b);
+            case opKind::NOTEQUAL: return value::ofBool(a != b);
+            default: break;
+        }
+    }
+    throw runtimeError("Unsupported binary operator " + std::string(opToString(op)));
+}
+
+} // namespace
+
+value interpreter::evalBinary(const binaryOpNode* n) {
+    if (n->op == opKind::AND) {
+        return value::ofBool(truthy(eval(n->left.get())) && truthy(eval(n->right.get())));
+    }
+    if (n->op == opKind::OR) {
+        return value::ofBool(truthy(eval(n->left.get())) || truthy(eval(n->right.get())));
+    }
+    value l = eval(n->left.get());
+    value r = eval(n->right.get());
+    return arithmetic(n->op, l, r, strings_, calls_);
+}
+
+value interpreter::evalAssign(const assignOpNode* n) {
+    if (n->index) {
+        value index = eval(n->index.get());
+        value v = eval(n->value.get());
+        value& target = element(local(n->slot, n->global), index);
+        if (n->op != opKind::ASSIGN) {
+            v = arithmetic(compoundBase(n->op), target, v, strings_, calls_);
+        }
+        target = convert(v, target.kind);
+        return target;
+    }
+    value v = eval(n->value.get());
+    value& target = local(n->slot, n->global);
+    if (n->op != opKind::ASSIGN) {
+        v = arithmetic(compoundBase(n->op), target, v, strings_, calls_);
+    }
+    // Slots hold their declared type from the declaration on
+    target = convert(v, target.kind);
+    return target;
+}
+
+value interpreter::evalList(const listNode* n) {
+    if (n->length) return newList(n->valueType, asInt(eval(n->length.get())));
+    value list = newList(n->valueType, (int64_t)n->elements.size());
+    valueKind kind = kindOf(elementType(n->valueType));
+    for (size_t i = 0; i < n->elements.size(); i++) {
+        (*list.l)[i] = convert(eval(n->elements[i].get()), kind);
+    }
+    return list;
+}
+
+value interpreter::evalInterp(const interpStringNode* n) {
+    // Parts are evaluated onto the stack first, like arguments, so the result is
+    // allocated once and each part is rendered straight into it
+    size_t base = top_;
+    if (base + n->parts.size() > stack_.size()) throw runtimeError("Stack overflow in string interpolation");
+    size_t size = 0;
+    for (const std::string& segment : n->segments) size += segment.size();
+    for (const auto& part : n->parts) {
+        value v = eval(part.get());
+        stack_[top_++] = v;
+        size += textSize(v);
+    }
+    std::string& result = strings_.make(calls_);
+    result.reserve(size);
+    for (size_t i = 0; i < n->parts.size(); i++) {
+        result += n->segments[i];
+        appendText(result, stack_[base + i]);
+    }
+    result += n->segments.back();
+    top_ = base;
+    return value::ofString(&result);
+}
@@ -0,0 +1,104 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "ast.h"
+#include "runtimestore.h"
+#include "sema.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class runtimeError : public std::exception {
+private:
+    std::string msg_;
+
+public:
+    runtimeError(const std::string& msg) : msg_(msg) {}
+    const char* what() const noexcept override {
+        return msg_.c_str();
+    }
+};
+
+enum class valueKind : uint8_t {
+    NONE, // void results and declared but never assigned strings
+    INT,
+    DOUBLE,
+    BOOL,
+    CHAR,
+    STRING,
+    LIST,
+};
+
+struct value;
+
+// Trivially copyable so frames are plain arrays. Strings point at literal text in
+// the tree or into the interpreter's string store, with escape sequences decoded.
+// Lists point into the interpreter's list store, all INT or all DOUBLE elements.
+struct value {
+    valueKind kind = valueKind::NONE;
+    union {
+        int64_t i;
+        double d;
+        bool b;
+        char c;
+        const std::string* s;
+        std::vector<value>* l;
+    };
+
+    value() : i(0) {}
+    static value ofInt(int64_t v) { value r; r.kind = valueKind::INT; r.i = v; return r; }
+    static value ofDouble(double v) { value r; r.kind = valueKind::DOUBLE; r.d = v; return r; }
+    static value ofBool(bool v) { value r; r.kind = valueKind::BOOL; r.i = 0; r.b = v; return r; }
+    static value ofChar(char v) { value r; r.kind = valueKind::CHAR; r.i = 0; r.c = v; return r; }
+    static value ofString(const std::string* v) { value r; r.kind = valueKind::STRING; r.s = v; return r; }
+    static value ofList(std::vector<value>* v) { value r; r.kind = valueKind::LIST; r.l = v; return r; }
+};
+
+// Executes resolved programs. Every frame is a window into one value stack
+// allocated up front, so calls and variable accesses never allocate.
+class interpreter {
+public:
+    static constexpr size_t DEFAULT_STACK_SLOTS = 1 << 20;
+
+private:
+    enum class flow { NORMAL, BREAK, CONTINUE, RETURN };
+
+    std::ostream& out_;
+    std::vector<value> stack_;
+    std::vector<value> globals_;
+    stringStore strings_; // results of concatenation and interpolation, see collect
+    runtimeStore<std::vector<value>> lists_; // made by list expressions, see collect
+    const symbol len_ = intern("len");
+    size_t fp_ = 0; // current frame base
+    size_t top_ = 0; // first free stack slot
+    value result_; // set by return
+    unsigned depth_ = 0;
+    uint64_t calls_ = 0; // calls made, strings and lists are born at the current count
+    uint64_t entered_ = 0; // calls_ when the current function was entered
+
+    value& local(uint32_t slot, bool global) { return global ? globals_[slot] : stack_[fp_ + slot]; }
+    value call(const fnCallNode* call);
+    value invoke(const functionNode* fn, const fnCallNode* site);
+    value builtinPrint(const fnCallNode* call);
+    value newList(astVarType type, int64_t length);
+    value& element(const value& list, const value& index);
+    value eval(const astNode* node);
+    value evalUnary(const unaryOpNode* n);
+    value evalBinary(const binaryOpNode* n);
+    value evalAssign(const assignOpNode* n);
+    value evalList(const listNode* n);
+    value evalInterp(const interpStringNode* n);
+    flow exec(const astNode* node);
+    void collect();
+    void write(const value& v);
+
+public:
+    explicit interpreter(std::ostream& out = std::cout, size_t stackSlots = DEFAULT_STACK_SLOTS);
+
+    // Initializes the globals of imports, then of program, and runs main().
+    // Returns what main returned, 0 for void.
+    int64_t run(const programNode& program, const std::vector<const programNode*>& imports = {});
+};
+
+#endif // INTERP_H
@@ -1,333 +1,610 @@
 #include "lexer.h"
+#include "charscan.h"
+#include "writer.h"
 
-std::string TokenToString(TokenType type) {
-    switch (type) {
-        case TokenType::RETURN: return "return";
-        case TokenType::LBRACE: return "{";
-        case TokenType::RBRACE: return "}";
-        case TokenType::LPAREN: return "(";
-        case TokenType::RPAREN: return ")";
-        case TokenType::LBRACK: return "[";
-        case TokenType::RBRACK: return "]";
-        case TokenType::SEMICOLON: return ";";
-        case TokenType::COLON: return ":";
-        case TokenType::COMMA: return ",";
-        case TokenType::DOT: return ".";
-        case TokenType::IDENTIFIER: return "identifier";
-        case TokenType::IF: return "if";
-        case TokenType::ELSEIF: return "elif";
-        case TokenType::ELSE: return "else";
-        case TokenType::FOR: return "for";
-        case TokenType::WHILE: return "while";
-        case TokenType::IMPORT: return "import";
-        case TokenType::CONTINUE: return "continue";
-        case TokenType::BREAK: return "break";
-        case TokenType::FUNCTION: return "fn";
-        case TokenType::LITERAL: return "literal";
-        case TokenType::VOID: return "void";
-        case TokenType::INT: return "int";
-        case TokenType::DOUBLE: return "double";
-        case TokenType::BOOLEAN: return "boolean";
-        case TokenType::CHAR: return "char";
-        case TokenType::STRING: return "string";
-        case TokenType::ASSIGN: return "=";
-        case TokenType::ADD: return "+";
-        case TokenType::SUB: return "-";
-        case TokenType::MUL: return "*";
-        case TokenType::DIV: return "/";
-        case TokenType::MOD: return "%";
-        case TokenType::LESSTHAN: return "<";
-        case TokenType::MORETHAN: return ">";
-        case TokenType::LESSTHANEQUAL: return "<=";
-        case TokenType::MORETHANEQUAL: return ">=";
-        case TokenType::EQUAL: return "==";
-        case TokenType::NOTEQUAL: return "!=";
-        case TokenType::NOT: return "!";
-        case TokenType::AND: return "&";
-        case TokenType::OR: return "|";
-        case TokenType::INVERT: return "~";
-        case TokenType::ASSIGN_ADD: return "+=";
-        case TokenType::ASSIGN_SUB: return "-=";
-        case TokenType::ASSIGN_MUL: return "*=";
-        case TokenType::ASSIGN_DIV: return "/=";
-        case TokenType::ASSIGN_MOD: return "%=";
-        case TokenType::INCREMENT:  return "++";
-        case TokenType::DECREMENT:  return "--";
-        default: return "UNKNOWN";
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define QUR_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define QUR_HAVE_MMAP 0
+#endif
+
+namespace {
+
+constexpr size_t tokenIndex(TokenType type) {
+    return static_cast<size_t>(type);
+}
+
+// Display name for every TokenType, built once at compile time
+constexpr std::array<std::string_view, tokenIndex(TokenType::TOKEN_TYPE_COUNT)> tokenNames = [] {
+    std::array<std::string_view, tokenIndex(TokenType::TOKEN_TYPE_COUNT)> names{};
+    for (auto& name : names) name = "UNKNOWN";
+    names[tokenIndex(TokenType::RETURN)] = "return";
+    names[tokenIndex(TokenType::LBRACE)] = "{";
+    names[tokenIndex(TokenType::RBRACE)] = "}";
+    names[tokenIndex(TokenType::LPAREN)] = "(";
+    names[tokenIndex(TokenType::RPAREN)] = ")";
+    names[tokenIndex(TokenType::LBRACK)] = "[";
+    names[tokenIndex(TokenType::RBRACK)] = "]";
+    names[tokenIndex(TokenType::SEMICOLON)] = ";";
+    names[tokenIndex(TokenType::COLON)] = ":";
+    names[tokenIndex(TokenType::COMMA)] = ",";
+    names[tokenIndex(TokenType::DOT)] = ".";
+    names[tokenIndex(TokenType::IDENTIFIER)] = "identifier";
+    names[tokenIndex(TokenType::IF)] = "if";
+    names[tokenIndex(TokenType::ELSEIF)] = "elif";
+    names[tokenIndex(TokenType::ELSE)] = "else";
+    names[tokenIndex(TokenType::FOR)] = "for";
+    names[tokenIndex(TokenType::WHILE)] = "while";
+    names[tokenIndex(TokenType::IMPORT)] = "import";
+    names[tokenIndex(TokenType::CONTINUE)] = "continue";
+    names[tokenIndex(TokenType::BREAK)] = "break";
+    names[tokenIndex(TokenType::FUNCTION)] = "fn";
+    names[tokenIndex(TokenType::LITERAL)] = "literal";
+    names[tokenIndex(TokenType::VOID)] = "void";
+    names[tokenIndex(TokenType::INT)] = "int";
+    names[tokenIndex(TokenType::DOUBLE)] = "double";
+    names[tokenIndex(TokenType::BOOLEAN)] = "boolean";
+    names[tokenIndex(TokenType::CHAR)] = "char";
+    names[tokenIndex(TokenType::STRING)] = "string";
+    names[tokenIndex(TokenType::LIST)] = "list";
+    names[tokenIndex(TokenType::ASSIGN)] = "=";
+    names[tokenIndex(TokenType::ADD)] = "+";
+    names[tokenIndex(TokenType::SUB)] = "-";
+    names[tokenIndex(TokenType::MUL)] = "*";
+    names[tokenIndex(TokenType::DIV)] = "/";
+    names[tokenIndex(TokenType::MOD)] = "%";
+    names[tokenIndex(TokenType::LESSTHAN)] = "<";
+    names[tokenIndex(TokenType::MORETHAN)] = ">";
+    names[tokenIndex(TokenType::LESSTHANEQUAL)] = "<=";
+    names[tokenIndex(TokenType::MORETHANEQUAL)] = ">=";
+    names[tokenIndex(TokenType::EQUAL)] = "==";
+    names[tokenIndex(TokenType::NOTEQUAL)] = "!=";
+    names[tokenIndex(TokenType::NOT)] = "!";
+    names[tokenIndex(TokenType::AND)] = "&";
+    names[tokenIndex(TokenType::OR)] = "|";
+    names[tokenIndex(TokenType::INVERT)] = "~";
+    names[tokenIndex(TokenType::ASSIGN_ADD)] = "+=";
+    names[tokenIndex(TokenType::ASSIGN_SUB)] = "-=";
+    names[tokenIndex(TokenType::ASSIGN_MUL)] = "*=";
+    names[tokenIndex(TokenType::ASSIGN_DIV)] = "/=";
+    names[tokenIndex(TokenType::ASSIGN_MOD)] = "%=";
+    names[tokenIndex(TokenType::INCREMENT)] = "++";
+    names[tokenIndex(TokenType::DECREMENT)] = "--";
+    return names;
+}();
+
+// Single character punctuation and operators
+constexpr TokenType singleCharToken(char c) {
+    switch (c) {
+        case '{': return TokenType::LBRACE;
+        case '}': return TokenType::RBRACE;
+        case '(': return TokenType::LPAREN;
+        case ')': return TokenType::RPAREN;
+        case '[': return TokenType::LBRACK;
+        case ']': return TokenType::RBRACK;
+        case ';': return TokenType::SEMICOLON;
+        case ':': return TokenType::COLON;
+        case ',': return TokenType::COMMA;
+        case '.': return TokenType::DOT;
+        case '=': return TokenType::ASSIGN;
+        case '+': return TokenType::ADD;
+        case '-': return TokenType::SUB;
+        case '*': return TokenType::MUL;
+        case '/': return TokenType::DIV;
+        case '%': return TokenType::MOD;
+        case '<': return TokenType::LESSTHAN;
+        case '>': return TokenType::MORETHAN;
+        case '!': return TokenType::NOT;
+        case '&': return TokenType::AND;
+        case '|': return TokenType::OR;
+        case '~': return TokenType::INVERT;
+        default: return TokenType::UNKNOWN;
+    }
+}
+
+// Two character operators, keyed on the first character
+constexpr TokenType doubleCharToken(char first, char second) {
+    switch (first) {
+        case '=': return second == '=' ? TokenType::EQUAL : TokenType::UNKNOWN;
+        case '!': return second == '=' ? TokenType::NOTEQUAL : TokenType::UNKNOWN;
+        case '<': return second == '=' ? TokenType::LESSTHANEQUAL : TokenType::UNKNOWN;
+        case '>': return second == '=' ? TokenType::MORETHANEQUAL : TokenType::UNKNOWN;
+        case '*': return second == '=' ? TokenType::ASSIGN_MUL : TokenType::UNKNOWN;
+        case '/': return second == '=' ? TokenType::ASSIGN_DIV : TokenType::UNKNOWN;
+        case '%': return second == '=' ? TokenType::ASSIGN_MOD : TokenType::UNKNOWN;
+        case '+':
+            if (second == '=') return TokenType::ASSIGN_ADD;
+            return second == '+' ? TokenType::INCREMENT : TokenType::UNKNOWN;
+        case '-':
+            if (second == '=') return TokenType::ASSIGN_SUB;
+            if (second == '-') return TokenType::DECREMENT;
+            return second == '>' ? TokenType::ARROW : TokenType::UNKNOWN;
+        default: return TokenType::UNKNOWN;
     }
 }
 
-TokenType StringToToken(const std::string& str) {
-    if (str == "return") return TokenType::RETURN;
-    if (str == "{") return TokenType::LBRACE;
-    if (str == "}") return TokenType::RBRACE;
-    if (str == "(") return TokenType::LPAREN;
-    if (str == ")") return TokenType::RPAREN;
-    if (str == "[") return TokenType::LBRACK;
-    if (str == "]") return TokenType::RBRACK;
-    if (str == ";") return TokenType::SEMICOLON;
-    if (str == ":") return TokenType::COLON;
-    if (str == ",") return TokenType::COMMA;
-    if (str == ".") return TokenType::DOT;
+static_assert(classifyKeyword("continue") == TokenType::CONTINUE, "keyword table out of sync");
+static_assert(classifyKeyword("elif") == TokenType::ELSEIF, "keyword table out of sync");
+static_assert(classifyKeyword("list") == TokenType::LIST, "keyword table out of sync");
+static_assert(classifyKeyword("elsewhere") == TokenType::IDENTIFIER, "keyword table out of sync");
+static_assert(tokenNames[tokenIndex(TokenType::DECREMENT)] == "--", "token name table out of sync");
+
+} // namespace
+
+std::string_view TokenToString(TokenType type) {
+    size_t index = tokenIndex(type);
+    return index < tokenNames.size() ? tokenNames[index] : tokenNames[0];
+}
+
+std::string decodeEscapes(std::string_view raw) {
+    std::string text;
+    text.reserve(raw.size());
+    for ( size_t i = 0; i < raw.size(); i++ ) {
+        char c = raw[i];
+        if ( c == '\\' && i + 1 < raw.size() ) {
+            switch ( raw[++i] ) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default: c = raw[i]; break;
+            }
+        }
+        text += c;
+    }
+    return text;
+}
+
+std::string encodeEscapes(std::string_view text) {
+    std::string raw;
+    raw.reserve(text.size());
+    for ( char c : text ) {
+        switch ( c ) {
+            case '\n': raw += "\\n"; break;
+            case '\t': raw += "\\t"; break;
+            case '\r': raw += "\\r"; break;
+            case '\0': raw += "\\0"; break;
+            case '\\': case '"': case '$': raw += '\\'; raw += c; break;
+            default: raw += c; break;
+        }
+    }
+    return raw;
+}
+
+TokenType StringToToken(std::string_view str) {
+    switch (str.size()) {
+        case 0: return TokenType::UNKNOWN;
+        case 1: return singleCharToken(str[0]);
+        case 2: {
+            TokenType type = doubleCharToken(str[0], str[1]);
+            if (type != TokenType::UNKNOWN) return type;
+            break;
+        }
+        default: break;
+    }
+    TokenType keyword = classifyKeyword(str);
+    if (keyword != TokenType::IDENTIFIER) return keyword;
+    // Names of token classes, the inverse of TokenToString
     if (str == "identifier") return TokenType::IDENTIFIER;
-    if (str == "if") return TokenType::IF;
-    if (str == "elif") return TokenType::ELSEIF;
-    if (str == "else") return TokenType::ELSE;
-    if (str == "for") return TokenType::FOR;
-    if (str == "while") return TokenType::WHILE;
-    if (str == "import") return TokenType::IMPORT;
-    if (str == "continue") return TokenType::CONTINUE;
-    if (str == "break") return TokenType::BREAK;
-    if (str == "fn") return TokenType::FUNCTION;
     if (str == "literal") return TokenType::LITERAL;
-    if (str == "void") return TokenType::VOID;
-    if (str == "int") return TokenType::INT;
-    if (str == "double") return TokenType::DOUBLE;
-    if (str == "boolean") return TokenType::BOOLEAN;
-    if (str == "char") return TokenType::CHAR;
-    if (str == "string") return TokenType::STRING;
-    if (str == "=") return TokenType::ASSIGN;
-    if (str == "+") return TokenType::ADD;
-    if (str == "-") return TokenType::SUB;
-    if (str == "*") return TokenType::MUL;
-    if (str == "/") return TokenType::DIV;
-    if (str == "%") return TokenType::MOD;
-    if (str == "<") return TokenType::LESSTHAN;
-    if (str == ">") return TokenType::MORETHAN;
-    if (str == "<=") return TokenType::LESSTHANEQUAL;
-    if (str == ">=") return TokenType::MORETHANEQUAL;
-    if (str == "==") return TokenType::EQUAL;
-    if (str == "!=") return TokenType::NOTEQUAL;
-    if (str == "!") return TokenType::NOT;
-    if (str == "&") return TokenType::AND;
-    if (str == "|") return TokenType::OR;
-    if (str == "~") return TokenType::INVERT;
-    if (str == "->") return TokenType::ARROW;
-    if (str == "+=") return TokenType::ASSIGN_ADD;
-    if (str == "-=") return TokenType::ASSIGN_SUB;
-    if (str == "*=") return TokenType::ASSIGN_MUL;
-    if (str == "/=") return TokenType::ASSIGN_DIV;
-    if (str == "%=") return TokenType::ASSIGN_MOD;
-    if (str == "++") return TokenType::INCREMENT;
-    if (str == "--") return TokenType::DECREMENT;
     return TokenType::UNKNOWN;
 }
 
-lexer::lexer(const std::string& inFile)
-    : inFile_(inFile) {
-    // Open the file
-    inStream_.open(inFile_);
-    // We then check if the file is actually open
-    if ( !inStream_.good() ) {
+sourceBuffer::~sourceBuffer() {
+    release();
+}
+
+sourceBuffer::sourceBuffer(sourceBuffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+sourceBuffer& sourceBuffer::operator=(sourceBuffer&& other) noexcept {
+    if ( this != &other ) {
+        release();
+        mapped_ = other.mapped_;
+        size_ = other.size_;
+        owned_ = std::move(other.owned_);
+        data_ = mapped_ ? other.data_ : owned_.data();
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.mapped_ = false;
+    }
+    return *this;
+}
+
+void sourceBuffer::release() {
+#if QUR_HAVE_MMAP
+    if ( mapped_ && data_ ) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    owned_.clear();
+}
+
+void sourceBuffer::load(const std::string& path, lexerMode mode) {
+    release();
+#if QUR_HAVE_MMAP
+    if ( mode == lexerMode::MMAP ) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if ( fd < 0 ) {
+            throw lexerError("Error opening file");
+        }
+        struct stat st;
+        // Empty files and anything that isn't a regular file can't be mapped
+        if ( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 ) {
+            void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if ( addr != MAP_FAILED ) {
+                madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(addr);
+                size_ = (size_t)st.st_size;
+                mapped_ = true;
+                close(fd);
+                return;
+            }
+        }
+        close(fd);
+    }
+#else
+    (void)mode;
+#endif
+    // Buffered: one read of the whole file into a single allocation
+    std::ifstream in(path, std::ios::binary);
+    if ( !in.good() ) {
         throw lexerError("Error opening file");
     }
-    std::string line;
-    int row = 1;
-    while ( std::getline(inStream_, line) ) {
-        for (int i = 0; i < line.size(); i++) {
-            char c = line[i];
-            int startCol = i + 1;
-            Token t;
-            // Whitespace
-            if ( std::isspace(c) ) {
-                continue; // skip whitespace
+    in.seekg(0, std::ios::end);
+    std::streamoff len = in.tellg();
+    in.seekg(0, std::ios::beg);
+    if ( len > 0 ) {
+        owned_.resize((size_t)len);
+        in.read(&owned_[0], len);
+        owned_.resize((size_t)in.gcount());
+    } else {
+        // Not seekable, fall back to draining the stream
+        owned_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    data_ = owned_.data();
+    size_ = owned_.size();
+}
+
+void sourceBuffer::assign(std::string text) {
+    release();
+    owned_ = std::move(text);
+    data_ = owned_.data();
+    size_ = owned_.size();
+}
+
+lexer::lexer(const std::string& inFile, lexerMode mode, tokenFlow flow, size_t errorLimit)
+    : inFile_(inFile), flow_(flow), diagnostics_(errorLimit) {
+    source_.load(inFile_, mode);
+    if ( flow_ == tokenFlow::EAGER ) {
+        scanAll();
+    }
+}
+
+lexer::lexer(sourceBuffer&& source, const std::string& inFile, tokenFlow flow, size_t errorLimit)
+    : inFile_(inFile), source_(std::move(source)), flow_(flow), diagnostics_(errorLimit) {
+    if ( flow_ == tokenFlow::EAGER ) {
+        scanAll();
+    }
+}
+
+void lexer::scanAll() {
+    compactToken t;
+    while ( scanToken(t) ) {
+        tokens_.push_back(t);
+    }
+}
+
+std::string lexer::unexpectedCharacter(std::string_view character, const sourceSpan& span) {
+    return "Unexpected character '" + std::string(character) + "' at row " + std::to_string(span.line) +
+           ", col " + std::to_string(span.column - 1);
+}
+
+void lexer::restart(size_t pos, int row, size_t lineStart) {
+    pos_ = pos;
+    row_ = row;
+    lineStart_ = lineStart;
+    ringHead_ = 0;
+    ringCount_ = 0;
+}
+
+// Scans the next token from the cursor, one pass over the whole buffer tracking
+// the start of the current line. Returns false once the buffer is exhausted.
+bool lexer::scanToken(compactToken& out) {
+    const char* src = source_.data();
+    const size_t n = source_.size();
+    int& row = row_;
+    size_t& lineStart = lineStart_;
+    size_t& i = pos_;
+
+    auto nextIs = [&](char expected) {
+        return i + 1 < n && src[i + 1] == expected;
+    };
+
+    while ( i < n ) {
+        char c = src[i];
+        int startCol = (int)(i - lineStart) + 1;
+        compactToken t;
+
+        // Newlines advance the line tracking
+        if ( c == '\n' ) {
+            row++;
+            i++;
+            lineStart = i;
+            continue;
+        }
+
+        // Whitespace, runs such as indentation are skipped a block at a time
+        if ( hasClass(c, CHAR_SPACE) ) {
+            i++;
+            if ( i < n && (src[i] == ' ' || src[i] == '\t') ) i = skipBlanks(src, i, n);
+            continue;
+        }
+
+        // Keyword or Variable
+        if ( hasClass(c, CHAR_ALPHA) ) {
+            size_t begin = i;
+            i = skipIdentifier(src, i + 1, n);
+            std::string_view word(src + begin, i - begin);
+            TokenType type = classifyKeyword(word);
+            symbolId sym = type == TokenType::IDENTIFIER ? intern(word).id : 0;
+            out = compactToken::make(type, begin, i - begin, row, startCol, sym);
+            return true;
+        }
+
+        // Number Literal
+        if ( hasClass(c, CHAR_DIGIT) ) {
+            size_t begin = i;
+            bool hasDot = false;
+            while ( i < n && (hasClass(src[i], CHAR_DIGIT) || src[i] == '.') ) {
+                if ( src[i] == '.' ) {
+                    if (hasDot) break;
+                    hasDot = true;
+                }
+                i++;
             }
+            out = compactToken::make(TokenType::LITERAL, begin, i - begin, row, startCol);
+            return true;
+        }
 
-            // Keyword or Variable
-            if ( std::isalpha(c) || c == '_' ) {
-                std::string word;
-                while ( i < line.size() && (std::isalnum(line[i]) || line[i] == '_' ) ) {
-                    word += line[i];
+        // String Literal, may span lines
+        if ( c == '"' ) {
+            int startRow = row;
+            i++; // skip opening "
+            size_t begin = i;
+            // Plain text is skipped up to the next quote, escape or newline
+            while ( (i = skipStringBody(src, i, n)) < n && src[i] != '"' ) {
+                if ( src[i] == '\\' && i + 1 < n ) { // escape sequence
                     i++;
                 }
-                i--;
-
-                TokenType type = StringToToken(word);
-                if ( type == TokenType::UNKNOWN ) {
-                    type = TokenType::IDENTIFIER;
+                if ( src[i] == '\n' ) {
+                    row++;
+                    lineStart = i + 1;
                 }
-                t = { type, word, row, startCol };
-                tokens_.push_back(t);
-                continue;
+                i++;
             }
+            out = compactToken::make(TokenType::STRING, begin, i - begin, startRow, startCol);
+            if ( i < n ) i++; // skip closing "
+            return true;
+        }
 
-            // Number Literal
-            if ( std::isdigit(c) ) {
-                std::string num;
-                bool hasDot = false;
-                while ( i < line.size() && (std::isdigit(line[i]) || line[i] == '.' ) ) {
-                    if (line[i] == '.') {
-                        if (hasDot) break;
-                        hasDot = true;
-                    }
-                    num += line[i];
+        // Char literal
+        if ( c == '\'' ) {
+            i++; // skip opening '
+            size_t begin = i;
+            if ( i < n ) {
+                if ( src[i] == '\\' && i + 1 < n ) { // escaped char
                     i++;
                 }
-                i--;
-                t = { TokenType::LITERAL, num, row, startCol };
-                tokens_.push_back(t);
-                continue;
+                i++;
             }
+            out = compactToken::make(TokenType::CHAR, begin, i - begin, row, startCol);
+            if ( i < n && src[i] == '\'' ) i++; // skip closing '
+            return true;
+        }
+
+        // Comments
+        if ( c == '/' && nextIs('/') ) {
+            const void* newline = std::memchr(src + i, '\n', n - i); // skip rest of line
+            i = newline ? (size_t)(static_cast<const char*>(newline) - src) : n;
+            continue;
+        }
 
-            // String Literal
-            if ( c == '"' ) {
-                std::string str;
-                i++; // skip opening "
-                while ( i < line.size() && line[i] != '"' ) {
-                    if ( line[i] == '\\' && i + 1 < line.size() ) { // escape sequence
-                        str += line[i];
-                        i++;
-                    }
-                    str += line[i];
+        // Other Tokens
+        switch (c) {
+            case '{': case '}': case '(': case ')': case '[': case ']':
+            case ';': case ',': case '.': case '&': case '|': case '~':
+                t = compactToken::make(singleCharToken(c), i, 1, row, startCol);
+                break;
+
+            case '=':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::EQUAL, i, 2, row, startCol);
                     i++;
+                } else {
+                    t = compactToken::make(TokenType::ASSIGN, i, 1, row, startCol);
                 }
-                t = { TokenType::STRING, str, row, startCol };
-                tokens_.push_back(t);
-                continue;
-            }
+                break;
 
-            // Char literal
-            if ( c == '\'' ) {
-                std::string chr;
-                i++; // skip opening '
-                if ( i < line.size() ) {
-                    chr += line[i];
-                    if ( chr[0] == '\\' && i + 1 < line.size() ) { // escaped char
-                        i++;
-                        chr += line[i];
-                    }
+            case '+':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::ASSIGN_ADD, i, 2, row, startCol);
+                    i++;
+                } else if ( nextIs('+') ) {
+                    t = compactToken::make(TokenType::INCREMENT, i, 2, row, startCol);
                     i++;
+                } else {
+                    t = compactToken::make(TokenType::ADD, i, 1, row, startCol);
                 }
-                t = { TokenType::CHAR, chr, row, startCol };
-                tokens_.push_back(t);
-                continue;
-            }
+                break;
 
-            // Comments
-            if ( c == '/' && i + 1 < line.size() && line[i+1] == '/' ) {
-                break; // skip rest of line
-            }
+            case '-':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::ASSIGN_SUB, i, 2, row, startCol);
+                    i++;
+                } else if ( nextIs('-') ) {
+                    t = compactToken::make(TokenType::DECREMENT, i, 2, row, startCol);
+                    i++;
+                } else {
+                    t = compactToken::make(TokenType::SUB, i, 1, row, startCol);
+                }
+                break;
+
+            case '*':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::ASSIGN_MUL, i, 2, row, startCol);
+                    i++;
+                } else {
+                    t = compactToken::make(TokenType::MUL, i, 1, row, startCol);
+                }
+                break;
+
+            case '/':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::ASSIGN_DIV, i, 2, row, startCol);
+                    i++;
+                } else {
+                    t = compactToken::make(TokenType::DIV, i, 1, row, startCol);
+                }
+                break;
+
+            case '%':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::ASSIGN_MOD, i, 2, row, startCol);
+                    i++;
+                } else {
+                    t = compactToken::make(TokenType::MOD, i, 1, row, startCol);
+                }
+                break;
 
-            // Other Tokens
-            switch (c) {
-                case '{': case '}': case '(': case ')': case '[': case ']':
-                case ';': case ',': case '.': case '&': case '|': case '~':
-                    t = { StringToToken(std::string(1, c)), std::string(1, c), row, startCol };
-                    tokens_.push_back(t);
-                    break;
-
-                case '=':
-                    if ( i + 1 < line.size() && line[i + 1] == '=' ) {
-                        t = { TokenType::EQUAL, "==", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::ASSIGN, "=", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '+':
-                    if (i + 1 < line.size() && line[i + 1] == '=') {
-                        t = { TokenType::ASSIGN_ADD, "+=", row, startCol };
-                        i++;
-                    } else if (i + 1 < line.size() && line[i + 1] == '+') {
-                        t = { TokenType::INCREMENT, "++", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::ADD, "+", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '-':
-                    if (i + 1 < line.size() && line[i + 1] == '=') {
-                        t = { TokenType::ASSIGN_SUB, "-=", row, startCol };
-                        i++;
-                    } else if (i + 1 < line.size() && line[i + 1] == '-') {
-                        t = { TokenType::DECREMENT, "--", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::SUB, "-", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '*':
-                    if (i + 1 < line.size() && line[i + 1] == '=') {
-                        t = { TokenType::ASSIGN_MUL, "*=", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::MUL, "*", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '/':
-                    if (i + 1 < line.size() && line[i + 1] == '=') {
-                        t = { TokenType::ASSIGN_DIV, "/=", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::DIV, "/", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '%':
-                    if (i + 1 < line.size() && line[i + 1] == '=') {
-                        t = { TokenType::ASSIGN_MOD, "%=", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::MOD, "%", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '<':
-                    if ( i + 1 < line.size() && line[i + 1] == '=' ) {
-                        t = { TokenType::LESSTHANEQUAL, "<=", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::LESSTHAN, "<", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '>':
-                    if ( i + 1 < line.size() && line[i + 1] == '=' ) {
-                        t = { TokenType::MORETHANEQUAL, ">=", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::MORETHAN, ">", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                case '!':
-                    if ( i + 1 < line.size() && line[i + 1] == '=') {
-                        t = { TokenType::NOTEQUAL, "!=", row, startCol };
-                        i++;
-                    } else {
-                        t = { TokenType::NOT, "!", row, startCol };
-                    }
-                    tokens_.push_back(t);
-                    break;
-
-                default:
-                    throw lexerError("Unexpected character '" + std::string(1, c) + "' at row " + std::to_string(row) + ", col " + std::to_string(i));
-                    break;
+            case '<':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::LESSTHANEQUAL, i, 2, row, startCol);
+                    i++;
+                } else {
+                    t = compactToken::make(TokenType::LESSTHAN, i, 1, row, startCol);
+                }
+                break;
+
+            case '>':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::MORETHANEQUAL, i, 2, row, startCol);
+                    i++;
+                } else {
+                    t = compactToken::make(TokenType::MORETHAN, i, 1, row, startCol);
+                }
+                break;
+
+            case '!':
+                if ( nextIs('=') ) {
+                    t = compactToken::make(TokenType::NOTEQUAL, i, 2, row, startCol);
+                    i++;
+                } else {
+                    t = compactToken::make(TokenType::NOT, i, 1, row, startCol);
+                }
+                break;
+
+            default: {
+                // Reported and skipped, scanning carries on after it. The continuation
+                // bytes of a UTF-8 sequence go with its first byte.
+                size_t begin = i++;
+                while ( i < n && ((unsigned char)src[i] & 0xC0) == 0x80 ) i++;
+                if ( !diagnostics_.full() ) {
+                    sourceSpan span{ (uint32_t)row, (uint32_t)startCol, (uint32_t)begin, (uint32_t)(i - begin) };
+                    diagnostics_.report(diagStage::LEXER, span, unexpectedCharacter(std::string_view(src + begin, i - begin), span));
+                }
+                continue;
             }
         }
-        row++;
+        i++;
+        out = t;
+        return true;
     }
+    return false;
+}
+
+const compactToken& lexer::endToken() {
+    static const compactToken eof = compactToken::make(TokenType::UNKNOWN, 0, 0, 0, 0);
+    return eof;
 }
 
-lexer::~lexer() {
-    inStream_.close();
+bool lexer::fill(size_t count) {
+    if ( flow_ == tokenFlow::EAGER ) {
+        return served_ + count <= tokens_.size();
+    }
+    compactToken t;
+    while ( ringCount_ < count ) {
+        if ( !scanToken(t) ) return false;
+        ring_[(ringHead_ + ringCount_) & (LOOKAHEAD - 1)] = t;
+        ringCount_++;
+    }
+    return true;
 }
 
-void lexer::printTokens() { 
-  for ( auto Token : tokens_ ) {
-    std::cout << TokenToString(Token.type) << " ";
-  }
+const compactToken& lexer::peek(size_t ahead) {
+    if ( ahead >= LOOKAHEAD || !fill(ahead + 1) ) {
+        return endToken();
+    }
+    if ( flow_ == tokenFlow::EAGER ) {
+        return tokens_[served_ + ahead];
+    }
+    return ring_[(ringHead_ + ahead) & (LOOKAHEAD - 1)];
+}
+
+compactToken lexer::next() {
+    if ( !fill(1) ) {
+        return endToken();
+    }
+    if ( flow_ == tokenFlow::EAGER ) {
+        return tokens_[served_++];
+    }
+    compactToken t = ring_[ringHead_];
+    ringHead_ = (ringHead_ + 1) & (LOOKAHEAD - 1);
+    ringCount_--;
+    served_++;
+    return t;
+}
+
+lexer::~lexer() = default;
+
+std::vector<Token> lexer::getTokens() const {
+    std::vector<Token> tokens;
+    tokens.reserve(tokens_.size());
+    for ( const compactToken& tok : tokens_ ) {
+        tokens.push_back({ tok.type, std::string(text(tok)), (int)tok.line, (int)tok.column });
+    }
+    return tokens;
+}
+
+void lexer::printTokens(std::ostream& out) {
+    bufferedWriter writer(out);
+    for ( const compactToken& tok : tokens_ ) {
+        writer << TokenToString(tok.type) << ' ';
+    }
+}
+
+void lexer::printTokensJSON(std::ostream& out) {
+    bufferedWriter writer(out);
+    writer << '[';
+    for ( size_t i = 0; i < tokens_.size(); i++ ) {
+        const compactToken& tok = tokens_[i];
+        if ( i ) writer << ", ";
+        writer << "{\"type\": \"" << TokenToString(tok.type) << "\", \"text\": ";
+        writer.quoted(text(tok)) << ", \"line\": " << tok.line << ", \"column\": " << (uint32_t)tok.column << '}';
+    }
+    writer << ']';
 }
  
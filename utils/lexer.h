@@ -1,12 +1,18 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <string>
-#include <fstream>
+#include <string_view>
 #include <vector>
 #include <iostream>
 
+#include "diagnostics.h"
+#include "symbols.h"
+
 class lexerError : public std::exception {
 private:
     std::string msg_; // No default error
@@ -18,7 +24,7 @@ public:
     }
 };
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     // Unknown for the sake that it's a possibility / edge case
     UNKNOWN,
 
@@ -87,8 +93,66 @@ enum class TokenType {
     ASSIGN_MOD, // %=
     INCREMENT, // ++
     DECREMENT, // --
+
+    TOKEN_TYPE_COUNT, // number of token types, never produced by the lexer
 };
 
+// Keyword lookup for scanned words, switches on length then first character.
+// Returns IDENTIFIER for anything that isn't a reserved word.
+constexpr TokenType classifyKeyword(std::string_view word) {
+    switch (word.size()) {
+        case 2:
+            if (word[0] == 'i') return word == "if" ? TokenType::IF : TokenType::IDENTIFIER;
+            if (word[0] == 'f') return word == "fn" ? TokenType::FUNCTION : TokenType::IDENTIFIER;
+            break;
+        case 3:
+            if (word[0] == 'f') return word == "for" ? TokenType::FOR : TokenType::IDENTIFIER;
+            if (word[0] == 'i') return word == "int" ? TokenType::INT : TokenType::IDENTIFIER;
+            break;
+        case 4:
+            if (word[0] == 'e') {
+                if (word == "elif") return TokenType::ELSEIF;
+                if (word == "else") return TokenType::ELSE;
+                break;
+            }
+            if (word[0] == 'v') return word == "void" ? TokenType::VOID : TokenType::IDENTIFIER;
+            if (word[0] == 'c') return word == "char" ? TokenType::CHAR : TokenType::IDENTIFIER;
+            if (word[0] == 'l') return word == "list" ? TokenType::LIST : TokenType::IDENTIFIER;
+            break;
+        case 5:
+            if (word[0] == 'w') return word == "while" ? TokenType::WHILE : TokenType::IDENTIFIER;
+            if (word[0] == 'b') return word == "break" ? TokenType::BREAK : TokenType::IDENTIFIER;
+            break;
+        case 6:
+            switch (word[0]) {
+                case 'r': return word == "return" ? TokenType::RETURN : TokenType::IDENTIFIER;
+                case 'i': return word == "import" ? TokenType::IMPORT : TokenType::IDENTIFIER;
+                case 'd': return word == "double" ? TokenType::DOUBLE : TokenType::IDENTIFIER;
+                case 's': return word == "string" ? TokenType::STRING : TokenType::IDENTIFIER;
+                default: break;
+            }
+            break;
+        case 7:
+            if (word[0] == 'b') return word == "boolean" ? TokenType::BOOLEAN : TokenType::IDENTIFIER;
+            break;
+        case 8:
+            if (word[0] == 'c') return word == "continue" ? TokenType::CONTINUE : TokenType::IDENTIFIER;
+            break;
+        default:
+            break;
+    }
+    return TokenType::IDENTIFIER;
+}
+
+std::string_view TokenToString(TokenType type);
+TokenType StringToToken(std::string_view str);
+
+// String literal text as lexed, with \n \t \r \0 decoded and any other escaped
+// character taken as is
+std::string decodeEscapes(std::string_view raw);
+// The reverse, for printing decoded text back as a literal
+std::string encodeEscapes(std::string_view text);
+
 struct Token {
     TokenType type;
     std::string lexme;
@@ -96,17 +160,135 @@ struct Token {
     int column;
 };
 
+// Compact, non-owning token: its text lives in the source buffer it was lexed from
+struct compactToken {
+    TokenType type : 8;
+    uint32_t column : 24; // saturates at MAX_COLUMN, 0 means no position
+    uint32_t line; // 0 means no position
+    uint32_t offset; // byte offset of the lexeme in the source buffer
+    uint32_t length; // byte length of the lexeme
+    symbolId sym; // interned text for identifiers, 0 otherwise
+
+    static constexpr uint32_t MAX_COLUMN = (1u << 24) - 1;
+
+    static compactToken make(TokenType t, size_t off, size_t len, int ln, int col, symbolId s = 0) {
+        compactToken tok;
+        tok.type = t;
+        tok.column = (uint32_t)col > MAX_COLUMN ? MAX_COLUMN : (uint32_t)col;
+        tok.line = (uint32_t)ln;
+        tok.offset = (uint32_t)off;
+        tok.length = (uint32_t)len;
+        tok.sym = s;
+        return tok;
+    }
+
+    std::string_view text(const char* source) const {
+        return std::string_view(source + offset, length);
+    }
+};
+static_assert(sizeof(compactToken) == 20, "compactToken should stay 20 bytes");
+
+// How the source file is brought into memory before scanning
+enum class lexerMode {
+    MMAP, // map the file read-only, falls back to BUFFERED if mapping fails
+    BUFFERED, // read the whole file into one heap buffer
+};
+
+// Whether tokens are all scanned up front or pulled one at a time with next()
+enum class tokenFlow {
+    EAGER, // scan everything in the constructor, getCompactTokens() holds them all
+    STREAMING, // scan on demand, only the lookahead window is kept in memory
+};
+
+// Owns the full contents of a source file as one contiguous block
+class sourceBuffer {
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::string owned_; // backing store when not mapped
+
+    void release();
+
+public:
+    sourceBuffer() = default;
+    ~sourceBuffer();
+    sourceBuffer(const sourceBuffer&) = delete;
+    sourceBuffer& operator=(const sourceBuffer&) = delete;
+    sourceBuffer(sourceBuffer&& other) noexcept;
+    sourceBuffer& operator=(sourceBuffer&& other) noexcept;
+
+    void load(const std::string& path, lexerMode mode = lexerMode::MMAP);
+    void assign(std::string text); // in-memory source, e.g. an editor buffer
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool isMapped() const { return mapped_; }
+};
+
 class lexer {
+public:
+    static constexpr size_t LOOKAHEAD = 8; // ring capacity, must be a power of two
+
 private:
     std::string inFile_;
-    std::ifstream inStream_;
-    std::vector<Token> tokens_;
+    sourceBuffer source_;
+    tokenFlow flow_;
+    std::vector<compactToken> tokens_;
+
+    // Scan cursor
+    size_t pos_ = 0;
+    int row_ = 1;
+    size_t lineStart_ = 0;
+
+    // Pull state, the ring is only used when streaming
+    std::array<compactToken, LOOKAHEAD> ring_{};
+    size_t ringHead_ = 0;
+    size_t ringCount_ = 0;
+    size_t served_ = 0;
+
+    diagnosticEngine diagnostics_;
+
+    bool scanToken(compactToken& out);
+    void scanAll();
+    bool fill(size_t count);
+    static const compactToken& endToken();
 
 public:
-    lexer(const std::string& inFile);
+    // Characters that start no token are reported to diagnostics() and skipped,
+    // errorLimit caps how many are kept (0 keeps all), see diagnosticEngine
+    lexer(const std::string& inFile, lexerMode mode = lexerMode::MMAP, tokenFlow flow = tokenFlow::EAGER,
+          size_t errorLimit = diagnosticEngine::DEFAULT_LIMIT);
+    // Lexes an already loaded buffer, inFile is only used as a name
+    lexer(sourceBuffer&& source, const std::string& inFile, tokenFlow flow = tokenFlow::EAGER,
+          size_t errorLimit = diagnosticEngine::DEFAULT_LIMIT);
     ~lexer();
-    std::vector<Token> getTokens() { return tokens_; }
-    void printTokens();
+
+    // Pull API, works in both flows. Past the end an UNKNOWN token with line 0 is returned.
+    compactToken next();
+    const compactToken& peek(size_t ahead = 0); // ahead must be below LOOKAHEAD
+    bool atEnd() { return !fill(1); }
+    bool isStreaming() const { return flow_ == tokenFlow::STREAMING; }
+    // Tokens scanned, or handed out so far when streaming
+    size_t tokenCount() const { return isStreaming() ? served_ : tokens_.size(); }
+
+    // Materializes owning tokens, prefer getCompactTokens() and text()
+    std::vector<Token> getTokens() const;
+    const std::vector<compactToken>& getCompactTokens() const { return tokens_; }
+    std::string_view text(const compactToken& tok) const { return tok.text(source_.data()); }
+    const char* sourceData() const { return source_.data(); }
+    size_t sourceSize() const { return source_.size(); }
+    // Streaming only: drops the lookahead and scans on from pos, the first byte of a
+    // token on line row, whose first byte is at lineStart. Lets an edited buffer be
+    // lexed again from the first token the edit can change, see sourceDocument.
+    void restart(size_t pos, int row, size_t lineStart);
+    // The message reported for a character that starts no token, at span
+    static std::string unexpectedCharacter(std::string_view character, const sourceSpan& span);
+    // Errors found so far, the whole file once an eager lexer is constructed.
+    // A parser built on this lexer adds its own errors here too.
+    diagnosticEngine& diagnostics() { return diagnostics_; }
+    void printTokens(std::ostream& out = std::cout);
+    // The tokens as a JSON array of {"type", "text", "line", "column"} objects
+    void printTokensJSON(std::ostream& out);
 };
 
 #endif // LEXER_H
@@ -0,0 +1,263 @@
+#include "module.h"
+#include "hash.h"
+#include "visitor.h"
+#include "profile.h"
+#include "sema.h"
+#include "serialize.h"
+
+#include <filesystem>
+#include <sstream>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Collects every import statement of a tree, wherever it appears
+class importCollector : public astVisitor<importCollector> {
+public:
+    std::vector<const importNode*> imports;
+
+    void visitImport(const importNode* n) { imports.push_back(n); }
+};
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+// Dropped modules go once the last compilation using them is done, then nothing will
+// run their globals again
+module::~module() {
+    if ( ast && ast->getRoot() ) releaseGlobals(*ast->getRoot());
+}
+
+std::string moduleLoader::canonicalPath(const std::string& path) {
+    if ( path.empty() ) return path;
+    std::error_code ec;
+    fs::path canonical = fs::weakly_canonical(fs::path(path), ec);
+    return ec ? path : canonical.string();
+}
+
+std::string moduleLoader::resolve(const std::string& importPath, const std::string& fromFile) const {
+    std::string relative = importPath;
+    if ( !endsWith(relative, ".qur") ) {
+        for ( char& c : relative ) {
+            if ( c == '.' ) c = '/';
+        }
+        relative += ".qur";
+    }
+
+    std::error_code ec;
+    fs::path rel(relative);
+    if ( rel.is_absolute() ) {
+        return fs::exists(rel, ec) ? canonicalPath(relative) : std::string();
+    }
+    fs::path local = fs::path(fromFile).parent_path() / rel;
+    if ( fs::exists(local, ec) ) return canonicalPath(local.string());
+    for ( const std::string& dir : searchPaths_ ) {
+        fs::path candidate = fs::path(dir) / rel;
+        if ( fs::exists(candidate, ec) ) return canonicalPath(candidate.string());
+    }
+    // Finally relative to the working directory, like the driver's own inputs
+    if ( fs::exists(rel, ec) ) return canonicalPath(relative);
+    return std::string();
+}
+
+std::shared_ptr<const module> moduleLoader::parse(const std::string& canonical) const {
+    auto mod = std::make_shared<module>();
+    mod->path = canonical;
+    std::ostringstream diag;
+    try {
+        sourceBuffer source;
+        {
+            phaseTimer timer("read");
+            // Taken before reading, so a write racing the read shows up in revalidate()
+            std::error_code ec;
+            fs::file_time_type modified = fs::last_write_time(canonical, ec);
+            if ( !ec ) mod->modified = (int64_t)modified.time_since_epoch().count();
+            source.load(canonical, mode_);
+            mod->size = source.size();
+        }
+        addProfileCount("files");
+        addProfileCount("bytes", source.size());
+        mod->hash = fnv1a64(source.data(), source.size());
+        bool image = endsWith(canonical, ".qast");
+        uint64_t key = buildCache_ && !image ? buildCache::key(source.data(), source.size()) : 0;
+        if ( image ) {
+            // Written by --emit-ast, so parsed and folded already
+            phaseTimer timer("image_load");
+            auto ast = std::make_unique<AST>();
+            nodePtr<programNode> root = astImage(source.data(), source.size()).toFlat().toProgram(ast->arena());
+            if ( !root ) throw moduleError("AST image has no program");
+            ast->setRoot(std::move(root));
+            mod->ast = std::move(ast);
+            mod->cached = true;
+        } else if ( buildCache_ ) {
+            phaseTimer timer("cache_load");
+            auto ast = std::make_unique<AST>();
+            if ( buildCache_->load(key, *ast) ) {
+                mod->ast = std::move(ast);
+                mod->cached = true;
+                addProfileCount("cache_hits");
+            }
+        }
+        if ( !mod->cached ) {
+            {
+                phaseTimer timer("lex");
+                mod->lex = std::make_unique<lexer>(std::move(source), canonical, flow_, errorLimit_);
+            }
+            mod->ast = std::make_unique<AST>(*mod->lex);
+            mod->ast->setErrorStream(diag);
+            mod->ast->setParseWorkers(parseWorkers_);
+            {
+                phaseTimer timer("parse"); // includes lexing when streaming
+                mod->ast->build();
+            }
+            addProfileCount("tokens", mod->lex->tokenCount());
+            {
+                phaseTimer timer("fold");
+                mod->ast->optimize();
+            }
+            // Only clean parses are cached, a hit must reproduce the diagnostics too
+            if ( buildCache_ && diag.str().empty() ) {
+                phaseTimer timer("cache_store");
+                buildCache_->store(key, *mod->ast->getRoot());
+            }
+        }
+        profileNodes(*mod->ast->getRoot());
+        addProfileCount("arena_bytes", mod->ast->arena().bytesUsed());
+    } catch ( ... ) {
+        mod->failure = std::current_exception();
+    }
+    mod->diagnostics = diag.str();
+
+    if ( mod->ast && mod->ast->getRoot() ) {
+        importCollector collector;
+        collector.visit(mod->ast->getRoot());
+        size_t unresolved = 0;
+        for ( const importNode* imp : collector.imports ) {
+            std::string resolved = resolve(imp->path, canonical);
+            if ( resolved.empty() ) {
+                mod->diagnostics += "Import error: cannot resolve '" + imp->path + "' from " + canonical + "\n";
+                unresolved++;
+                continue;
+            }
+            mod->imports.push_back(resolved);
+        }
+        if ( unresolved && !mod->failure ) {
+            mod->failure = std::make_exception_ptr(
+                moduleError("Failed to resolve " + std::to_string(unresolved) + " import(s)"));
+        }
+    }
+    return mod;
+}
+
+std::shared_ptr<const module> moduleLoader::acquire(const std::string& canonical) {
+    std::shared_ptr<entry> e;
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        auto it = cache_.find(canonical);
+        if ( it != cache_.end() ) {
+            e = it->second;
+            ready_.wait(guard, [&] { return e->ready; });
+            return e->mod;
+        }
+        e = std::make_shared<entry>();
+        cache_.emplace(canonical, e);
+        parses_++;
+    }
+
+    // Parse outside the lock so independent modules load concurrently
+    std::shared_ptr<const module> mod = parse(canonical);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        e->mod = mod;
+        e->ready = true;
+    }
+    ready_.notify_all();
+    return mod;
+}
+
+std::shared_ptr<const module> moduleLoader::load(const std::string& path) {
+    std::shared_ptr<const module> root = acquire(canonicalPath(path));
+    // Only waiting on parses, never on other importers, so cycles can't deadlock
+    dependencies(*root);
+    return root;
+}
+
+std::vector<std::shared_ptr<const module>> moduleLoader::dependencies(const module& root) {
+    std::vector<std::shared_ptr<const module>> order;
+    std::unordered_set<std::string> seen{ root.path };
+    std::vector<std::string> pending(root.imports.rbegin(), root.imports.rend());
+    while ( !pending.empty() ) {
+        std::string next = std::move(pending.back());
+        pending.pop_back();
+        if ( !seen.insert(next).second ) continue;
+        std::shared_ptr<const module> mod = acquire(next);
+        order.push_back(mod);
+        pending.insert(pending.end(), mod->imports.rbegin(), mod->imports.rend());
+    }
+    return order;
+}
+
+size_t moduleLoader::revalidate() {
+    std::vector<std::shared_ptr<const module>> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for ( const auto& kv : cache_ ) {
+            if ( kv.second->ready ) snapshot.push_back(kv.second->mod);
+        }
+    }
+    std::unordered_set<std::string> stale;
+    for ( const auto& mod : snapshot ) {
+        if ( !mod->ok() ) {
+            stale.insert(mod->path);
+            continue;
+        }
+        std::error_code ec;
+        fs::file_time_type modified = fs::last_write_time(mod->path, ec);
+        if ( !ec && (int64_t)modified.time_since_epoch().count() == mod->modified &&
+             fs::file_size(mod->path, ec) == mod->size && !ec ) {
+            continue;
+        }
+        sourceBuffer source;
+        try {
+            source.load(mod->path, lexerMode::BUFFERED);
+        } catch ( const lexerError& ) {
+            stale.insert(mod->path); // deleted or unreadable
+            continue;
+        }
+        if ( fnv1a64(source.data(), source.size()) != mod->hash ) stale.insert(mod->path);
+    }
+    // Importers of anything dropped go too, until nothing more is added
+    for ( bool grew = !stale.empty(); grew; ) {
+        grew = false;
+        for ( const auto& mod : snapshot ) {
+            if ( stale.count(mod->path) ) continue;
+            for ( const std::string& imported : mod->imports ) {
+                if ( stale.count(imported) ) {
+                    stale.insert(mod->path);
+                    grew = true;
+                    break;
+                }
+            }
+        }
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    for ( const std::string& path : stale ) {
+        cache_.erase(path);
+    }
+    return stale.size();
+}
+
+size_t moduleLoader::parseCount() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return parses_;
+}
+
+size_t moduleLoader::size() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return cache_.size();
+}
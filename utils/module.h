@@ -0,0 +1,101 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "lexer.h"
+#include "ast.h"
+#include "cache.h"
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class moduleError : public std::exception {
+private:
+    std::string msg_;
+
+public:
+    moduleError(const std::string& msg) : msg_(msg) {}
+    const char* what() const noexcept override {
+        return msg_.c_str();
+    }
+};
+
+// One parsed source file. The lexer is kept alive since the AST points into its buffers.
+struct module {
+    std::string path; // canonical
+    uint64_t hash = 0; // FNV-1a of the contents
+    int64_t modified = 0; // last write time before reading, in ticks of the filesystem clock
+    uint64_t size = 0; // of the file in bytes
+    bool cached = false; // ast came from the build cache or is a .qast image, lex is null
+    std::unique_ptr<lexer> lex;
+    std::unique_ptr<AST> ast;
+    std::vector<std::string> imports; // canonical paths of direct imports, in source order
+    std::string diagnostics; // lexer and parse errors collected while building, see diagnosticEngine
+    std::exception_ptr failure; // set when reading, lexing or parsing failed
+
+    // Gives the tree's global slots back, see releaseGlobals
+    ~module();
+
+    bool ok() const { return !failure; }
+};
+
+// Resolves imports and parses every module once, shared by all files of a compilation.
+// Safe to use from several threads, a module being parsed by one thread is waited on by others.
+class moduleLoader {
+private:
+    struct entry {
+        std::shared_ptr<const module> mod;
+        bool ready = false;
+    };
+
+    std::vector<std::string> searchPaths_;
+    tokenFlow flow_;
+    lexerMode mode_;
+    std::mutex lock_;
+    std::condition_variable ready_;
+    std::unordered_map<std::string, std::shared_ptr<entry>> cache_;
+    size_t parses_ = 0;
+    size_t parseWorkers_ = 0;
+    size_t errorLimit_ = diagnosticEngine::DEFAULT_LIMIT;
+    const buildCache* buildCache_ = nullptr;
+
+    std::shared_ptr<const module> parse(const std::string& canonical) const;
+    std::shared_ptr<const module> acquire(const std::string& canonical);
+
+public:
+    explicit moduleLoader(tokenFlow flow = tokenFlow::EAGER, lexerMode mode = lexerMode::MMAP)
+        : flow_(flow), mode_(mode) {}
+
+    void addSearchPath(const std::string& dir) { searchPaths_.push_back(dir); }
+    // Reuses and records trees of unchanged files across runs, cache must outlive the loader
+    void setBuildCache(const buildCache* cache) { buildCache_ = cache; }
+    // Threads each file's parse may use, see AST::setParseWorkers
+    void setParseWorkers(size_t workers) { parseWorkers_ = workers; }
+    // Errors kept per file before parsing it stops, 0 keeps all, see diagnosticEngine
+    void setErrorLimit(size_t limit) { errorLimit_ = limit; }
+
+    // Maps an import path to a file: "a.b" is a/b.qur, anything ending in .qur is taken as is.
+    // Looks next to the importing file first, then in each search path, then the working directory.
+    std::string resolve(const std::string& importPath, const std::string& fromFile) const;
+    static std::string canonicalPath(const std::string& path);
+
+    // Parses path (once) and every module it imports transitively. Failures are reported
+    // on the returned module rather than thrown. Import cycles are allowed.
+    std::shared_ptr<const module> load(const std::string& path);
+    // Every module reachable from root, excluding root, in first-import order
+    std::vector<std::shared_ptr<const module>> dependencies(const module& root);
+
+    // Drops cached modules whose file contents no longer match, along with every module
+    // importing one of them (their trees point into the dropped ones) and modules that
+    // failed, whose imports may resolve now. Files whose size and last write time are
+    // unchanged are not read. Returns how many were dropped.
+    size_t revalidate();
+    size_t parseCount();
+    size_t size();
+};
+
+#endif // MODULE_H
@@ -0,0 +1,377 @@
+#include "printer.h"
+
+void astNode::print(int indent) const {
+    astPrinter(std::cout, indent).visit(this);
+}
+
+void astNode::print(std::ostream& out, int indent) const {
+    astPrinter(out, indent).visit(this);
+}
+
+// Visits a child at a deeper indent, then restores the current one
+void astPrinter::nested(const astNode* node, int extra) {
+    if (!node) return;
+    indent_ += extra;
+    visit(node);
+    indent_ -= extra;
+}
+
+void astPrinter::visitString(const stringLiteralNode* n) {
+    line() << "string(\"" << n->value << "\")\n";
+}
+
+void astPrinter::visitInt(const intLiteralNode* n) {
+    line() << "int(" << n->value << ")\n";
+}
+
+void astPrinter::visitDouble(const doubleLiteralNode* n) {
+    line() << "double(" << n->value << ")\n";
+}
+
+void astPrinter::visitChar(const charLiteralNode* n) {
+    line() << "char('" << n->value << "')\n";
+}
+
+void astPrinter::visitBool(const booleanLiteralNode* n) {
+    line() << "bool(" << (n->value ? "true" : "false") << ")\n";
+}
+
+void astPrinter::visitVariable(const variableNode* n) {
+    line() << "Variable(\"" << n->name.str() << "\", type=" << (int)n->varType << ")\n";
+}
+
+void astPrinter::visitUnaryOp(const unaryOpNode* n) {
+    line() << "UnaryOp(" << opToString(n->op) << ")\n";
+    nested(n->operand.get(), 2);
+}
+
+void astPrinter::visitBinaryOp(const binaryOpNode* n) {
+    line() << "BinaryOp(" << opToString(n->op) << ")\n";
+    nested(n->left.get(), 2);
+    nested(n->right.get(), 2);
+}
+
+void astPrinter::visitAssignOp(const assignOpNode* n) {
+    line() << "AssignOp(target=\"" << n->targetName.str() << "\", op=\"" << opToString(n->op) << "\")\n";
+    if (n->index) {
+        line(2) << "Index:\n";
+        nested(n->index.get(), 4);
+        line(2) << "Value:\n";
+        nested(n->value.get(), 4);
+        return;
+    }
+    nested(n->value.get(), 2);
+}
+
+void astPrinter::visitFnCall(const fnCallNode* n) {
+    line() << "FnCall(\"" << n->name.str() << "\")\n";
+    for (const auto& a : n->args) nested(a.get(), 2);
+}
+
+void astPrinter::visitIndex(const indexNode* n) {
+    line() << "Index\n";
+    nested(n->list.get(), 2);
+    nested(n->index.get(), 2);
+}
+
+void astPrinter::visitList(const listNode* n) {
+    line() << "List(type=" << (int)n->varType << ")\n";
+    if (n->length) {
+        line(2) << "Length:\n";
+        nested(n->length.get(), 4);
+    }
+    for (const auto& e : n->elements) nested(e.get(), 2);
+}
+
+void astPrinter::visitInterpString(const interpStringNode* n) {
+    line() << "Interpolation\n";
+    for (size_t i = 0; i < n->segments.size(); i++) {
+        line(2) << "string(\"" << encodeEscapes(n->segments[i]) << "\")\n";
+        if (i < n->parts.size()) nested(n->parts[i].get(), 2);
+    }
+}
+
+void astPrinter::visitImport(const importNode* n) {
+    line() << "Import(" << n->path << ")\n";
+}
+
+void astPrinter::visitIf(const ifNode* n) {
+    line() << "IfStatement\n";
+    line(2) << "Condition:\n";
+    nested(n->condition.get(), 4);
+    line(2) << "Then:\n";
+    nested(n->thenBody.get(), 4);
+    if (n->elseBody) {
+        line(2) << "Else:\n";
+        nested(n->elseBody.get(), 4);
+    }
+}
+
+void astPrinter::visitFor(const forNode* n) {
+    line() << "ForLoop\n";
+    line(2) << "Init:\n";
+    nested(n->init.get(), 4);
+    line(2) << "Condition:\n";
+    nested(n->condition.get(), 4);
+    line(2) << "Increment:\n";
+    nested(n->increment.get(), 4);
+    line(2) << "Body:\n";
+    nested(n->body.get(), 4);
+}
+
+void astPrinter::visitWhile(const whileNode* n) {
+    line() << "WhileLoop\n";
+    line(2) << "Condition:\n";
+    nested(n->condition.get(), 4);
+    line(2) << "Body:\n";
+    nested(n->body.get(), 4);
+}
+
+void astPrinter::visitReturn(const returnNode* n) {
+    line() << "Return\n";
+    nested(n->value.get(), 2);
+}
+
+void astPrinter::visitBreak(const breakNode*) {
+    line() << "Break\n";
+}
+
+void astPrinter::visitContinue(const continueNode*) {
+    line() << "Continue\n";
+}
+
+void astPrinter::visitVarDecl(const varDeclNode* n) {
+    line() << "VarDecl(\"" << n->name.str() << "\", type=" << (int)n->varType << ")\n";
+    if (n->initializer) {
+        line(2) << "Initializer:\n";
+        nested(n->initializer.get(), 4);
+    }
+}
+
+void astPrinter::visitFunction(const functionNode* n) {
+    line() << "Function(\"" << n->name.str() << "\", returnType=" << (int)n->returnType << ")\n";
+    line(2) << "Params:\n";
+    for (const auto& param : n->params) {
+        line(4) << "Param(\"" << param.name.str() << "\", type=" << (int)param.type << ")\n";
+    }
+    if (n->body) {
+        line(2) << "Body:\n";
+        nested(n->body.get(), 4);
+    }
+}
+
+void astPrinter::visitBody(const bodyNode* n) {
+    line() << "Body {\n";
+    for (const auto& stmt : n->statements) nested(stmt.get(), 2);
+    line() << "}\n";
+}
+
+void astPrinter::visitProgram(const programNode* n) {
+    line() << "Program\n";
+    for (const auto& decl : n->declarations) nested(decl.get(), 2);
+}
+
+namespace {
+
+std::string_view varTypeName(astVarType t) {
+    switch (t) {
+        case astVarType::VOID: return "void";
+        case astVarType::INT: return "int";
+        case astVarType::DOUBLE: return "double";
+        case astVarType::STRING: return "string";
+        case astVarType::CHAR: return "char";
+        case astVarType::BOOLEAN: return "boolean";
+        case astVarType::INT_LIST: return "list<int>";
+        case astVarType::DOUBLE_LIST: return "list<double>";
+        default: return "inferred";
+    }
+}
+
+} // namespace
+
+void astJsonPrinter::value(const astNode* child) {
+    if (child) {
+        visit(child);
+    } else {
+        out_ << "null";
+    }
+}
+
+template <class T>
+void astJsonPrinter::array(const std::vector<nodePtr<T>>& children) {
+    out_ << '[';
+    for (size_t i = 0; i < children.size(); i++) {
+        if (i) out_ << ", ";
+        value(children[i].get());
+    }
+    out_ << ']';
+}
+
+bufferedWriter& astJsonPrinter::open(const char* kind) {
+    return out_ << "{\"node\": \"" << kind << '"';
+}
+
+void astJsonPrinter::visitString(const stringLiteralNode* n) {
+    open("String") << ", \"value\": ";
+    out_.quoted(n->text) << '}';
+}
+
+void astJsonPrinter::visitInt(const intLiteralNode* n) {
+    open("Int") << ", \"value\": " << n->value << '}';
+}
+
+void astJsonPrinter::visitDouble(const doubleLiteralNode* n) {
+    open("Double") << ", \"value\": " << n->value << '}';
+}
+
+void astJsonPrinter::visitChar(const charLiteralNode* n) {
+    open("Char") << ", \"value\": ";
+    out_.quoted(std::string_view(&n->value, 1)) << '}';
+}
+
+void astJsonPrinter::visitBool(const booleanLiteralNode* n) {
+    open("Bool") << ", \"value\": " << (n->value ? "true" : "false") << '}';
+}
+
+void astJsonPrinter::visitVariable(const variableNode* n) {
+    open("Variable") << ", \"name\": ";
+    out_.quoted(n->name.str()) << ", \"type\": \"" << varTypeName(n->varType) << "\"}";
+}
+
+void astJsonPrinter::visitUnaryOp(const unaryOpNode* n) {
+    open("UnaryOp") << ", \"op\": \"" << opToString(n->op) << "\", \"operand\": ";
+    value(n->operand.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitBinaryOp(const binaryOpNode* n) {
+    open("BinaryOp") << ", \"op\": \"" << opToString(n->op) << "\", \"left\": ";
+    value(n->left.get());
+    out_ << ", \"right\": ";
+    value(n->right.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitAssignOp(const assignOpNode* n) {
+    open("AssignOp") << ", \"target\": ";
+    out_.quoted(n->targetName.str()) << ", \"op\": \"" << opToString(n->op) << "\", \"index\": ";
+    value(n->index.get());
+    out_ << ", \"value\": ";
+    value(n->value.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitFnCall(const fnCallNode* n) {
+    open("FnCall") << ", \"name\": ";
+    out_.quoted(n->name.str()) << ", \"args\": ";
+    array(n->args);
+    out_ << '}';
+}
+
+void astJsonPrinter::visitIndex(const indexNode* n) {
+    open("Index") << ", \"list\": ";
+    value(n->list.get());
+    out_ << ", \"index\": ";
+    value(n->index.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitList(const listNode* n) {
+    open("List") << ", \"type\": \"" << varTypeName(n->varType) << "\", \"length\": ";
+    value(n->length.get());
+    out_ << ", \"elements\": ";
+    array(n->elements);
+    out_ << '}';
+}
+
+void astJsonPrinter::visitInterpString(const interpStringNode* n) {
+    open("Interpolation") << ", \"segments\": [";
+    for (size_t i = 0; i < n->segments.size(); i++) {
+        if (i) out_ << ", ";
+        out_.quoted(n->segments[i]);
+    }
+    out_ << "], \"parts\": ";
+    array(n->parts);
+    out_ << '}';
+}
+
+void astJsonPrinter::visitImport(const importNode* n) {
+    open("Import") << ", \"path\": ";
+    out_.quoted(n->path) << '}';
+}
+
+void astJsonPrinter::visitIf(const ifNode* n) {
+    open("If") << ", \"condition\": ";
+    value(n->condition.get());
+    out_ << ", \"then\": ";
+    value(n->thenBody.get());
+    out_ << ", \"else\": ";
+    value(n->elseBody.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitFor(const forNode* n) {
+    open("For") << ", \"init\": ";
+    value(n->init.get());
+    out_ << ", \"condition\": ";
+    value(n->condition.get());
+    out_ << ", \"increment\": ";
+    value(n->increment.get());
+    out_ << ", \"body\": ";
+    value(n->body.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitWhile(const whileNode* n) {
+    open("While") << ", \"condition\": ";
+    value(n->condition.get());
+    out_ << ", \"body\": ";
+    value(n->body.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitReturn(const returnNode* n) {
+    open("Return") << ", \"value\": ";
+    value(n->value.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitBreak(const breakNode*) {
+    open("Break") << '}';
+}
+
+void astJsonPrinter::visitContinue(const continueNode*) {
+    open("Continue") << '}';
+}
+
+void astJsonPrinter::visitVarDecl(const varDeclNode* n) {
+    open("VarDecl") << ", \"name\": ";
+    out_.quoted(n->name.str()) << ", \"type\": \"" << varTypeName(n->varType) << "\", \"initializer\": ";
+    value(n->initializer.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitFunction(const functionNode* n) {
+    open("Function") << ", \"name\": ";
+    out_.quoted(n->name.str()) << ", \"returnType\": \"" << varTypeName(n->returnType) << "\", \"params\": [";
+    for (size_t i = 0; i < n->params.size(); i++) {
+        if (i) out_ << ", ";
+        out_ << "{\"name\": ";
+        out_.quoted(n->params[i].name.str()) << ", \"type\": \"" << varTypeName(n->params[i].type) << "\"}";
+    }
+    out_ << "], \"body\": ";
+    value(n->body.get());
+    out_ << '}';
+}
+
+void astJsonPrinter::visitBody(const bodyNode* n) {
+    open("Body") << ", \"statements\": ";
+    array(n->statements);
+    out_ << '}';
+}
+
+void astJsonPrinter::visitProgram(const programNode* n) {
+    open("Program") << ", \"declarations\": ";
+    array(n->declarations);
+    out_ << '}';
+}
@@ -0,0 +1,90 @@
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include "visitor.h"
+#include "writer.h"
+#include <ostream>
+
+// Indented debug dump of a node tree, written through one buffer that is flushed
+// to the stream when the printer goes away
+class astPrinter : public astVisitor<astPrinter> {
+private:
+    bufferedWriter out_;
+    int indent_;
+
+    // Starts a line at the current indent plus extra
+    bufferedWriter& line(int extra = 0) { return out_.indent(indent_ + extra); }
+    void nested(const astNode* node, int extra);
+
+public:
+    explicit astPrinter(std::ostream& out, int indent = 0) : out_(out), indent_(indent) {}
+
+    void visitString(const stringLiteralNode* n);
+    void visitInt(const intLiteralNode* n);
+    void visitDouble(const doubleLiteralNode* n);
+    void visitChar(const charLiteralNode* n);
+    void visitBool(const booleanLiteralNode* n);
+    void visitVariable(const variableNode* n);
+    void visitUnaryOp(const unaryOpNode* n);
+    void visitBinaryOp(const binaryOpNode* n);
+    void visitAssignOp(const assignOpNode* n);
+    void visitFnCall(const fnCallNode* n);
+    void visitIndex(const indexNode* n);
+    void visitList(const listNode* n);
+    void visitInterpString(const interpStringNode* n);
+    void visitImport(const importNode* n);
+    void visitIf(const ifNode* n);
+    void visitFor(const forNode* n);
+    void visitWhile(const whileNode* n);
+    void visitReturn(const returnNode* n);
+    void visitBreak(const breakNode* n);
+    void visitContinue(const continueNode* n);
+    void visitVarDecl(const varDeclNode* n);
+    void visitFunction(const functionNode* n);
+    void visitBody(const bodyNode* n);
+    void visitProgram(const programNode* n);
+};
+
+// The same tree as one line of JSON. Every node is an object whose "node" member
+// names its kind, children are nested objects or arrays, and absent ones are null.
+class astJsonPrinter : public astVisitor<astJsonPrinter> {
+private:
+    bufferedWriter out_;
+
+    // child as a JSON value, null when absent
+    void value(const astNode* child);
+    template <class T>
+    void array(const std::vector<nodePtr<T>>& children);
+    // Opens the object of a node: {"node": "kind"
+    bufferedWriter& open(const char* kind);
+
+public:
+    explicit astJsonPrinter(std::ostream& out) : out_(out) {}
+
+    void visitString(const stringLiteralNode* n);
+    void visitInt(const intLiteralNode* n);
+    void visitDouble(const doubleLiteralNode* n);
+    void visitChar(const charLiteralNode* n);
+    void visitBool(const booleanLiteralNode* n);
+    void visitVariable(const variableNode* n);
+    void visitUnaryOp(const unaryOpNode* n);
+    void visitBinaryOp(const binaryOpNode* n);
+    void visitAssignOp(const assignOpNode* n);
+    void visitFnCall(const fnCallNode* n);
+    void visitIndex(const indexNode* n);
+    void visitList(const listNode* n);
+    void visitInterpString(const interpStringNode* n);
+    void visitImport(const importNode* n);
+    void visitIf(const ifNode* n);
+    void visitFor(const forNode* n);
+    void visitWhile(const whileNode* n);
+    void visitReturn(const returnNode* n);
+    void visitBreak(const breakNode* n);
+    void visitContinue(const continueNode* n);
+    void visitVarDecl(const varDeclNode* n);
+    void visitFunction(const functionNode* n);
+    void visitBody(const bodyNode* n);
+    void visitProgram(const programNode* n);
+};
+
+#endif // PRINTER_H
@@ -0,0 +1,294 @@
+#include "profile.h"
+#include "visitor.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define QUR_HAVE_RUSAGE 1
+#include <sys/resource.h>
+#else
+#define QUR_HAVE_RUSAGE 0
+#endif
+
+namespace {
+
+constexpr size_t NODE_TYPE_COUNT = static_cast<size_t>(astNodeType::PROGRAM) + 1;
+
+struct phaseTotal {
+    const char* name;
+    double seconds;
+    uint64_t calls;
+};
+
+struct counterTotal {
+    const char* name;
+    uint64_t value;
+};
+
+// Allocation counters are read by operator new, which can run before any other
+// static is constructed, so they are constant initialized
+std::atomic<bool> enabled{ false };
+std::atomic<uint64_t> allocations{ 0 };
+std::atomic<uint64_t> allocatedBytes{ 0 };
+
+struct profileState {
+    std::mutex lock;
+    std::chrono::steady_clock::time_point start;
+    std::vector<phaseTotal> phases; // in the order first recorded
+    std::vector<counterTotal> counters;
+    std::array<uint64_t, NODE_TYPE_COUNT> nodes{};
+};
+
+profileState& state() {
+    static profileState s;
+    return s;
+}
+
+// Names of the node types that are ever instantiated, null for the abstract ones
+const char* nodeTypeName(astNodeType type) {
+    switch (type) {
+        case astNodeType::STRING: return "STRING";
+        case astNodeType::INT: return "INT";
+        case astNodeType::DOUBLE: return "DOUBLE";
+        case astNodeType::CHAR: return "CHAR";
+        case astNodeType::BOOL: return "BOOL";
+        case astNodeType::VARIABLE: return "VARIABLE";
+        case astNodeType::UNARYOP: return "UNARYOP";
+        case astNodeType::BINARYOP: return "BINARYOP";
+        case astNodeType::ASSIGNOP: return "ASSIGNOP";
+        case astNodeType::FNCALL: return "FNCALL";
+        case astNodeType::INDEX: return "INDEX";
+        case astNodeType::LIST: return "LIST";
+        case astNodeType::INTERP: return "INTERP";
+        case astNodeType::IMPORT: return "IMPORT";
+        case astNodeType::IF: return "IF";
+        case astNodeType::FOR: return "FOR";
+        case astNodeType::WHILE: return "WHILE";
+        case astNodeType::RETURN: return "RETURN";
+        case astNodeType::BREAK: return "BREAK";
+        case astNodeType::CONTINUE: return "CONTINUE";
+        case astNodeType::FUNCTION: return "FUNCTION";
+        case astNodeType::VARDECL: return "VARDECL";
+        case astNodeType::BODY: return "BODY";
+        case astNodeType::PROGRAM: return "PROGRAM";
+        default: return nullptr;
+    }
+}
+
+class nodeCounter : public astVisitor<nodeCounter> {
+public:
+    std::array<uint64_t, NODE_TYPE_COUNT> counts{};
+
+    void defaultVisit(const astNode* n) {
+        counts[static_cast<size_t>(n->type)]++;
+        visitChildren(n);
+    }
+};
+
+// Everything the reports need, copied out under the lock
+struct snapshot {
+    double wall;
+    std::vector<phaseTotal> phases;
+    std::vector<counterTotal> counters;
+    std::array<uint64_t, NODE_TYPE_COUNT> nodes;
+    uint64_t nodeTotal = 0;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    uint64_t peakRSS = 0; // bytes, 0 when unknown
+
+    double phase(const char* name) const {
+        for ( const phaseTotal& p : phases ) {
+            if ( std::strcmp(p.name, name) == 0 ) return p.seconds;
+        }
+        return 0;
+    }
+    uint64_t counter(const char* name) const {
+        for ( const counterTotal& c : counters ) {
+            if ( std::strcmp(c.name, name) == 0 ) return c.value;
+        }
+        return 0;
+    }
+    double rate(uint64_t count, double seconds) const {
+        return seconds > 0 ? count / seconds : 0;
+    }
+};
+
+snapshot takeSnapshot() {
+    profileState& s = state();
+    snapshot snap;
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        snap.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - s.start).count();
+        snap.phases = s.phases;
+        snap.counters = s.counters;
+        snap.nodes = s.nodes;
+    }
+    for ( uint64_t n : snap.nodes ) snap.nodeTotal += n;
+    snap.allocations = allocations.load(std::memory_order_relaxed);
+    snap.allocatedBytes = allocatedBytes.load(std::memory_order_relaxed);
+#if QUR_HAVE_RUSAGE
+    struct rusage usage;
+    if ( getrusage(RUSAGE_SELF, &usage) == 0 ) {
+#if defined(__APPLE__)
+        snap.peakRSS = (uint64_t)usage.ru_maxrss; // already bytes
+#else
+        snap.peakRSS = (uint64_t)usage.ru_maxrss * 1024;
+#endif
+    }
+#endif
+    return snap;
+}
+
+double megabytes(uint64_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    if ( enabled.load(std::memory_order_relaxed) ) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    for (;;) {
+        if ( void* p = std::malloc(size ? size : 1) ) return p;
+        std::new_handler handler = std::get_new_handler();
+        if ( !handler ) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void enableProfiling() {
+    profileState& s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    if ( enabled.load() ) return;
+    s.start = std::chrono::steady_clock::now();
+    enabled.store(true);
+}
+
+bool profiling() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void addPhaseTime(const char* phase, double seconds) {
+    profileState& s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    for ( phaseTotal& p : s.phases ) {
+        if ( std::strcmp(p.name, phase) == 0 ) {
+            p.seconds += seconds;
+            p.calls++;
+            return;
+        }
+    }
+    s.phases.push_back({ phase, seconds, 1 });
+}
+
+void addProfileCount(const char* counter, uint64_t n) {
+    if ( !profiling() ) return;
+    profileState& s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    for ( counterTotal& c : s.counters ) {
+        if ( std::strcmp(c.name, counter) == 0 ) {
+            c.value += n;
+            return;
+        }
+    }
+    s.counters.push_back({ counter, n });
+}
+
+void profileNodes(const programNode& program) {
+    if ( !profiling() ) return;
+    nodeCounter counter;
+    counter.visit(&program);
+    profileState& s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    for ( size_t i = 0; i < NODE_TYPE_COUNT; i++ ) {
+        s.nodes[i] += counter.counts[i];
+    }
+}
+
+void writeTimeReport(std::ostream& out) {
+    snapshot snap = takeSnapshot();
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+
+    out << "=== Time Report ===\n";
+    out << std::left << std::setw(16) << "Phase" << std::right << std::setw(12) << "Wall (ms)"
+        << std::setw(8) << "Calls" << std::setw(8) << "%" << "\n";
+    for ( const phaseTotal& p : snap.phases ) {
+        out << std::left << std::setw(16) << p.name << std::right << std::setw(12) << p.seconds * 1000
+            << std::setw(8) << p.calls << std::setw(8) << (snap.wall > 0 ? p.seconds * 100 / snap.wall : 0) << "\n";
+    }
+    out << std::left << std::setw(16) << "total" << std::right << std::setw(12) << snap.wall * 1000 << "\n\n";
+
+    for ( const counterTotal& c : snap.counters ) {
+        out << std::left << std::setw(16) << c.name << std::right << std::setw(12) << c.value << "\n";
+    }
+    uint64_t tokens = snap.counter("tokens");
+    double lex = snap.phase("lex");
+    out << "Tokens/sec: " << snap.rate(tokens, lex) << " lexing, "
+        << snap.rate(tokens, lex + snap.phase("parse")) << " lexing and parsing\n\n";
+
+    out << "AST nodes: " << snap.nodeTotal << "\n";
+    for ( size_t i = 0; i < NODE_TYPE_COUNT; i++ ) {
+        const char* name = nodeTypeName(static_cast<astNodeType>(i));
+        if ( name && snap.nodes[i] ) {
+            out << "  " << std::left << std::setw(14) << name << std::right << std::setw(12) << snap.nodes[i] << "\n";
+        }
+    }
+    out << "\n";
+
+    if ( snap.peakRSS ) out << "Peak RSS: " << megabytes(snap.peakRSS) << " MB\n";
+    out << "Allocations: " << snap.allocations << " (" << megabytes(snap.allocatedBytes) << " MB)\n";
+    out << "===================\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void writeTimeReportJSON(std::ostream& out) {
+    snapshot snap = takeSnapshot();
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    // Every name written is a fixed identifier, none needs escaping
+    out << "{\"wall_ms\": " << snap.wall * 1000 << ", \"phases\": [";
+    for ( size_t i = 0; i < snap.phases.size(); i++ ) {
+        const phaseTotal& p = snap.phases[i];
+        out << (i ? ", " : "") << "{\"name\": \"" << p.name << "\", \"ms\": " << p.seconds * 1000
+            << ", \"calls\": " << p.calls << "}";
+    }
+    out << "], \"counters\": {";
+    for ( size_t i = 0; i < snap.counters.size(); i++ ) {
+        out << (i ? ", " : "") << "\"" << snap.counters[i].name << "\": " << snap.counters[i].value;
+    }
+    uint64_t tokens = snap.counter("tokens");
+    double lex = snap.phase("lex");
+    out << "}, \"tokens_per_sec\": {\"lex\": " << snap.rate(tokens, lex)
+        << ", \"lex_parse\": " << snap.rate(tokens, lex + snap.phase("parse")) << "}";
+    out << ", \"nodes\": {\"total\": " << snap.nodeTotal;
+    for ( size_t i = 0; i < NODE_TYPE_COUNT; i++ ) {
+        const char* name = nodeTypeName(static_cast<astNodeType>(i));
+        if ( name ) out << ", \"" << name << "\": " << snap.nodes[i];
+    }
+    out << "}, \"peak_rss_bytes\": " << snap.peakRSS << ", \"allocations\": " << snap.allocations
+        << ", \"allocated_bytes\": " << snap.allocatedBytes << "}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,46 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+struct programNode;
+
+// Compile-time profile behind --time-report. Nothing is recorded until
+// enableProfiling(), after which every thread adds to one set of totals: wall time
+// per phase, named counters, AST node counts by type and heap allocations made
+// through operator new. Phase times are summed over files, so with several files
+// compiling in parallel they can add up to more than the run took.
+void enableProfiling();
+bool profiling();
+
+void addPhaseTime(const char* phase, double seconds);
+void addProfileCount(const char* counter, uint64_t n = 1);
+// Counts the nodes of a finished tree by astNodeType
+void profileNodes(const programNode& program);
+
+// Everything recorded so far, plus peak RSS and wall time since enableProfiling()
+void writeTimeReport(std::ostream& out);
+// The same as one JSON object
+void writeTimeReportJSON(std::ostream& out);
+
+// Adds the wall time from construction to destruction to phase while profiling
+class phaseTimer {
+private:
+    const char* phase_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    explicit phaseTimer(const char* phase) : phase_(phase), active_(profiling()) {
+        if ( active_ ) start_ = std::chrono::steady_clock::now();
+    }
+    ~phaseTimer() {
+        if ( active_ ) addPhaseTime(phase_, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count());
+    }
+    phaseTimer(const phaseTimer&) = delete;
+    phaseTimer& operator=(const phaseTimer&) = delete;
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,81 @@
+#ifndef RUNTIMESTORE_H
+#define RUNTIMESTORE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Objects made while a program runs, such as the strings from concatenation and
+// interpolation and the lists from list expressions. Each is allocated on its own so
+// the ones nothing points at any more can be freed by sweep, whose caller knows where
+// the engine keeps its values. Freed objects keep their buffers for the next ones made.
+template <typename T>
+class runtimeStore {
+private:
+    struct entry {
+        T item;
+        uint64_t born;
+    };
+
+    static constexpr size_t MIN_SWEEP = 4096; // live objects before the first sweep
+    static constexpr size_t MAX_SPARE = 4096;
+
+    std::vector<std::unique_ptr<entry>> live_; // in the order made, so by born
+    std::vector<std::unique_ptr<entry>> spare_;
+    size_t limit_ = MIN_SWEEP;
+
+public:
+    // What a pointer held by the engine points at in an object, its address by default
+    struct addressOf {
+        const void* operator()(const T& item) const { return &item; }
+    };
+
+    // An empty object that lives until a sweep finds nothing pointing at it. born
+    // never decreases from one call to the next.
+    T& make(uint64_t born = 0) {
+        std::unique_ptr<entry> e;
+        if (spare_.empty()) {
+            e = std::make_unique<entry>();
+        } else {
+            e = std::move(spare_.back());
+            spare_.pop_back();
+            e->item.clear();
+        }
+        e->born = born;
+        live_.push_back(std::move(e));
+        return live_.back()->item;
+    }
+
+    // Enough objects were made since the last sweep to make another worth it
+    bool full() const { return live_.size() >= limit_; }
+
+    // Frees the objects born at or after since that no pointer in held points at, as
+    // key tells. held may have any pointers, it is sorted.
+    template <typename Key = addressOf>
+    void sweep(std::vector<const void*>& held, uint64_t since = 0, Key key = Key()) {
+        std::sort(held.begin(), held.end());
+        auto first = std::partition_point(live_.begin(), live_.end(), [&](const std::unique_ptr<entry>& e) { return e->born < since; });
+        auto kept = first;
+        for (auto it = first; it != live_.end(); ++it) {
+            if (std::binary_search(held.begin(), held.end(), key((*it)->item))) {
+                *kept++ = std::move(*it);
+            } else if (spare_.size() < MAX_SPARE) {
+                spare_.push_back(std::move(*it));
+            }
+        }
+        // Older objects may only be freed by a later sweep, they don't count towards
+        // the next one being worth it
+        size_t survivors = (size_t)(kept - first);
+        live_.erase(kept, live_.end());
+        limit_ = live_.size() + std::max(MIN_SWEEP, survivors);
+    }
+
+    size_t size() const { return live_.size(); }
+};
+
+using stringStore = runtimeStore<std::string>;
+
+#endif // RUNTIMESTORE_H
@@ -0,0 +1,493 @@
+#include "sema.h"
+#include "visitor.h"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+namespace {
+
+bool isIntClass(astVarType t) {
+    return t == astVarType::INT || t == astVarType::BOOLEAN || t == astVarType::CHAR;
+}
+
+bool isNumeric(astVarType t) {
+    return isIntClass(t) || t == astVarType::DOUBLE;
+}
+
+std::string typeName(astVarType t) {
+    switch (t) {
+        case astVarType::INT: return "int";
+        case astVarType::DOUBLE: return "double";
+        case astVarType::BOOLEAN: return "boolean";
+        case astVarType::CHAR: return "char";
+        case astVarType::STRING: return "string";
+        case astVarType::INT_LIST: return "list<int>";
+        case astVarType::DOUBLE_LIST: return "list<double>";
+        default: return "void";
+    }
+}
+
+bool isComparison(opKind op) {
+    switch (op) {
+        case opKind::LESSTHAN:
+        case opKind::MORETHAN:
+        case opKind::LESSTHANEQUAL:
+        case opKind::MORETHANEQUAL:
+        case opKind::EQUAL:
+        case opKind::NOTEQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+opKind compoundBase(opKind op) {
+    switch (op) {
+        case opKind::ASSIGN_ADD: return opKind::ADD;
+        case opKind::ASSIGN_SUB: return opKind::SUB;
+        case opKind::ASSIGN_MUL: return opKind::MUL;
+        case opKind::ASSIGN_DIV: return opKind::DIV;
+        case opKind::ASSIGN_MOD: return opKind::MOD;
+        default: return opKind::UNKNOWN;
+    }
+}
+
+std::mutex resolveLock;
+uint32_t nextGlobal = 0; // guarded by resolveLock
+std::vector<uint32_t> freeGlobals; // released slots below nextGlobal, a min-heap, guarded by resolveLock
+
+// The lowest released slot, so slots stay dense while modules come and go
+uint32_t takeGlobal() {
+    if (freeGlobals.empty()) return nextGlobal++;
+    std::pop_heap(freeGlobals.begin(), freeGlobals.end(), std::greater<uint32_t>());
+    uint32_t slot = freeGlobals.back();
+    freeGlobals.pop_back();
+    return slot;
+}
+
+// Hands the slots of program's globals back to takeGlobal, with resolveLock held
+void freeGlobalSlots(const programNode& program) {
+    for (const auto& decl : program.declarations) {
+        if (decl && decl->type == astNodeType::VARDECL) {
+            auto var = static_cast<const varDeclNode*>(decl.get());
+            if (var->slot == NO_SLOT) continue;
+            freeGlobals.push_back(var->slot);
+            std::push_heap(freeGlobals.begin(), freeGlobals.end(), std::greater<uint32_t>());
+            var->slot = NO_SLOT;
+        }
+    }
+}
+
+const functionNode* findFunction(const programNode& program, symbol name) {
+    for (const auto& decl : program.declarations) {
+        if (decl && decl->type == astNodeType::FUNCTION) {
+            auto fn = static_cast<const functionNode*>(decl.get());
+            if (fn->name == name) return fn;
+        }
+    }
+    return nullptr;
+}
+
+// Scoped symbol tables, used once per program and then discarded. Expressions
+// visit to their static type, statements to VOID.
+class semanticAnalyzer : public astVisitor<semanticAnalyzer, astVarType> {
+private:
+    struct binding {
+        symbolId name;
+        uint32_t slot;
+        astVarType type;
+    };
+
+    const programNode& program_;
+    const std::vector<const programNode*>& visible_;
+    const symbol print_ = intern("print");
+    const symbol len_ = intern("len");
+    std::vector<binding> globals_;
+    std::vector<binding> locals_; // innermost last
+    std::vector<std::pair<size_t, uint32_t>> scopes_; // locals_ size and next slot at entry
+    uint32_t nextSlot_ = 0;
+    uint32_t frameSize_ = 0;
+    unsigned loopDepth_ = 0;
+    const functionNode* fn_ = nullptr;
+
+    std::string where() const {
+        return fn_ ? " in function '" + std::string(fn_->name.str()) + "'" : std::string();
+    }
+    [[noreturn]] void fail(const std::string& msg) const { throw semanticError(msg + where()); }
+
+    void pushScope() { scopes_.emplace_back(locals_.size(), nextSlot_); }
+    void popScope() {
+        locals_.resize(scopes_.back().first);
+        nextSlot_ = scopes_.back().second; // siblings reuse the slots of a closed scope
+        scopes_.pop_back();
+    }
+
+    uint32_t declare(symbol name, astVarType type) {
+        locals_.push_back({ name.id, nextSlot_, type });
+        if (++nextSlot_ > frameSize_) frameSize_ = nextSlot_;
+        return nextSlot_ - 1;
+    }
+
+    astVarType lookup(symbol name, uint32_t& slot, bool& global) const {
+        for (auto it = locals_.rbegin(); it != locals_.rend(); ++it) {
+            if (it->name == name.id) {
+                slot = it->slot;
+                global = false;
+                return it->type;
+            }
+        }
+        for (const binding& b : globals_) {
+            if (b.name == name.id) {
+                slot = b.slot;
+                global = true;
+                return b.type;
+            }
+        }
+        // Then the globals of imports, which are resolved first
+        for (const programNode* imp : visible_) {
+            for (const auto& decl : imp->declarations) {
+                if (!decl || decl->type != astNodeType::VARDECL) continue;
+                auto var = static_cast<const varDeclNode*>(decl.get());
+                if (var->name == name && var->slot != NO_SLOT) {
+                    slot = var->slot;
+                    global = true;
+                    return var->varType;
+                }
+            }
+        }
+        fail("Undefined variable '" + std::string(name.str()) + "'");
+    }
+
+    // Implicit conversions only exist between numeric types
+    void checkConvert(astVarType from, astVarType to) const {
+        if (from != to && (!isNumeric(from) || !isNumeric(to))) {
+            fail("Cannot convert " + typeName(from) + " to " + typeName(to));
+        }
+    }
+
+    void checkCondition(const astNode* cond) {
+        if (!cond) return;
+        astVarType t = visit(cond);
+        if (t == astVarType::VOID || isListType(t)) fail("Cannot use " + typeName(t) + " as a condition");
+    }
+
+    void checkIndex(astVarType t, const char* what) const {
+        if (!isIntClass(t)) fail(std::string(what) + " must be an integer, got " + typeName(t));
+    }
+
+    // A list literal takes the list type it is converted to, so [1, 2] can be a list<double>
+    astVarType visitAs(const astNode* node, astVarType target) {
+        if (node && node->type == astNodeType::LIST && isListType(target)) {
+            auto list = static_cast<const listNode*>(node);
+            if (!list->length) list->valueType = target;
+        }
+        return visit(node);
+    }
+
+    astVarType binaryType(opKind op, astVarType lt, astVarType rt) const {
+        if (isListType(lt) || isListType(rt)) {
+            fail("Operator " + std::string(opToString(op)) + " is not defined for " + typeName(lt) + " and " + typeName(rt));
+        }
+        if (lt == astVarType::STRING || rt == astVarType::STRING) {
+            if (op == opKind::ADD) {
+                if (lt == astVarType::VOID || rt == astVarType::VOID) fail("Cannot convert void to string");
+                return astVarType::STRING;
+            }
+            if (lt == rt && isComparison(op)) return astVarType::BOOLEAN;
+            fail("Operator " + std::string(opToString(op)) + " is not defined for " + typeName(lt) + " and " + typeName(rt));
+        }
+        if (!isNumeric(lt) || !isNumeric(rt)) {
+            fail("Operator " + std::string(opToString(op)) + " needs values, got void");
+        }
+        if (isComparison(op)) return astVarType::BOOLEAN;
+        if (op != opKind::ADD && op != opKind::SUB && op != opKind::MUL && op != opKind::DIV && op != opKind::MOD) {
+            fail("Unsupported binary operator " + std::string(opToString(op)));
+        }
+        return lt == astVarType::DOUBLE || rt == astVarType::DOUBLE ? astVarType::DOUBLE : astVarType::INT;
+    }
+
+public:
+    semanticAnalyzer(const programNode& program, const std::vector<const programNode*>& visible)
+        : program_(program), visible_(visible) {}
+
+    astVarType defaultVisit(const astNode* node) { fail("Cannot evaluate " + node->describe()); }
+
+    astVarType visitProgram(const programNode* n) {
+        // Globals are visible from every function, wherever they are declared
+        for (const auto& decl : n->declarations) {
+            if (decl && decl->type == astNodeType::VARDECL) {
+                auto var = static_cast<const varDeclNode*>(decl.get());
+                var->slot = takeGlobal();
+                var->global = true;
+                globals_.push_back({ var->name.id, var->slot, var->varType });
+            }
+        }
+        n->globalCount = (uint32_t)globals_.size();
+
+        for (const auto& decl : n->declarations) {
+            if (!decl) continue;
+            switch (decl->type) {
+                case astNodeType::FUNCTION:
+                    visit(decl.get());
+                    break;
+                case astNodeType::VARDECL: {
+                    auto var = static_cast<const varDeclNode*>(decl.get());
+                    if (var->initializer) checkConvert(visitAs(var->initializer.get(), var->varType), var->varType);
+                    break;
+                }
+                case astNodeType::IMPORT:
+                    break;
+                default:
+                    fail("Statements outside a function are not supported (" + decl->describe() + ")");
+            }
+        }
+        return astVarType::VOID;
+    }
+
+    astVarType visitFunction(const functionNode* n) {
+        fn_ = n;
+        nextSlot_ = 0;
+        frameSize_ = 0;
+        loopDepth_ = 0;
+        pushScope();
+        for (const paramNode& param : n->params) declare(param.name, param.type);
+        visit(n->body.get());
+        popScope();
+        n->frameSize = frameSize_;
+        fn_ = nullptr;
+        return astVarType::VOID;
+    }
+
+    astVarType visitBody(const bodyNode* n) {
+        pushScope();
+        for (const auto& stmt : n->statements) visit(stmt.get());
+        popScope();
+        return astVarType::VOID;
+    }
+
+    astVarType visitIf(const ifNode* n) {
+        checkCondition(n->condition.get());
+        visit(n->thenBody.get());
+        visit(n->elseBody.get());
+        return astVarType::VOID;
+    }
+
+    astVarType visitWhile(const whileNode* n) {
+        checkCondition(n->condition.get());
+        loopDepth_++;
+        visit(n->body.get());
+        loopDepth_--;
+        return astVarType::VOID;
+    }
+
+    astVarType visitFor(const forNode* n) {
+        pushScope(); // the init declaration belongs to the loop
+        visit(n->init.get());
+        checkCondition(n->condition.get());
+        visit(n->increment.get());
+        loopDepth_++;
+        visit(n->body.get());
+        loopDepth_--;
+        popScope();
+        return astVarType::VOID;
+    }
+
+    astVarType visitReturn(const returnNode* n) {
+        if (fn_->returnType == astVarType::VOID) {
+            visit(n->value.get()); // evaluated for its effects
+        } else if (!n->value) {
+            fail("Missing return value");
+        } else {
+            checkConvert(visitAs(n->value.get(), fn_->returnType), fn_->returnType);
+        }
+        return astVarType::VOID;
+    }
+
+    astVarType visitBreak(const breakNode*) {
+        if (!loopDepth_) fail("break outside of a loop");
+        return astVarType::VOID;
+    }
+
+    astVarType visitContinue(const continueNode*) {
+        if (!loopDepth_) fail("continue outside of a loop");
+        return astVarType::VOID;
+    }
+
+    astVarType visitImport(const importNode*) { return astVarType::VOID; }
+
+    astVarType visitVarDecl(const varDeclNode* n) {
+        // Before declaring, so the name still means the outer one
+        if (n->initializer) checkConvert(visitAs(n->initializer.get(), n->varType), n->varType);
+        n->slot = declare(n->name, n->varType);
+        n->global = false;
+        return astVarType::VOID;
+    }
+
+    astVarType visitString(const stringLiteralNode*) { return astVarType::STRING; }
+    astVarType visitInt(const intLiteralNode*) { return astVarType::INT; }
+    astVarType visitDouble(const doubleLiteralNode*) { return astVarType::DOUBLE; }
+    astVarType visitChar(const charLiteralNode*) { return astVarType::CHAR; }
+    astVarType visitBool(const booleanLiteralNode*) { return astVarType::BOOLEAN; }
+
+    astVarType visitVariable(const variableNode* n) {
+        n->valueType = lookup(n->name, n->slot, n->global);
+        return n->valueType;
+    }
+
+    astVarType visitUnaryOp(const unaryOpNode* n) {
+        switch (n->op) {
+            case opKind::PRE_INCREMENT:
+            case opKind::PRE_DECREMENT:
+            case opKind::POST_INCREMENT:
+            case opKind::POST_DECREMENT: {
+                if (!n->operand || n->operand->type != astNodeType::VARIABLE) {
+                    fail("Operand of " + std::string(opToString(n->op)) + " must be a variable");
+                }
+                astVarType t = visit(n->operand.get());
+                if (!isNumeric(t)) fail("Cannot apply " + std::string(opToString(n->op)) + " to " + typeName(t));
+                return t;
+            }
+            default:
+                break;
+        }
+        astVarType t = visit(n->operand.get());
+        switch (n->op) {
+            case opKind::NOT:
+                if (t != astVarType::VOID && !isListType(t)) return astVarType::BOOLEAN;
+                break;
+            case opKind::SUB:
+                if (t == astVarType::DOUBLE) return astVarType::DOUBLE;
+                if (isIntClass(t)) return astVarType::INT;
+                break;
+            case opKind::INVERT:
+                if (t == astVarType::BOOLEAN) return astVarType::BOOLEAN;
+                if (t == astVarType::INT || t == astVarType::CHAR) return astVarType::INT;
+                break;
+            default:
+                break;
+        }
+        fail("Cannot apply " + std::string(opToString(n->op)) + " to " + typeName(t));
+    }
+
+    astVarType visitBinaryOp(const binaryOpNode* n) {
+        if (n->op == opKind::AND || n->op == opKind::OR) {
+            checkCondition(n->left.get());
+            checkCondition(n->right.get());
+            return astVarType::BOOLEAN;
+        }
+        astVarType lt = visit(n->left.get());
+        astVarType rt = visit(n->right.get());
+        return binaryType(n->op, lt, rt);
+    }
+
+    astVarType visitAssignOp(const assignOpNode* n) {
+        n->valueType = lookup(n->targetName, n->slot, n->global);
+        if (n->index) {
+            if (!isListType(n->valueType)) fail("Cannot index " + typeName(n->valueType));
+            checkIndex(visit(n->index.get()), "List index");
+            astVarType et = elementType(n->valueType);
+            astVarType vt = visit(n->value.get());
+            if (n->op != opKind::ASSIGN) vt = binaryType(compoundBase(n->op), et, vt);
+            checkConvert(vt, et);
+            return et;
+        }
+        astVarType vt = n->op == opKind::ASSIGN ? visitAs(n->value.get(), n->valueType) : visit(n->value.get());
+        if (n->op != opKind::ASSIGN) vt = binaryType(compoundBase(n->op), n->valueType, vt);
+        checkConvert(vt, n->valueType);
+        return n->valueType;
+    }
+
+    astVarType visitFnCall(const fnCallNode* n) {
+        const functionNode* callee = findFunction(program_, n->name);
+        for (size_t i = 0; !callee && i < visible_.size(); i++) callee = findFunction(*visible_[i], n->name);
+        n->callee = callee;
+        if (!callee && n->name == len_) {
+            if (n->args.size() != 1) fail("Function 'len' expects 1 argument(s), got " + std::to_string(n->args.size()));
+            astVarType t = visit(n->args[0].get());
+            if (!isListType(t)) fail("Cannot take len of " + typeName(t));
+            return astVarType::INT;
+        }
+        if (!callee && n->name != print_) {
+            fail("Undefined function '" + std::string(n->name.str()) + "'");
+        }
+        if (callee && callee->params.size() != n->args.size()) {
+            fail("Function '" + std::string(n->name.str()) + "' expects " + std::to_string(callee->params.size()) +
+                 " argument(s), got " + std::to_string(n->args.size()));
+        }
+        for (size_t i = 0; i < n->args.size(); i++) {
+            if (callee) {
+                checkConvert(visitAs(n->args[i].get(), callee->params[i].type), callee->params[i].type);
+                continue;
+            }
+            astVarType t = visit(n->args[i].get());
+            if (isListType(t)) fail("Cannot print " + typeName(t));
+        }
+        return callee ? callee->returnType : astVarType::VOID;
+    }
+
+    astVarType visitIndex(const indexNode* n) {
+        astVarType lt = visit(n->list.get());
+        if (!isListType(lt)) fail("Cannot index " + typeName(lt));
+        checkIndex(visit(n->index.get()), "List index");
+        return elementType(lt);
+    }
+
+    astVarType visitInterpString(const interpStringNode* n) {
+        for (const auto& part : n->parts) {
+            astVarType t = visit(part.get());
+            if (t == astVarType::VOID || isListType(t)) fail("Cannot interpolate " + typeName(t));
+        }
+        return astVarType::STRING;
+    }
+
+    astVarType visitList(const listNode* n) {
+        if (n->length) {
+            checkIndex(visit(n->length.get()), "List length");
+            n->valueType = n->varType;
+            return n->valueType;
+        }
+        // Without a target type, any double element makes it a list<double>
+        std::vector<astVarType> types;
+        for (const auto& element : n->elements) {
+            astVarType t = visit(element.get());
+            if (!isNumeric(t)) fail("List elements must be numbers, got " + typeName(t));
+            types.push_back(t);
+        }
+        if (n->valueType == astVarType::INFERRED) {
+            if (types.empty()) fail("Cannot infer the type of an empty list");
+            n->valueType = astVarType::INT_LIST;
+            for (astVarType t : types) {
+                if (t == astVarType::DOUBLE) n->valueType = astVarType::DOUBLE_LIST;
+            }
+        }
+        for (astVarType t : types) checkConvert(t, elementType(n->valueType));
+        return n->valueType;
+    }
+};
+
+} // namespace
+
+void resolveProgram(const programNode& program, const std::vector<const programNode*>& visible) {
+    // Modules are shared between compilations, so each is annotated exactly once
+    std::lock_guard<std::mutex> guard(resolveLock);
+    if (program.resolved) return;
+    try {
+        semanticAnalyzer(program, visible).visit(&program);
+    } catch (...) {
+        // Resolved again by the next compilation that uses it, with new slots
+        freeGlobalSlots(program);
+        throw;
+    }
+    program.resolved = true;
+}
+
+void releaseGlobals(const programNode& program) {
+    std::lock_guard<std::mutex> guard(resolveLock);
+    freeGlobalSlots(program);
+}
+
+uint32_t globalSlotCount() {
+    std::lock_guard<std::mutex> guard(resolveLock);
+    return nextGlobal;
+}
@@ -0,0 +1,43 @@
+#ifndef SEMA_H
+#define SEMA_H
+
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class semanticError : public std::exception {
+private:
+    std::string msg_;
+
+public:
+    semanticError(const std::string& msg) : msg_(msg) {}
+    const char* what() const noexcept override {
+        return msg_.c_str();
+    }
+};
+
+// Semantic pass, run once per program before any back end sees it. Scoped symbol
+// tables over functions, bodies, for init and declarations give every variable
+// reference and assignment its frame or global slot and its static type, and link
+// calls to their functionNode. Calls resolve against the program's own functions
+// first, then those of visible (its imports) in order, and the same goes for
+// globals, so imports should be resolved before their importers. print is builtin.
+// Global slots are unique across all resolved programs, so modules never alias,
+// until a program's slots are released for programs resolved after it.
+//
+// Every expression is typed with the runtime's rules (int | boolean | char
+// arithmetic gives int, any double operand gives double, string + anything
+// concatenates, interpolation takes anything but void and lists), so undefined
+// names, wrong argument counts, impossible conversions, void conditions and
+// missing return values throw semanticError before execution.
+// Lists only take numbers, support indexing, assignment and the builtin len, and
+// list literals take their element type from where they are stored when known.
+void resolveProgram(const programNode& program, const std::vector<const programNode*>& visible = {});
+// Gives the global slots of program back once nothing will run it any more, as when
+// its module is dropped. Programs resolved later may take them.
+void releaseGlobals(const programNode& program);
+// One past the highest global slot handed out so far
+uint32_t globalSlotCount();
+
+#endif // SEMA_H
@@ -0,0 +1,215 @@
+#include "serialize.h"
+#include "hash.h"
+#include "version.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <unordered_map>
+
+namespace {
+
+constexpr char MAGIC[4] = { 'Q', 'A', 'S', 'T' };
+constexpr uint32_t BYTE_ORDER_TAG = 0x01020304u;
+
+// Kinds whose payload is a symbol id in memory and a string index on disk
+bool hasSymbol(astNodeType kind) {
+    switch (kind) {
+        case astNodeType::VARIABLE:
+        case astNodeType::ASSIGNOP:
+        case astNodeType::FNCALL:
+        case astNodeType::VARDECL:
+        case astNodeType::FUNCTION:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool hasString(astNodeType kind) {
+    return kind == astNodeType::STRING || kind == astNodeType::IMPORT;
+}
+
+template <class T>
+void append(std::string& out, const T* data, size_t count) {
+    out.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+} // namespace
+
+uint64_t compilerVersionHash() {
+    static const uint64_t hash = fnv1a64(QUR_VERSION, std::strlen(QUR_VERSION));
+    return hash;
+}
+
+std::string serializeAST(const flatAST& flat, uint64_t sourceHash) {
+    // Literal strings keep their indices, names are appended after them
+    std::vector<std::string> strings = flat.strings();
+    std::vector<flatNode> nodes = flat.nodes();
+    std::unordered_map<symbolId, uint32_t> names;
+    for (flatNode& n : nodes) {
+        if (!hasSymbol(n.kind)) continue;
+        symbolId id = (symbolId)n.payload;
+        auto it = names.find(id);
+        if (it == names.end()) {
+            it = names.emplace(id, (uint32_t)strings.size()).first;
+            strings.emplace_back(symbol{ id }.str());
+        }
+        n.payload = it->second;
+    }
+
+    std::vector<uint32_t> offsets;
+    offsets.reserve(strings.size() + 1);
+    uint32_t total = 0;
+    for (const std::string& str : strings) {
+        offsets.push_back(total);
+        total += (uint32_t)str.size();
+    }
+    offsets.push_back(total);
+
+    astFileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = AST_FORMAT_VERSION;
+    header.byteOrder = BYTE_ORDER_TAG;
+    header.nodeCount = (uint32_t)nodes.size();
+    header.childCount = (uint32_t)flat.childList().size();
+    header.stringCount = (uint32_t)strings.size();
+    header.stringBytes = total;
+    header.sourceHash = sourceHash;
+    header.compilerHash = compilerVersionHash();
+
+    std::string out;
+    out.reserve(sizeof(header) + nodes.size() * sizeof(flatNode) + header.childCount * sizeof(nodeId) +
+                offsets.size() * sizeof(uint32_t) + total);
+    append(out, &header, 1);
+    append(out, nodes.data(), nodes.size());
+    append(out, flat.childList().data(), flat.childList().size());
+    append(out, offsets.data(), offsets.size());
+    for (const std::string& str : strings) out += str;
+    return out;
+}
+
+bool writeAST(const std::string& path, const flatAST& flat, uint64_t sourceHash) {
+    std::string bytes = serializeAST(flat, sourceHash);
+    static const unsigned salt = std::random_device{}(); // tells processes apart
+    static std::atomic<unsigned> counter{ 0 }; // and threads within one
+    std::string temp = path + ".tmp" + std::to_string(salt) + "." + std::to_string(counter++);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out.good()) return false;
+        out.write(bytes.data(), (std::streamsize)bytes.size());
+        if (!out.good()) {
+            out.close();
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec) std::filesystem::remove(temp, ec);
+    return !ec;
+}
+
+astImage::astImage(const std::string& path, lexerMode mode) {
+    file_.load(path, mode);
+    open(file_.data(), file_.size());
+}
+
+astImage::astImage(const char* data, size_t size) {
+    open(data, size);
+}
+
+void astImage::open(const char* data, size_t size) {
+    if (size < sizeof(header_)) throw serializeError("AST file is truncated");
+    if (reinterpret_cast<uintptr_t>(data) % alignof(flatNode) != 0) throw serializeError("AST image is misaligned");
+    std::memcpy(&header_, data, sizeof(header_));
+    if (std::memcmp(header_.magic, MAGIC, sizeof(MAGIC)) != 0) throw serializeError("Not an AST file");
+    if (header_.byteOrder != BYTE_ORDER_TAG) throw serializeError("AST file has foreign byte order");
+    if (header_.version != AST_FORMAT_VERSION) {
+        throw serializeError("AST file format " + std::to_string(header_.version) + ", expected " +
+                             std::to_string(AST_FORMAT_VERSION));
+    }
+    if (header_.compilerHash != compilerVersionHash()) throw serializeError("AST file is from another compiler version");
+
+    size_t expected = sizeof(header_) + (size_t)header_.nodeCount * sizeof(flatNode) +
+                      (size_t)header_.childCount * sizeof(nodeId) +
+                      ((size_t)header_.stringCount + 1) * sizeof(uint32_t) + header_.stringBytes;
+    if (size != expected) throw serializeError("AST file is truncated");
+
+    const char* cursor = data + sizeof(header_);
+    nodes_ = reinterpret_cast<const flatNode*>(cursor);
+    cursor += (size_t)header_.nodeCount * sizeof(flatNode);
+    children_ = reinterpret_cast<const nodeId*>(cursor);
+    cursor += (size_t)header_.childCount * sizeof(nodeId);
+    offsets_ = reinterpret_cast<const uint32_t*>(cursor);
+    cursor += ((size_t)header_.stringCount + 1) * sizeof(uint32_t);
+    strings_ = cursor;
+
+    for (uint32_t i = 0; i < header_.stringCount; i++) {
+        if (offsets_[i] > offsets_[i + 1] || offsets_[i + 1] > header_.stringBytes) {
+            throw serializeError("AST file has a corrupt string table");
+        }
+    }
+    for (nodeId id = 0; id < header_.nodeCount; id++) {
+        const flatNode& n = nodes_[id];
+        if (n.kind > astNodeType::PROGRAM || (uint64_t)n.firstChild + n.childCount > header_.childCount) {
+            throw serializeError("AST file has a corrupt node");
+        }
+        if ((hasSymbol(n.kind) || hasString(n.kind)) && n.payload >= header_.stringCount) {
+            throw serializeError("AST file has a corrupt node");
+        }
+        // Pre-order: children always come after their parent, which also rules out cycles
+        for (uint32_t i = 0; i < n.childCount; i++) {
+            nodeId child = children_[n.firstChild + i];
+            if (child != NO_NODE && (child <= id || child >= header_.nodeCount)) {
+                throw serializeError("AST file has a corrupt child list");
+            }
+        }
+        // Interpolations are read back assuming a segment around every part
+        if (n.kind == astNodeType::INTERP) {
+            bool valid = n.childCount % 2 == 1;
+            for (uint32_t i = 0; valid && i < n.childCount; i += 2) {
+                nodeId segment = children_[n.firstChild + i];
+                valid = segment != NO_NODE && nodes_[segment].kind == astNodeType::STRING;
+            }
+            if (!valid) throw serializeError("AST file has a corrupt node");
+        }
+    }
+}
+
+flatAST::childRange astImage::children(nodeId id) const {
+    const flatNode& n = nodes_[id];
+    const nodeId* first = children_ + n.firstChild;
+    return { first, first + n.childCount };
+}
+
+nodeId astImage::child(nodeId id, size_t slot) const {
+    const flatNode& n = nodes_[id];
+    return slot < n.childCount ? children_[n.firstChild + slot] : NO_NODE;
+}
+
+double astImage::doubleValue(nodeId id) const {
+    double value;
+    uint64_t bits = nodes_[id].payload;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+flatAST astImage::toFlat() const {
+    std::vector<flatNode> nodes(nodes_, nodes_ + header_.nodeCount);
+    std::vector<nodeId> children(children_, children_ + header_.childCount);
+    std::vector<std::string> strings;
+    strings.reserve(header_.stringCount);
+    for (uint32_t i = 0; i < header_.stringCount; i++) strings.emplace_back(string(i));
+    for (flatNode& n : nodes) {
+        if (hasSymbol(n.kind)) n.payload = intern(strings[n.payload]).id;
+    }
+    return flatAST::fromParts(std::move(nodes), std::move(children), std::move(strings));
+}
+
+void astImage::print(std::ostream& out) const {
+    if (root() != NO_NODE) printFlatNode(*this, out, root(), 0);
+}
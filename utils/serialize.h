@@ -0,0 +1,97 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "flatast.h"
+#include "lexer.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+class serializeError : public std::exception {
+private:
+    std::string msg_;
+
+public:
+    serializeError(const std::string& msg) : msg_(msg) {}
+    const char* what() const noexcept override {
+        return msg_.c_str();
+    }
+};
+
+// Bumped whenever the layout below or the meaning of a flatNode field changes
+constexpr uint32_t AST_FORMAT_VERSION = 3;
+
+// A serialized flatAST, in host byte order:
+//   header | nodes[nodeCount] | children[childCount] | stringOffsets[stringCount + 1] | string bytes
+// Node payloads that hold a symbol id on the host are written as a string table
+// index instead, so files don't depend on the interning order of the process.
+// Every section is naturally aligned, so a mapped file is used in place.
+struct astFileHeader {
+    char magic[4]; // "QAST"
+    uint32_t version; // AST_FORMAT_VERSION
+    uint32_t byteOrder; // 0x01020304 as written by the producer
+    uint32_t nodeCount;
+    uint32_t childCount;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+    uint32_t reserved;
+    uint64_t sourceHash; // whatever key the producer chose, see buildCache
+    uint64_t compilerHash; // hash of QUR_VERSION
+};
+static_assert(sizeof(astFileHeader) == 48, "astFileHeader is written to disk as is");
+
+// Hash of the compiler version, stored in every file and checked on load
+uint64_t compilerVersionHash();
+
+std::string serializeAST(const flatAST& flat, uint64_t sourceHash);
+// Writes through a temporary file and a rename, readers never see a partial file
+bool writeAST(const std::string& path, const flatAST& flat, uint64_t sourceHash);
+
+// Read-only view of a serialized AST, walked in place without building nodes.
+// Same accessors as flatAST, except that names are string_views into the image.
+// The file is validated once on open, so walking it afterwards can't go out of bounds.
+class astImage {
+private:
+    sourceBuffer file_; // empty when viewing caller owned memory
+    astFileHeader header_{};
+    const flatNode* nodes_ = nullptr;
+    const nodeId* children_ = nullptr;
+    const uint32_t* offsets_ = nullptr;
+    const char* strings_ = nullptr;
+
+    void open(const char* data, size_t size);
+
+public:
+    // Maps path, throws serializeError (or lexerError if it can't be read)
+    explicit astImage(const std::string& path, lexerMode mode = lexerMode::MMAP);
+    // data must stay alive and be 8 byte aligned
+    astImage(const char* data, size_t size);
+
+    uint64_t sourceHash() const { return header_.sourceHash; }
+    bool isMapped() const { return file_.isMapped(); }
+
+    nodeId root() const { return header_.nodeCount ? 0 : NO_NODE; }
+    size_t size() const { return header_.nodeCount; }
+    const flatNode& node(nodeId id) const { return nodes_[id]; }
+    flatAST::childRange children(nodeId id) const;
+    nodeId child(nodeId id, size_t slot) const;
+
+    int64_t intValue(nodeId id) const { return (int64_t)nodes_[id].payload; }
+    double doubleValue(nodeId id) const;
+    char charValue(nodeId id) const { return (char)nodes_[id].payload; }
+    bool boolValue(nodeId id) const { return nodes_[id].payload != 0; }
+    std::string_view name(nodeId id) const { return string((uint32_t)nodes_[id].payload); }
+    std::string_view stringValue(nodeId id) const { return string((uint32_t)nodes_[id].payload); }
+    std::string_view string(uint32_t index) const {
+        return std::string_view(strings_ + offsets_[index], offsets_[index + 1] - offsets_[index]);
+    }
+
+    // Copies into an in-memory flatAST, interning names, e.g. to rebuild a node tree
+    flatAST toFlat() const;
+    // Same layout as the tree printer
+    void print(std::ostream& out) const;
+};
+
+#endif // SERIALIZE_H
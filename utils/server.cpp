@@ -0,0 +1,268 @@
+#include "server.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Every message is a sequence of frames in the host's byte order, client and
+// server always run on the same machine.
+//   request:  u8 kind ('c' compile, 'q' shutdown), string cwd, u32 argc, string args...
+//   response: string out, string err, i32 status
+// where a string is a u32 byte count followed by the bytes.
+
+namespace {
+
+constexpr uint32_t MAX_STRING = 1u << 30; // anything larger is a broken peer
+
+bool writeAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while ( size > 0 ) {
+        // A client that went away must not take the server down with SIGPIPE
+        ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n <= 0 ) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool readAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while ( size > 0 ) {
+        ssize_t n = ::recv(fd, p, size, 0);
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n <= 0 ) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+void putU32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& out, const std::string& text) {
+    putU32(out, (uint32_t)text.size());
+    out += text;
+}
+
+bool readU32(int fd, uint32_t& value) {
+    return readAll(fd, &value, sizeof(value));
+}
+
+bool readString(int fd, std::string& text) {
+    uint32_t size;
+    if ( !readU32(fd, size) || size > MAX_STRING ) return false;
+    text.resize(size);
+    return size == 0 || readAll(fd, &text[0], size);
+}
+
+bool readRequest(int fd, serverRequest& request) {
+    char kind;
+    if ( !readAll(fd, &kind, 1) ) return false;
+    request.shutdown = kind == 'q';
+    uint32_t argc;
+    if ( !readString(fd, request.cwd) || !readU32(fd, argc) ) return false;
+    request.args.clear();
+    while ( argc-- > 0 ) {
+        request.args.emplace_back();
+        if ( !readString(fd, request.args.back()) ) return false;
+    }
+    return true;
+}
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if ( path.empty() || path.size() >= sizeof(addr.sun_path) ) {
+        throw serverError("socket path '" + path + "' is empty or too long");
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+// Connected socket, or -1
+int connectTo(const sockaddr_un& addr) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( fd < 0 ) return -1;
+    if ( ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ) {
+        int reason = errno; // for the caller's message
+        ::close(fd);
+        errno = reason;
+        return -1;
+    }
+    return fd;
+}
+
+// State shared by the accept loop and the connection threads
+class serverState {
+private:
+    std::mutex lock_;
+    std::condition_variable finished_;
+    std::unordered_map<int, bool> connections_; // fd -> busy with a request
+    bool stopping_ = false;
+
+public:
+    const requestHandler& handler;
+    sockaddr_un addr;
+
+    serverState(const requestHandler& h, const sockaddr_un& a) : handler(h), addr(a) {}
+
+    bool stopping() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return stopping_;
+    }
+
+    void opened(int fd) {
+        std::lock_guard<std::mutex> guard(lock_);
+        connections_[fd] = false;
+    }
+
+    // Marks fd busy for a request that arrived, false if the server is stopping
+    bool begin(int fd) {
+        std::lock_guard<std::mutex> guard(lock_);
+        if ( stopping_ ) return false;
+        connections_[fd] = true;
+        return true;
+    }
+
+    // Back to waiting for the next request, false if the server is stopping
+    bool end(int fd) {
+        std::lock_guard<std::mutex> guard(lock_);
+        connections_[fd] = false;
+        return !stopping_;
+    }
+
+    void closed(int fd) {
+        std::lock_guard<std::mutex> guard(lock_);
+        connections_.erase(fd);
+        ::close(fd);
+        finished_.notify_all();
+    }
+
+    // Idle connections are woken from their read, busy ones stop after answering
+    void stop() {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+        for ( const auto& conn : connections_ ) {
+            if ( !conn.second ) ::shutdown(conn.first, SHUT_RD);
+        }
+    }
+
+    void waitForConnections() {
+        std::unique_lock<std::mutex> guard(lock_);
+        finished_.wait(guard, [this] { return connections_.empty(); });
+    }
+};
+
+void serveConnection(serverState& state, int fd) {
+    serverRequest request;
+    while ( readRequest(fd, request) ) {
+        if ( !state.begin(fd) ) break;
+        std::string reply;
+        if ( request.shutdown ) {
+            state.end(fd);
+            state.stop();
+            // Wakes the accept loop so it sees the flag
+            int wake = connectTo(state.addr);
+            if ( wake >= 0 ) ::close(wake);
+            putString(reply, "");
+            putString(reply, "");
+            putU32(reply, 0);
+            writeAll(fd, reply.data(), reply.size());
+            break;
+        }
+        std::ostringstream out, err;
+        int status;
+        try {
+            status = state.handler(request, out, err);
+        } catch ( const std::exception& e ) {
+            err << "Error: " << e.what() << std::endl;
+            status = 1;
+        }
+        putString(reply, out.str());
+        putString(reply, err.str());
+        putU32(reply, (uint32_t)status);
+        if ( !writeAll(fd, reply.data(), reply.size()) || !state.end(fd) ) break;
+    }
+    state.closed(fd);
+}
+
+} // namespace
+
+void serve(const std::string& socketPath, const requestHandler& handler, std::ostream& log) {
+    sockaddr_un addr = socketAddress(socketPath);
+    // A socket left behind by a server that died is replaced, a live one is not
+    int existing = connectTo(addr);
+    if ( existing >= 0 ) {
+        ::close(existing);
+        throw serverError("a server is already listening on " + socketPath);
+    }
+    struct stat info;
+    if ( ::lstat(socketPath.c_str(), &info) == 0 ) {
+        if ( !S_ISSOCK(info.st_mode) ) throw serverError(socketPath + " exists and is not a socket");
+        ::unlink(socketPath.c_str());
+    }
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( listener < 0 ) throw serverError(std::string("cannot create socket: ") + std::strerror(errno));
+    if ( ::bind(listener, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listener, 64) != 0 ) {
+        std::string reason = std::strerror(errno);
+        ::close(listener);
+        throw serverError("cannot listen on " + socketPath + ": " + reason);
+    }
+    log << "Listening on " << socketPath << std::endl;
+
+    serverState state(handler, addr);
+    while ( !state.stopping() ) {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if ( fd < 0 ) {
+            if ( errno == EINTR || errno == ECONNABORTED ) continue;
+            log << "Error: accept failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        if ( state.stopping() ) {
+            ::close(fd);
+            break;
+        }
+        state.opened(fd);
+        std::thread([&state, fd] { serveConnection(state, fd); }).detach();
+    }
+    ::close(listener);
+    ::unlink(socketPath.c_str());
+    state.stop();
+    state.waitForConnections();
+}
+
+int sendRequest(const std::string& socketPath, const serverRequest& request, std::ostream& out, std::ostream& err) {
+    int fd = connectTo(socketAddress(socketPath));
+    if ( fd < 0 ) throw serverError("cannot connect to " + socketPath + ": " + std::strerror(errno));
+
+    std::string message(1, request.shutdown ? 'q' : 'c');
+    putString(message, request.cwd);
+    putU32(message, (uint32_t)request.args.size());
+    for ( const std::string& arg : request.args ) {
+        putString(message, arg);
+    }
+    std::string stdoutText, stderrText;
+    uint32_t status = 1;
+    bool ok = writeAll(fd, message.data(), message.size()) && readString(fd, stdoutText) &&
+              readString(fd, stderrText) && readU32(fd, status);
+    ::close(fd);
+    if ( !ok ) throw serverError("the server at " + socketPath + " closed the connection");
+    out << stdoutText << std::flush;
+    err << stderrText << std::flush;
+    return (int)status;
+}
@@ -0,0 +1,46 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <exception>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class serverError : public std::exception {
+private:
+    std::string msg_;
+
+public:
+    serverError(const std::string& msg) : msg_(msg) {}
+    const char* what() const noexcept override {
+        return msg_.c_str();
+    }
+};
+
+// What a client asks for: compiler arguments, taken relative to the client's
+// working directory, or that the server stop
+struct serverRequest {
+    bool shutdown = false;
+    std::string cwd;
+    std::vector<std::string> args;
+};
+
+// Runs one request, writes what a compiler process would have printed to out and
+// err and returns its exit status. Called from one thread per client connection,
+// so it must be safe to run concurrently.
+using requestHandler = std::function<int(const serverRequest& request, std::ostream& out, std::ostream& err)>;
+
+// Listens on a Unix socket at socketPath and hands every request to handler. A
+// client may keep its connection open and send any number of requests, one at a
+// time. Returns once a shutdown request arrives and the requests in progress are
+// answered, removing the socket. Throws serverError if the socket can't be set up,
+// including when another server is already listening on it.
+void serve(const std::string& socketPath, const requestHandler& handler, std::ostream& log);
+
+// Client side: sends request to the server at socketPath, copies its output to
+// out and err and returns the exit status. Throws serverError when the server
+// can't be reached or hangs up.
+int sendRequest(const std::string& socketPath, const serverRequest& request, std::ostream& out, std::ostream& err);
+
+#endif // SERVER_H
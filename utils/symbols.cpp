@@ -0,0 +1,79 @@
+#include "symbols.h"
+
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+std::string_view symbol::str() const {
+    return symbolTable::global().text(*this);
+}
+
+std::ostream& operator<<(std::ostream& out, symbol sym) {
+    return out << sym.str();
+}
+
+std::string_view symbolTable::shard::store(std::string_view text) {
+    if ( text.size() > remaining ) {
+        size_t size = text.size() > TEXT_BLOCK_SIZE ? text.size() : TEXT_BLOCK_SIZE;
+        blocks.emplace_back(new char[size]);
+        cursor = blocks.back().get();
+        remaining = size;
+    }
+    std::memcpy(cursor, text.data(), text.size());
+    std::string_view stored(cursor, text.size());
+    cursor += text.size();
+    remaining -= text.size();
+    return stored;
+}
+
+symbolTable::symbolTable() {
+    publish(0, std::string_view());
+}
+
+symbolTable::~symbolTable() {
+    for ( auto& chunk : chunks_ ) {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+}
+
+symbolTable& symbolTable::global() {
+    static symbolTable table;
+    return table;
+}
+
+void symbolTable::publish(symbolId id, std::string_view text) {
+    size_t chunkIndex = id >> CHUNK_BITS;
+    if ( chunkIndex >= MAX_CHUNKS ) {
+        throw std::length_error("Symbol table is full");
+    }
+    std::string_view* chunk = chunks_[chunkIndex].load(std::memory_order_acquire);
+    if ( !chunk ) {
+        std::lock_guard<std::mutex> guard(chunkLock_);
+        chunk = chunks_[chunkIndex].load(std::memory_order_relaxed);
+        if ( !chunk ) {
+            chunk = new std::string_view[CHUNK_SIZE];
+            chunks_[chunkIndex].store(chunk, std::memory_order_release);
+        }
+    }
+    chunk[id & (CHUNK_SIZE - 1)] = text;
+}
+
+symbol symbolTable::intern(std::string_view text) {
+    if ( text.empty() ) return symbol{};
+    shard& s = shards_[std::hash<std::string_view>()(text) % SHARD_COUNT];
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto it = s.ids.find(text);
+    if ( it != s.ids.end() ) {
+        return symbol{ it->second };
+    }
+    std::string_view stored = s.store(text);
+    symbolId id = next_.fetch_add(1, std::memory_order_relaxed);
+    publish(id, stored);
+    s.ids.emplace(stored, id);
+    return symbol{ id };
+}
+
+std::string_view symbolTable::text(symbol sym) const {
+    const std::string_view* chunk = chunks_[sym.id >> CHUNK_BITS].load(std::memory_order_acquire);
+    return chunk ? chunk[sym.id & (CHUNK_SIZE - 1)] : std::string_view();
+}
@@ -0,0 +1,74 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using symbolId = uint32_t;
+
+// Handle to an interned string, equal text always yields the same id. Id 0 is the empty string.
+struct symbol {
+    symbolId id = 0;
+
+    std::string_view str() const;
+    bool empty() const { return id == 0; }
+    bool operator==(symbol other) const { return id == other.id; }
+    bool operator!=(symbol other) const { return id != other.id; }
+};
+
+std::ostream& operator<<(std::ostream& out, symbol sym);
+
+// Process wide string interner shared by the lexer and the parser. Interning takes a
+// per-shard lock, resolving an id back to its text never locks.
+class symbolTable {
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+    static constexpr size_t CHUNK_BITS = 14;
+    static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+    static constexpr size_t MAX_CHUNKS = 16384;
+    static constexpr size_t TEXT_BLOCK_SIZE = 64 * 1024;
+
+    struct shard {
+        std::mutex lock;
+        std::unordered_map<std::string_view, symbolId> ids;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* cursor = nullptr;
+        size_t remaining = 0;
+
+        std::string_view store(std::string_view text);
+    };
+
+    std::array<shard, SHARD_COUNT> shards_;
+    std::array<std::atomic<std::string_view*>, MAX_CHUNKS> chunks_{};
+    std::mutex chunkLock_;
+    std::atomic<symbolId> next_{1};
+
+    void publish(symbolId id, std::string_view text);
+
+public:
+    symbolTable();
+    ~symbolTable();
+    symbolTable(const symbolTable&) = delete;
+    symbolTable& operator=(const symbolTable&) = delete;
+
+    static symbolTable& global();
+
+    symbol intern(std::string_view text);
+    std::string_view text(symbol sym) const;
+    size_t size() const { return next_.load(std::memory_order_relaxed); }
+};
+
+inline symbol intern(std::string_view text) {
+    return symbolTable::global().intern(text);
+}
+
+#endif // SYMBOLS_H
@@ -0,0 +1,58 @@
+#include "threadpool.h"
+
+size_t threadPool::defaultWorkers() {
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+threadPool::threadPool(size_t workers) {
+    if ( workers == 0 ) workers = defaultWorkers();
+    workers_.reserve(workers);
+    for ( size_t i = 0; i < workers; i++ ) {
+        workers_.emplace_back([this] { workerLoop(); });
+    }
+}
+
+threadPool::~threadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    hasWork_.notify_all();
+    for ( auto& worker : workers_ ) {
+        worker.join();
+    }
+}
+
+void threadPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        jobs_.push_back(std::move(job));
+    }
+    hasWork_.notify_one();
+}
+
+void threadPool::wait() {
+    std::unique_lock<std::mutex> guard(lock_);
+    idle_.wait(guard, [this] { return jobs_.empty() && active_ == 0; });
+}
+
+void threadPool::workerLoop() {
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            hasWork_.wait(guard, [this] { return stopping_ || !jobs_.empty(); });
+            if ( stopping_ && jobs_.empty() ) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            active_++;
+        }
+        job(); // jobs are expected to handle their own exceptions
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            active_--;
+            if ( jobs_.empty() && active_ == 0 ) idle_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads draining a FIFO of jobs
+class threadPool {
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> jobs_;
+    std::mutex lock_;
+    std::condition_variable hasWork_;
+    std::condition_variable idle_;
+    size_t active_ = 0;
+    bool stopping_ = false;
+
+    void workerLoop();
+
+public:
+    // 0 picks one worker per hardware thread
+    explicit threadPool(size_t workers = 0);
+    ~threadPool();
+    threadPool(const threadPool&) = delete;
+    threadPool& operator=(const threadPool&) = delete;
+
+    void submit(std::function<void()> job);
+    // Blocks until the queue is empty and no job is running
+    void wait();
+    size_t size() const { return workers_.size(); }
+
+    static size_t defaultWorkers();
+};
+
+#endif // THREADPOOL_H
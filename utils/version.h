@@ -0,0 +1,7 @@
+#ifndef VERSION_H
+#define VERSION_H
+
+// Bumped on any change that alters parse results, invalidates on-disk caches
+constexpr const char* QUR_VERSION = "0.3.0";
+
+#endif // VERSION_H
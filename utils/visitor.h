@@ -0,0 +1,159 @@
+#ifndef VISITOR_H
+#define VISITOR_H
+
+#include "ast.h"
+#include <type_traits>
+
+// CRTP traversal over the node tree. visit() dispatches once on astNodeType and
+// calls the matching visitX on Derived, no virtual calls involved. Handlers that
+// Derived doesn't define fall back to defaultVisit(), which walks the children
+// for void visitors and returns R() otherwise.
+template <class Derived, class R = void>
+class astVisitor {
+protected:
+    Derived& self() { return static_cast<Derived&>(*this); }
+
+public:
+    R visit(const astNode* node) {
+        if (!node) return R();
+        switch (node->type) {
+            case astNodeType::STRING: return self().visitString(static_cast<const stringLiteralNode*>(node));
+            case astNodeType::INT: return self().visitInt(static_cast<const intLiteralNode*>(node));
+            case astNodeType::DOUBLE: return self().visitDouble(static_cast<const doubleLiteralNode*>(node));
+            case astNodeType::CHAR: return self().visitChar(static_cast<const charLiteralNode*>(node));
+            case astNodeType::BOOL: return self().visitBool(static_cast<const booleanLiteralNode*>(node));
+            case astNodeType::VARIABLE: return self().visitVariable(static_cast<const variableNode*>(node));
+            case astNodeType::UNARYOP: return self().visitUnaryOp(static_cast<const unaryOpNode*>(node));
+            case astNodeType::BINARYOP: return self().visitBinaryOp(static_cast<const binaryOpNode*>(node));
+            case astNodeType::ASSIGNOP: return self().visitAssignOp(static_cast<const assignOpNode*>(node));
+            case astNodeType::FNCALL: return self().visitFnCall(static_cast<const fnCallNode*>(node));
+            case astNodeType::INDEX: return self().visitIndex(static_cast<const indexNode*>(node));
+            case astNodeType::LIST: return self().visitList(static_cast<const listNode*>(node));
+            case astNodeType::INTERP: return self().visitInterpString(static_cast<const interpStringNode*>(node));
+            case astNodeType::IMPORT: return self().visitImport(static_cast<const importNode*>(node));
+            case astNodeType::IF: return self().visitIf(static_cast<const ifNode*>(node));
+            case astNodeType::FOR: return self().visitFor(static_cast<const forNode*>(node));
+            case astNodeType::WHILE: return self().visitWhile(static_cast<const whileNode*>(node));
+            case astNodeType::RETURN: return self().visitReturn(static_cast<const returnNode*>(node));
+            case astNodeType::BREAK: return self().visitBreak(static_cast<const breakNode*>(node));
+            case astNodeType::CONTINUE: return self().visitContinue(static_cast<const continueNode*>(node));
+            case astNodeType::VARDECL: return self().visitVarDecl(static_cast<const varDeclNode*>(node));
+            case astNodeType::FUNCTION: return self().visitFunction(static_cast<const functionNode*>(node));
+            case astNodeType::BODY: return self().visitBody(static_cast<const bodyNode*>(node));
+            case astNodeType::PROGRAM: return self().visitProgram(static_cast<const programNode*>(node));
+            default: return self().defaultVisit(node);
+        }
+    }
+
+    // Visits every direct child in source order, results are discarded
+    void visitChildren(const astNode* node) {
+        switch (node->type) {
+            case astNodeType::UNARYOP:
+                visit(static_cast<const unaryOpNode*>(node)->operand.get());
+                break;
+            case astNodeType::BINARYOP: {
+                auto n = static_cast<const binaryOpNode*>(node);
+                visit(n->left.get());
+                visit(n->right.get());
+                break;
+            }
+            case astNodeType::ASSIGNOP: {
+                auto n = static_cast<const assignOpNode*>(node);
+                visit(n->index.get());
+                visit(n->value.get());
+                break;
+            }
+            case astNodeType::FNCALL:
+                for (const auto& arg : static_cast<const fnCallNode*>(node)->args) visit(arg.get());
+                break;
+            case astNodeType::INDEX: {
+                auto n = static_cast<const indexNode*>(node);
+                visit(n->list.get());
+                visit(n->index.get());
+                break;
+            }
+            case astNodeType::LIST: {
+                auto n = static_cast<const listNode*>(node);
+                visit(n->length.get());
+                for (const auto& element : n->elements) visit(element.get());
+                break;
+            }
+            case astNodeType::INTERP:
+                for (const auto& part : static_cast<const interpStringNode*>(node)->parts) visit(part.get());
+                break;
+            case astNodeType::IF: {
+                auto n = static_cast<const ifNode*>(node);
+                visit(n->condition.get());
+                visit(n->thenBody.get());
+                visit(n->elseBody.get());
+                break;
+            }
+            case astNodeType::FOR: {
+                auto n = static_cast<const forNode*>(node);
+                visit(n->init.get());
+                visit(n->condition.get());
+                visit(n->increment.get());
+                visit(n->body.get());
+                break;
+            }
+            case astNodeType::WHILE: {
+                auto n = static_cast<const whileNode*>(node);
+                visit(n->condition.get());
+                visit(n->body.get());
+                break;
+            }
+            case astNodeType::RETURN:
+                visit(static_cast<const returnNode*>(node)->value.get());
+                break;
+            case astNodeType::VARDECL:
+                visit(static_cast<const varDeclNode*>(node)->initializer.get());
+                break;
+            case astNodeType::FUNCTION:
+                visit(static_cast<const functionNode*>(node)->body.get());
+                break;
+            case astNodeType::BODY:
+                for (const auto& stmt : static_cast<const bodyNode*>(node)->statements) visit(stmt.get());
+                break;
+            case astNodeType::PROGRAM:
+                for (const auto& decl : static_cast<const programNode*>(node)->declarations) visit(decl.get());
+                break;
+            default:
+                break;
+        }
+    }
+
+    R defaultVisit(const astNode* node) {
+        if constexpr (std::is_void<R>::value) {
+            visitChildren(node);
+        } else {
+            return R();
+        }
+    }
+
+    R visitString(const stringLiteralNode* n) { return self().defaultVisit(n); }
+    R visitInt(const intLiteralNode* n) { return self().defaultVisit(n); }
+    R visitDouble(const doubleLiteralNode* n) { return self().defaultVisit(n); }
+    R visitChar(const charLiteralNode* n) { return self().defaultVisit(n); }
+    R visitBool(const booleanLiteralNode* n) { return self().defaultVisit(n); }
+    R visitVariable(const variableNode* n) { return self().defaultVisit(n); }
+    R visitUnaryOp(const unaryOpNode* n) { return self().defaultVisit(n); }
+    R visitBinaryOp(const binaryOpNode* n) { return self().defaultVisit(n); }
+    R visitAssignOp(const assignOpNode* n) { return self().defaultVisit(n); }
+    R visitFnCall(const fnCallNode* n) { return self().defaultVisit(n); }
+    R visitIndex(const indexNode* n) { return self().defaultVisit(n); }
+    R visitList(const listNode* n) { return self().defaultVisit(n); }
+    R visitInterpString(const interpStringNode* n) { return self().defaultVisit(n); }
+    R visitImport(const importNode* n) { return self().defaultVisit(n); }
+    R visitIf(const ifNode* n) { return self().defaultVisit(n); }
+    R visitFor(const forNode* n) { return self().defaultVisit(n); }
+    R visitWhile(const whileNode* n) { return self().defaultVisit(n); }
+    R visitReturn(const returnNode* n) { return self().defaultVisit(n); }
+    R visitBreak(const breakNode* n) { return self().defaultVisit(n); }
+    R visitContinue(const continueNode* n) { return self().defaultVisit(n); }
+    R visitVarDecl(const varDeclNode* n) { return self().defaultVisit(n); }
+    R visitFunction(const functionNode* n) { return self().defaultVisit(n); }
+    R visitBody(const bodyNode* n) { return self().defaultVisit(n); }
+    R visitProgram(const programNode* n) { return self().defaultVisit(n); }
+};
+
+#endif // VISITOR_H
@@ -0,0 +1,390 @@
+#include "vm.h"
+#include "interp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <type_traits>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define QUR_COMPUTED_GOTO 1
+#endif
+
+vm::vm(std::ostream& out, size_t registerCount) : out_(out), registers_(registerCount) {
+    frames_.reserve(MAX_CALL_DEPTH);
+}
+
+// Registers aren't typed, so any that could be a string or list pointer keeps what
+// it points at
+std::vector<const void*> vm::held(const bcReg* r, const bcFunction* fn) const {
+    const bcReg* end = r + fn->registerCount;
+    for (const frame& f : frames_) end = std::max<const bcReg*>(end, f.base + f.fn->registerCount);
+    std::vector<const void*> held;
+    for (const bcReg* reg = registers_.data(); reg != end; reg++) held.push_back(reg->s);
+    for (const bcReg& reg : globals_) held.push_back(reg.s);
+    return held;
+}
+
+std::string& vm::newString(const bcReg* r, const bcFunction* fn) {
+    if (strings_.full()) {
+        std::vector<const void*> pointers = held(r, fn);
+        strings_.sweep(pointers);
+    }
+    return strings_.make();
+}
+
+bcReg* vm::newList(int64_t length, const bcReg* r, const bcFunction* fn) {
+    if (length < 0) throw runtimeError("Negative list length " + std::to_string(length));
+    if (lists_.full()) {
+        std::vector<const void*> pointers = held(r, fn);
+        lists_.sweep(pointers, 0, [](const std::vector<bcReg>& l) -> const void* { return l.data(); });
+    }
+    std::vector<bcReg>& elements = lists_.make();
+    elements.assign((size_t)length + 1, bcReg{});
+    bcReg* list = elements.data();
+    list[0].i = length;
+    return list;
+}
+
+namespace {
+
+[[noreturn]] void outOfRange(int64_t index, int64_t length) {
+    throw runtimeError("Index " + std::to_string(index) + " out of range for list of length " + std::to_string(length));
+}
+
+template <typename T>
+bool compare(opKind op, T a, T b) {
+    switch (op) {
+        case opKind::LESSTHAN: return a < b;
+        case opKind::MORETHAN: return a > b;
+        case opKind::LESSTHANEQUAL: return a <= b;
+        case opKind::MORETHANEQUAL: return a >= b;
+        case opKind::EQUAL: return a == b;
+        default: return a != b;
+    }
+}
+
+int64_t apply(opKind op, int64_t a, int64_t b) {
+    switch (op) {
+        case opKind::ADD: return (int64_t)((uint64_t)a + (uint64_t)b);
+        case opKind::SUB: return (int64_t)((uint64_t)a - (uint64_t)b);
+        default: return (int64_t)((uint64_t)a * (uint64_t)b);
+    }
+}
+
+double apply(opKind op, double a, double b) {
+    switch (op) {
+        case opKind::ADD: return a + b;
+        case opKind::SUB: return a - b;
+        case opKind::MUL: return a * b;
+        default: return a / b;
+    }
+}
+
+// Fails where the loop would have, the first index some list doesn't have, on
+// the first list the body would index there
+void checkKernel(const bcKernel& kernel, const bcReg* r, int64_t start, int64_t end) {
+    int64_t fail = end;
+    if (start < 0) {
+        fail = start;
+    } else {
+        for (uint32_t list : kernel.checked) {
+            int64_t length = r[list].l[0].i;
+            if (length < fail) fail = std::max(start, length);
+        }
+    }
+    if (fail == end) return;
+    for (uint32_t list : kernel.checked) {
+        int64_t length = r[list].l[0].i;
+        if (fail < 0 || fail >= length) outOfRange(fail, length);
+    }
+}
+
+template <typename T>
+T& as(bcReg& reg) {
+    if constexpr (std::is_same_v<T, double>) return reg.d;
+    else return reg.i;
+}
+template <typename T>
+T& at(bcReg* list, int64_t i) {
+    return as<T>(list[i + 1]);
+}
+
+template <typename T>
+void runKernel(const bcKernel& kernel, bcReg* r, int64_t start, int64_t end) {
+    bcReg* a = kernel.a != NO_REG ? r[kernel.a].l : nullptr;
+    bcReg* b = kernel.b != NO_REG ? r[kernel.b].l : nullptr;
+    bcReg* dst = kernel.dst != NO_REG ? r[kernel.dst].l : nullptr;
+    T scalar = kernel.scalar == NO_REG ? T() : as<T>(r[kernel.scalar]);
+    switch (kernel.shape) {
+        case bcKernel::SUM: {
+            T& acc = as<T>(r[kernel.acc]);
+            for (int64_t i = start; i < end; i++) acc = apply(opKind::ADD, acc, at<T>(a, i));
+            break;
+        }
+        case bcKernel::DOT: {
+            T& acc = as<T>(r[kernel.acc]);
+            for (int64_t i = start; i < end; i++) acc = apply(opKind::ADD, acc, apply(opKind::MUL, at<T>(a, i), at<T>(b, i)));
+            break;
+        }
+        case bcKernel::MAP:
+            for (int64_t i = start; i < end; i++) {
+                T x = at<T>(a, i);
+                T y = b ? at<T>(b, i) : scalar;
+                at<T>(dst, i) = kernel.scalarLeft ? apply(kernel.op, scalar, x) : apply(kernel.op, x, y);
+            }
+            break;
+        case bcKernel::FILL:
+            for (int64_t i = start; i < end; i++) at<T>(dst, i) = scalar;
+            break;
+        case bcKernel::COUNT: {
+            uint64_t count = (uint64_t)r[kernel.acc].i;
+            for (int64_t i = start; i < end; i++) count += compare<T>(kernel.op, at<T>(a, i), scalar);
+            r[kernel.acc].i = (int64_t)count;
+            break;
+        }
+    }
+}
+
+} // namespace
+
+int64_t vm::run(const bcProgram& program) {
+    globals_.assign(program.globalCount, bcReg{});
+    frames_.clear();
+
+    const bcFunction* fn = &program.functions[program.entry];
+    const bcInstr* code = fn->code.data();
+    const bcInstr* pc = code;
+    const bcReg* k = fn->constants.data();
+    bcReg* r = registers_.data();
+    bcReg* const registersEnd = registers_.data() + registers_.size();
+    bcReg* g = globals_.data();
+    if (fn->registerCount > registers_.size()) throw runtimeError("Stack overflow");
+
+#define A r[pc->a]
+#define B r[pc->b]
+#define C r[pc->c]
+
+#ifdef QUR_COMPUTED_GOTO
+    static void* const labels[] = {
+#define QUR_BC_LABEL(name) &&op_##name,
+        QUR_BC_OPS(QUR_BC_LABEL)
+#undef QUR_BC_LABEL
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) == (size_t)bcOp::OP_COUNT, "label table out of sync");
+#define CASE(name) op_##name:
+#define DISPATCH() goto *labels[(uint32_t)pc->op]
+#define NEXT() do { ++pc; DISPATCH(); } while (0)
+#define JUMP(target) do { pc = code + (target); DISPATCH(); } while (0)
+#define RESUME() DISPATCH()
+    DISPATCH();
+#else
+#define CASE(name) case bcOp::name:
+#define NEXT() do { ++pc; goto dispatch; } while (0)
+#define JUMP(target) do { pc = code + (target); goto dispatch; } while (0)
+#define RESUME() goto dispatch
+dispatch:
+    switch (pc->op) {
+#endif
+
+    // The typed variants only matter to the native back end
+    CASE(MOV) A = B; NEXT();
+    CASE(MOV_D) A = B; NEXT();
+    CASE(LOADK) A = k[pc->b]; NEXT();
+    CASE(LOADK_D) A = k[pc->b]; NEXT();
+    CASE(LOADK_S) A = k[pc->b]; NEXT();
+    CASE(GGET) A = g[pc->b]; NEXT();
+    CASE(GGET_D) A = g[pc->b]; NEXT();
+    CASE(GSET) g[pc->a] = B; NEXT();
+    CASE(GSET_D) g[pc->a] = B; NEXT();
+
+    CASE(I2D) A.d = (double)B.i; NEXT();
+    CASE(D2I) A.i = (int64_t)B.d; NEXT();
+    CASE(I2B) A.i = B.i != 0; NEXT();
+    CASE(D2B) A.i = B.d != 0.0; NEXT();
+    CASE(I2C) A.i = B.i & 0xFF; NEXT();
+    CASE(S2B) A.i = !B.s->empty(); NEXT();
+
+    // Integer arithmetic wraps instead of overflowing
+    CASE(ADD_I) A.i = (int64_t)((uint64_t)B.i + (uint64_t)C.i); NEXT();
+    CASE(SUB_I) A.i = (int64_t)((uint64_t)B.i - (uint64_t)C.i); NEXT();
+    CASE(MUL_I) A.i = (int64_t)((uint64_t)B.i * (uint64_t)C.i); NEXT();
+    CASE(DIV_I)
+        if (C.i == 0) throw runtimeError("Division by zero");
+        A.i = C.i == -1 ? (int64_t)(0 - (uint64_t)B.i) : B.i / C.i;
+        NEXT();
+    CASE(MOD_I)
+        if (C.i == 0) throw runtimeError("Division by zero");
+        A.i = C.i == -1 ? 0 : B.i % C.i;
+        NEXT();
+    CASE(ADD_D) A.d = B.d + C.d; NEXT();
+    CASE(SUB_D) A.d = B.d - C.d; NEXT();
+    CASE(MUL_D) A.d = B.d * C.d; NEXT();
+    CASE(DIV_D) A.d = B.d / C.d; NEXT();
+    CASE(MOD_D) A.d = std::fmod(B.d, C.d); NEXT();
+
+    CASE(LT_I) A.i = B.i < C.i; NEXT();
+    CASE(GT_I) A.i = B.i > C.i; NEXT();
+    CASE(LE_I) A.i = B.i <= C.i; NEXT();
+    CASE(GE_I) A.i = B.i >= C.i; NEXT();
+    CASE(EQ_I) A.i = B.i == C.i; NEXT();
+    CASE(NE_I) A.i = B.i != C.i; NEXT();
+    CASE(LT_D) A.i = B.d < C.d; NEXT();
+    CASE(GT_D) A.i = B.d > C.d; NEXT();
+    CASE(LE_D) A.i = B.d <= C.d; NEXT();
+    CASE(GE_D) A.i = B.d >= C.d; NEXT();
+    CASE(EQ_D) A.i = B.d == C.d; NEXT();
+    CASE(NE_D) A.i = B.d != C.d; NEXT();
+    CASE(LT_S) A.i = B.s->compare(*C.s) < 0; NEXT();
+    CASE(GT_S) A.i = B.s->compare(*C.s) > 0; NEXT();
+    CASE(LE_S) A.i = B.s->compare(*C.s) <= 0; NEXT();
+    CASE(GE_S) A.i = B.s->compare(*C.s) >= 0; NEXT();
+    CASE(EQ_S) A.i = *B.s == *C.s; NEXT();
+    CASE(NE_S) A.i = *B.s != *C.s; NEXT();
+
+    CASE(NEG_I) A.i = (int64_t)(0 - (uint64_t)B.i); NEXT();
+    CASE(NEG_D) A.d = -B.d; NEXT();
+    CASE(NOT) A.i = B.i == 0; NEXT();
+    CASE(INV_I) A.i = ~B.i; NEXT();
+    CASE(INC_I) A.i = (int64_t)((uint64_t)A.i + (uint64_t)(int64_t)(int32_t)pc->c); NEXT();
+    CASE(INC_D) A.d += (double)(int32_t)pc->c; NEXT();
+
+    // The operands stay in their registers until the result is written, so making
+    // the result never frees them
+    CASE(CONCAT) {
+        std::string& text = newString(r, fn);
+        text.reserve(B.s->size() + C.s->size());
+        text += *B.s;
+        text += *C.s;
+        A.s = &text;
+        NEXT();
+    }
+    CASE(TOSTR_I) A.s = &newString(r, fn).assign(std::to_string(B.i)); NEXT();
+    CASE(TOSTR_D) {
+        std::ostringstream text;
+        text << B.d;
+        A.s = &newString(r, fn).assign(text.str());
+        NEXT();
+    }
+    CASE(TOSTR_B) A.s = &newString(r, fn).assign(B.i ? "true" : "false"); NEXT();
+    CASE(TOSTR_C) A.s = &newString(r, fn).assign(1, (char)B.i); NEXT();
+    CASE(JOIN) {
+        const bcReg* pieces = &B;
+        size_t size = 0;
+        for (uint32_t k = 0; k < pc->c; k++) size += pieces[k].s->size();
+        std::string& text = newString(r, fn);
+        text.reserve(size);
+        for (uint32_t k = 0; k < pc->c; k++) text += *pieces[k].s;
+        A.s = &text;
+        NEXT();
+    }
+
+    CASE(NEWLIST) A.l = newList(B.i, r, fn); NEXT();
+    CASE(LGET)
+        if ((uint64_t)C.i >= (uint64_t)B.l[0].i) outOfRange(C.i, B.l[0].i);
+        A.i = B.l[C.i + 1].i;
+        NEXT();
+    CASE(LGET_D)
+        if ((uint64_t)C.i >= (uint64_t)B.l[0].i) outOfRange(C.i, B.l[0].i);
+        A.d = B.l[C.i + 1].d;
+        NEXT();
+    CASE(LSET)
+        if ((uint64_t)B.i >= (uint64_t)A.l[0].i) outOfRange(B.i, A.l[0].i);
+        A.l[B.i + 1].i = C.i;
+        NEXT();
+    CASE(LSET_D)
+        if ((uint64_t)B.i >= (uint64_t)A.l[0].i) outOfRange(B.i, A.l[0].i);
+        A.l[B.i + 1].d = C.d;
+        NEXT();
+    CASE(LEN) A.i = B.l[0].i; NEXT();
+    CASE(VEC) {
+        const bcKernel& kernel = fn->kernels[pc->a];
+        int64_t start = r[kernel.index].i, end = r[kernel.end].i;
+        if (start < end) {
+            checkKernel(kernel, r, start, end);
+            if (kernel.isDouble) runKernel<double>(kernel, r, start, end);
+            else runKernel<int64_t>(kernel, r, start, end);
+            r[kernel.index].i = end;
+        }
+        NEXT();
+    }
+
+    CASE(JMP) JUMP(pc->a);
+    CASE(JZ) if (A.i == 0) JUMP(pc->b); NEXT();
+    CASE(JNZ) if (A.i != 0) JUMP(pc->b); NEXT();
+    CASE(JLT_I) if (A.i < B.i) JUMP(pc->c); NEXT();
+    CASE(JGT_I) if (A.i > B.i) JUMP(pc->c); NEXT();
+    CASE(JLE_I) if (A.i <= B.i) JUMP(pc->c); NEXT();
+    CASE(JGE_I) if (A.i >= B.i) JUMP(pc->c); NEXT();
+    CASE(JEQ_I) if (A.i == B.i) JUMP(pc->c); NEXT();
+    CASE(JNE_I) if (A.i != B.i) JUMP(pc->c); NEXT();
+
+    CASE(CALL) {
+        const bcFunction* callee = &program.functions[pc->b];
+        bcReg* base = r + pc->c; // the arguments are already in place
+        if (base + callee->registerCount > registersEnd || frames_.size() == MAX_CALL_DEPTH) {
+            throw runtimeError("Stack overflow calling '" + callee->name + "'");
+        }
+        frames_.push_back({ fn, pc + 1, r, pc->a });
+        fn = callee;
+        code = fn->code.data();
+        k = fn->constants.data();
+        r = base;
+        JUMP(0);
+    }
+    CASE(RET) {
+        bcReg result = A;
+        if (frames_.empty()) {
+            out_.flush();
+            return result.i;
+        }
+        frame f = frames_.back();
+        frames_.pop_back();
+        fn = f.fn;
+        code = fn->code.data();
+        k = fn->constants.data();
+        r = f.base;
+        pc = f.ret;
+        if (f.dst != NO_REG) r[f.dst] = result;
+        RESUME();
+    }
+    CASE(RETV) {
+        if (frames_.empty()) {
+            out_.flush();
+            return 0;
+        }
+        frame f = frames_.back();
+        frames_.pop_back();
+        fn = f.fn;
+        code = fn->code.data();
+        k = fn->constants.data();
+        r = f.base;
+        pc = f.ret;
+        RESUME();
+    }
+    CASE(NORET) throw runtimeError("Function '" + fn->name + "' did not return a value");
+
+    CASE(PRINT_I) out_ << A.i; NEXT();
+    CASE(PRINT_D) out_ << A.d; NEXT();
+    CASE(PRINT_B) out_ << (A.i ? "true" : "false"); NEXT();
+    CASE(PRINT_C) out_ << (char)A.i; NEXT();
+    CASE(PRINT_S) out_ << *A.s; NEXT();
+    CASE(PRINT_SP) out_ << ' '; NEXT();
+    CASE(PRINT_NL) out_ << '\n'; NEXT();
+
+#ifndef QUR_COMPUTED_GOTO
+    default:
+        break;
+    }
+#endif
+    throw runtimeError("Invalid bytecode");
+
+#undef A
+#undef B
+#undef C
+#undef CASE
+#undef NEXT
+#undef JUMP
+#undef RESUME
+#undef DISPATCH
+}
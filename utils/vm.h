@@ -0,0 +1,50 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+#include "runtimestore.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Runs bcProgram with computed goto dispatch where the compiler supports it.
+// Registers, globals and call frames are allocated once per vm, so calls and
+// loops never allocate. Only string concatenation and conversion, and new lists do.
+class vm {
+public:
+    static constexpr size_t DEFAULT_REGISTERS = 1 << 18;
+    static constexpr size_t MAX_CALL_DEPTH = 1 << 16;
+
+private:
+    struct frame {
+        const bcFunction* fn;
+        const bcInstr* ret; // caller's next instruction
+        bcReg* base; // caller's registers
+        uint32_t dst; // caller register receiving the result, or NO_REG
+    };
+
+    std::ostream& out_;
+    std::vector<bcReg> registers_;
+    std::vector<bcReg> globals_;
+    std::vector<frame> frames_;
+    stringStore strings_; // results of string operations, see newString
+    runtimeStore<std::vector<bcReg>> lists_; // lists made, see newList
+
+    // Every pointer a register or global could hold. r and fn are the running frame's,
+    // every register up to the end of the highest frame is looked at.
+    std::vector<const void*> held(const bcReg* r, const bcFunction* fn) const;
+    // An empty string that lives as long as a register or global points at it
+    std::string& newString(const bcReg* r, const bcFunction* fn);
+    // A list of length zeros, which lives as long as a register or global points at
+    // its length
+    bcReg* newList(int64_t length, const bcReg* r, const bcFunction* fn);
+
+public:
+    explicit vm(std::ostream& out = std::cout, size_t registerCount = DEFAULT_REGISTERS);
+
+    // Returns what main returned, 0 for void. Throws runtimeError.
+    int64_t run(const bcProgram& program);
+};
+
+#endif // VM_H
@@ -0,0 +1,83 @@
+#include "writer.h"
+
+#include <array>
+#include <charconv>
+#include <cstdio>
+
+namespace {
+
+constexpr size_t SPACE_RUN = 256;
+constexpr std::array<char, SPACE_RUN> spaceRun = [] {
+    std::array<char, SPACE_RUN> run{};
+    for ( char& c : run ) c = ' ';
+    return run;
+}();
+constexpr std::string_view spaces(spaceRun.data(), SPACE_RUN);
+
+} // namespace
+
+void bufferedWriter::flush() {
+    if ( used_ ) out_.write(buffer_.get(), (std::streamsize)used_);
+    used_ = 0;
+}
+
+void bufferedWriter::writeLarge(std::string_view text) {
+    flush();
+    if ( text.size() >= CAPACITY ) {
+        out_.write(text.data(), (std::streamsize)text.size());
+        return;
+    }
+    std::memcpy(buffer_.get(), text.data(), text.size());
+    used_ = text.size();
+}
+
+void bufferedWriter::writeInteger(long long value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    *this << std::string_view(digits, (size_t)(result.ptr - digits));
+}
+
+void bufferedWriter::writeUnsigned(unsigned long long value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    *this << std::string_view(digits, (size_t)(result.ptr - digits));
+}
+
+bufferedWriter& bufferedWriter::operator<<(double value) {
+    // Matches operator<< on a stream with default flags and precision, which is %g
+    char digits[32];
+    int length = std::snprintf(digits, sizeof(digits), "%g", value);
+    return *this << std::string_view(digits, (size_t)length);
+}
+
+bufferedWriter& bufferedWriter::indent(size_t count) {
+    while ( count > SPACE_RUN ) {
+        *this << spaces;
+        count -= SPACE_RUN;
+    }
+    return *this << spaces.substr(0, count);
+}
+
+bufferedWriter& bufferedWriter::quoted(std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    *this << '"';
+    size_t plain = 0; // start of the run that needs no escaping
+    for ( size_t i = 0; i < text.size(); i++ ) {
+        unsigned char c = (unsigned char)text[i];
+        if ( c >= 0x20 && c != '"' && c != '\\' ) continue;
+        *this << text.substr(plain, i - plain);
+        plain = i + 1;
+        switch ( c ) {
+            case '"': *this << "\\\""; break;
+            case '\\': *this << "\\\\"; break;
+            case '\n': *this << "\\n"; break;
+            case '\t': *this << "\\t"; break;
+            case '\r': *this << "\\r"; break;
+            default:
+                *this << "\\u00" << hex[c >> 4] << hex[c & 15];
+                break;
+        }
+    }
+    *this << text.substr(plain) << '"';
+    return *this;
+}
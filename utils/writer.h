@@ -0,0 +1,66 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+
+// Collects text in one large buffer and hands it to the stream in big writes, for
+// dumps that would otherwise go through the stream a few bytes at a time. Numbers
+// are formatted as a default std::ostream would. Flushes when full and when destroyed.
+class bufferedWriter {
+private:
+    static constexpr size_t CAPACITY = 64 * 1024;
+
+    std::ostream& out_;
+    std::unique_ptr<char[]> buffer_;
+    size_t used_ = 0;
+
+    void writeLarge(std::string_view text);
+    void writeInteger(long long value);
+    void writeUnsigned(unsigned long long value);
+
+public:
+    explicit bufferedWriter(std::ostream& out) : out_(out), buffer_(new char[CAPACITY]) {}
+    ~bufferedWriter() { flush(); }
+    bufferedWriter(const bufferedWriter&) = delete;
+    bufferedWriter& operator=(const bufferedWriter&) = delete;
+
+    void flush();
+
+    bufferedWriter& operator<<(std::string_view text) {
+        if ( text.size() > CAPACITY - used_ ) {
+            writeLarge(text);
+        } else {
+            std::memcpy(buffer_.get() + used_, text.data(), text.size());
+            used_ += text.size();
+        }
+        return *this;
+    }
+    bufferedWriter& operator<<(const char* text) { return *this << std::string_view(text); }
+    bufferedWriter& operator<<(char c) {
+        if ( used_ == CAPACITY ) flush();
+        buffer_[used_++] = c;
+        return *this;
+    }
+    template <class T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, char>::value && !std::is_same<T, bool>::value, int> = 0>
+    bufferedWriter& operator<<(T value) {
+        if ( std::is_signed<T>::value ) {
+            writeInteger((long long)value);
+        } else {
+            writeUnsigned((unsigned long long)value);
+        }
+        return *this;
+    }
+    bufferedWriter& operator<<(double value);
+
+    // count spaces, from a run kept ready instead of building a string each time
+    bufferedWriter& indent(size_t count);
+    // text as a JSON string literal, quotes included
+    bufferedWriter& quoted(std::string_view text);
+};
+
+#endif // WRITER_H